@@ -1,6 +1,6 @@
 TEMPLATE = app
 TARGET = "CasinoCoin-Qt"
-VERSION = 3.0.0.0
+VERSION = 3.0.0.1
 INCLUDEPATH += src src/json src/qt
 QT += core gui network widgets qml quick
 DEFINES += QT_GUI BOOST_THREAD_USE_LIB BOOST_SPIRIT_THREADSAFE USE_IPV6 __NO_SYSTEM_INCLUDES
@@ -167,14 +167,18 @@ HEADERS += src/qt/bitcoingui.h \
     src/uint256.h \
     src/serialize.h \
     src/main.h \
+    src/mappedfile.h \
     src/net.h \
     src/key.h \
+    src/secp256k1.h \
     src/db.h \
     src/walletdb.h \
     src/script.h \
     src/init.h \
     src/bloom.h \
+    src/blockencodings.h \
     src/mruset.h \
+    src/uint256map.h \
     src/checkqueue.h \
     src/json/json_spirit_writer_template.h \
     src/json/json_spirit_writer.h \
@@ -203,6 +207,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/walletstack.h \
     src/qt/walletframe.h \
     src/bitcoinrpc.h \
+    src/rpcworkqueue.h \
     src/qt/overviewpage.h \
     src/qt/csvmodelwriter.h \
     src/crypter.h \
@@ -212,6 +217,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/qvaluecombobox.h \
     src/qt/askpassphrasedialog.h \
     src/protocol.h \
+    src/pushnotify.h \
     src/qt/notificator.h \
     src/qt/paymentserver.h \
     src/allocators.h \
@@ -280,11 +286,14 @@ SOURCES += src/qt/bitcoin.cpp \
     src/hash.cpp \
     src/netbase.cpp \
     src/key.cpp \
+    src/secp256k1.cpp \
     src/script.cpp \
     src/main.cpp \
+    src/mappedfile.cpp \
     src/init.cpp \
     src/net.cpp \
     src/bloom.cpp \
+    src/blockencodings.cpp \
     src/checkpoints.cpp \
     src/addrman.cpp \
     src/db.cpp \
@@ -322,6 +331,7 @@ SOURCES += src/qt/bitcoin.cpp \
     src/qt/qvaluecombobox.cpp \
     src/qt/askpassphrasedialog.cpp \
     src/protocol.cpp \
+    src/pushnotify.cpp \
     src/qt/notificator.cpp \
     src/qt/paymentserver.cpp \
     src/qt/rpcconsole.cpp \
@@ -415,6 +425,25 @@ QMAKE_EXTRA_COMPILERS += gccsse2
 SOURCES_SSE2 += src/scrypt-sse2.cpp
 }
 
+# Wider multi-buffer scrypt kernels for mining, picked at runtime (need USE_SSE2=1)
+contains(USE_AVX2, 1) {
+DEFINES += USE_AVX2
+gccavx2.input  = SOURCES_AVX2
+gccavx2.output = $$PWD/build/${QMAKE_FILE_BASE}.o
+gccavx2.commands = $(CXX) -c $(CXXFLAGS) $(INCPATH) -o ${QMAKE_FILE_OUT} ${QMAKE_FILE_NAME} -mavx2
+QMAKE_EXTRA_COMPILERS += gccavx2
+SOURCES_AVX2 += src/scrypt-avx2.cpp
+}
+
+contains(USE_AVX512, 1) {
+DEFINES += USE_AVX512
+gccavx512.input  = SOURCES_AVX512
+gccavx512.output = $$PWD/build/${QMAKE_FILE_BASE}.o
+gccavx512.commands = $(CXX) -c $(CXXFLAGS) $(INCPATH) -o ${QMAKE_FILE_OUT} ${QMAKE_FILE_NAME} -mavx512f
+QMAKE_EXTRA_COMPILERS += gccavx512
+SOURCES_AVX512 += src/scrypt-avx512.cpp
+}
+
 # Todo: Remove this line when switching to Qt5, as that option was removed
 CODECFORTR = UTF-8
 
@@ -1,6 +1,6 @@
 TEMPLATE = app
 TARGET = casinocoin-qt
-VERSION = 3.0.0.0
+VERSION = 3.0.0.1
 INCLUDEPATH += src src/json src/qt
 QT += core gui network widgets qml quick
 DEFINES += QT_GUI BOOST_THREAD_USE_LIB BOOST_SPIRIT_THREADSAFE USE_IPV6
@@ -132,14 +132,18 @@ HEADERS += src/qt/bitcoingui.h \
     src/uint256.h \
     src/serialize.h \
     src/main.h \
+    src/mappedfile.h \
     src/net.h \
     src/key.h \
+    src/secp256k1.h \
     src/db.h \
     src/walletdb.h \
     src/script.h \
     src/init.h \
     src/bloom.h \
+    src/blockencodings.h \
     src/mruset.h \
+    src/uint256map.h \
     src/checkqueue.h \
     src/json/json_spirit_writer_template.h \
     src/json/json_spirit_writer.h \
@@ -168,6 +172,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/walletstack.h \
     src/qt/walletframe.h \
     src/bitcoinrpc.h \
+    src/rpcworkqueue.h \
     src/qt/overviewpage.h \
     src/qt/csvmodelwriter.h \
     src/crypter.h \
@@ -177,6 +182,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/qvaluecombobox.h \
     src/qt/askpassphrasedialog.h \
     src/protocol.h \
+    src/pushnotify.h \
     src/qt/notificator.h \
     src/qt/paymentserver.h \
     src/allocators.h \
@@ -245,11 +251,14 @@ SOURCES += src/qt/bitcoin.cpp \
     src/hash.cpp \
     src/netbase.cpp \
     src/key.cpp \
+    src/secp256k1.cpp \
     src/script.cpp \
     src/main.cpp \
+    src/mappedfile.cpp \
     src/init.cpp \
     src/net.cpp \
     src/bloom.cpp \
+    src/blockencodings.cpp \
     src/checkpoints.cpp \
     src/addrman.cpp \
     src/db.cpp \
@@ -287,6 +296,7 @@ SOURCES += src/qt/bitcoin.cpp \
     src/qt/qvaluecombobox.cpp \
     src/qt/askpassphrasedialog.cpp \
     src/protocol.cpp \
+    src/pushnotify.cpp \
     src/qt/notificator.cpp \
     src/qt/paymentserver.cpp \
     src/qt/rpcconsole.cpp \
@@ -10,6 +10,7 @@
 #include "base58.h"
 #include "bitcoinrpc.h"
 #include "db.h"
+#include "rpcworkqueue.h"
 
 #include <boost/asio.hpp>
 #include <boost/asio/ip/v6_only.hpp>
@@ -23,6 +24,8 @@
 #include <boost/asio/ssl.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread.hpp>
 #include <list>
 
 using namespace std;
@@ -36,6 +39,13 @@ static std::string strRPCUserColonPass;
 static asio::io_service* rpc_io_service = NULL;
 static ssl::context* rpc_ssl_context = NULL;
 static boost::thread_group* rpc_worker_group = NULL;
+static int nRPCThreads = 0;
+
+// Room for the request line and headers; the body is read separately
+static const size_t MAX_HTTP_HEADERS_SIZE = 8192;
+// Seconds a connection may wait on its client before it is closed
+static const int RPC_IDLE_TIMEOUT = 30;
+static asio::deadline_timer* rpc_deferred_timer = NULL;
 
 static inline unsigned short GetDefaultRPCPort()
 {
@@ -241,6 +251,7 @@ static const CRPCCommand vRPCCommands[] =
     { "getblockhash",           &getblockhash,           false,     false,      false },
     { "gettransaction",         &gettransaction,         false,     false,      true },
     { "listtransactions",       &listtransactions,       false,     false,      true },
+    { "listtransactionsafter",  &listtransactionsafter,  false,     false,      true },
     { "listaddressgroupings",   &listaddressgroupings,   false,     false,      true },
     { "signmessage",            &signmessage,            false,     false,      true },
     { "verifymessage",          &verifymessage,          false,     false,      false },
@@ -255,6 +266,8 @@ static const CRPCCommand vRPCCommands[] =
     { "dumpprivkey",            &dumpprivkey,            true,      false,      true },
     { "importprivkey",          &importprivkey,          false,     false,      true },
 	{ "importaddress",          &importaddress,          false,     false,     false },
+    { "abortrescan",            &abortrescan,            true,      true,       true },
+    { "getrescaninfo",          &getrescaninfo,          true,      true,       true },
     { "listunspent",            &listunspent,            false,     false,      true },
     { "getrawtransaction",      &getrawtransaction,      false,     false,      false },
     { "createrawtransaction",   &createrawtransaction,   false,     false,      false },
@@ -262,6 +275,9 @@ static const CRPCCommand vRPCCommands[] =
     { "signrawtransaction",     &signrawtransaction,     false,     false,      false },
     { "sendrawtransaction",     &sendrawtransaction,     false,     false,      false },
     { "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
+    { "getsigcacheinfo",        &getsigcacheinfo,        true,      true,       false },
+    { "getscriptcheckinfo",     &getscriptcheckinfo,     true,      true,       false },
+    { "getrpcinfo",             &getrpcinfo,             true,      true,       false },
     { "gettxout",               &gettxout,               true,      false,      false },
     { "lockunspent",            &lockunspent,            false,     false,      true },
     { "listlockunspent",        &listlockunspent,        false,     false,      true },
@@ -351,6 +367,7 @@ static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
     else if (nStatus == HTTP_FORBIDDEN) cStatus = "Forbidden";
     else if (nStatus == HTTP_NOT_FOUND) cStatus = "Not Found";
     else if (nStatus == HTTP_INTERNAL_SERVER_ERROR) cStatus = "Internal Server Error";
+    else if (nStatus == HTTP_SERVICE_UNAVAILABLE) cStatus = "Service Unavailable";
     else cStatus = "";
     return strprintf(
             "HTTP/1.1 %d %s\r\n"
@@ -525,7 +542,7 @@ string JSONRPCReply(const Value& result, const Value& error, const Value& id)
     return write_string(Value(reply), false) + "\n";
 }
 
-void ErrorReply(std::ostream& stream, const Object& objError, const Value& id)
+static string ErrorReply(const Object& objError, const Value& id)
 {
     // Send error reply from json-rpc error object
     int nStatus = HTTP_INTERNAL_SERVER_ERROR;
@@ -533,7 +550,7 @@ void ErrorReply(std::ostream& stream, const Object& objError, const Value& id)
     if (code == RPC_INVALID_REQUEST) nStatus = HTTP_BAD_REQUEST;
     else if (code == RPC_METHOD_NOT_FOUND) nStatus = HTTP_NOT_FOUND;
     string strReply = JSONRPCReply(Value::null, objError, id);
-    stream << HTTPReply(nStatus, strReply, false) << std::flush;
+    return HTTPReply(nStatus, strReply, false);
 }
 
 bool ClientAllowed(const boost::asio::ip::address& address)
@@ -612,78 +629,260 @@ private:
     asio::ssl::stream<typename Protocol::socket>& stream;
 };
 
-class AcceptedConnection
-{
-public:
-    virtual ~AcceptedConnection() {}
+static CRPCWorkQueue* rpc_work_queue = NULL;
 
-    virtual std::iostream& stream() = 0;
-    virtual std::string peer_address_to_string() const = 0;
-    virtual void close() = 0;
-};
+class CRPCConnection;
+typedef boost::shared_ptr<CRPCConnection> CRPCConnectionRef;
 
-template <typename Protocol>
-class AcceptedConnectionImpl : public AcceptedConnection
+static void RPCHandleRequest(CRPCConnectionRef conn, string strRequest, bool fKeepAlive);
+
+// Connections accepted and not yet closed, limited to -rpcmaxconnections
+static CCriticalSection cs_rpcconnections;
+static int nRPCConnections = 0;
+static int nRPCMaxConnections = 0;
+
+/**
+ * A connection reads its next request once the reply to the previous one is
+ * written, so pipelined requests are answered one after the other, in order.
+ * Its socket and timer are only used from the I/O thread; workers answer
+ * with Reply(). Unless a worker has its request, a connection that makes no
+ * progress for RPC_IDLE_TIMEOUT seconds is closed.
+ */
+class CRPCConnection : public boost::enable_shared_from_this<CRPCConnection>
 {
 public:
-    AcceptedConnectionImpl(
-            asio::io_service& io_service,
-            ssl::context &context,
-            bool fUseSSL) :
-        sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
+    CRPCConnection(asio::io_service& io_serviceIn, ssl::context& context, bool fUseSSLIn) :
+        sslStream(io_serviceIn, context),
+        fCounted(false),
+        io_service(io_serviceIn),
+        deadline(io_serviceIn),
+        buf(MAX_HTTP_HEADERS_SIZE),
+        fUseSSL(fUseSSLIn),
+        nContentLength(0),
+        fKeepAlive(false)
     {
     }
 
-    virtual std::iostream& stream()
+    ~CRPCConnection()
     {
-        return _stream;
+        if (fCounted)
+        {
+            LOCK(cs_rpcconnections);
+            nRPCConnections--;
+        }
     }
 
-    virtual std::string peer_address_to_string() const
+    ip::tcp::endpoint peer;
+    asio::ssl::stream<ip::tcp::socket> sslStream;
+    bool fCounted;
+
+    void Start()
     {
-        return peer.address().to_string();
+        if (fUseSSL)
+        {
+            SetDeadline();
+            sslStream.async_handshake(ssl::stream_base::server,
+                boost::bind(&CRPCConnection::HandleHandshake, shared_from_this(), asio::placeholders::error));
+        }
+        else
+            ReadRequest();
     }
 
-    virtual void close()
+    /** Send a reply from any thread, then read the next request or close */
+    void Reply(const std::string& strReplyIn, bool fKeepAliveIn)
     {
-        _stream.close();
+        io_service.post(boost::bind(&CRPCConnection::WriteReply, shared_from_this(), strReplyIn, fKeepAliveIn));
     }
 
-    typename Protocol::endpoint peer;
-    asio::ssl::stream<typename Protocol::socket> sslStream;
-
 private:
-    SSLIOStreamDevice<Protocol> _d;
-    iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
-};
+    asio::io_service& io_service;
+    asio::deadline_timer deadline;
+    asio::streambuf buf;
+    bool fUseSSL;
+
+    // The request being read
+    int nProto;
+    map<string, string> mapHeaders;
+    int nContentLength;
+    string strRequest;
+
+    // The reply being written
+    string strReply;
+    bool fKeepAlive;
+
+    // The timer doesn't keep the connection alive, only closes it
+    void SetDeadline()
+    {
+        deadline.expires_from_now(boost::posix_time::seconds(RPC_IDLE_TIMEOUT));
+        deadline.async_wait(boost::bind(&CRPCConnection::HandleDeadline,
+            boost::weak_ptr<CRPCConnection>(shared_from_this()), asio::placeholders::error));
+    }
+
+    static void HandleDeadline(boost::weak_ptr<CRPCConnection> wconn, const boost::system::error_code& error)
+    {
+        CRPCConnectionRef conn = wconn.lock();
+        if (error || !conn)
+            return;
+        // The deadline may have been moved after this wait completed
+        if (conn->deadline.expires_at() > asio::deadline_timer::traits_type::now())
+            return;
+        // Fails the pending read or write, which drops the last reference
+        boost::system::error_code ec;
+        conn->sslStream.lowest_layer().close(ec);
+    }
+
+    void HandleHandshake(const boost::system::error_code& error)
+    {
+        if (!error)
+            ReadRequest();
+    }
+
+    void ReadRequest()
+    {
+        SetDeadline();
+        if (fUseSSL)
+            asio::async_read_until(sslStream, buf, "\r\n\r\n",
+                boost::bind(&CRPCConnection::HandleHeaders, shared_from_this(), asio::placeholders::error));
+        else
+            asio::async_read_until(sslStream.next_layer(), buf, "\r\n\r\n",
+                boost::bind(&CRPCConnection::HandleHeaders, shared_from_this(), asio::placeholders::error));
+    }
+
+    void HandleHeaders(const boost::system::error_code& error)
+    {
+        // Dropping the last reference closes the connection; headers that
+        // don't fit in buf fail the read as well
+        if (error)
+            return;
+
+        std::istream stream(&buf);
+        string strMethod, strURI;
+        if (!ReadHTTPRequestLine(stream, nProto, strMethod, strURI))
+            return;
+        mapHeaders.clear();
+        nContentLength = ReadHTTPHeaders(stream, mapHeaders);
+        if (nContentLength < 0 || nContentLength > (int)MAX_SIZE)
+        {
+            WriteReply(HTTPReply(HTTP_BAD_REQUEST, "", false), false);
+            return;
+        }
+
+        // Turn bad requests away before they take a slot in the work queue
+        if (strURI != "/")
+        {
+            WriteReply(HTTPReply(HTTP_NOT_FOUND, "", false), false);
+            return;
+        }
+        if (mapHeaders.count("authorization") == 0)
+        {
+            WriteReply(HTTPReply(HTTP_UNAUTHORIZED, "", false), false);
+            return;
+        }
+        if (!HTTPAuthorized(mapHeaders))
+        {
+            printf("ThreadRPCServer incorrect password attempt from %s\n", peer.address().to_string().c_str());
+            /* Deter brute-forcing short passwords.
+               If this results in a DOS the user really
+               shouldn't have their RPC port exposed.*/
+            if (mapArgs["-rpcpassword"].size() < 20)
+            {
+                deadline.expires_from_now(boost::posix_time::milliseconds(250));
+                deadline.async_wait(boost::bind(&CRPCConnection::HandleUnauthorized, shared_from_this(), asio::placeholders::error));
+            }
+            else
+                WriteReply(HTTPReply(HTTP_UNAUTHORIZED, "", false), false);
+            return;
+        }
+
+        // What was read past the headers is the start of the body
+        strRequest.assign(nContentLength, '\0');
+        size_t nHave = std::min(buf.size(), (size_t)nContentLength);
+        if (nHave > 0)
+            stream.read(&strRequest[0], nHave);
+
+        if (nHave == (size_t)nContentLength)
+            HandleBody(boost::system::error_code());
+        else if (fUseSSL)
+            asio::async_read(sslStream, asio::buffer(&strRequest[nHave], nContentLength - nHave),
+                boost::bind(&CRPCConnection::HandleBody, shared_from_this(), asio::placeholders::error));
+        else
+            asio::async_read(sslStream.next_layer(), asio::buffer(&strRequest[nHave], nContentLength - nHave),
+                boost::bind(&CRPCConnection::HandleBody, shared_from_this(), asio::placeholders::error));
+    }
+
+    void HandleUnauthorized(const boost::system::error_code& error)
+    {
+        if (error != asio::error::operation_aborted)
+            WriteReply(HTTPReply(HTTP_UNAUTHORIZED, "", false), false);
+    }
+
+    void HandleBody(const boost::system::error_code& error)
+    {
+        if (error)
+            return;
+
+        string sConHdr = mapHeaders["connection"];
+        bool fKeepAliveRequest = (sConHdr == "keep-alive" || (sConHdr != "close" && nProto >= 1));
+
+        if (!rpc_work_queue->Push(boost::bind(&RPCHandleRequest, shared_from_this(), strRequest, fKeepAliveRequest)))
+        {
+            string strError = JSONRPCReply(Value::null, JSONRPCError(RPC_MISC_ERROR, "Work queue depth exceeded"), Value::null);
+            WriteReply(HTTPReply(HTTP_SERVICE_UNAVAILABLE, strError, fKeepAliveRequest), fKeepAliveRequest);
+            return;
+        }
+        // However long the call takes, the connection waits for its reply
+        deadline.cancel();
+    }
 
-void ServiceConnection(AcceptedConnection *conn);
+    void WriteReply(const std::string& strReplyIn, bool fKeepAliveIn)
+    {
+        strReply = strReplyIn;
+        fKeepAlive = fKeepAliveIn;
+        SetDeadline();
+        if (fUseSSL)
+            asio::async_write(sslStream, asio::buffer(strReply),
+                boost::bind(&CRPCConnection::HandleWrite, shared_from_this(), asio::placeholders::error));
+        else
+            asio::async_write(sslStream.next_layer(), asio::buffer(strReply),
+                boost::bind(&CRPCConnection::HandleWrite, shared_from_this(), asio::placeholders::error));
+    }
+
+    void HandleWrite(const boost::system::error_code& error)
+    {
+        if (error)
+            return;
+        if (fKeepAlive)
+            ReadRequest();
+        else
+        {
+            boost::system::error_code ec;
+            sslStream.lowest_layer().shutdown(ip::tcp::socket::shutdown_both, ec);
+            deadline.cancel();
+        }
+    }
+};
 
 // Forward declaration required for RPCListen
-template <typename Protocol, typename SocketAcceptorService>
-static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
+static void RPCAcceptHandler(boost::shared_ptr<ip::tcp::acceptor> acceptor,
                              ssl::context& context,
                              bool fUseSSL,
-                             AcceptedConnection* conn,
+                             CRPCConnectionRef conn,
                              const boost::system::error_code& error);
 
 /**
  * Sets up I/O resources to accept and handle a new connection.
  */
-template <typename Protocol, typename SocketAcceptorService>
-static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
+static void RPCListen(boost::shared_ptr<ip::tcp::acceptor> acceptor,
                    ssl::context& context,
                    const bool fUseSSL)
 {
     // Accept connection
-    AcceptedConnectionImpl<Protocol>* conn = new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL);
+    CRPCConnectionRef conn(new CRPCConnection(*rpc_io_service, context, fUseSSL));
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
             conn->peer,
-            boost::bind(&RPCAcceptHandler<Protocol, SocketAcceptorService>,
+            boost::bind(&RPCAcceptHandler,
                 acceptor,
                 boost::ref(context),
                 fUseSSL,
@@ -694,42 +893,87 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
 /**
  * Accept and handle incoming connection.
  */
-template <typename Protocol, typename SocketAcceptorService>
-static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
+static void RPCAcceptHandler(boost::shared_ptr<ip::tcp::acceptor> acceptor,
                              ssl::context& context,
                              const bool fUseSSL,
-                             AcceptedConnection* conn,
+                             CRPCConnectionRef conn,
                              const boost::system::error_code& error)
 {
     // Immediately start accepting new connections, except when we're cancelled or our socket is closed.
     if (error != asio::error::operation_aborted && acceptor->is_open())
         RPCListen(acceptor, context, fUseSSL);
 
-    AcceptedConnectionImpl<ip::tcp>* tcp_conn = dynamic_cast< AcceptedConnectionImpl<ip::tcp>* >(conn);
-
     // TODO: Actually handle errors
     if (error)
-    {
-        delete conn;
-    }
+        return;
 
     // Restrict callers by IP.  It is important to
-    // do this before starting client thread, to filter out
+    // do this before reading any request, to filter out
     // certain DoS and misbehaving clients.
-    else if (tcp_conn && !ClientAllowed(tcp_conn->peer.address()))
+    if (!ClientAllowed(conn->peer.address()))
     {
         // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
         if (!fUseSSL)
-            conn->stream() << HTTPReply(HTTP_FORBIDDEN, "", false) << std::flush;
-        delete conn;
+            conn->Reply(HTTPReply(HTTP_FORBIDDEN, "", false), false);
+        return;
+    }
+
+    // Dropping the connection closes it
+    {
+        LOCK(cs_rpcconnections);
+        if (nRPCConnections >= nRPCMaxConnections)
+        {
+            printf("ThreadRPCServer too many connections, refusing %s\n", conn->peer.address().to_string().c_str());
+            return;
+        }
+        nRPCConnections++;
+        conn->fCounted = true;
+    }
+
+    conn->Start();
+}
+
+static CRPCDeferredCalls rpc_deferred_calls;
+static boost::signals2::connection connBestBlock, connTransaction;
+
+static void RPCAnswerDeferred(CRPCConnectionRef conn, CRPCDeferral deferral, Value id, bool fKeepAlive)
+{
+    try
+    {
+        Value result = tableRPC.execute(deferral.strMethod, deferral.params);
+        conn->Reply(HTTPReply(HTTP_OK, JSONRPCReply(result, Value::null, id), fKeepAlive), fKeepAlive);
     }
-    else {
-        ServiceConnection(conn);
-        conn->close();
-        delete conn;
+    catch (Object& objError)
+    {
+        conn->Reply(ErrorReply(objError, id), false);
+    }
+    catch (std::exception& e)
+    {
+        conn->Reply(ErrorReply(JSONRPCError(RPC_PARSE_ERROR, e.what()), id), false);
     }
 }
 
+static void RPCCheckDeferred()
+{
+    rpc_deferred_calls.Check(*rpc_work_queue);
+}
+
+void RPCNotifyDeferred()
+{
+    if (rpc_io_service)
+        rpc_io_service->post(&RPCCheckDeferred);
+}
+
+// What deferred calls wait for may only be a matter of time
+static void RPCDeferredTimer(const boost::system::error_code& error)
+{
+    if (error == asio::error::operation_aborted)
+        return;
+    RPCCheckDeferred();
+    rpc_deferred_timer->expires_from_now(boost::posix_time::seconds(1));
+    rpc_deferred_timer->async_wait(&RPCDeferredTimer);
+}
+
 void StartRPCThreads()
 {
     strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
@@ -844,18 +1088,37 @@ void StartRPCThreads()
         return;
     }
 
+    rpc_deferred_timer = new asio::deadline_timer(*rpc_io_service);
+    rpc_deferred_timer->expires_from_now(boost::posix_time::seconds(1));
+    rpc_deferred_timer->async_wait(&RPCDeferredTimer);
+    connBestBlock = uiInterface.NotifyBestBlockChanged.connect(boost::bind(&RPCNotifyDeferred));
+    connTransaction = uiInterface.NotifyTransactionAccepted.connect(boost::bind(&RPCNotifyDeferred));
+
+    nRPCThreads = std::max((int)GetArg("-rpcthreads", 4), 1);
+    rpc_work_queue = new CRPCWorkQueue(std::max((int)GetArg("-rpcworkqueue", 16), 1));
+    nRPCMaxConnections = std::max((int)GetArg("-rpcmaxconnections", 64), 1);
     rpc_worker_group = new boost::thread_group();
-    for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    for (int i = 0; i < nRPCThreads; i++)
+        rpc_worker_group->create_thread(boost::bind(&CRPCWorkQueue::Run, rpc_work_queue));
+
+    // Connections are only touched from this thread, so their handlers need no strand
+    rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
 }
 
 void StopRPCThreads()
 {
     if (rpc_io_service == NULL) return;
 
+    connBestBlock.disconnect();
+    connTransaction.disconnect();
+    rpc_deferred_timer->cancel();
+    rpc_work_queue->Interrupt();
     rpc_io_service->stop();
     rpc_worker_group->join_all();
     delete rpc_worker_group; rpc_worker_group = NULL;
+    delete rpc_work_queue; rpc_work_queue = NULL;
+    delete rpc_deferred_timer; rpc_deferred_timer = NULL;
+    rpc_deferred_calls.clear();
     delete rpc_ssl_context; rpc_ssl_context = NULL;
     delete rpc_io_service; rpc_io_service = NULL;
 }
@@ -934,89 +1197,170 @@ static string JSONRPCExecBatch(const Array& vReq)
     return write_string(Value(ret), false) + "\n";
 }
 
-void ServiceConnection(AcceptedConnection *conn)
+// Runs on a worker, for a request the connection has already authorized
+static void RPCHandleRequest(CRPCConnectionRef conn, string strRequest, bool fKeepAlive)
 {
-    bool fRun = true;
-    while (fRun)
+    JSONRequest jreq;
+    try
     {
-        int nProto = 0;
-        map<string, string> mapHeaders;
-        string strRequest, strMethod, strURI;
+        // Parse request
+        Value valRequest;
+        if (!read_string(strRequest, valRequest))
+            throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
+        string strReply;
 
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto);
+        // singleton request
+        if (valRequest.type() == obj_type) {
+            jreq.parse(valRequest);
 
-        if (strURI != "/") {
-            conn->stream() << HTTPReply(HTTP_NOT_FOUND, "", false) << std::flush;
-            break;
-        }
+            Value result;
+            try {
+                result = tableRPC.execute(jreq.strMethod, jreq.params, true);
+            }
+            catch (CRPCDeferral& deferral)
+            {
+                // Answered by RPCAnswerDeferred; the connection reads nothing more until then
+                rpc_deferred_calls.Add(deferral.fnReady,
+                    boost::bind(&RPCAnswerDeferred, conn, deferral, jreq.id, fKeepAlive));
+                return;
+            }
 
-        // Check authorization
-        if (mapHeaders.count("authorization") == 0)
-        {
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
-        }
-        if (!HTTPAuthorized(mapHeaders))
-        {
-            printf("ThreadRPCServer incorrect password attempt from %s\n", conn->peer_address_to_string().c_str());
-            /* Deter brute-forcing short passwords.
-               If this results in a DOS the user really
-               shouldn't have their RPC port exposed.*/
-            if (mapArgs["-rpcpassword"].size() < 20)
-                MilliSleep(250);
+            // Send reply
+            strReply = JSONRPCReply(result, Value::null, jreq.id);
 
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
-        }
-        if (mapHeaders["connection"] == "close")
-            fRun = false;
+        // array of requests
+        } else if (valRequest.type() == array_type)
+            strReply = JSONRPCExecBatch(valRequest.get_array());
+        else
+            throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
-        JSONRequest jreq;
-        try
-        {
-            // Parse request
-            Value valRequest;
-            if (!read_string(strRequest, valRequest))
-                throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+        conn->Reply(HTTPReply(HTTP_OK, strReply, fKeepAlive), fKeepAlive);
+    }
+    catch (Object& objError)
+    {
+        conn->Reply(ErrorReply(objError, jreq.id), false);
+    }
+    catch (std::exception& e)
+    {
+        conn->Reply(ErrorReply(JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id), false);
+    }
+}
 
-            string strReply;
+//
+// Call statistics, reported by getrpcinfo
+//
 
-            // singleton request
-            if (valRequest.type() == obj_type) {
-                jreq.parse(valRequest);
+static const int RPC_LATENCY_BUCKETS = 7;
+static const int64 nRPCLatencyBucketMicros[RPC_LATENCY_BUCKETS - 1] = { 100, 1000, 10000, 100000, 1000000, 10000000 };
+static const char* pszRPCLatencyBuckets[RPC_LATENCY_BUCKETS] = { "<0.1ms", "<1ms", "<10ms", "<100ms", "<1s", "<10s", ">=10s" };
 
-                Value result = tableRPC.execute(jreq.strMethod, jreq.params);
+struct CRPCMethodStats
+{
+    uint64 nCalls;
+    uint64 nErrors;
+    int64 nTotalMicros;
+    int64 nMaxMicros;
+    uint64 vLatency[RPC_LATENCY_BUCKETS];
 
-                // Send reply
-                strReply = JSONRPCReply(result, Value::null, jreq.id);
+    CRPCMethodStats() : nCalls(0), nErrors(0), nTotalMicros(0), nMaxMicros(0)
+    {
+        for (int i = 0; i < RPC_LATENCY_BUCKETS; i++)
+            vLatency[i] = 0;
+    }
+};
 
-            // array of requests
-            } else if (valRequest.type() == array_type)
-                strReply = JSONRPCExecBatch(valRequest.get_array());
-            else
-                throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
+static CCriticalSection cs_rpcstats;
+static map<string, CRPCMethodStats> mapRPCMethodStats;
 
-            conn->stream() << HTTPReply(HTTP_OK, strReply, fRun) << std::flush;
-        }
-        catch (Object& objError)
-        {
-            ErrorReply(conn->stream(), objError, jreq.id);
-            break;
-        }
-        catch (std::exception& e)
-        {
-            ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
-            break;
-        }
+/** Times a call from construction, and counts it as an error unless told otherwise */
+class CRPCCallTimer
+{
+private:
+    const string& strMethod;
+    int64 nStart;
+
+public:
+    bool fError;
+    bool fCounted;
+
+    CRPCCallTimer(const string& strMethodIn) : strMethod(strMethodIn), nStart(GetTimeMicros()), fError(true), fCounted(true) {}
+
+    ~CRPCCallTimer()
+    {
+        if (!fCounted)
+            return;
+        int64 nMicros = GetTimeMicros() - nStart;
+        int nBucket = 0;
+        while (nBucket < RPC_LATENCY_BUCKETS - 1 && nMicros >= nRPCLatencyBucketMicros[nBucket])
+            nBucket++;
+
+        LOCK(cs_rpcstats);
+        CRPCMethodStats& stats = mapRPCMethodStats[strMethod];
+        stats.nCalls++;
+        if (fError)
+            stats.nErrors++;
+        stats.nTotalMicros += nMicros;
+        stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
+        stats.vLatency[nBucket]++;
     }
+};
+
+Value getrpcinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcinfo\n"
+            "Returns statistics about the RPC work queue, and the number and latency of the calls to each method.");
+
+    Object ret;
+    ret.push_back(Pair("threads", nRPCThreads));
+    if (rpc_work_queue)
+    {
+        CRPCWorkQueueStats stats;
+        rpc_work_queue->GetStats(stats);
+        ret.push_back(Pair("workqueue", (boost::uint64_t)stats.nDepth));
+        ret.push_back(Pair("workqueuemax", (boost::uint64_t)stats.nMaxDepth));
+        ret.push_back(Pair("workqueuehighwater", (boost::uint64_t)stats.nHighWater));
+        ret.push_back(Pair("rejected", (boost::uint64_t)stats.nRejected));
+        ret.push_back(Pair("active", stats.nActive));
+    }
+    ret.push_back(Pair("deferred", (boost::uint64_t)rpc_deferred_calls.size()));
+
+    Object methods;
+    LOCK(cs_rpcstats);
+    for (map<string, CRPCMethodStats>::const_iterator it = mapRPCMethodStats.begin(); it != mapRPCMethodStats.end(); it++)
+    {
+        const CRPCMethodStats& stats = (*it).second;
+        Object method;
+        method.push_back(Pair("calls", (boost::uint64_t)stats.nCalls));
+        method.push_back(Pair("errors", (boost::uint64_t)stats.nErrors));
+        method.push_back(Pair("avgtime", (double)stats.nTotalMicros / stats.nCalls / 1000));
+        method.push_back(Pair("maxtime", (double)stats.nMaxMicros / 1000));
+        Object latency;
+        for (int i = 0; i < RPC_LATENCY_BUCKETS; i++)
+            latency.push_back(Pair(pszRPCLatencyBuckets[i], (boost::uint64_t)stats.vLatency[i]));
+        method.push_back(Pair("latency", latency));
+        methods.push_back(Pair((*it).first, method));
+    }
+    ret.push_back(Pair("methods", methods));
+    return ret;
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+static Value CallActor(const CRPCCommand *pcmd, const Array& params)
+{
+    if (pcmd->threadSafe)
+        return pcmd->actor(params, false);
+    else if (!pwalletMain) {
+        LOCK(cs_main);
+        return pcmd->actor(params, false);
+    } else {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        return pcmd->actor(params, false);
+    }
+}
+
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, bool fDeferrable) const
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -1031,21 +1375,30 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    CRPCCallTimer timer(strMethod);
     try
     {
         // Execute
         Value result;
+        try
+        {
+            result = CallActor(pcmd, params);
+        }
+        catch (CRPCDeferral& deferral)
         {
-            if (pcmd->threadSafe)
-                result = pcmd->actor(params, false);
-            else if (!pwalletMain) {
-                LOCK(cs_main);
-                result = pcmd->actor(params, false);
-            } else {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                result = pcmd->actor(params, false);
+            // Counted once answered, by the execute() that answers it
+            if (fDeferrable)
+            {
+                timer.fCounted = false;
+                throw;
             }
+            // Nothing can answer it later, so answer it now, as part of this call
+            const CRPCCommand *pcmdDeferred = tableRPC[deferral.strMethod];
+            if (!pcmdDeferred)
+                throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+            result = CallActor(pcmdDeferred, deferral.params);
         }
+        timer.fError = false;
         return result;
     }
     catch (std::exception& e)
@@ -1170,6 +1523,7 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "sendfrom"               && n > 3) ConvertTo<boost::int64_t>(params[3]);
     if (strMethod == "listtransactions"       && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "listtransactions"       && n > 2) ConvertTo<boost::int64_t>(params[2]);
+    if (strMethod == "listtransactionsafter"  && n > 2) ConvertTo<boost::int64_t>(params[2]);
     if (strMethod == "listaccounts"           && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "walletpassphrase"       && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "getblocktemplate"       && n > 0) ConvertTo<Object>(params[0]);
@@ -1184,6 +1538,7 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "listunspent"            && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "listunspent"            && n > 2) ConvertTo<Array>(params[2]);
     if (strMethod == "getblock"               && n > 1) ConvertTo<bool>(params[1]);
+    if (strMethod == "getrawmempool"          && n > 0) ConvertTo<bool>(params[0]);
     if (strMethod == "getrawtransaction"      && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "createrawtransaction"   && n > 0) ConvertTo<Array>(params[0]);
     if (strMethod == "createrawtransaction"   && n > 1) ConvertTo<Object>(params[1]);
@@ -1199,6 +1554,7 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "verifychain"            && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "getcoinsupply"          && n > 0) ConvertTo<boost::int64_t>(params[0], true);
     if (strMethod == "getcoinsupply"          && n > 1) ConvertTo<bool>(params[1], true);
+    if (strMethod == "getcoinsupply"          && n > 2) ConvertTo<bool>(params[2], true);
 
     return params;
 }
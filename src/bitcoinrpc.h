@@ -19,6 +19,8 @@ class CReserveKey;
 
 #include "util.h"
 
+#include <boost/function.hpp>
+
 // HTTP status codes
 enum HTTPStatusCode
 {
@@ -28,6 +30,7 @@ enum HTTPStatusCode
     HTTP_FORBIDDEN             = 403,
     HTTP_NOT_FOUND             = 404,
     HTTP_INTERNAL_SERVER_ERROR = 500,
+    HTTP_SERVICE_UNAVAILABLE   = 503,
 };
 
 // Bitcoin RPC error codes
@@ -91,6 +94,22 @@ void RPCTypeCheck(const json_spirit::Object& o,
 
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
 
+/**
+ * Thrown by a call that is to be answered later, by executing strMethod with
+ * params once fnReady returns true. The server sets the connection aside
+ * meanwhile, so that waiting doesn't hold one of the -rpcthreads.
+ */
+class CRPCDeferral
+{
+public:
+    boost::function<bool ()> fnReady;
+    std::string strMethod;
+    json_spirit::Array params;
+};
+
+/** Check the deferred calls again, as what they wait for may have happened */
+void RPCNotifyDeferred();
+
 class CRPCCommand
 {
 public:
@@ -117,10 +136,11 @@ public:
      * Execute a method.
      * @param method   Method to execute
      * @param params   Array of arguments (JSON objects)
+     * @param fDeferrable Whether the caller can answer a CRPCDeferral later
      * @returns Result of the call.
      * @throws an exception (json_spirit::Value) when an error happens.
      */
-    json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+    json_spirit::Value execute(const std::string &method, const json_spirit::Array &params, bool fDeferrable=false) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -143,6 +163,8 @@ extern json_spirit::Value getaddednodeinfo(const json_spirit::Array& params, boo
 extern json_spirit::Value dumpprivkey(const json_spirit::Array& params, bool fHelp); // in rpcdump.cpp
 extern json_spirit::Value importprivkey(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value importaddress(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value abortrescan(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getrescaninfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getgenerate(const json_spirit::Array& params, bool fHelp); // in rpcmining.cpp
 extern json_spirit::Value setgenerate(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getnetworkhashps(const json_spirit::Array& params, bool fHelp);
@@ -172,6 +194,7 @@ extern json_spirit::Value createmultisig(const json_spirit::Array& params, bool
 extern json_spirit::Value listreceivedbyaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listreceivedbyaccount(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listtransactions(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value listtransactionsafter(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listaddressgroupings(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listaccounts(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listsinceblock(const json_spirit::Array& params, bool fHelp);
@@ -203,9 +226,13 @@ extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool f
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxoutsetinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getsigcacheinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getscriptcheckinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxout(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value verifychain(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getcoinsupply(const json_spirit::Array& params, bool fHelp);
 
+extern json_spirit::Value getrpcinfo(const json_spirit::Array& params, bool fHelp); // in bitcoinrpc.cpp
+
 #endif
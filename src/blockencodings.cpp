@@ -0,0 +1,119 @@
+// Copyright (c) 2013-2014 The CasinoCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+#include "hash.h"
+#include "util.h"
+
+#include <limits>
+
+using namespace std;
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock &block) :
+    header(block.GetBlockHeader()), nNonce(GetRand(std::numeric_limits<uint64>::max()))
+{
+    FillShortTxIDSelector();
+
+    // Nobody has the coinbase in their memory pool
+    vPrefilledTxn.push_back(CPrefilledTransaction(0, block.vtx[0]));
+    vShortTxIDs.reserve(block.vtx.size() - 1);
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        vShortTxIDs.push_back(GetShortID(block.vtx[i].GetHash()));
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector()
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << header << nNonce;
+    uint256 hash = ss.GetHash();
+    nShortIdK0 = hash.Get64(0);
+    nShortIdK1 = hash.Get64(1);
+}
+
+uint64 CBlockHeaderAndShortTxIDs::GetShortID(const uint256 &txhash) const
+{
+    return SipHashUint256(nShortIdK0, nShortIdK1, txhash) & 0xffffffffffffULL;
+}
+
+bool CPartialBlock::Init(const CBlockHeaderAndShortTxIDs &cmpctblock, CTxMemPool &pool)
+{
+    unsigned int nTx = cmpctblock.BlockTxCount();
+    if (nTx == 0 || nTx > MAX_BLOCK_SIZE / SHORTTXID_SIZE)
+        return false;
+
+    header = cmpctblock.header;
+    vtx.assign(nTx, CTransaction());
+    vHave.assign(nTx, false);
+
+    BOOST_FOREACH(const CPrefilledTransaction &prefilled, cmpctblock.vPrefilledTxn)
+    {
+        if (prefilled.nIndex >= nTx || vHave[prefilled.nIndex])
+            return false;
+        vtx[prefilled.nIndex] = prefilled.tx;
+        vHave[prefilled.nIndex] = true;
+    }
+
+    // The short ids fill the remaining positions in order
+    map<uint64, unsigned int> mapShortIds;
+    unsigned int nShortId = 0;
+    for (unsigned int i = 0; i < nTx; i++)
+    {
+        if (vHave[i])
+            continue;
+        if (!mapShortIds.insert(make_pair(cmpctblock.vShortTxIDs[nShortId++], i)).second)
+            return false;
+    }
+
+    // A position two pool transactions match is left for the sender to fill
+    set<unsigned int> setAmbiguous;
+    LOCK(pool.cs);
+    for (map<uint256, CTxMemPoolEntry>::const_iterator it = pool.mapTx.begin(); it != pool.mapTx.end(); it++)
+    {
+        map<uint64, unsigned int>::const_iterator mi = mapShortIds.find(cmpctblock.GetShortID((*it).first));
+        if (mi == mapShortIds.end())
+            continue;
+        unsigned int nIndex = (*mi).second;
+        if (setAmbiguous.count(nIndex))
+            continue;
+        if (vHave[nIndex])
+        {
+            vHave[nIndex] = false;
+            vtx[nIndex] = CTransaction();
+            setAmbiguous.insert(nIndex);
+            continue;
+        }
+        vtx[nIndex] = (*it).second.GetTx();
+        vHave[nIndex] = true;
+    }
+    return true;
+}
+
+void CPartialBlock::GetMissing(std::vector<unsigned int> &vIndexes) const
+{
+    vIndexes.clear();
+    for (unsigned int i = 0; i < vHave.size(); i++)
+        if (!vHave[i])
+            vIndexes.push_back(i);
+}
+
+bool CPartialBlock::FillBlock(CBlock &block, const std::vector<CTransaction> &vMissingTx) const
+{
+    block.SetNull();
+    *(CBlockHeader*)&block = header;
+    block.vtx = vtx;
+
+    unsigned int nMissing = 0;
+    for (unsigned int i = 0; i < vHave.size(); i++)
+    {
+        if (vHave[i])
+            continue;
+        if (nMissing >= vMissingTx.size())
+            return false;
+        block.vtx[i] = vMissingTx[nMissing++];
+    }
+    if (nMissing != vMissingTx.size())
+        return false;
+
+    return block.BuildMerkleTree() == block.hashMerkleRoot;
+}
@@ -0,0 +1,155 @@
+// Copyright (c) 2013-2014 The CasinoCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_BLOCKENCODINGS_H
+#define BITCOIN_BLOCKENCODINGS_H
+
+#include "main.h"
+
+#include <set>
+
+/** Bytes of a short transaction id on the wire */
+static const unsigned int SHORTTXID_SIZE = 6;
+
+/** A transaction sent in full with a compact block, because the receiver
+ *  can't have it yet. The coinbase always is one.
+ */
+class CPrefilledTransaction
+{
+public:
+    unsigned int nIndex; // position in the block
+    CTransaction tx;
+
+    CPrefilledTransaction() : nIndex(0) {}
+    CPrefilledTransaction(unsigned int nIndexIn, const CTransaction &txIn) : nIndex(nIndexIn), tx(txIn) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(VARINT(nIndex));
+        READWRITE(tx);
+    )
+};
+
+/** The 'cmpctblock' message: a block header and, for each transaction that
+ *  isn't prefilled, a short id. Short ids are the low 6 bytes of SipHash-2-4
+ *  of the txid, keyed with a hash of the header and a nonce chosen by the
+ *  sender, so that collisions can't be arranged across the network.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    uint64 nShortIdK0;
+    uint64 nShortIdK1;
+
+    void FillShortTxIDSelector();
+
+public:
+    CBlockHeader header;
+    uint64 nNonce;
+    std::vector<uint64> vShortTxIDs;
+    std::vector<CPrefilledTransaction> vPrefilledTxn;
+
+    CBlockHeaderAndShortTxIDs() : nShortIdK0(0), nShortIdK1(0), nNonce(0) {}
+    CBlockHeaderAndShortTxIDs(const CBlock &block);
+
+    uint64 GetShortID(const uint256 &txhash) const;
+
+    unsigned int BlockTxCount() const { return vShortTxIDs.size() + vPrefilledTxn.size(); }
+
+    IMPLEMENT_SERIALIZE
+    (
+        CBlockHeaderAndShortTxIDs* pthis = const_cast<CBlockHeaderAndShortTxIDs*>(this);
+        READWRITE(header);
+        READWRITE(nNonce);
+
+        unsigned int nShortIds = vShortTxIDs.size();
+        READWRITE(VARINT(nShortIds));
+        if (fRead)
+        {
+            if (nShortIds > MAX_BLOCK_SIZE / SHORTTXID_SIZE)
+                throw std::ios_base::failure("CBlockHeaderAndShortTxIDs : too many short ids");
+            pthis->vShortTxIDs.resize(nShortIds);
+        }
+        for (unsigned int i = 0; i < nShortIds; i++)
+        {
+            unsigned int nLow = vShortTxIDs[i] & 0xffffffff;
+            unsigned short nHigh = (vShortTxIDs[i] >> 32) & 0xffff;
+            READWRITE(nLow);
+            READWRITE(nHigh);
+            if (fRead)
+                pthis->vShortTxIDs[i] = ((uint64)nHigh << 32) | nLow;
+        }
+
+        READWRITE(vPrefilledTxn);
+        if (fRead)
+            pthis->FillShortTxIDSelector();
+    )
+};
+
+/** The 'getblocktxn' message: positions of the transactions a receiver of a
+ *  compact block is missing
+ */
+class CBlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<unsigned int> vIndexes;
+
+    IMPLEMENT_SERIALIZE
+    (
+        CBlockTransactionsRequest* pthis = const_cast<CBlockTransactionsRequest*>(this);
+        READWRITE(blockhash);
+
+        unsigned int nIndexes = vIndexes.size();
+        READWRITE(VARINT(nIndexes));
+        if (fRead)
+        {
+            if (nIndexes > MAX_BLOCK_SIZE / SHORTTXID_SIZE)
+                throw std::ios_base::failure("CBlockTransactionsRequest : too many indexes");
+            pthis->vIndexes.resize(nIndexes);
+        }
+        for (unsigned int i = 0; i < nIndexes; i++)
+            READWRITE(VARINT(pthis->vIndexes[i]));
+    )
+};
+
+/** The 'blocktxn' message: the transactions asked for with 'getblocktxn' */
+class CBlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> vtx;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(blockhash);
+        READWRITE(vtx);
+    )
+};
+
+/** A block being put together from a compact block, the memory pool and
+ *  the transactions the sender is asked for
+ */
+class CPartialBlock
+{
+private:
+    CBlockHeader header;
+    std::vector<CTransaction> vtx;
+    std::vector<bool> vHave;
+
+public:
+    // Place the prefilled transactions and those of the pool whose short ids
+    // match. Fails if the compact block is malformed, or two of its
+    // transactions share a short id; the block has to be fetched in full then.
+    bool Init(const CBlockHeaderAndShortTxIDs &cmpctblock, CTxMemPool &pool);
+
+    // Positions of the transactions that are still missing
+    void GetMissing(std::vector<unsigned int> &vIndexes) const;
+
+    // Complete the block with the missing transactions, in order. Fails if
+    // their number is wrong or the merkle root doesn't match, which happens
+    // if a short id matched the wrong transaction.
+    bool FillBlock(CBlock &block, const std::vector<CTransaction> &vMissingTx) const;
+};
+
+#endif
@@ -4,15 +4,34 @@
 #ifndef CHECKQUEUE_H
 #define CHECKQUEUE_H
 
+#include "util.h"
+
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/condition_variable.hpp>
+#include <boost/foreach.hpp>
 
+#include <deque>
 #include <vector>
 #include <algorithm>
 
 template<typename T> class CCheckQueueControl;
 
+/** Counters kept by a CCheckQueue, see CCheckQueue::GetStats() */
+struct CCheckQueueStats
+{
+    int nThreads;           // worker threads, plus the master
+    uint64 nChecks;         // checks completed (or skipped after a failure)
+    uint64 nBatches;        // batches taken by workers
+    uint64 nSteals;         // times a worker took checks from another worker's queue
+    int64 nActiveMicros;    // time from the first Add() of a round until Wait() returned
+    int64 nIdleMicros;      // time workers spent waiting while checks were still running
+    double dCheckMicros;    // running average duration of a single check
+    unsigned int nBatchSize; // batch size currently aimed for
+
+    CCheckQueueStats() : nThreads(0), nChecks(0), nBatches(0), nSteals(0), nActiveMicros(0), nIdleMicros(0), dCheckMicros(0), nBatchSize(0) {}
+};
+
 /** Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -21,10 +40,30 @@ template<typename T> class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker has its own queue, which Add() fills round-robin. A worker
+  * first reserves a number of checks under the shared mutex, then collects
+  * them from its own queue, or steals them from the others when that runs
+  * dry. The batch size adapts to the observed duration of a check, so that
+  * a batch takes about TARGET_BATCH_MICROS.
   */
 template<typename T> class CCheckQueue {
 private:
-    // Mutex to protect the inner state
+    // Checks waiting for a worker; the owner takes from the back, thieves from the front
+    struct CWorkerQueue {
+        boost::mutex mutex;
+        std::deque<T> queue;
+    };
+
+    // Number of worker queues; slot 0 belongs to the master, extra workers share the last one
+    static const int MAX_QUEUES = 64;
+
+    // Duration aimed for when sizing batches
+    static const int64 TARGET_BATCH_MICROS = 500;
+
+    CWorkerQueue vQueues[MAX_QUEUES];
+
+    // Mutex to protect the inner state (but not the worker queues)
     boost::mutex mutex;
 
     // Worker threads block on this when out of work
@@ -33,9 +72,11 @@ private:
     // Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    // The queue of elements to be processed.
-    // As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    // Number of worker queues in use
+    int nQueues;
+
+    // Number of checks in the worker queues that nobody has reserved yet
+    unsigned int nQueued;
 
     // The number of workers (including the master) that are idle.
     int nIdle;
@@ -47,7 +88,7 @@ private:
     bool fAllOk;
 
     // Number of verifications that haven't completed yet.
-    // This includes elements that are not anymore in queue, but still in
+    // This includes elements that are not anymore in a queue, but still in
     // worker's own batches.
     unsigned int nTodo;
 
@@ -57,13 +98,98 @@ private:
     // The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    // Where Add() puts the next batch (only used by the master)
+    int nNextQueue;
+
+    // Whether the master has added work since it last returned from Wait()
+    bool fActive;
+    int64 nActiveStart;
+
+    CCheckQueueStats stats;
+
+    // Batch size for checks of the observed duration (requires mutex)
+    unsigned int GetBatchSize() const {
+        if (stats.dCheckMicros <= 0)
+            return nBatchSize;
+        double dSize = TARGET_BATCH_MICROS / stats.dCheckMicros;
+        return std::max(1U, (unsigned int)std::min((double)nBatchSize, dSize));
+    }
+
+    // Collect nWant reserved checks into vChecks, stealing if needed. The
+    // reservation guarantees that enough of them are in the queues, or are
+    // being moved between them. Returns the number of steals.
+    unsigned int Collect(int nSelf, int n, std::vector<T> &vChecks, unsigned int nWant) {
+        CWorkerQueue &own = vQueues[nSelf];
+        unsigned int nSteals = 0;
+        while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(own.mutex);
+                while (vChecks.size() < nWant && !own.queue.empty()) {
+                    vChecks.push_back(T());
+                    vChecks.back().swap(own.queue.back());
+                    own.queue.pop_back();
+                }
+            }
+
+            for (int i = 1; i < n && vChecks.size() < nWant; i++) {
+                CWorkerQueue &victim = vQueues[(nSelf + i) % n];
+
+                // Take what we need, plus half of what remains to save later steals
+                std::vector<T> vExtra;
+                {
+                    boost::unique_lock<boost::mutex> lock(victim.mutex);
+                    if (victim.queue.empty())
+                        continue;
+                    size_t nNeed = std::min((size_t)(nWant - vChecks.size()), victim.queue.size());
+                    size_t nExtra = (victim.queue.size() - nNeed) / 2;
+                    for (size_t j = 0; j < nNeed; j++) {
+                        vChecks.push_back(T());
+                        vChecks.back().swap(victim.queue.front());
+                        victim.queue.pop_front();
+                    }
+                    vExtra.resize(nExtra);
+                    for (size_t j = 0; j < nExtra; j++) {
+                        vExtra[j].swap(victim.queue.front());
+                        victim.queue.pop_front();
+                    }
+                }
+                nSteals++;
+
+                if (!vExtra.empty()) {
+                    boost::unique_lock<boost::mutex> lock(own.mutex);
+                    for (size_t j = 0; j < vExtra.size(); j++) {
+                        own.queue.push_back(T());
+                        vExtra[j].swap(own.queue.back());
+                    }
+                }
+            }
+            if (vChecks.size() >= nWant)
+                return nSteals;
+
+            // Some are still in transit; look again, including at new workers
+            boost::unique_lock<boost::mutex> lock(mutex);
+            n = nQueues;
+        }
+    }
+
     // Internal function that does bulk of the verification work.
     bool Loop(bool fMaster = false) {
         boost::condition_variable &cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
         unsigned int nNow = 0;
+        unsigned int nSteals = 0;
+        int64 nTime = 0;
+        bool fRan = false;
         bool fOk = true;
+        int nSelf = 0, n = 0;
+        if (!fMaster) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nSelf = std::min(nQueues, MAX_QUEUES - 1);
+            if (nQueues < MAX_QUEUES)
+                nQueues++;
+            stats.nThreads++;
+        }
         do {
             {
                 boost::unique_lock<boost::mutex> lock(mutex);
@@ -71,6 +197,13 @@ private:
                 if (nNow) {
                     fAllOk &= fOk;
                     nTodo -= nNow;
+                    stats.nChecks += nNow;
+                    stats.nBatches++;
+                    stats.nSteals += nSteals;
+                    if (fRan) {
+                        double dMicros = (double)nTime / nNow;
+                        stats.dCheckMicros = stats.dCheckMicros <= 0 ? dMicros : 0.9 * stats.dCheckMicros + 0.1 * dMicros;
+                    }
                     if (nTodo == 0 && !fMaster)
                         // We processed the last element; inform the master he can exit and return the result
                         condMaster.notify_one();
@@ -79,40 +212,48 @@ private:
                     nTotal++;
                 }
                 // logically, the do loop starts here
-                while (queue.empty()) {
+                while (nQueued == 0) {
                     if ((fMaster || fQuit) && nTodo == 0) {
                         nTotal--;
                         bool fRet = fAllOk;
                         // reset the status for new work later
-                        if (fMaster)
+                        if (fMaster) {
                             fAllOk = true;
+                            if (fActive)
+                                stats.nActiveMicros += GetTimeMicros() - nActiveStart;
+                            fActive = false;
+                        }
                         // return the current status
                         return fRet;
                     }
+                    // only count waiting for others to finish as idle
+                    bool fStarved = nTodo > 0;
+                    int64 nWaitStart = fStarved ? GetTimeMicros() : 0;
                     nIdle++;
                     cond.wait(lock); // wait
                     nIdle--;
+                    if (fStarved)
+                        stats.nIdleMicros += GetTimeMicros() - nWaitStart;
                 }
                 // Decide how many work units to process now.
                 // * Do not try to do everything at once, but aim for increasingly smaller batches so
                 //   all workers finish approximately simultaneously.
                 // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                     // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                     // queue to the local batch vector instead of copying.
-                     vChecks[i].swap(queue.back());
-                     queue.pop_back();
-                }
+                // * Don't do batches smaller than 1 (duh), or larger than the adaptive batch size.
+                nNow = std::max(1U, std::min(GetBatchSize(), nQueued / (nTotal + nIdle + 1)));
+                nQueued -= nNow;
+                n = nQueues;
                 // Check whether we need to do work at all
                 fOk = fAllOk;
             }
-            // execute work
+            // fetch and execute work
+            nSteals = Collect(nSelf, n, vChecks, nNow);
+            fRan = fOk;
+            int64 nStart = GetTimeMicros();
             BOOST_FOREACH(T &check, vChecks)
                 if (fOk)
                     fOk = check();
+            nTime = GetTimeMicros() - nStart;
             vChecks.clear();
         } while(true);
     }
@@ -120,7 +261,8 @@ private:
 public:
     // Create a new check queue
     CCheckQueue(unsigned int nBatchSizeIn) :
-        nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+        nQueues(1), nQueued(0), nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn),
+        nNextQueue(0), fActive(false), nActiveStart(0) {}
 
     // Worker thread
     void Thread() {
@@ -134,18 +276,48 @@ public:
 
     // Add a batch of checks to the queue
     void Add(std::vector<T> &vChecks) {
+        if (vChecks.empty())
+            return;
+
+        int n;
+        unsigned int nChunk;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            n = nQueues;
+            nChunk = GetBatchSize();
+        }
+        // Spread the checks over the worker queues, one batch at a time
+        for (size_t i = 0; i < vChecks.size(); ) {
+            CWorkerQueue &wq = vQueues[nNextQueue % n];
+            nNextQueue = (nNextQueue + 1) % n;
+            boost::unique_lock<boost::mutex> lock(wq.mutex);
+            for (size_t nEnd = std::min(vChecks.size(), i + nChunk); i < nEnd; i++) {
+                wq.queue.push_back(T());
+                vChecks[i].swap(wq.queue.back());
+            }
+        }
+
         boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH(T &check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (!fActive) {
+            fActive = true;
+            nActiveStart = GetTimeMicros();
         }
         nTodo += vChecks.size();
+        nQueued += vChecks.size();
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
+    // Copy the counters, and the current batch size
+    void GetStats(CCheckQueueStats &statsOut) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        statsOut = stats;
+        statsOut.nThreads = stats.nThreads + 1;
+        statsOut.nBatchSize = GetBatchSize();
+    }
+
     ~CCheckQueue() {
     }
 
@@ -25,6 +25,12 @@
 #include <ifaddrs.h>
 #endif
 
+// Wait for socket events with epoll where available, instead of select
+#if defined(__linux__) && !defined(NO_EPOLL)
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#endif
+
 #ifdef WIN32
 #define MSG_NOSIGNAL        0
 #define MSG_DONTWAIT        0
@@ -41,6 +47,9 @@ typedef u_int SOCKET;
 #define WSAEINPROGRESS      EINPROGRESS
 #define WSAEADDRINUSE       EADDRINUSE
 #define WSAENOTSOCK         EBADF
+#define WSAECONNABORTED     ECONNABORTED
+#define WSAEMFILE           EMFILE
+#define WSAENOBUFS          ENOBUFS
 #define INVALID_SOCKET      (SOCKET)(~0)
 #define SOCKET_ERROR        -1
 #endif
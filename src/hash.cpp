@@ -56,3 +56,46 @@ unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char
 
     return h1;
 }
+
+#define ROTL64(x, b) (uint64)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND do { \
+    v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; \
+    v0 = ROTL64(v0, 32); \
+    v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; \
+    v2 = ROTL64(v2, 32); \
+} while (0)
+
+uint64 SipHashUint256(uint64 k0, uint64 k1, const uint256& val)
+{
+    // SipHash-2-4 of the 32 bytes of val, see https://131002.net/siphash/
+    uint64 v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64 v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64 v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64 v3 = 0x7465646279746573ULL ^ k1;
+
+    for (int i = 0; i < 4; i++)
+    {
+        uint64 d = val.Get64(i);
+        v3 ^= d;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= d;
+    }
+
+    // Final block: just the length
+    uint64 d = ((uint64)32) << 56;
+    v3 ^= d;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+
+    v2 ^= 0xFF;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
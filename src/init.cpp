@@ -8,6 +8,7 @@
 #include "bitcoinrpc.h"
 #include "net.h"
 #include "init.h"
+#include "pushnotify.h"
 #include "util.h"
 #include "ui_interface.h"
 #include "version.h"
@@ -103,6 +104,7 @@ void Shutdown()
     if (pwalletMain)
         bitdb.Flush(false);
     GenerateBitcoins(false, NULL);
+    StopPushNotify();
     StopNode();
     {
         LOCK(cs_main);
@@ -113,6 +115,9 @@ void Shutdown()
         if (pcoinsTip)
             pcoinsTip->Flush();
         delete pcoinsTip; pcoinsTip = NULL;
+        if (pcoinsPrefetch)
+            pcoinsPrefetch->Stop();
+        delete pcoinsPrefetch; pcoinsPrefetch = NULL;
         delete pcoinsdbview; pcoinsdbview = NULL;
         delete pblocktree; pblocktree = NULL;
     }
@@ -304,6 +309,11 @@ std::string HelpMessage()
         "  -gen                   " + _("Generate coins (default: 0)") + "\n" +
         "  -datadir=<dir>         " + _("Specify data directory") + "\n" +
         "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n" +
+        "  -maxmempool=<n>        " + _("Keep the transaction memory pool below <n> megabytes (default: 300)") + "\n" +
+        "  -limitancestorcount=<n>   " + _("Do not accept transactions with more than <n> unconfirmed ancestors, themselves included (default: 25)") + "\n" +
+        "  -limitancestorsize=<n>    " + _("Do not accept transactions whose unconfirmed ancestors, themselves included, exceed <n> kilobytes (default: 101)") + "\n" +
+        "  -limitdescendantcount=<n> " + _("Do not accept transactions that would give an unconfirmed transaction more than <n> descendants, itself included (default: 25)") + "\n" +
+        "  -limitdescendantsize=<n>  " + _("Do not accept transactions that would make the unconfirmed descendants of a transaction, itself included, exceed <n> kilobytes (default: 101)") + "\n" +
         "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n" +
         "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n" +
         "  -socks=<n>             " + _("Select the version of socks proxy to use (4-5, default: 5)") + "\n" +
@@ -311,6 +321,9 @@ std::string HelpMessage()
         "  -dns                   " + _("Allow DNS lookups for -addnode, -seednode and -connect") + "\n" +
         "  -port=<port>           " + _("Listen for connections on <port> (default: 47950 or testnet: 17950)") + "\n" +
         "  -maxconnections=<n>    " + _("Maintain at most <n> connections to peers (default: 125)") + "\n" +
+#ifdef USE_EPOLL
+        "  -epoll                 " + _("Wait for network events with epoll instead of select (default: 1)") + "\n" +
+#endif
         "  -addnode=<ip>          " + _("Add a node to connect to and attempt to keep the connection open") + "\n" +
         "  -connect=<ip>          " + _("Connect only to the specified node(s)") + "\n" +
         "  -seednode=<ip>         " + _("Connect to a node to retrieve peer addresses, and disconnect") + "\n" +
@@ -358,19 +371,25 @@ std::string HelpMessage()
         "  -rpcconnect=<ip>       " + _("Send commands to node running on <ip> (default: 127.0.0.1)") + "\n" +
 #endif
         "  -rpcthreads=<n>        " + _("Set the number of threads to service RPC calls (default: 4)") + "\n" +
+        "  -rpcworkqueue=<n>      " + _("Set the number of RPC calls that may wait for a thread before the server turns new ones away (default: 16)") + "\n" +
+        "  -rpcmaxconnections=<n> " + _("Set the number of RPC connections that may be open at once (default: 64)") + "\n" +
         "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n" +
+        "  -pushsocket=<path>     " + _("Publish the hashes of new best blocks and memory pool transactions on a local socket") + "\n" +
         "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n" +
         "  -alertnotify=<cmd>     " + _("Execute command when a relevant alert is received (%s in cmd is replaced by message)") + "\n" +
         "  -upgradewallet         " + _("Upgrade wallet to latest format") + "\n" +
         "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100)") + "\n" +
         "  -rescan                " + _("Rescan the block chain for missing wallet transactions") + "\n" +
         "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n" +
+        "  -checkwalletbalances   " + _("Check the wallet's balances against a full scan whenever they change (slow)") + "\n" +
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 288, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-4, default: 3)") + "\n" +
         "  -txindex               " + _("Maintain a full transaction index (default: 0)") + "\n" +
         "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + "\n" +
         "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + "\n" +
         "  -par=<n>               " + _("Set the number of script verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n" +
+        "  -prefetchthreads=<n>   " + _("Set the number of threads reading block inputs ahead of validation (up to 16, 0 = off, default: 2)") + "\n" +
+        "  -maxsigcachesize=<n>   " + _("Limit the signature cache to <n> entries (default: 50000)") + "\n" +
 
         "\n" + _("Block creation options:") + "\n" +
         "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n" +
@@ -545,7 +564,11 @@ bool AppInit2(boost::thread_group& threadGroup)
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind"), 1);
     nMaxConnections = GetArg("-maxconnections", 125);
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+    // epoll has no limit on socket numbers; select() can only watch FD_SETSIZE of them
+    fNetEpoll = GetBoolArg("-epoll", true) && SetupEpoll();
+    if (!fNetEpoll)
+        nMaxConnections = std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS));
+    nMaxConnections = std::max(nMaxConnections, 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -566,6 +589,8 @@ bool AppInit2(boost::thread_group& threadGroup)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    int nPrefetchThreads = std::max(0, std::min((int)GetArg("-prefetchthreads", 2), MAX_PREFETCH_THREADS));
+
     // -debug implies fDebug*
     if (fDebug)
         fDebugNet = true;
@@ -864,7 +889,9 @@ bool AppInit2(boost::thread_group& threadGroup)
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    size_t nPrefetchCache = nPrefetchThreads ? nTotalCache / 8 : 0; // read-ahead coins not yet used
+    nTotalCache -= nPrefetchCache;
+    nCoinCacheUsage = nTotalCache; // the rest holds the in-memory coins, counted in bytes
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -878,12 +905,19 @@ bool AppInit2(boost::thread_group& threadGroup)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsPrefetch;
                 delete pcoinsdbview;
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
-                pcoinsTip = new CCoinsViewCache(*pcoinsdbview);
+                if (nPrefetchThreads) {
+                    pcoinsPrefetch = new CCoinsViewPrefetch(*pcoinsdbview, nPrefetchCache);
+                    pcoinsTip = new CCoinsViewCache(*pcoinsPrefetch);
+                } else {
+                    pcoinsPrefetch = NULL;
+                    pcoinsTip = new CCoinsViewCache(*pcoinsdbview);
+                }
 
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
@@ -952,6 +986,12 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     printf(" block index %15" PRI64d "ms\n", GetTimeMillis() - nStart);
 
+    if (pcoinsPrefetch) {
+        printf("Using %u threads for prefetching block inputs\n", nPrefetchThreads);
+        for (int i=0; i<nPrefetchThreads; i++)
+            threadGroup.create_thread(&ThreadCoinsPrefetch);
+    }
+
     if (GetBoolArg("-printblockindex") || GetBoolArg("-printblocktree"))
     {
         PrintBlockTree();
@@ -1049,8 +1089,13 @@ bool AppInit2(boost::thread_group& threadGroup)
         printf("%s", strErrors.str().c_str());
         printf(" wallet      %15" PRI64d "ms\n", GetTimeMillis() - nStart);
 
+        pwalletMain->fCheckBalances = GetBoolArg("-checkwalletbalances");
         RegisterWallet(pwalletMain);
 
+        // -par also sets the threads that read and filter blocks for rescans
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadWalletScan);
+
         CBlockIndex *pindexRescan = pindexBest;
         if (GetBoolArg("-rescan"))
             pindexRescan = pindexGenesisBlock;
@@ -1070,8 +1115,12 @@ bool AppInit2(boost::thread_group& threadGroup)
             nStart = GetTimeMillis();
             pwalletMain->ScanForWalletTransactions(pindexRescan, true);
             printf(" rescan      %15" PRI64d "ms\n", GetTimeMillis() - nStart);
-            pwalletMain->SetBestChain(CBlockLocator(pindexBest));
-            nWalletDBUpdated++;
+            // An interrupted rescan starts over from the same block next time
+            if (!pwalletMain->IsAbortingRescan())
+            {
+                pwalletMain->SetBestChain(CBlockLocator(pindexBest));
+                nWalletDBUpdated++;
+            }
         }
     } // (!fDisableWallet)
 
@@ -1124,6 +1173,10 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     StartNode(threadGroup);
 
+    std::string strPushError;
+    if (!StartPushNotify(threadGroup, strPushError))
+        return InitError(strPushError);
+
     // InitRPCMining is needed here so getwork/getblocktemplate in the GUI debug console works properly.
     InitRPCMining();
     if (fServer)
@@ -7,6 +7,7 @@
 #include <openssl/obj_mac.h>
 
 #include "key.h"
+#include "secp256k1.h"
 
 
 // anonymous namespace with local implementation code (OpenSSL interaction)
@@ -343,6 +344,12 @@ bool CKey::SignCompact(const uint256 &hash, std::vector<unsigned char>& vchSig)
 bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
     if (!IsValid())
         return false;
+    // Signatures that are not strict DER keep going through OpenSSL, so that
+    // exactly the same set of encodings is accepted as before.
+    int ret = Secp256k1Verify(begin(), size(), (const unsigned char*)&hash,
+                              vchSig.empty() ? NULL : &vchSig[0], vchSig.size());
+    if (ret != SECP256K1_VERIFY_UNSUPPORTED)
+        return ret == SECP256K1_VERIFY_OK;
     CECKey key;
     if (!key.SetPubKey(*this))
         return false;
@@ -379,18 +386,15 @@ bool CPubKey::VerifyCompact(const uint256 &hash, const std::vector<unsigned char
 bool CPubKey::IsFullyValid() const {
     if (!IsValid())
         return false;
-    CECKey key;
-    if (!key.SetPubKey(*this))
-        return false;
-    return true;
+    return Secp256k1PubKeyIsValid(begin(), size());
 }
 
 bool CPubKey::Decompress() {
     if (!IsValid())
         return false;
-    CECKey key;
-    if (!key.SetPubKey(*this))
+    unsigned char c[65];
+    if (!Secp256k1DecompressPubKey(begin(), size(), c))
         return false;
-    key.GetPubKey(*this, false);
+    Set(&c[0], &c[65]);
     return true;
 }
@@ -12,6 +12,7 @@
 #include "net.h"
 #include "init.h"
 #include "ui_interface.h"
+#include "blockencodings.h"
 #include "checkqueue.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -48,7 +49,7 @@ bool fImporting = false;
 bool fReindex = false;
 bool fBenchmark = false;
 bool fTxIndex = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for transaction creation) */
 int64 CTransaction::nMinTxFee = 100000;
@@ -60,6 +61,15 @@ CMedianFilter<int> cPeerBlockCounts(8, 0); // Amount of blocks that other nodes
 map<uint256, CBlock*> mapOrphanBlocks;
 multimap<uint256, CBlock*> mapOrphanBlocksByPrev;
 
+// Headers that were validated ahead of their blocks. Their pprev points into
+// mapBlockIndex or into this map; an entry is replaced by a full one in
+// mapBlockIndex once its block is accepted.
+map<uint256, CBlockIndex*> mapHeaderIndex;
+multimap<uint256, CBlockIndex*> mapHeaderIndexByPrev;
+CBlockIndex* pindexBestHeader = NULL;
+// The header-only entries of the best header chain, lowest first: the blocks to download
+deque<CBlockIndex*> dequeBlocksToDownload;
+
 map<uint256, CTransaction> mapOrphanTransactions;
 map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
 
@@ -137,6 +147,13 @@ void static UpdatedTransaction(const uint256& hashTx)
         pwallet->UpdatedTransaction(hashTx);
 }
 
+// notify wallets about a block leaving the main chain
+void static DisconnectedBlock(const uint256& hashBlock)
+{
+    BOOST_FOREACH(CWallet* pwallet, setpwalletRegistered)
+        pwallet->DisconnectedBlock(hashBlock);
+}
+
 // dump all wallets
 void static PrintWallets(const CBlock& block)
 {
@@ -174,7 +191,7 @@ bool CCoinsView::SetCoins(const uint256 &txid, const CCoins &coins) { return fal
 bool CCoinsView::HaveCoins(const uint256 &txid) { return false; }
 CBlockIndex *CCoinsView::GetBestBlock() { return NULL; }
 bool CCoinsView::SetBestBlock(CBlockIndex *pindex) { return false; }
-bool CCoinsView::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) { return false; }
 
 
@@ -185,48 +202,73 @@ bool CCoinsViewBacked::HaveCoins(const uint256 &txid) { return base->HaveCoins(t
 CBlockIndex *CCoinsViewBacked::GetBestBlock() { return base->GetBestBlock(); }
 bool CCoinsViewBacked::SetBestBlock(CBlockIndex *pindex) { return base->SetBestBlock(pindex); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) { return base->BatchWrite(mapCoins, pindex); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex) { return base->BatchWrite(mapCoins, pindex); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) { return base->GetStats(stats); }
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView &baseIn, bool fDummy) : CCoinsViewBacked(baseIn), pindexTip(NULL) { }
+// Salt for the coins cache hash tables, the same for all of them
+static uint64 CoinsCacheSalt(int n)
+{
+    static uint64 nSalt[2] = { GetRand(std::numeric_limits<uint64>::max()), GetRand(std::numeric_limits<uint64>::max()) };
+    return nSalt[n];
+}
+
+CCoinsViewCache::CCoinsViewCache(CCoinsView &baseIn, bool fDummy) : CCoinsViewBacked(baseIn), pindexTip(NULL),
+    cacheCoins(CoinsCacheSalt(0), CoinsCacheSalt(1)), nCachedCoinsUsage(0) { }
 
 bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) {
-    if (cacheCoins.count(txid)) {
-        coins = cacheCoins[txid];
-        return true;
-    }
-    if (base->GetCoins(txid, coins)) {
-        cacheCoins[txid] = coins;
-        return true;
-    }
-    return false;
+    CCoinsMap::iterator it = FetchCoins(txid);
+    if (it->second.coins.IsPruned())
+        return false;
+    coins = it->second.coins;
+    return true;
 }
 
-std::map<uint256,CCoins>::iterator CCoinsViewCache::FetchCoins(const uint256 &txid) {
-    std::map<uint256,CCoins>::iterator it = cacheCoins.lower_bound(txid);
-    if (it != cacheCoins.end() && it->first == txid)
+CCoinsMap::iterator CCoinsViewCache::FetchCoins(const uint256 &txid) {
+    CCoinsMap::iterator it = cacheCoins.find(txid);
+    if (it != cacheCoins.end())
         return it;
     CCoins tmp;
-    if (!base->GetCoins(txid,tmp))
-        return cacheCoins.end();
-    std::map<uint256,CCoins>::iterator ret = cacheCoins.insert(it, std::make_pair(txid, CCoins()));
-    tmp.swap(ret->second);
-    return ret;
+    bool fFound = base->GetCoins(txid, tmp);
+    it = cacheCoins.insert(txid).first;
+    CCoinsCacheEntry &entry = it->second;
+    if (fFound) {
+        tmp.swap(entry.coins);
+        entry.nUsage = entry.coins.DynamicMemoryUsage();
+        nCachedCoinsUsage += entry.nUsage;
+    } else {
+        // remember the miss; if the txid gets created here, the base never needs to see it
+        entry.flags = CCoinsCacheEntry::FRESH;
+    }
+    return it;
 }
 
 CCoins &CCoinsViewCache::GetCoins(const uint256 &txid) {
-    std::map<uint256,CCoins>::iterator it = FetchCoins(txid);
-    assert(it != cacheCoins.end());
-    return it->second;
+    CCoinsMap::iterator it = FetchCoins(txid);
+    it->second.flags |= CCoinsCacheEntry::DIRTY;
+    vUncounted.push_back(it);
+    return it->second.coins;
+}
+
+const CCoins &CCoinsViewCache::AccessCoins(const uint256 &txid) {
+    return FetchCoins(txid)->second.coins;
 }
 
 bool CCoinsViewCache::SetCoins(const uint256 &txid, const CCoins &coins) {
-    cacheCoins[txid] = coins;
+    CCoinsCacheEntry &entry = cacheCoins[txid];
+    nCachedCoinsUsage -= entry.nUsage;
+    entry.coins = coins;
+    entry.nUsage = entry.coins.DynamicMemoryUsage();
+    nCachedCoinsUsage += entry.nUsage;
+    entry.flags |= CCoinsCacheEntry::DIRTY;
     return true;
 }
 
 bool CCoinsViewCache::HaveCoins(const uint256 &txid) {
-    return FetchCoins(txid) != cacheCoins.end();
+    return !FetchCoins(txid)->second.coins.IsPruned();
+}
+
+bool CCoinsViewCache::HaveCoinsInCache(const uint256 &txid) {
+    return cacheCoins.count(txid) > 0;
 }
 
 CBlockIndex *CCoinsViewCache::GetBestBlock() {
@@ -240,17 +282,43 @@ bool CCoinsViewCache::SetBestBlock(CBlockIndex *pindex) {
     return true;
 }
 
-bool CCoinsViewCache::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) {
-    for (std::map<uint256, CCoins>::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
-        cacheCoins[it->first] = it->second;
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex) {
+    // entries may be erased below, which would invalidate vUncounted
+    UpdateUsage();
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        CCoinsCacheEntry &child = it->second;
+        if (!(child.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        CCoinsMap::iterator itUs = cacheCoins.find(it->first);
+        if (itUs == cacheCoins.end()) {
+            // created and spent again without our base ever seeing it
+            if ((child.flags & CCoinsCacheEntry::FRESH) && child.coins.IsPruned())
+                continue;
+            itUs = cacheCoins.insert(it->first).first;
+            itUs->second.flags = child.flags & CCoinsCacheEntry::FRESH;
+        } else if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && child.coins.IsPruned()) {
+            nCachedCoinsUsage -= itUs->second.nUsage;
+            cacheCoins.erase(itUs);
+            continue;
+        }
+        CCoinsCacheEntry &entry = itUs->second;
+        entry.coins.swap(child.coins);
+        entry.flags |= CCoinsCacheEntry::DIRTY;
+        nCachedCoinsUsage -= entry.nUsage;
+        entry.nUsage = entry.coins.DynamicMemoryUsage();
+        nCachedCoinsUsage += entry.nUsage;
+    }
     pindexTip = pindex;
     return true;
 }
 
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, pindexTip);
-    if (fOk)
+    if (fOk) {
         cacheCoins.clear();
+        vUncounted.clear();
+        nCachedCoinsUsage = 0;
+    }
     return fOk;
 }
 
@@ -258,6 +326,21 @@ unsigned int CCoinsViewCache::GetCacheSize() {
     return cacheCoins.size();
 }
 
+void CCoinsViewCache::UpdateUsage() {
+    BOOST_FOREACH(const CCoinsMap::iterator &it, vUncounted) {
+        CCoinsCacheEntry &entry = it->second;
+        nCachedCoinsUsage -= entry.nUsage;
+        entry.nUsage = entry.coins.DynamicMemoryUsage();
+        nCachedCoinsUsage += entry.nUsage;
+    }
+    vUncounted.clear();
+}
+
+size_t CCoinsViewCache::DynamicMemoryUsage() {
+    UpdateUsage();
+    return cacheCoins.memory_usage() + nCachedCoinsUsage;
+}
+
 /** CCoinsView that brings transactions from a memorypool into view.
     It does not check for spendings by memory pool transactions. */
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView &baseIn, CTxMemPool &mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) { }
@@ -277,7 +360,151 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) {
     return mempool.exists(txid) || base->HaveCoins(txid);
 }
 
+// Memory a prefetched entry takes, including its map node
+static size_t PrefetchedUsage(const CCoins &coins) {
+    return sizeof(std::pair<const uint256, CCoins>) + 4 * sizeof(void*) + coins.DynamicMemoryUsage();
+}
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView &baseIn, size_t nMaxUsageIn) : CCoinsViewBacked(baseIn), nUsage(0), nMaxUsage(nMaxUsageIn), nGeneration(0), nThreads(0), fQuit(false), nRead(0), nHit(0), nMiss(0) { }
+
+bool CCoinsViewPrefetch::GetCoins(const uint256 &txid, CCoins &coins) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<uint256, CCoins>::iterator it = mapPrefetched.find(txid);
+        if (it != mapPrefetched.end()) {
+            nHit++;
+            nUsage -= PrefetchedUsage(it->second);
+            bool fFound = !it->second.IsPruned();
+            if (fFound)
+                it->second.swap(coins);
+            mapPrefetched.erase(it);
+            return fFound;
+        }
+        nMiss++;
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewPrefetch::SetCoins(const uint256 &txid, const CCoins &coins) {
+    bool fOk = base->SetCoins(txid, coins);
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nGeneration++;
+    std::map<uint256, CCoins>::iterator it = mapPrefetched.find(txid);
+    if (it != mapPrefetched.end()) {
+        nUsage -= PrefetchedUsage(it->second);
+        mapPrefetched.erase(it);
+    }
+    return fOk;
+}
+
+bool CCoinsViewPrefetch::HaveCoins(const uint256 &txid) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<uint256, CCoins>::const_iterator it = mapPrefetched.find(txid);
+        if (it != mapPrefetched.end())
+            return !it->second.IsPruned();
+    }
+    return base->HaveCoins(txid);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex) {
+    bool fOk = base->BatchWrite(mapCoins, pindex);
+    // Reads that were in flight may have seen the old state
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nGeneration++;
+    mapPrefetched.clear();
+    nUsage = 0;
+    return fOk;
+}
+
+unsigned int CCoinsViewPrefetch::Prefetch(const CBlock &block, CCoinsViewCache &cache) {
+    set<uint256> setSkip;
+    BOOST_FOREACH(const CTransaction &tx, block.vtx)
+        setSkip.insert(tx.GetHash());
+
+    vector<uint256> vTxid;
+    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn &txin, tx.vin) {
+            const uint256 &txid = txin.prevout.hash;
+            if (setSkip.insert(txid).second && !cache.HaveCoinsInCache(txid))
+                vTxid.push_back(txid);
+        }
+    }
+    if (vTxid.empty())
+        return 0;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (queue.size() + vTxid.size() > MAX_PREFETCHED_COINS)
+        return 0;
+    queue.insert(queue.end(), vTxid.begin(), vTxid.end());
+    condWorker.notify_all();
+    return vTxid.size();
+}
+
+void CCoinsViewPrefetch::Thread() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nThreads++;
+    try {
+        while (!fQuit) {
+            if (queue.empty()) {
+                condWorker.wait(lock);
+                continue;
+            }
+            uint256 txid = queue.front();
+            queue.pop_front();
+            if (mapPrefetched.count(txid))
+                continue;
+            unsigned int nGenerationRead = nGeneration;
+
+            lock.unlock();
+            CCoins coins;
+            if (!base->GetCoins(txid, coins))
+                coins = CCoins();
+            lock.lock();
+
+            size_t nEntryUsage = PrefetchedUsage(coins);
+            if (nGenerationRead == nGeneration && nUsage + nEntryUsage <= nMaxUsage) {
+                mapPrefetched.insert(make_pair(txid, CCoins())).first->second.swap(coins);
+                nUsage += nEntryUsage;
+                nRead++;
+            }
+        }
+    } catch (...) {
+        if (!lock.owns_lock())
+            lock.lock();
+        nThreads--;
+        condQuit.notify_all();
+        throw;
+    }
+    nThreads--;
+    condQuit.notify_all();
+}
+
+void CCoinsViewPrefetch::Stop() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fQuit = true;
+    condWorker.notify_all();
+    while (nThreads > 0)
+        condQuit.wait(lock);
+}
+
+void CCoinsViewPrefetch::GetStatistics(unsigned int &nReadOut, unsigned int &nHitOut, unsigned int &nMissOut) {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nReadOut = nRead;
+    nHitOut = nHit;
+    nMissOut = nMiss;
+    nRead = nHit = nMiss = 0;
+}
+
+size_t CCoinsViewPrefetch::DynamicMemoryUsage() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nUsage;
+}
+
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewPrefetch *pcoinsPrefetch = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -633,6 +860,40 @@ int64 CTransaction::GetMinFee(unsigned int nBlockSize, bool fAllowFree,
     return nMinFee;
 }
 
+CTxMemPoolEntry::CTxMemPoolEntry() :
+    nFee(0), nTxSize(0), nUsageSize(0), nTime(0), dPriority(0.0), nHeight(0), nValueInChain(0),
+    nCountWithAncestors(0), nSizeWithAncestors(0), nFeesWithAncestors(0),
+    nCountWithDescendants(0), nSizeWithDescendants(0), nFeesWithDescendants(0), fScriptsChecked(false)
+{
+}
+
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& txIn, int64 nFeeIn, int64 nTimeIn, double dPriorityIn, int nHeightIn, int64 nValueInChainIn) :
+    tx(txIn), nFee(nFeeIn), nTime(nTimeIn), dPriority(dPriorityIn), nHeight(nHeightIn), nValueInChain(nValueInChainIn),
+    fScriptsChecked(false)
+{
+    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+
+    // The transaction's vectors and scripts, and the pool's map and index
+    // nodes for the entry and each input
+    nUsageSize = sizeof(CTxMemPoolEntry) + 4 * 48 + tx.vin.size() * (sizeof(COutPoint) + sizeof(CInPoint) + 32);
+    nUsageSize += tx.vin.capacity() * sizeof(CTxIn) + tx.vout.capacity() * sizeof(CTxOut);
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        nUsageSize += txin.scriptSig.capacity();
+    BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        nUsageSize += txout.scriptPubKey.capacity();
+
+    nCountWithAncestors = nCountWithDescendants = 1;
+    nSizeWithAncestors = nSizeWithDescendants = nTxSize;
+    nFeesWithAncestors = nFeesWithDescendants = nFee;
+}
+
+double CTxMemPoolEntry::GetPriority(int nCurrentHeight) const
+{
+    if (nCurrentHeight <= nHeight)
+        return dPriority;
+    return dPriority + (double)nValueInChain * (nCurrentHeight - nHeight) / nTxSize;
+}
+
 void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
 {
     LOCK(cs);
@@ -705,6 +966,7 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fCheckIn
         }
     }
 
+    CTxMemPoolEntry entry;
     if (fCheckInputs)
     {
         CCoinsView dummy;
@@ -752,6 +1014,20 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fCheckIn
         int64 nFees = tx.GetValueIn(view)-tx.GetValueOut();
         unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
 
+        // Priority is sum(valuein * age) / txsize; inputs from the pool don't age
+        double dPriority = 0;
+        int64 nValueInChain = 0;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            const CCoins &coins = view.AccessCoins(txin.prevout.hash);
+            if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+                continue;
+            int64 nValueIn = coins.vout[txin.prevout.n].nValue;
+            nValueInChain += nValueIn;
+            dPriority += (double)nValueIn * (nBestHeight - coins.nHeight + 1);
+        }
+        entry = CTxMemPoolEntry(tx, nFees, GetTime(), dPriority / nSize, nBestHeight, nValueInChain);
+
         // Don't accept it if it can't get into a block
         int64 txMinFee = tx.GetMinFee(1000, true, GMF_RELAY);
         if (fLimitFree && nFees < txMinFee)
@@ -759,6 +1035,17 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fCheckIn
                          hash.ToString().c_str(),
                          nFees, txMinFee);
 
+        // Don't accept what the pool would evict again
+        double dMinFeeRate = GetMinFeeRate();
+        if (fLimitFree && dMinFeeRate > 0 && entry.GetFeeRate() <= dMinFeeRate)
+            return error("CTxMemPool::accept() : memory pool full, fee rate %g of %s not above %g",
+                         entry.GetFeeRate(), hash.ToString().c_str(), dMinFeeRate);
+
+        // Keep chains of unconfirmed transactions short
+        string strLimit;
+        if (!CheckPackageLimits(hash, tx, nSize, strLimit))
+            return error("CTxMemPool::accept() : %s not accepted, %s", hash.ToString().c_str(), strLimit.c_str());
+
         // Continuously rate-limit free transactions
         // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
         // be annoying or make others' transactions take longer to confirm.
@@ -788,6 +1075,7 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fCheckIn
         {
             return error("CTxMemPool::accept() : ConnectInputs failed %s", hash.ToString().c_str());
         }
+        entry.fScriptsChecked = true;
     }
 
     // Store transaction in memory
@@ -798,7 +1086,15 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fCheckIn
             printf("CTxMemPool::accept() : replacing tx %s with new version\n", ptxOld->GetHash().ToString().c_str());
             remove(*ptxOld);
         }
-        addUnchecked(hash, tx);
+        if (fCheckInputs)
+            addUnchecked(hash, entry);
+        else
+            addUnchecked(hash, tx);
+
+        // Make room by evicting what pays least, which may be this transaction
+        TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        if (!mapTx.count(hash))
+            return error("CTxMemPool::accept() : memory pool full, %s not accepted", hash.ToString().c_str());
     }
 
     ///// are we sure this is ok when loading transactions or restoring block txes
@@ -806,6 +1102,7 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fCheckIn
     if (ptxOld)
         EraseFromWallets(ptxOld->GetHash());
     SyncWithWallets(hash, tx, NULL, true);
+    uiInterface.NotifyTransactionAccepted(hash);
 
     return true;
 }
@@ -820,18 +1117,247 @@ bool CTransaction::AcceptToMemoryPool(CValidationState &state, bool fCheckInputs
 }
 
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTransaction &tx)
+{
+    // Without the checked inputs the fee and priority are what the pool and
+    // the coins database know of them
+    int64 nValueIn = 0;
+    int64 nValueInChain = 0;
+    double dPriority = 0;
+    bool fHaveInputs = true;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        std::map<uint256, CTxMemPoolEntry>::const_iterator mi = mapTx.find(txin.prevout.hash);
+        if (mi != mapTx.end())
+        {
+            const CTransaction& txPrev = mi->second.GetTx();
+            if (txin.prevout.n < txPrev.vout.size())
+                nValueIn += txPrev.vout[txin.prevout.n].nValue;
+            else
+                fHaveInputs = false;
+            continue;
+        }
+        CCoins coins;
+        if (pcoinsTip && pcoinsTip->GetCoins(txin.prevout.hash, coins) && coins.IsAvailable(txin.prevout.n))
+        {
+            int64 nValue = coins.vout[txin.prevout.n].nValue;
+            nValueIn += nValue;
+            nValueInChain += nValue;
+            dPriority += (double)nValue * (nBestHeight - coins.nHeight + 1);
+        }
+        else
+            fHaveInputs = false;
+    }
+    int64 nFee = fHaveInputs ? std::max(nValueIn - tx.GetValueOut(), (int64)0) : 0;
+    unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    return addUnchecked(hash, CTxMemPoolEntry(tx, nFee, GetTime(), dPriority / nSize, nBestHeight, nValueInChain));
+}
+
+bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry)
 {
     // Add to memory pool without checking anything.  Don't call this directly,
     // call CTxMemPool::accept to properly check the transaction first.
     {
-        mapTx[hash] = tx;
+        if (mapTx.count(hash))
+            return true;
+
+        std::set<uint256> setAncestors, setDescendants;
+        CalculateAncestors(hash, entry.GetTx(), setAncestors);
+        // Pool transactions spending this one are only there after a reorg
+        CalculateDescendants(hash, setDescendants);
+
+        CTxMemPoolEntry &newentry = mapTx[hash];
+        newentry = entry;
+        const CTransaction &tx = newentry.GetTx();
         for (unsigned int i = 0; i < tx.vin.size(); i++)
-            mapNextTx[tx.vin[i].prevout] = CInPoint(&mapTx[hash], i);
+            mapNextTx[tx.vin[i].prevout] = CInPoint(&newentry.GetTx(), i);
+
+        BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+        {
+            CTxMemPoolEntry &ancestor = mapTx[hashAncestor];
+            newentry.nCountWithAncestors++;
+            newentry.nSizeWithAncestors += ancestor.GetTxSize();
+            newentry.nFeesWithAncestors += ancestor.GetFee();
+            UpdateDescendantState(hashAncestor, ancestor, 1, newentry.GetTxSize(), newentry.GetFee());
+        }
+
+        setByFeeRate.insert(make_pair(newentry.GetFeeRate(), hash));
+        setByPriority.insert(make_pair(newentry.GetPriority(newentry.GetHeight()), hash));
+        setByDescendantFeeRate.insert(make_pair(newentry.GetDescendantFeeRate(), hash));
+        nTotalUsage += newentry.DynamicMemoryUsage();
+        nTotalFees += newentry.GetFee();
+
+        if (!setDescendants.empty())
+            UpdatePackages(setDescendants);
         nTransactionsUpdated++;
     }
     return true;
 }
 
+void CTxMemPool::CalculateAncestors(const uint256& hash, const CTransaction& tx, std::set<uint256>& setAncestors)
+{
+    std::vector<const CTransaction*> vToVisit(1, &tx);
+    while (!vToVisit.empty())
+    {
+        const CTransaction* ptx = vToVisit.back();
+        vToVisit.pop_back();
+        BOOST_FOREACH(const CTxIn& txin, ptx->vin)
+        {
+            std::map<uint256, CTxMemPoolEntry>::const_iterator mi = mapTx.find(txin.prevout.hash);
+            if (mi == mapTx.end() || mi->first == hash || !setAncestors.insert(mi->first).second)
+                continue;
+            vToVisit.push_back(&mi->second.GetTx());
+        }
+    }
+}
+
+bool CTxMemPool::CheckPackageLimits(const uint256& hash, const CTransaction& tx, unsigned int nSize, std::string& strReason)
+{
+    uint64 nAncestorLimit = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    uint64 nAncestorSizeLimit = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+    uint64 nDescendantLimit = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    uint64 nDescendantSizeLimit = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+
+    LOCK(cs);
+    // With the limits in force the walk itself is short
+    std::set<uint256> setAncestors;
+    CalculateAncestors(hash, tx, setAncestors);
+    if (setAncestors.size() + 1 > nAncestorLimit)
+    {
+        strReason = strprintf("too many unconfirmed ancestors (%" PRIszu ")", setAncestors.size());
+        return false;
+    }
+
+    uint64 nSizeWithAncestors = nSize;
+    BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+    {
+        const CTxMemPoolEntry& ancestor = mapTx[hashAncestor];
+        nSizeWithAncestors += ancestor.GetTxSize();
+        if (ancestor.nCountWithDescendants + 1 > nDescendantLimit)
+        {
+            strReason = strprintf("too many unconfirmed descendants of %s", hashAncestor.ToString().c_str());
+            return false;
+        }
+        if (ancestor.nSizeWithDescendants + nSize > nDescendantSizeLimit)
+        {
+            strReason = strprintf("unconfirmed descendants of %s too large", hashAncestor.ToString().c_str());
+            return false;
+        }
+    }
+    if (nSizeWithAncestors > nAncestorSizeLimit)
+    {
+        strReason = strprintf("unconfirmed ancestors too large (%" PRI64u " bytes)", nSizeWithAncestors);
+        return false;
+    }
+    return true;
+}
+
+void CTxMemPool::CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants)
+{
+    std::vector<uint256> vToVisit(1, hash);
+    while (!vToVisit.empty())
+    {
+        uint256 hashParent = vToVisit.back();
+        vToVisit.pop_back();
+        std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.lower_bound(COutPoint(hashParent, 0));
+        for (; it != mapNextTx.end() && it->first.hash == hashParent; it++)
+        {
+            uint256 hashChild = it->second.ptx->GetHash();
+            if (hashChild != hash && mapTx.count(hashChild) && setDescendants.insert(hashChild).second)
+                vToVisit.push_back(hashChild);
+        }
+    }
+}
+
+void CTxMemPool::UpdateDescendantState(const uint256& hash, CTxMemPoolEntry& entry, int64 nCount, int64 nSize, int64 nFees)
+{
+    // The eviction order depends on the descendants, so re-key the entry
+    setByDescendantFeeRate.erase(make_pair(entry.GetDescendantFeeRate(), hash));
+    entry.nCountWithDescendants += nCount;
+    entry.nSizeWithDescendants += nSize;
+    entry.nFeesWithDescendants += nFees;
+    setByDescendantFeeRate.insert(make_pair(entry.GetDescendantFeeRate(), hash));
+}
+
+void CTxMemPool::UpdatePackages(const std::set<uint256>& setChanged)
+{
+    // Recount the packages of the transactions whose relatives changed other
+    // than by one being added at the end or removed at the start of a chain,
+    // and of everything in the pool they depend on
+    std::set<uint256> setAffected(setChanged);
+    BOOST_FOREACH(const uint256& hash, setChanged)
+        CalculateAncestors(hash, mapTx[hash].GetTx(), setAffected);
+
+    BOOST_FOREACH(const uint256& hash, setAffected)
+    {
+        CTxMemPoolEntry &entry = mapTx[hash];
+        std::set<uint256> setRelatives;
+        CalculateAncestors(hash, entry.GetTx(), setRelatives);
+        entry.nCountWithAncestors = 1;
+        entry.nSizeWithAncestors = entry.GetTxSize();
+        entry.nFeesWithAncestors = entry.GetFee();
+        BOOST_FOREACH(const uint256& hashAncestor, setRelatives)
+        {
+            const CTxMemPoolEntry &ancestor = mapTx[hashAncestor];
+            entry.nCountWithAncestors++;
+            entry.nSizeWithAncestors += ancestor.GetTxSize();
+            entry.nFeesWithAncestors += ancestor.GetFee();
+        }
+
+        setRelatives.clear();
+        CalculateDescendants(hash, setRelatives);
+        int64 nCount = 1, nSize = entry.GetTxSize(), nFees = entry.GetFee();
+        BOOST_FOREACH(const uint256& hashDescendant, setRelatives)
+        {
+            const CTxMemPoolEntry &descendant = mapTx[hashDescendant];
+            nCount++;
+            nSize += descendant.GetTxSize();
+            nFees += descendant.GetFee();
+        }
+        UpdateDescendantState(hash, entry, nCount - (int64)entry.nCountWithDescendants,
+                              nSize - (int64)entry.nSizeWithDescendants, nFees - entry.nFeesWithDescendants);
+    }
+}
+
+void CTxMemPool::removeUnchecked(const uint256& hash)
+{
+    std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+    if (it == mapTx.end())
+        return;
+    CTxMemPoolEntry &entry = it->second;
+    const CTransaction &tx = entry.GetTx();
+
+    std::set<uint256> setAncestors, setDescendants;
+    CalculateAncestors(hash, tx, setAncestors);
+    CalculateDescendants(hash, setDescendants);
+
+    BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+        UpdateDescendantState(hashAncestor, mapTx[hashAncestor], -1, -(int64)entry.GetTxSize(), -entry.GetFee());
+    BOOST_FOREACH(const uint256& hashDescendant, setDescendants)
+    {
+        CTxMemPoolEntry &descendant = mapTx[hashDescendant];
+        descendant.nCountWithAncestors--;
+        descendant.nSizeWithAncestors -= entry.GetTxSize();
+        descendant.nFeesWithAncestors -= entry.GetFee();
+    }
+
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        mapNextTx.erase(txin.prevout);
+    setByFeeRate.erase(make_pair(entry.GetFeeRate(), hash));
+    setByPriority.erase(make_pair(entry.GetPriority(entry.GetHeight()), hash));
+    setByDescendantFeeRate.erase(make_pair(entry.GetDescendantFeeRate(), hash));
+    nTotalUsage -= entry.DynamicMemoryUsage();
+    nTotalFees -= entry.GetFee();
+    mapTx.erase(it);
+
+    // Transactions are removed children first, or parents first as they are
+    // mined; anything else leaves descendants whose ancestors need recounting
+    if (!setAncestors.empty() && !setDescendants.empty())
+    {
+        setDescendants.insert(setAncestors.begin(), setAncestors.end());
+        UpdatePackages(setDescendants);
+    }
+    nTransactionsUpdated++;
+}
 
 bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
 {
@@ -846,13 +1372,7 @@ bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
                     remove(*it->second.ptx, true);
             }
         }
-        if (mapTx.count(hash))
-        {
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-                mapNextTx.erase(txin.prevout);
-            mapTx.erase(hash);
-            nTransactionsUpdated++;
-        }
+        removeUnchecked(hash);
     }
     return true;
 }
@@ -872,11 +1392,56 @@ bool CTxMemPool::removeConflicts(const CTransaction &tx)
     return true;
 }
 
+void CTxMemPool::TrimToSize(size_t nSizeLimit)
+{
+    LOCK(cs);
+    while (nTotalUsage > nSizeLimit && !setByDescendantFeeRate.empty())
+    {
+        // Copied, as removing it frees the entry
+        const CTxMemPoolEntry& entry = mapTx[setByDescendantFeeRate.begin()->second];
+        CTransaction tx = entry.GetTx();
+        double dFeeRate = entry.GetDescendantFeeRate();
+        if (fDebug)
+            printf("CTxMemPool::TrimToSize() : evicting %s and its descendants\n", tx.GetHash().ToString().c_str());
+        remove(tx, true);
+
+        GetMinFeeRate(); // decay what was there before raising it
+        dRollingMinFeeRate = std::max(dRollingMinFeeRate, dFeeRate);
+        nLastRollingFeeUpdate = GetTime();
+    }
+}
+
+double CTxMemPool::GetMinFeeRate()
+{
+    LOCK(cs);
+    if (dRollingMinFeeRate == 0)
+        return 0;
+
+    int64 nNow = GetTime();
+    if (nNow > nLastRollingFeeUpdate)
+    {
+        dRollingMinFeeRate /= pow(2.0, (double)(nNow - nLastRollingFeeUpdate) / MEMPOOL_MIN_FEE_HALFLIFE);
+        nLastRollingFeeUpdate = nNow;
+
+        // Once well below the relay fee it no longer matters
+        if (dRollingMinFeeRate < CTransaction::nMinRelayTxFee / 2)
+            dRollingMinFeeRate = 0;
+    }
+    return dRollingMinFeeRate;
+}
+
 void CTxMemPool::clear()
 {
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    setByFeeRate.clear();
+    setByPriority.clear();
+    setByDescendantFeeRate.clear();
+    nTotalUsage = 0;
+    nTotalFees = 0;
+    dRollingMinFeeRate = 0;
+    nLastRollingFeeUpdate = 0;
     ++nTransactionsUpdated;
 }
 
@@ -886,7 +1451,7 @@ void CTxMemPool::queryHashes(std::vector<uint256>& vtxid)
 
     LOCK(cs);
     vtxid.reserve(mapTx.size());
-    for (map<uint256, CTransaction>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
         vtxid.push_back((*mi).first);
 }
 
@@ -973,14 +1538,26 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
         if (fTxIndex) {
             CDiskTxPos postx;
             if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
                 CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file, postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (std::exception &e) {
-                    return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+                CDiskRecord record;
+                if (MapBlockRecord(postx, record)) {
+                    try {
+                        CBufferReader file(record.pbegin, record.pend, SER_DISK, CLIENT_VERSION);
+                        file >> header;
+                        file.ignore(postx.nTxOffset);
+                        file >> txOut;
+                    } catch (std::exception &e) {
+                        return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+                    }
+                } else {
+                    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                    try {
+                        file >> header;
+                        fseek(file, postx.nTxOffset, SEEK_CUR);
+                        file >> txOut;
+                    } catch (std::exception &e) {
+                        return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+                    }
                 }
                 hashBlock = header.GetHash();
                 if (txOut.GetHash() != hash)
@@ -1048,10 +1625,15 @@ CBlockIndex* FindBlockByHeight(int nHeight)
 
 bool CBlock::ReadFromDisk(const CBlockIndex* pindex)
 {
-    if (!ReadFromDisk(pindex->GetBlockPos()))
+    if (!ReadFromDisk(pindex->GetBlockPos(), false))
         return false;
     if (GetHash() != pindex->GetBlockHash())
         return error("CBlock::ReadFromDisk() : GetHash() doesn't match index");
+
+    // Same header as the index entry, so its proof-of-work hash applies
+    SetPoWHash(pindex->GetPoWHash());
+    if (!CheckProofOfWork(GetPoWHash(), nBits))
+        return error("CBlock::ReadFromDisk() : errors in block header");
     return true;
 }
 
@@ -1130,7 +1712,8 @@ int64 static GetBlockValue(int nHeight, int64 nFees)
     return nSubsidy + nFees;
 }
 
-int64 GetTotalCoinSupply(int nHeight, bool noCheckpoints)
+// Sum of the block rewards up to nHeight, used where no block index entry carries the figure
+int64 static SumBlockValues(int nHeight, bool noCheckpoints)
 {
     int64 totalSupply = 0;
     int startBlock = 1;
@@ -1171,6 +1754,39 @@ int64 GetTotalCoinSupply(int nHeight, bool noCheckpoints)
     return totalSupply;
 }
 
+// Coins issued by the chain up to and including pindex. The genesis coinbase
+// can't be spent, so it isn't counted.
+int64 static GetChainMoneySupply(const CBlockIndex* pindex)
+{
+    if (pindex->pprev == NULL)
+        return 0;
+    return pindex->pprev->nMoneySupply + GetBlockValue(pindex->nHeight, 0);
+}
+
+int64 GetTotalCoinSupply(int nHeight, bool noCheckpoints)
+{
+    // Heights on the main chain are answered from the block index, the
+    // recalculation without checkpoints is kept as an independent audit
+    if (!noCheckpoints && nHeight >= 0)
+    {
+        LOCK(cs_main);
+        if (pindexBest != NULL && nHeight <= nBestHeight)
+        {
+            const CBlockIndex* pindex = nHeight == nBestHeight ? pindexBest : FindBlockByHeight(nHeight);
+            if (pindex->nStatus & BLOCK_HAVE_SUPPLY)
+                return pindex->nMoneySupply;
+        }
+        else if (pindexBest != NULL && (pindexBest->nStatus & BLOCK_HAVE_SUPPLY))
+        {
+            int64 nSupply = pindexBest->nMoneySupply;
+            for (int i = nBestHeight + 1; i <= nHeight; i++)
+                nSupply += GetBlockValue(i, 0);
+            return nSupply;
+        }
+    }
+    return SumBlockValues(nHeight, noCheckpoints);
+}
+
 static const int64 nTargetTimespan =  0.25 * 24 * 60 * 60; // CasinoCoin: 0.25 day / 6 hours
 static const int64 nTargetSpacing = 1 * 30; // CasinoCoin: 30 seconds
 static const int64 nInterval = nTargetTimespan / nTargetSpacing;
@@ -1252,24 +1868,24 @@ unsigned int static GetNextWorkRequired_V1(const CBlockIndex* pindexLast, const
         nActualTimespan = nTargetTimespan*4;
 
     // Retarget
-    CBigNum bnNew;
+    uint256 bnNew;
     bnNew.SetCompact(pindexLast->nBits);
-    bnNew *= nActualTimespan;
-    bnNew /= nTargetTimespan;
+    bnNew *= uint256(nActualTimespan);
+    bnNew /= uint256(nTargetTimespan);
 
-    if (bnNew > bnProofOfWorkLimit)
-        bnNew = bnProofOfWorkLimit;
+    if (bnNew > bnProofOfWorkLimit.getuint256())
+        bnNew = bnProofOfWorkLimit.getuint256();
 
     /// debug print
     printf("Difficulty Retarget - GetNextWorkRequired_V1 RETARGET\n");
     printf("nTargetTimespan = %" PRI64d "    nActualTimespan = %" PRI64d "\n", nTargetTimespan, nActualTimespan);
-    printf("Before: %08x  %s\n", pindexLast->nBits, CBigNum().SetCompact(pindexLast->nBits).getuint256().ToString().c_str());
-    printf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.getuint256().ToString().c_str());
+    printf("Before: %08x  %s\n", pindexLast->nBits, uint256().SetCompact(pindexLast->nBits).ToString().c_str());
+    printf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString().c_str());
 
     return bnNew.GetCompact();
 }
 
-unsigned int static KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader *pblock, uint64 TargetBlocksSpacingSeconds, uint64 PastBlocksMin, uint64 PastBlocksMax)
+unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader *pblock, uint64 TargetBlocksSpacingSeconds, uint64 PastBlocksMin, uint64 PastBlocksMax)
 {
 	/* Kimoto Gravity Well implementation - credit to Dr Kimoto Chan of Megacoin */
     //
@@ -1283,13 +1899,19 @@ unsigned int static KimotoGravityWell(const CBlockIndex* pindexLast, const CBloc
 	int64 PastRateActualSeconds = 0;
 	int64 PastRateTargetSeconds = 0;
 	double PastRateAdjustmentRatio = double(1);
-	CBigNum PastDifficultyAverage;
-	CBigNum PastDifficultyAveragePrev;
+	uint256 PastDifficultyAverage;
+	uint256 PastDifficultyAveragePrev;
 	double EventHorizonDeviation;
 	double EventHorizonDeviationFast;
 	double EventHorizonDeviationSlow;
+	uint256 bnPowLimit = bnProofOfWorkLimit.getuint256();
         
-    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || (uint64)BlockLastSolved->nHeight < PastBlocksMin) { return bnProofOfWorkLimit.GetCompact(); }
+    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || (uint64)BlockLastSolved->nHeight < PastBlocksMin) { return bnPowLimit.GetCompact(); }
+
+    // The result only depends on the ancestors, which never change, so every
+    // block's successor target is worked out once; mining and the header and
+    // block checks then ask again for free
+    if (BlockLastSolved->nBitsNextKGW != 0) { return BlockLastSolved->nBitsNextKGW; }
         
 	for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++)
 	{
@@ -1297,7 +1919,25 @@ unsigned int static KimotoGravityWell(const CBlockIndex* pindexLast, const CBloc
 		PastBlocksMass++;
                 
 		if (i == 1) { PastDifficultyAverage.SetCompact(BlockReading->nBits); }
-		else { PastDifficultyAverage = ((CBigNum().SetCompact(BlockReading->nBits) - PastDifficultyAveragePrev) / i) + PastDifficultyAveragePrev; }
+		else
+		{
+			// (Current - Prev) / i + Prev, where the division truncates towards zero
+			// like it did with CBigNum, also when Current is the smaller one
+			uint256 bnReading;
+			bnReading.SetCompact(BlockReading->nBits);
+			if (bnReading >= PastDifficultyAveragePrev)
+			{
+				PastDifficultyAverage = bnReading - PastDifficultyAveragePrev;
+				PastDifficultyAverage /= uint256(i);
+				PastDifficultyAverage += PastDifficultyAveragePrev;
+			}
+			else
+			{
+				PastDifficultyAverage = PastDifficultyAveragePrev - bnReading;
+				PastDifficultyAverage /= uint256(i);
+				PastDifficultyAverage = PastDifficultyAveragePrev - PastDifficultyAverage;
+			}
+		}
 		PastDifficultyAveragePrev = PastDifficultyAverage;
                 
 		PastRateActualSeconds = BlockLastSolved->GetBlockTime() - BlockReading->GetBlockTime();
@@ -1320,21 +1960,31 @@ unsigned int static KimotoGravityWell(const CBlockIndex* pindexLast, const CBloc
 		BlockReading = BlockReading->pprev;
 	}
         
-	CBigNum bnNew(PastDifficultyAverage);
+	uint256 bnNew(PastDifficultyAverage);
 	if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0)
 	{
-		bnNew *= PastRateActualSeconds;
-		bnNew /= PastRateTargetSeconds;
+		// A product that does not fit in 256 bits divided by PastRateTargetSeconds
+		// (below 2^19) is far above the limit, where it would be capped anyway
+		uint256 bnMaxFactor = ~uint256(0);
+		bnMaxFactor /= uint256(PastRateActualSeconds);
+		if (bnNew > bnMaxFactor)
+			bnNew = bnPowLimit;
+		else
+		{
+			bnNew *= uint256(PastRateActualSeconds);
+			bnNew /= uint256(PastRateTargetSeconds);
+		}
 	}
-    if (bnNew > bnProofOfWorkLimit) { bnNew = bnProofOfWorkLimit; }
+    if (bnNew > bnPowLimit) { bnNew = bnPowLimit; }
         
     /// debug print
     printf("Difficulty Retarget - Kimoto Gravity Well RETARGET\n");
     printf("PastRateAdjustmentRatio = %g\n", PastRateAdjustmentRatio);
-    printf("Before: %08x  %s\n", BlockLastSolved->nBits, CBigNum().SetCompact(BlockLastSolved->nBits).getuint256().ToString().c_str());
-    printf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.getuint256().ToString().c_str());
-        
-	return bnNew.GetCompact();
+    printf("Before: %08x  %s\n", BlockLastSolved->nBits, uint256().SetCompact(BlockLastSolved->nBits).ToString().c_str());
+    printf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString().c_str());
+
+	const_cast<CBlockIndex*>(BlockLastSolved)->nBitsNextKGW = bnNew.GetCompact();
+	return BlockLastSolved->nBitsNextKGW;
 }
 
 unsigned int static GetNextWorkRequired_V2(const CBlockIndex* pindexLast, const CBlockHeader *pblock)
@@ -1400,25 +2050,25 @@ unsigned int static DigiShield(const CBlockIndex* pindexLast, const CBlockHeader
 
 
 
-    CBigNum bnNew;
+    uint256 bnNew;
     bnNew.SetCompact(pindexLast->nBits);
     
     if (nActualTimespan < (retargetTimespan - (retargetTimespan/4)) ) nActualTimespan = (retargetTimespan - (retargetTimespan/4));
     if (nActualTimespan > (retargetTimespan + (retargetTimespan/2)) ) nActualTimespan = (retargetTimespan + (retargetTimespan/2));
 
     // Retarget
-    bnNew *= nActualTimespan;
-    bnNew /= retargetTimespan;
+    bnNew *= uint256(nActualTimespan);
+    bnNew /= uint256(retargetTimespan);
     
     /// debug print
     printf("DigiShield RETARGET \n");
     printf("retargetTimespan = %" PRI64d "    nActualTimespan = %" PRI64d "\n", retargetTimespan, nActualTimespan);
-    printf("Before: %08x  %s\n", pindexLast->nBits, CBigNum().SetCompact(pindexLast->nBits).getuint256().ToString().c_str());
-    printf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.getuint256().ToString().c_str());
+    printf("Before: %08x  %s\n", pindexLast->nBits, uint256().SetCompact(pindexLast->nBits).ToString().c_str());
+    printf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString().c_str());
     
 
-    if (bnNew > bnProofOfWorkLimit)
-        bnNew = bnProofOfWorkLimit;
+    if (bnNew > bnProofOfWorkLimit.getuint256())
+        bnNew = bnProofOfWorkLimit.getuint256();
 
 
 
@@ -1481,6 +2131,177 @@ bool IsInitialBlockDownload()
             pindexBest->GetBlockTime() < GetTime() - 24 * 60 * 60);
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Header index
+//
+
+// Find the index entry of a block, whether we have its data or only its header
+CBlockIndex static *LookupBlockIndex(const uint256 &hash)
+{
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    if (mi != mapBlockIndex.end())
+        return (*mi).second;
+    mi = mapHeaderIndex.find(hash);
+    if (mi != mapHeaderIndex.end())
+        return (*mi).second;
+    return NULL;
+}
+
+// Make pindexNew the tip of the header chain, and line up its missing blocks for download
+void static SetBestHeader(CBlockIndex *pindexNew)
+{
+    if (pindexNew == NULL || (pindexNew->nStatus & BLOCK_HAVE_DATA))
+        dequeBlocksToDownload.clear();
+    else if (pindexBestHeader != NULL && pindexNew->pprev == pindexBestHeader)
+        dequeBlocksToDownload.push_back(pindexNew);
+    else
+    {
+        // Switched branches; header-only entries only ever descend from each other
+        dequeBlocksToDownload.clear();
+        for (CBlockIndex *pindex = pindexNew; pindex && !(pindex->nStatus & BLOCK_HAVE_DATA); pindex = pindex->pprev)
+            dequeBlocksToDownload.push_front(pindex);
+    }
+    pindexBestHeader = pindexNew;
+}
+
+CBlockIndex static *GetBestHeader()
+{
+    if (pindexBestHeader == NULL || (pindexBest && pindexBest->nChainWork > pindexBestHeader->nChainWork))
+        SetBestHeader(pindexBest);
+    return pindexBestHeader;
+}
+
+int GetBestHeaderHeight()
+{
+    LOCK(cs_main);
+    CBlockIndex *pindex = GetBestHeader();
+    return pindex ? pindex->nHeight : -1;
+}
+
+// Hand the place of a header-only entry over to the full entry of its block
+void static ReplaceHeaderIndex(CBlockIndex *pindexNew)
+{
+    uint256 hash = pindexNew->GetBlockHash();
+    map<uint256, CBlockIndex*>::iterator mi = mapHeaderIndex.find(hash);
+    if (mi != mapHeaderIndex.end())
+    {
+        CBlockIndex *pindexHeader = (*mi).second;
+        for (multimap<uint256, CBlockIndex*>::iterator it = mapHeaderIndexByPrev.lower_bound(hash);
+             it != mapHeaderIndexByPrev.upper_bound(hash); ++it)
+            (*it).second->pprev = pindexNew;
+
+        uint256 hashPrev = pindexNew->pprev ? pindexNew->pprev->GetBlockHash() : 0;
+        for (multimap<uint256, CBlockIndex*>::iterator it = mapHeaderIndexByPrev.lower_bound(hashPrev);
+             it != mapHeaderIndexByPrev.upper_bound(hashPrev); ++it)
+        {
+            if ((*it).second == pindexHeader)
+            {
+                mapHeaderIndexByPrev.erase(it);
+                break;
+            }
+        }
+
+        // Its parent has a full entry, so if it is to be downloaded it is first in line
+        if (!dequeBlocksToDownload.empty() && dequeBlocksToDownload.front() == pindexHeader)
+            dequeBlocksToDownload.pop_front();
+        if (pindexBestHeader == pindexHeader)
+            pindexBestHeader = pindexNew;
+
+        mapHeaderIndex.erase(mi);
+        delete pindexHeader;
+    }
+
+    if (pindexBestHeader == NULL || pindexNew->nChainWork > pindexBestHeader->nChainWork)
+        SetBestHeader(pindexNew);
+}
+
+// Mark the headers that build on a failed block, and fall back to the best chain of headers left
+void static InvalidateHeaders(CBlockIndex *pindexFailed)
+{
+    vector<uint256> vWorkQueue;
+    vWorkQueue.push_back(pindexFailed->GetBlockHash());
+    for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+    {
+        uint256 hashPrev = vWorkQueue[i];
+        for (multimap<uint256, CBlockIndex*>::iterator it = mapHeaderIndexByPrev.lower_bound(hashPrev);
+             it != mapHeaderIndexByPrev.upper_bound(hashPrev); ++it)
+        {
+            (*it).second->nStatus |= BLOCK_FAILED_CHILD;
+            vWorkQueue.push_back((*it).second->GetBlockHash());
+        }
+    }
+
+    CBlockIndex *pindexNewBest = pindexBest;
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CBlockIndex*)& item, mapHeaderIndex)
+    {
+        CBlockIndex *pindex = item.second;
+        if (!(pindex->nStatus & BLOCK_FAILED_MASK) && (pindexNewBest == NULL || pindex->nChainWork > pindexNewBest->nChainWork))
+            pindexNewBest = pindex;
+    }
+    pindexBestHeader = NULL;
+    SetBestHeader(pindexNewBest);
+}
+
+// Validate a header received ahead of its block, and add it to the header index
+bool static AcceptBlockHeader(CValidationState &state, CBlockHeader &block, CBlockIndex **ppindex)
+{
+    uint256 hash = block.GetHash();
+    CBlockIndex *pindex = LookupBlockIndex(hash);
+    if (pindex)
+    {
+        if (pindex->nStatus & BLOCK_FAILED_MASK)
+            return state.Invalid(error("AcceptBlockHeader() : block %s is marked invalid", hash.ToString().c_str()));
+        *ppindex = pindex;
+        return true;
+    }
+
+    // The checks CheckBlock and AcceptBlock do on the header
+    if (!CheckProofOfWork(block.GetPoWHash(), block.nBits))
+        return state.DoS(50, error("AcceptBlockHeader() : proof of work failed"));
+
+    if (block.GetBlockTime() > GetAdjustedTime() + 2 * 60 * 60)
+        return state.Invalid(error("AcceptBlockHeader() : block timestamp too far in the future"));
+
+    CBlockIndex *pindexPrev = LookupBlockIndex(block.hashPrevBlock);
+    if (pindexPrev == NULL)
+        return state.DoS(10, error("AcceptBlockHeader() : prev block not found"));
+    if (pindexPrev->nStatus & BLOCK_FAILED_MASK)
+        return state.DoS(100, error("AcceptBlockHeader() : prev block invalid"));
+    int nHeight = pindexPrev->nHeight + 1;
+
+    if (block.nBits != GetNextWorkRequired(pindexPrev, &block))
+        return state.DoS(100, error("AcceptBlockHeader() : incorrect proof of work"));
+
+    if (block.GetBlockTime() <= pindexPrev->GetMedianTimePast())
+        return state.Invalid(error("AcceptBlockHeader() : block's timestamp is too early"));
+
+    if (!Checkpoints::CheckBlock(nHeight, hash))
+        return state.DoS(100, error("AcceptBlockHeader() : rejected by checkpoint lock-in at %d", nHeight));
+
+    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+    if (pcheckpoint && nHeight < pcheckpoint->nHeight)
+        return state.DoS(100, error("AcceptBlockHeader() : forked chain older than last checkpoint (height %d)", nHeight));
+
+    CBlockIndex* pindexNew = new CBlockIndex(block);
+    assert(pindexNew);
+    map<uint256, CBlockIndex*>::iterator mi = mapHeaderIndex.insert(make_pair(hash, pindexNew)).first;
+    pindexNew->phashBlock = &((*mi).first);
+    pindexNew->pprev = pindexPrev;
+    pindexNew->nHeight = nHeight;
+    pindexNew->nChainWork = pindexPrev->nChainWork + pindexNew->GetBlockWork().getuint256();
+    pindexNew->nStatus = BLOCK_VALID_TREE;
+    pindexNew->SetPoWHash(block.GetPoWHash());
+    mapHeaderIndexByPrev.insert(make_pair(block.hashPrevBlock, pindexNew));
+
+    CBlockIndex *pindexBestSoFar = GetBestHeader();
+    if (pindexBestSoFar == NULL || pindexNew->nChainWork > pindexBestSoFar->nChainWork)
+        SetBestHeader(pindexNew);
+
+    *ppindex = pindexNew;
+    return true;
+}
+
 void static InvalidChainFound(CBlockIndex* pindexNew)
 {
     if (pindexNew->nChainWork > nBestInvalidWork)
@@ -1504,6 +2325,7 @@ void static InvalidBlockFound(CBlockIndex *pindex) {
     pindex->nStatus |= BLOCK_FAILED_VALID;
     pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex));
     setBlockIndexValid.erase(pindex);
+    InvalidateHeaders(pindex);
     InvalidChainFound(pindex);
     if (pindex->pnext) {
         CValidationState stateDummy;
@@ -1584,7 +2406,7 @@ void CBlockHeader::UpdateTime(const CBlockIndex* pindexPrev)
 
 const CTxOut &CTransaction::GetOutputFor(const CTxIn& input, CCoinsViewCache& view)
 {
-    const CCoins &coins = view.GetCoins(input.prevout.hash);
+    const CCoins &coins = view.AccessCoins(input.prevout.hash);
     assert(coins.IsAvailable(input.prevout.n));
     return coins.vout[input.prevout.n];
 }
@@ -1645,7 +2467,7 @@ bool CTransaction::HaveInputs(CCoinsViewCache &inputs) const
         // then check whether the actual outputs are available
         for (unsigned int i = 0; i < vin.size(); i++) {
             const COutPoint &prevout = vin[i].prevout;
-            const CCoins &coins = inputs.GetCoins(prevout.hash);
+            const CCoins &coins = inputs.AccessCoins(prevout.hash);
             if (!coins.IsAvailable(prevout.n))
                 return false;
         }
@@ -1685,7 +2507,7 @@ bool CTransaction::CheckInputs(CValidationState &state, CCoinsViewCache &inputs,
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             const COutPoint &prevout = vin[i].prevout;
-            const CCoins &coins = inputs.GetCoins(prevout.hash);
+            const CCoins &coins = inputs.AccessCoins(prevout.hash);
 
             // If prev is coinbase, check that it's matured
             if (coins.IsCoinBase()) {
@@ -1721,7 +2543,7 @@ bool CTransaction::CheckInputs(CValidationState &state, CCoinsViewCache &inputs,
         if (fScriptChecks) {
             for (unsigned int i = 0; i < vin.size(); i++) {
                 const COutPoint &prevout = vin[i].prevout;
-                const CCoins &coins = inputs.GetCoins(prevout.hash);
+                const CCoins &coins = inputs.AccessCoins(prevout.hash);
 
                 // Verify signature
                 CScriptCheck check(coins, *this, i, flags, 0);
@@ -1835,12 +2657,28 @@ bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoin
     }
 }
 
+boost::filesystem::path static GetDiskFilePath(const CDiskBlockPos &pos, const char *prefix)
+{
+    return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
+}
+
+// Block and undo files are read through mappings kept open between reads.
+// Address space is scarce in a 32-bit process, so fewer are kept there.
+static CMappedFilePool mappedBlockFiles(sizeof(void*) > 4 ? 256 : 8);
+
 void static FlushBlockFile(bool fFinalize = false)
 {
     LOCK(cs_LastBlockFile);
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
+    // Mappings can't reach past the end of a truncated file
+    if (fFinalize)
+    {
+        mappedBlockFiles.Release(GetDiskFilePath(posOld, "blk"));
+        mappedBlockFiles.Release(GetDiskFilePath(posOld, "rev"));
+    }
+
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
@@ -1867,6 +2705,15 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+void GetScriptCheckStats(CCheckQueueStats &stats) {
+    scriptcheckqueue.GetStats(stats);
+}
+
+void ThreadCoinsPrefetch() {
+    RenameThread("bitcoin-prefetch");
+    pcoinsPrefetch->Thread();
+}
+
 bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsViewCache &view, bool fJustCheck)
 {
     // Check it again in case a previous version let a bad block in
@@ -1902,7 +2749,7 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
     if (fEnforceBIP30) {
         for (unsigned int i=0; i<vtx.size(); i++) {
             uint256 hash = GetTxHash(i);
-            if (view.HaveCoins(hash) && !view.GetCoins(hash).IsPruned())
+            if (view.HaveCoins(hash) && !view.AccessCoins(hash).IsPruned())
                 return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"));
         }
     }
@@ -1919,6 +2766,7 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64 nStart = GetTimeMicros();
+    int64 nTimeFetch = 0;
     int64 nFees = 0;
     int nInputs = 0;
     unsigned int nSigOps = 0;
@@ -1936,8 +2784,11 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
 
         if (!tx.IsCoinBase())
         {
+            // The first lookup brings the inputs into view, from disk if necessary
+            int64 nFetchStart = GetTimeMicros();
             if (!tx.HaveInputs(view))
                 return state.DoS(100, error("ConnectBlock() : inputs missing/spent"));
+            nTimeFetch += GetTimeMicros() - nFetchStart;
 
             if (fStrictPayToScriptHash)
             {
@@ -1967,7 +2818,16 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
     }
     int64 nTime = GetTimeMicros() - nStart;
     if (fBenchmark)
+    {
         printf("- Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin)\n", (unsigned)vtx.size(), 0.001 * nTime, 0.001 * nTime / vtx.size(), nInputs <= 1 ? 0 : 0.001 * nTime / (nInputs-1));
+        printf("- Fetch inputs: %.2fms\n", 0.001 * nTimeFetch);
+        if (pcoinsPrefetch)
+        {
+            unsigned int nRead, nHit, nMiss;
+            pcoinsPrefetch->GetStatistics(nRead, nHit, nMiss);
+            printf("- Prefetch: %u read ahead, %u used, %u read on demand\n", nRead, nHit, nMiss);
+        }
+    }
 
     if (vtx[0].GetValueOut() > GetBlockValue(pindex->nHeight, nFees))
         return state.DoS(100, error("ConnectBlock() : coinbase pays too much (actual=%" PRI64d " vs limit=%" PRI64d ")", vtx[0].GetValueOut(), GetBlockValue(pindex->nHeight, nFees)));
@@ -2106,7 +2966,7 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
 
     // Make sure it's successfully written to disk before changing memory structure
     bool fIsInitialDownload = IsInitialBlockDownload();
-    if (!fIsInitialDownload || pcoinsTip->GetCacheSize() > nCoinCacheSize) {
+    if (!fIsInitialDownload || pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) {
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
@@ -2127,6 +2987,8 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
     BOOST_FOREACH(CBlockIndex* pindex, vDisconnect)
         if (pindex->pprev)
             pindex->pprev->pnext = NULL;
+    BOOST_FOREACH(CBlockIndex* pindex, vDisconnect)
+        DisconnectedBlock(pindex->GetBlockHash());
 
     // Connect longer branch
     BOOST_FOREACH(CBlockIndex* pindex, vConnect)
@@ -2193,6 +3055,9 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
         boost::thread t(runCommand, strCmd); // thread runs free
     }
 
+    if (!fIsInitialDownload)
+        uiInterface.NotifyBestBlockChanged(hashBestChain);
+
     return true;
 }
 
@@ -2222,7 +3087,10 @@ bool CBlock::AddToBlockIndex(CValidationState &state, const CDiskBlockPos &pos)
     pindexNew->nDataPos = pos.nPos;
     pindexNew->nUndoPos = 0;
     pindexNew->nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA;
+    pindexNew->SetPoWHash(GetPoWHash());
+    pindexNew->SetMoneySupply(GetChainMoneySupply(pindexNew));
     setBlockIndexValid.insert(pindexNew);
+    ReplaceHeaderIndex(pindexNew);
 
     if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindexNew)))
         return state.Abort(_("Failed to write block index"));
@@ -2507,6 +3375,33 @@ bool CBlockIndex::IsSuperMajority(int minVersion, const CBlockIndex* pstart, uns
     return (nFound >= nRequired);
 }
 
+// Keep the number of orphan blocks bounded, by dropping random ones that no other orphan builds on
+void static PruneOrphanBlocks()
+{
+    while (mapOrphanBlocks.size() > MAX_ORPHAN_BLOCKS)
+    {
+        map<uint256, CBlock*>::iterator it = mapOrphanBlocks.lower_bound(GetRandHash());
+        if (it == mapOrphanBlocks.end())
+            it = mapOrphanBlocks.begin();
+        multimap<uint256, CBlock*>::iterator itChild;
+        while ((itChild = mapOrphanBlocksByPrev.find((*it).first)) != mapOrphanBlocksByPrev.end())
+            it = mapOrphanBlocks.find((*itChild).second->GetHash());
+
+        CBlock* pblock = (*it).second;
+        for (multimap<uint256, CBlock*>::iterator mi = mapOrphanBlocksByPrev.lower_bound(pblock->hashPrevBlock);
+             mi != mapOrphanBlocksByPrev.upper_bound(pblock->hashPrevBlock); ++mi)
+        {
+            if ((*mi).second == pblock)
+            {
+                mapOrphanBlocksByPrev.erase(mi);
+                break;
+            }
+        }
+        mapOrphanBlocks.erase(it);
+        delete pblock;
+    }
+}
+
 bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp)
 {
     // Check for duplicate
@@ -2520,6 +3415,15 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
     if (!pblock->CheckBlock(state))
         return error("ProcessBlock() : CheckBlock FAILED");
 
+    // Start reading its inputs while earlier blocks are still being connected
+    if (pcoinsPrefetch)
+    {
+        int64 nStart = GetTimeMicros();
+        unsigned int nQueued = pcoinsPrefetch->Prefetch(*pblock, *pcoinsTip);
+        if (fBenchmark)
+            printf("- Prefetch %u input transactions: %.2fms\n", nQueued, 0.001 * (GetTimeMicros() - nStart));
+    }
+
     CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
     if (pcheckpoint && pblock->hashPrevBlock != hashBestChain)
     {
@@ -2551,8 +3455,10 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
             mapOrphanBlocks.insert(make_pair(hash, pblock2));
             mapOrphanBlocksByPrev.insert(make_pair(pblock2->hashPrevBlock, pblock2));
 
-            // Ask this guy to fill in what we're missing
-            pfrom->PushGetBlocks(pindexBest, GetOrphanRoot(pblock2));
+            // Ask this guy for the headers of what we're missing, unless its parents are already being downloaded
+            if (!mapHeaderIndex.count(hash))
+                pfrom->PushMessage("getheaders", CBlockLocator(GetBestHeader()), GetOrphanRoot(pblock2));
+            PruneOrphanBlocks();
         }
         return true;
     }
@@ -2773,7 +3679,7 @@ FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly)
 {
     if (pos.IsNull())
         return NULL;
-    boost::filesystem::path path = GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
+    boost::filesystem::path path = GetDiskFilePath(pos, prefix);
     boost::filesystem::create_directories(path.parent_path());
     FILE* file = fopen(path.string().c_str(), "rb+");
     if (!file && !fReadOnly)
@@ -2800,6 +3706,43 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
     return OpenDiskFile(pos, "rev", fReadOnly);
 }
 
+bool static MapDiskRecord(const CDiskBlockPos &pos, const char *prefix, unsigned int nTrailer, CDiskRecord &record)
+{
+    // Records are preceded by the network magic and their size
+    if (pos.IsNull() || pos.nPos < 8)
+        return false;
+    boost::filesystem::path path = GetDiskFilePath(pos, prefix);
+    boost::shared_ptr<const CMappedFile> file = mappedBlockFiles.Get(path, pos.nPos);
+    if (!file)
+        return false;
+    const char* pheader = file->begin() + pos.nPos - 8;
+    if (memcmp(pheader, pchMessageStart, sizeof(pchMessageStart)) != 0)
+        return false;
+    unsigned int nSize;
+    memcpy(&nSize, pheader + 4, sizeof(nSize));
+
+    // The file may have grown since it was mapped
+    uint64 nEnd = (uint64)pos.nPos + nSize + nTrailer;
+    if (nEnd > file->size())
+    {
+        file = mappedBlockFiles.Get(path, nEnd);
+        if (!file)
+            return false;
+    }
+    record.file = file;
+    record.pbegin = file->begin() + pos.nPos;
+    record.pend = record.pbegin + nSize + nTrailer;
+    return true;
+}
+
+bool MapBlockRecord(const CDiskBlockPos &pos, CDiskRecord &record) {
+    return MapDiskRecord(pos, "blk", 0, record);
+}
+
+bool MapUndoRecord(const CDiskBlockPos &pos, CDiskRecord &record) {
+    return MapDiskRecord(pos, "rev", sizeof(uint256), record);
+}
+
 CBlockIndex * InsertBlockIndex(uint256 hash)
 {
     if (hash == 0)
@@ -2841,6 +3784,9 @@ bool static LoadBlockIndexDB()
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWork().getuint256();
         pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
+        // Entries written before the supply was stored get it on their next write
+        if (!(pindex->nStatus & BLOCK_HAVE_SUPPLY))
+            pindex->SetMoneySupply(GetChainMoneySupply(pindex));
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS && !(pindex->nStatus & BLOCK_FAILED_MASK))
             setBlockIndexValid.insert(pindex);
     }
@@ -2926,7 +3872,7 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= 2*nCoinCacheSize + 32000) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= 2*nCoinCacheUsage) {
             bool fClean = true;
             if (!block.DisconnectBlock(state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
@@ -2970,6 +3916,12 @@ void UnloadBlockIndex()
     nBestInvalidWork = 0;
     hashBestChain = 0;
     pindexBest = NULL;
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CBlockIndex*)& item, mapHeaderIndex)
+        delete item.second;
+    mapHeaderIndex.clear();
+    mapHeaderIndexByPrev.clear();
+    dequeBlocksToDownload.clear();
+    pindexBestHeader = NULL;
 }
 
 bool LoadBlockIndex()
@@ -3334,6 +4286,122 @@ string GetWarnings(string strFor)
 //
 
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Block download
+//
+
+// A block requested from a peer; it holds a reference to the node until it is done
+struct CBlockRequest
+{
+    CNode* pnode;
+    int64 nTime;
+};
+map<uint256, CBlockRequest> mapBlocksInFlight;
+
+// Current stalling timeout, see BLOCK_STALLING_TIMEOUT
+int64 nBlockStallingTimeout = BLOCK_STALLING_TIMEOUT;
+
+void MarkBlockAsInFlight(CNode* pnode, const uint256 &hash)
+{
+    CBlockRequest &request = mapBlocksInFlight[hash];
+    request.pnode = pnode;
+    request.nTime = GetTime();
+    pnode->AddRef();
+    pnode->nBlocksInFlight++;
+}
+
+// Compact blocks waiting for the transactions asked for with 'getblocktxn',
+// from the peer the block is in flight from
+map<uint256, CPartialBlock> mapPartialBlocks;
+
+// Forget the request for a block, if there was one
+void MarkBlockAsReceived(const uint256 &hash)
+{
+    mapPartialBlocks.erase(hash);
+    map<uint256, CBlockRequest>::iterator it = mapBlocksInFlight.find(hash);
+    if (it == mapBlocksInFlight.end())
+        return;
+    CNode* pnode = (*it).second.pnode;
+    pnode->nBlocksInFlight--;
+    pnode->nStallingSince = 0;
+    pnode->Release();
+    mapBlocksInFlight.erase(it);
+}
+
+// Disconnect peers that held up the download window for too long, and give the
+// requests of disconnected peers, or that were not answered in time, to others
+void CheckBlocksInFlight()
+{
+    int64 nNow = GetTime();
+    map<uint256, CBlockRequest>::iterator it = mapBlocksInFlight.begin();
+    while (it != mapBlocksInFlight.end())
+    {
+        CNode* pnode = (*it).second.pnode;
+        if (!pnode->fDisconnect && pnode->nStallingSince && nNow - pnode->nStallingSince > nBlockStallingTimeout)
+        {
+            printf("peer %s is stalling block download, disconnecting\n", pnode->addr.ToString().c_str());
+            pnode->fDisconnect = true;
+            // if the next peer is slow too, the network may just be slow
+            nBlockStallingTimeout = min(nBlockStallingTimeout * 2, BLOCK_STALLING_TIMEOUT_MAX);
+        }
+        uint256 hash = (*it).first;
+        bool fDrop = pnode->fDisconnect || nNow - (*it).second.nTime > BLOCK_DOWNLOAD_TIMEOUT;
+        it++;
+        if (fDrop)
+            MarkBlockAsReceived(hash);
+    }
+}
+
+// Near the tip most transactions of a new block are in our memory pool
+// already, so ask peers that can send compact blocks for one
+int static GetBlockRequestType(CNode* pto)
+{
+    if (pto->nVersion >= COMPACT_BLOCKS_VERSION && !IsInitialBlockDownload())
+        return MSG_CMPCT_BLOCK;
+    return MSG_BLOCK;
+}
+
+// Request blocks from the start of the download window that nobody else is
+// fetching, until the peer's share of requests is used up
+void FindBlocksToDownload(CNode* pto, vector<CInv> &vGetData)
+{
+    if (pto->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER || dequeBlocksToDownload.empty())
+        return;
+
+    // Until it tells us otherwise, assume a peer has the blocks up to the height it started with
+    int nPeerHeight = max(pto->nStartingHeight, pto->nBestKnownHeight);
+    unsigned int nWindow = min((unsigned int)dequeBlocksToDownload.size(), BLOCK_DOWNLOAD_WINDOW);
+    for (unsigned int i = 0; i < nWindow; i++)
+    {
+        CBlockIndex* pindex = dequeBlocksToDownload[i];
+        if (pindex->nHeight > nPeerHeight)
+            return;
+        uint256 hash = pindex->GetBlockHash();
+        if (mapOrphanBlocks.count(hash) || mapBlocksInFlight.count(hash))
+            continue;
+        vGetData.push_back(CInv(GetBlockRequestType(pto), hash));
+        MarkBlockAsInFlight(pto, hash);
+        if (pto->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER)
+            return;
+    }
+
+    // Everything in the window is received or requested and this peer could
+    // take more: whoever has the first block of the window holds everyone up
+    if (nWindow == BLOCK_DOWNLOAD_WINDOW)
+    {
+        map<uint256, CBlockRequest>::iterator it = mapBlocksInFlight.find(dequeBlocksToDownload.front()->GetBlockHash());
+        if (it != mapBlocksInFlight.end() && (*it).second.pnode != pto && (*it).second.pnode->nStallingSince == 0)
+        {
+            (*it).second.pnode->nStallingSince = GetTime();
+            if (fDebug)
+                printf("peer %s is holding up block download at height %d\n",
+                       (*it).second.pnode->addr.ToString().c_str(), dequeBlocksToDownload.front()->nHeight);
+        }
+    }
+}
+
+
 bool static AlreadyHave(const CInv& inv)
 {
     switch (inv.type)
@@ -3365,6 +4433,72 @@ bool static AlreadyHave(const CInv& inv)
 unsigned char pchMessageStart[4] = { 0xfa, 0xc3, 0xb6, 0xda }; // CasinoCoin
 
 
+//
+// Raw block serving
+//
+
+// Recently served blocks as complete 'block' messages, most recent first.
+// Peers in initial download tend to ask for the same stretch of blocks.
+typedef list<pair<uint256, boost::shared_ptr<const CSerializeData> > > RawBlockList;
+static RawBlockList listRawBlocks;
+static map<uint256, RawBlockList::iterator> mapRawBlocks;
+static size_t nRawBlockCacheSize = 0;
+static CCriticalSection cs_RawBlocks;
+
+// The 'block' message for a block, copied from its block file rather than
+// deserialized and serialized again
+boost::shared_ptr<const CSerializeData> static GetRawBlockMessage(const CBlockIndex* pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    {
+        LOCK(cs_RawBlocks);
+        map<uint256, RawBlockList::iterator>::iterator mi = mapRawBlocks.find(hash);
+        if (mi != mapRawBlocks.end())
+        {
+            listRawBlocks.splice(listRawBlocks.begin(), listRawBlocks, mi->second);
+            return mi->second->second;
+        }
+    }
+
+    boost::shared_ptr<const CSerializeData> pmsg;
+    CDiskRecord record;
+    if (!MapBlockRecord(pindex->GetBlockPos(), record))
+        return pmsg;
+    // Only the header is checked, as on the ReadFromDisk path: the transactions
+    // were checked against the merkle root when the block was accepted
+    size_t nSize = record.pend - record.pbegin;
+    if (nSize < 80 || Hash(record.pbegin, record.pbegin + 80) != hash)
+    {
+        printf("GetRawBlockMessage() : block %s on disk doesn't match its index\n", hash.ToString().c_str());
+        return pmsg;
+    }
+
+    uint256 hashPayload = Hash(record.pbegin, record.pend);
+    CMessageHeader header("block", nSize);
+    memcpy(&header.nChecksum, &hashPayload, sizeof(header.nChecksum));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(CMessageHeader::HEADER_SIZE + nSize);
+    ss << header;
+    ss.write(record.pbegin, nSize);
+    CSerializeData* pdata = new CSerializeData();
+    ss.GetAndClear(*pdata);
+    pmsg.reset(pdata);
+
+    LOCK(cs_RawBlocks);
+    if (mapRawBlocks.count(hash))
+        return pmsg;
+    listRawBlocks.push_front(make_pair(hash, pmsg));
+    mapRawBlocks[hash] = listRawBlocks.begin();
+    nRawBlockCacheSize += pmsg->size();
+    while (nRawBlockCacheSize > MAX_RAW_BLOCK_CACHE_SIZE && listRawBlocks.size() > 1)
+    {
+        nRawBlockCacheSize -= listRawBlocks.back().second->size();
+        mapRawBlocks.erase(listRawBlocks.back().first);
+        listRawBlocks.pop_back();
+    }
+    return pmsg;
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -3387,7 +4521,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = true;
                 map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
@@ -3412,11 +4546,27 @@ void static ProcessGetData(CNode* pfrom)
                 {
                     // Send block from disk
                     CBlock block;
-                    block.ReadFromDisk((*mi).second);
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    // Compact blocks only help with blocks the peer's memory pool still has the transactions of
+                    bool fCompact = inv.type == MSG_CMPCT_BLOCK && ((*mi).second)->nHeight >= nBestHeight - MAX_CMPCTBLOCK_DEPTH;
+                    if (fCompact)
+                    {
+                        if (block.ReadFromDisk((*mi).second))
+                            pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+                    }
+                    else if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK)
+                    {
+                        boost::shared_ptr<const CSerializeData> pmsg = GetRawBlockMessage((*mi).second);
+                        if (pmsg)
+                            pfrom->PushSerializedMessage(*pmsg);
+                        else
+                        {
+                            block.ReadFromDisk((*mi).second);
+                            pfrom->PushMessage("block", block);
+                        }
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        block.ReadFromDisk((*mi).second);
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
@@ -3520,6 +4670,23 @@ bool static CheckValidClientVersion(int clientVersion)
     }
 }
 
+// Hand a block received from a peer, in full or rebuilt, to ProcessBlock
+void static ProcessReceivedBlock(CNode* pfrom, CBlock &block)
+{
+    CInv inv(MSG_BLOCK, block.GetHash());
+    pfrom->AddInventoryKnown(inv);
+    MarkBlockAsReceived(inv.hash);
+    nBlockStallingTimeout = max(BLOCK_STALLING_TIMEOUT, nBlockStallingTimeout * 15 / 16);
+
+    CValidationState state;
+    if (ProcessBlock(state, pfrom, &block) || state.CorruptionPossible())
+        mapAlreadyAskedFor.erase(inv);
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+        if (nDoS > 0)
+            pfrom->Misbehaving(nDoS);
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 {
     RandAddSeedPerfmon();
@@ -3745,11 +4912,27 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             if (fDebug)
                 printf("  got inventory: %s  %s\n", inv.ToString().c_str(), fAlreadyHave ? "have" : "new");
 
-            if (!fAlreadyHave) {
+            if (!fAlreadyHave && inv.type == MSG_BLOCK) {
+                map<uint256, CBlockIndex*>::iterator mi = mapHeaderIndex.find(inv.hash);
+                if (mi != mapHeaderIndex.end()) {
+                    // Already lined up for download, and now we know this peer has it
+                    pfrom->nBestKnownHeight = max(pfrom->nBestKnownHeight, (*mi).second->nHeight);
+                } else if (!fImporting && !fReindex) {
+                    // Get the headers leading up to it. While the header chain is still
+                    // far behind, leave that to the sync node instead of asking everyone.
+                    CBlockIndex *pindexHeaders = GetBestHeader();
+                    bool fHeadersSynced = pindexHeaders && pindexHeaders->GetBlockTime() > GetAdjustedTime() - 24 * 60 * 60;
+                    if (fHeadersSynced)
+                        pfrom->PushMessage("getheaders", CBlockLocator(pindexHeaders), inv.hash);
+                    if (!IsInitialBlockDownload())
+                        pfrom->AskFor(inv);
+                }
+            } else if (!fAlreadyHave) {
                 if (!fImporting && !fReindex)
                     pfrom->AskFor(inv);
             } else if (inv.type == MSG_BLOCK && mapOrphanBlocks.count(inv.hash)) {
-                pfrom->PushGetBlocks(pindexBest, GetOrphanRoot(mapOrphanBlocks[inv.hash]));
+                if (!mapHeaderIndex.count(inv.hash))
+                    pfrom->PushMessage("getheaders", CBlockLocator(GetBestHeader()), GetOrphanRoot(mapOrphanBlocks[inv.hash]));
             } else if (nInv == nLastBlock) {
                 // In case we are on a very long side-chain, it is possible that we already have
                 // the last block in an inv bundle sent in response to getblocks. Try to detect
@@ -3845,7 +5028,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 
         // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
         vector<CBlock> vHeaders;
-        int nLimit = 2000;
+        int nLimit = MAX_HEADERS_RESULTS;
         printf("getheaders %d to %s\n", (pindex ? pindex->nHeight : -1), hashStop.ToString().c_str());
         for (; pindex; pindex = pindex->pnext)
         {
@@ -3857,6 +5040,58 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     }
 
 
+    else if (strCommand == "headers" && !fImporting && !fReindex)
+    {
+        // Sent as blocks without transactions
+        unsigned int nCount = ReadCompactSize(vRecv);
+        if (nCount > MAX_HEADERS_RESULTS)
+        {
+            pfrom->Misbehaving(20);
+            return error("message headers size() = %u", nCount);
+        }
+        vector<CBlockHeader> vHeaders(nCount);
+        for (unsigned int n = 0; n < nCount; n++)
+        {
+            vRecv >> vHeaders[n];
+            ReadCompactSize(vRecv); // transaction count, always 0
+        }
+        if (nCount == 0)
+            return true;
+
+        // They don't connect to ours; ask for the ones in between
+        if (!LookupBlockIndex(vHeaders[0].hashPrevBlock))
+        {
+            pfrom->PushMessage("getheaders", CBlockLocator(GetBestHeader()), uint256(0));
+            return true;
+        }
+
+        CBlockIndex *pindexLast = NULL;
+        BOOST_FOREACH(CBlockHeader& header, vHeaders)
+        {
+            if (pindexLast && header.hashPrevBlock != pindexLast->GetBlockHash())
+            {
+                pfrom->Misbehaving(20);
+                return error("message headers not continuous");
+            }
+            CValidationState state;
+            if (!AcceptBlockHeader(state, header, &pindexLast))
+            {
+                int nDoS = 0;
+                if (state.IsInvalid(nDoS) && nDoS > 0)
+                    pfrom->Misbehaving(nDoS);
+                return error("message headers contains an invalid header");
+            }
+        }
+        pfrom->nBestKnownHeight = max(pfrom->nBestKnownHeight, pindexLast->nHeight);
+        if (fDebug)
+            printf("headers up to %d from %s, best header now %d\n", pindexLast->nHeight, pfrom->addr.ToString().c_str(), GetBestHeader()->nHeight);
+
+        // A full message means the peer has more
+        if (nCount == MAX_HEADERS_RESULTS)
+            pfrom->PushMessage("getheaders", CBlockLocator(pindexLast), uint256(0));
+    }
+
+
     else if (strCommand == "tx")
     {
         vector<uint256> vWorkQueue;
@@ -3946,16 +5181,121 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         printf("received block %s\n", block.GetHash().ToString().c_str());
         // block.print();
 
-        CInv inv(MSG_BLOCK, block.GetHash());
-        pfrom->AddInventoryKnown(inv);
+        ProcessReceivedBlock(pfrom, block);
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex)
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        uint256 hash = cmpctblock.header.GetHash();
+        pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hash));
+
+        // Only rebuild blocks we asked this peer for
+        map<uint256, CBlockRequest>::iterator it = mapBlocksInFlight.find(hash);
+        if (it == mapBlocksInFlight.end() || (*it).second.pnode != pfrom)
+            return true;
+        if (mapBlockIndex.count(hash))
+        {
+            MarkBlockAsReceived(hash);
+            return true;
+        }
 
         CValidationState state;
-        if (ProcessBlock(state, pfrom, &block) || state.CorruptionPossible())
-            mapAlreadyAskedFor.erase(inv);
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-            if (nDoS > 0)
+        CBlockIndex *pindex = NULL;
+        if (!AcceptBlockHeader(state, cmpctblock.header, &pindex))
+        {
+            MarkBlockAsReceived(hash);
+            int nDoS = 0;
+            if (state.IsInvalid(nDoS) && nDoS > 0)
                 pfrom->Misbehaving(nDoS);
+            return error("message cmpctblock has an invalid header");
+        }
+        pfrom->nBestKnownHeight = max(pfrom->nBestKnownHeight, pindex->nHeight);
+
+        CPartialBlock &partial = mapPartialBlocks[hash];
+        vector<unsigned int> vMissing;
+        CBlock block;
+        if (!partial.Init(cmpctblock, mempool))
+        {
+            // Ask for the full block instead, still from this peer
+            mapPartialBlocks.erase(hash);
+            pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, hash)));
+        }
+        else
+        {
+            partial.GetMissing(vMissing);
+            if (fDebug)
+                printf("compact block %s from %s: %" PRIszu " of %u transactions missing\n", hash.ToString().c_str(),
+                       pfrom->addr.ToString().c_str(), vMissing.size(), cmpctblock.BlockTxCount());
+            if (!vMissing.empty())
+            {
+                CBlockTransactionsRequest req;
+                req.blockhash = hash;
+                req.vIndexes = vMissing;
+                pfrom->PushMessage("getblocktxn", req);
+            }
+            else if (partial.FillBlock(block, vector<CTransaction>()))
+                ProcessReceivedBlock(pfrom, block);
+            else
+            {
+                mapPartialBlocks.erase(hash);
+                pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, hash)));
+            }
+        }
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        CBlockTransactionsRequest req;
+        vRecv >> req;
+
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !((*mi).second->nStatus & BLOCK_HAVE_DATA))
+            return true;
+
+        CBlock block;
+        if (!block.ReadFromDisk((*mi).second))
+            return error("getblocktxn : failed to read block %s", req.blockhash.ToString().c_str());
+        CBlockTransactions resp;
+        resp.blockhash = req.blockhash;
+        resp.vtx.reserve(req.vIndexes.size());
+        BOOST_FOREACH(unsigned int nIndex, req.vIndexes)
+        {
+            if (nIndex >= block.vtx.size())
+            {
+                pfrom->Misbehaving(100);
+                return error("message getblocktxn asks for transaction %u of %" PRIszu "", nIndex, block.vtx.size());
+            }
+            resp.vtx.push_back(block.vtx[nIndex]);
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex)
+    {
+        CBlockTransactions resp;
+        vRecv >> resp;
+
+        map<uint256, CPartialBlock>::iterator it = mapPartialBlocks.find(resp.blockhash);
+        map<uint256, CBlockRequest>::iterator itRequest = mapBlocksInFlight.find(resp.blockhash);
+        if (it == mapPartialBlocks.end() || itRequest == mapBlocksInFlight.end() || (*itRequest).second.pnode != pfrom)
+            return true;
+
+        CBlock block;
+        bool fFilled = (*it).second.FillBlock(block, resp.vtx);
+        mapPartialBlocks.erase(it);
+        if (fFilled)
+            ProcessReceivedBlock(pfrom, block);
+        else
+        {
+            // A short id matched the wrong transaction of our memory pool
+            pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash)));
+        }
     }
 
 
@@ -4156,6 +5496,10 @@ bool ProcessMessages(CNode* pfrom)
         // at this point, any failure means we can delete the current message
         it++;
 
+        // Account for the time it waited since it was received
+        pfrom->nProcessDelayTotal += GetTimeMicros() - msg.nTime;
+        pfrom->nMessagesProcessed++;
+
         // Scan for message start
         if (memcmp(msg.hdr.pchMessageStart, pchMessageStart, sizeof(pchMessageStart)) != 0) {
             printf("\n\nPROCESSMESSAGE: INVALID MESSAGESTART\n\n");
@@ -4231,7 +5575,7 @@ bool ProcessMessages(CNode* pfrom)
 
     // In case the connection got shut down, its receive buffer was wiped
     if (!pfrom->fDisconnect)
-        pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
+        pfrom->EraseRecvMsg(it);
 
     return fOk;
 }
@@ -4255,10 +5599,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                 pto->PushMessage("ping");
         }
 
-        // Start block sync
+        // Start block sync: headers first, the blocks are then fetched from all peers
         if (pto->fStartSync && !fImporting && !fReindex) {
             pto->fStartSync = false;
-            pto->PushGetBlocks(pindexBest, uint256(0));
+            pto->PushMessage("getheaders", CBlockLocator(GetBestHeader()), uint256(0));
         }
 
         // Resend wallet transactions that haven't gotten in a block yet
@@ -4382,12 +5726,21 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata
         //
         vector<CInv> vGetData;
+        if (fSendTrickle)
+            CheckBlocksInFlight();
+        if (!pto->fDisconnect && !pto->fClient && !fImporting && !fReindex)
+            FindBlocksToDownload(pto, vGetData);
         int64 nNow = GetTime() * 1000000;
         while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
         {
-            const CInv& inv = (*pto->mapAskFor.begin()).second;
-            if (!AlreadyHave(inv))
+            CInv inv = (*pto->mapAskFor.begin()).second;
+            if (!AlreadyHave(inv) && !(inv.type == MSG_BLOCK && mapBlocksInFlight.count(inv.hash)))
             {
+                if (inv.type == MSG_BLOCK)
+                {
+                    MarkBlockAsInFlight(pto, inv.hash);
+                    inv.type = GetBlockRequestType(pto);
+                }
                 if (fDebugNet)
                     printf("sending getdata: %s\n", inv.ToString().c_str());
                 vGetData.push_back(inv);
@@ -4553,102 +5906,89 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         LOCK2(cs_main, mempool.cs);
         CBlockIndex* pindexPrev = pindexBest;
         CCoinsViewCache view(*pcoinsTip, true);
+        pblocktemplate->nPoolFees = mempool.GetTotalFees();
 
-        // Priority order to process transactions
+        // The pool keeps its transactions in priority and fee rate order, so
+        // walk the order in use; a transaction spending others in the pool
+        // waits until they are in the block, and then competes with the rest
         list<COrphan> vOrphan; // list memory doesn't move
         map<uint256, vector<COrphan*> > mapDependers;
+        set<uint256> setDone;
+        set<uint256> setInBlock;
+        vector<TxPriority> vecReady;
         bool fPrintPriority = GetBoolArg("-printpriority");
 
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+        // Collect transactions into block
+        uint64 nBlockSize = 1000;
+        uint64 nBlockTx = 0;
+        int nBlockSigOps = 100;
+        bool fSortedByFee = (nBlockPrioritySize <= 0);
+        int nConsecutiveFailed = 0;
+
+        TxPriorityCompare comparer(fSortedByFee);
+        const CTxMemPool::indexed_set* psetOrder = fSortedByFee ? &mempool.GetFeeRateOrder() : &mempool.GetPriorityOrder();
+        CTxMemPool::indexed_set::const_reverse_iterator mi = psetOrder->rbegin();
+
+        while (mi != psetOrder->rend() || !vecReady.empty())
         {
-            CTransaction& tx = (*mi).second;
+            // Take the best of the next transaction in pool order and those
+            // whose inputs were just added to the block
+            TxPriority next;
+            if (mi != psetOrder->rend())
+            {
+                CTxMemPoolEntry &entry = mempool.mapTx[mi->second];
+                next = TxPriority(entry.GetPriority(pindexPrev->nHeight), entry.GetFeeRate(), &entry.GetTx());
+            }
+            if (!vecReady.empty() && (mi == psetOrder->rend() || !comparer(vecReady.front(), next)))
+            {
+                next = vecReady.front();
+                std::pop_heap(vecReady.begin(), vecReady.end(), comparer);
+                vecReady.pop_back();
+            }
+            else
+                mi++;
+
+            double dPriority = next.get<0>();
+            double dFeePerKb = next.get<1>();
+            CTransaction& tx = *(next.get<2>());
+            uint256 hash = tx.GetHash();
+            if (setDone.count(hash))
+                continue;
             if (tx.IsCoinBase() || !tx.IsFinal())
+            {
+                setDone.insert(hash);
                 continue;
+            }
 
+            // Has to wait for dependencies
             COrphan* porphan = NULL;
-            double dPriority = 0;
-            int64 nTotalIn = 0;
-            bool fMissingInputs = false;
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
             {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        printf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].vout[txin.prevout.n].nValue;
+                if (!mempool.mapTx.count(txin.prevout.hash) || setInBlock.count(txin.prevout.hash))
                     continue;
+                if (!porphan)
+                {
+                    // Use list for automatic deletion
+                    vOrphan.push_back(COrphan(&tx));
+                    porphan = &vOrphan.back();
+                    porphan->dPriority = dPriority;
+                    porphan->dFeePerKb = dFeePerKb;
                 }
-                const CCoins &coins = view.GetCoins(txin.prevout.hash);
-
-                int64 nValueIn = coins.vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = pindexPrev->nHeight - coins.nHeight + 1;
-
-                dPriority += (double)nValueIn * nConf;
+                mapDependers[txin.prevout.hash].push_back(porphan);
+                porphan->setDependsOn.insert(txin.prevout.hash);
             }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority /= nTxSize;
-
-            // This is a more accurate fee-per-kilobyte than is used by the client code, because the
-            // client code rounds up the size to the nearest 1K. That's good, because it gives an
-            // incentive to create smaller transactions.
-            double dFeePerKb =  double(nTotalIn-tx.GetValueOut()) / (double(nTxSize)/1000.0);
-
             if (porphan)
-            {
-                porphan->dPriority = dPriority;
-                porphan->dFeePerKb = dFeePerKb;
-            }
-            else
-                vecPriority.push_back(TxPriority(dPriority, dFeePerKb, &(*mi).second));
-        }
-
-        // Collect transactions into block
-        uint64 nBlockSize = 1000;
-        uint64 nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                continue;
+            setDone.insert(hash);
 
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            double dFeePerKb = vecPriority.front().get<1>();
-            CTransaction& tx = *(vecPriority.front().get<2>());
+            // The rest pay less still, once past the minimum block size
+            if (fSortedByFee && (dFeePerKb < CTransaction::nMinTxFee) && (nBlockSize >= nBlockMinSize))
+                break;
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+            // Give up once the block is nearly full and nothing fits
+            if (nBlockSize + 4000 > nBlockMaxSize && nConsecutiveFailed > 1000)
+                break;
+            nConsecutiveFailed++;
 
             // Size limits
             unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
@@ -4665,13 +6005,17 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
                 continue;
 
             // Prioritize by fee once past the priority size or we run out of high-priority
-            // transactions:
+            // transactions; what was waiting is found again in fee rate order
             if (!fSortedByFee &&
                 ((nBlockSize + nTxSize >= nBlockPrioritySize) || (dPriority < COIN * 576 / 250)))
             {
                 fSortedByFee = true;
                 comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                psetOrder = &mempool.GetFeeRateOrder();
+                mi = psetOrder->rbegin();
+                vecReady.clear();
+                mapDependers.clear();
+                vOrphan.clear();
             }
 
             if (!tx.HaveInputs(view))
@@ -4683,12 +6027,15 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
             if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
                 continue;
 
+            // Scripts checked as the transaction entered the pool, with stricter
+            // flags, stay valid as long as its inputs exist
+            std::map<uint256, CTxMemPoolEntry>::const_iterator it = mempool.mapTx.find(hash);
+            bool fScriptChecks = (it == mempool.mapTx.end() || !it->second.fScriptsChecked);
             CValidationState state;
-            if (!tx.CheckInputs(state, view, true, SCRIPT_VERIFY_P2SH))
+            if (!tx.CheckInputs(state, view, fScriptChecks, SCRIPT_VERIFY_P2SH))
                 continue;
 
             CTxUndo txundo;
-            uint256 hash = tx.GetHash();
             tx.UpdateCoins(state, view, txundo, pindexPrev->nHeight+1, hash);
 
             // Added
@@ -4699,6 +6046,8 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
             ++nBlockTx;
             nBlockSigOps += nTxSigOps;
             nFees += nTxFees;
+            setInBlock.insert(hash);
+            nConsecutiveFailed = 0;
 
             if (fPrintPriority)
             {
@@ -4716,8 +6065,8 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
                         porphan->setDependsOn.erase(hash);
                         if (porphan->setDependsOn.empty())
                         {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->dFeePerKb, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                            vecReady.push_back(TxPriority(porphan->dPriority, porphan->dFeePerKb, porphan->ptx));
+                            std::push_heap(vecReady.begin(), vecReady.end(), comparer);
                         }
                     }
                 }
@@ -4761,6 +6110,51 @@ CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey)
     return CreateNewBlock(scriptPubKey);
 }
 
+// The block template shared by the mining RPCs
+static CCriticalSection cs_blocktemplate;
+static boost::shared_ptr<const CBlockTemplate> pblocktemplateShared;
+static CBlockIndex* pindexPrevShared = NULL;
+static unsigned int nTransactionsUpdatedShared = 0;
+static CBlockTemplateStats blocktemplatestats;
+
+boost::shared_ptr<const CBlockTemplate> GetSharedBlockTemplate(int64 nMaxAge, CBlockIndex*& pindexPrevRet)
+{
+    LOCK(cs_blocktemplate);
+    blocktemplatestats.nRequests++;
+    if (!pblocktemplateShared || pindexPrevShared != pindexBest ||
+        (nTransactionsUpdated != nTransactionsUpdatedShared && GetTime() - blocktemplatestats.nTimeBuilt > nMaxAge))
+    {
+        // Store the pindexBest used before CreateNewBlock, to avoid races
+        unsigned int nTransactionsUpdatedNew = nTransactionsUpdated;
+        CBlockIndex* pindexPrevNew = pindexBest;
+        int64 nStart = GetTimeMicros();
+
+        CScript scriptDummy = CScript() << OP_TRUE;
+        pblocktemplateShared.reset(CreateNewBlock(scriptDummy));
+        if (!pblocktemplateShared)
+            return pblocktemplateShared;
+        pindexPrevShared = pindexPrevNew;
+        nTransactionsUpdatedShared = nTransactionsUpdatedNew;
+
+        blocktemplatestats.hashPrevBlock = pblocktemplateShared->block.hashPrevBlock;
+        blocktemplatestats.nTimeBuilt = GetTime();
+        blocktemplatestats.nBuildMicros = GetTimeMicros() - nStart;
+        blocktemplatestats.nTx = pblocktemplateShared->block.vtx.size();
+        blocktemplatestats.nBuilds++;
+        if (fBenchmark)
+            printf("GetSharedBlockTemplate() : built template with %u transactions in %.2fms\n",
+                   blocktemplatestats.nTx, 0.001 * blocktemplatestats.nBuildMicros);
+    }
+    pindexPrevRet = pindexPrevShared;
+    return pblocktemplateShared;
+}
+
+void GetBlockTemplateStats(CBlockTemplateStats &stats)
+{
+    LOCK(cs_blocktemplate);
+    stats = blocktemplatestats;
+}
+
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -4873,6 +6267,9 @@ void static CasinoCoinMiner(CWallet *pwallet)
     CReserveKey reservekey(pwallet);
     unsigned int nExtraNonce = 0;
 
+    // Too large for the stack of a thread once several hashes share it
+    std::vector<char> vScratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+
     try { loop {
         while (vNodes.empty())
             MilliSleep(1000);
@@ -4915,23 +6312,37 @@ void static CasinoCoinMiner(CWallet *pwallet)
         {
             unsigned int nHashesDone = 0;
 
-            uint256 thash;
-            char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+            // Hash scrypt_multi_ways consecutive nonces per call
+            const int nWays = scrypt_multi_ways;
+            char pheaders[SCRYPT_MAX_WAYS * 80];
+            uint256 thash[SCRYPT_MAX_WAYS];
+            for (int i = 0; i < nWays; i++)
+                memcpy(pheaders + 80 * i, BEGIN(pblock->nVersion), 80);
+            bool fFound = false;
             loop
             {
-                scrypt_1024_1_1_256_sp(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
+                for (int i = 0; i < nWays; i++)
+                    *(unsigned int*)(pheaders + 80 * i + 76) = pblock->nNonce + i;
+                scrypt_1024_1_1_256_sp_multi(pheaders, BEGIN(thash[0]), &vScratchpad[0]);
 
-                if (thash <= hashTarget)
+                for (int i = 0; i < nWays; i++)
                 {
-                    // Found a solution
-                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                    CheckWork(pblock, *pwallet, reservekey);
-                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-                    break;
+                    if (thash[i] <= hashTarget)
+                    {
+                        // Found a solution
+                        pblock->nNonce += i;
+                        SetThreadPriority(THREAD_PRIORITY_NORMAL);
+                        CheckWork(pblock, *pwallet, reservekey);
+                        SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                        fFound = true;
+                        break;
+                    }
                 }
-                pblock->nNonce += 1;
-                nHashesDone += 1;
-                if ((pblock->nNonce & 0xFF) == 0)
+                if (fFound)
+                    break;
+                pblock->nNonce += nWays;
+                nHashesDone += nWays;
+                if ((pblock->nNonce & 0xFF) < (unsigned int)nWays)
                     break;
             }
 
@@ -5082,6 +6493,12 @@ public:
             delete (*it1).second;
         mapBlockIndex.clear();
 
+        // headers without blocks
+        std::map<uint256, CBlockIndex*>::iterator it3 = mapHeaderIndex.begin();
+        for (; it3 != mapHeaderIndex.end(); it3++)
+            delete (*it3).second;
+        mapHeaderIndex.clear();
+
         // orphan blocks
         std::map<uint256, CBlock*>::iterator it2 = mapOrphanBlocks.begin();
         for (; it2 != mapOrphanBlocks.end(); it2++)
@@ -6,15 +6,19 @@
 #define BITCOIN_MAIN_H
 
 #include "bignum.h"
+#include "checkqueue.h"
+#include "mappedfile.h"
 #include "sync.h"
 #include "net.h"
 #include "script.h"
 #include "scrypt.h"
+#include "uint256map.h"
 
 #include <list>
 
 class CWallet;
 class CBlock;
+class CBlockHeader;
 class CBlockIndex;
 class CKeyItem;
 class CReserveKey;
@@ -39,6 +43,37 @@ static const unsigned int MAX_STANDARD_TX_SIZE = 100000;
 static const unsigned int MAX_BLOCK_SIGOPS = MAX_BLOCK_SIZE/50;
 /** The maximum number of orphan transactions kept in memory */
 static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE/100;
+/** The maximum number of orphan blocks kept in memory */
+static const unsigned int MAX_ORPHAN_BLOCKS = 750;
+/** The maximum number of headers in a 'headers' protocol message */
+static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Number of blocks ahead of the first missing one that may be downloaded in parallel */
+static const unsigned int BLOCK_DOWNLOAD_WINDOW = 512;
+/** Maximum number of blocks requested from a single peer at a time */
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Seconds a peer may hold up the download window before it is disconnected, at first.
+    Doubled for each peer disconnected for it, up to BLOCK_STALLING_TIMEOUT_MAX, and eased
+    back as blocks arrive, so that a slow network doesn't lose its peers one after another */
+static const int64 BLOCK_STALLING_TIMEOUT = 10;
+static const int64 BLOCK_STALLING_TIMEOUT_MAX = 80;
+/** Seconds after which an unanswered block request is given to another peer */
+static const int64 BLOCK_DOWNLOAD_TIMEOUT = 120;
+/** Default for -maxmempool, maximum memory pool usage in megabytes */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -limitancestorcount, maximum number of in-pool ancestors of a transaction, itself included */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum size in kilobytes of a transaction with its in-pool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, maximum number of in-pool descendants of a transaction, itself included */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum size in kilobytes of a transaction with its in-pool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Seconds for the memory pool's minimum fee rate, raised by evictions, to halve */
+static const int64 MEMPOOL_MIN_FEE_HALFLIFE = 12 * 60 * 60;
+/** Blocks this far below the tip are sent in full even if asked for as compact blocks */
+static const int MAX_CMPCTBLOCK_DEPTH = 10;
+/** Bytes of recently served 'block' messages kept ready to send again */
+static const unsigned int MAX_RAW_BLOCK_CACHE_SIZE = 16000000;
 /** The maximum number of entries in an 'inv' protocol message */
 static const unsigned int MAX_INV_SZ = 50000;
 /** The maximum size of a blk?????.dat file (since 0.8) */
@@ -62,6 +97,10 @@ static const int COINBASE_MATURITY = 8;
 static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20 1985 UTC
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
+/** Maximum number of coins prefetch threads allowed */
+static const int MAX_PREFETCH_THREADS = 16;
+/** Maximum number of transactions queued for prefetching */
+static const unsigned int MAX_PREFETCHED_COINS = 50000;
 #ifdef USE_UPNP
 static const int fHaveUPnP = true;
 #else
@@ -101,7 +140,7 @@ extern bool fReindex;
 extern bool fBenchmark;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 
 // Settings
 extern int64 nTransactionFee;
@@ -115,6 +154,7 @@ class CReserveKey;
 class CCoinsDB;
 class CBlockTreeDB;
 struct CDiskBlockPos;
+struct CDiskRecord;
 class CCoins;
 class CTxUndo;
 class CCoinsView;
@@ -123,6 +163,7 @@ class CScriptCheck;
 class CValidationState;
 
 struct CBlockTemplate;
+struct CBlockTemplateStats;
 
 /** Register a wallet to receive updates from core */
 void RegisterWallet(CWallet* pwalletIn);
@@ -132,12 +173,20 @@ void UnregisterWallet(CWallet* pwalletIn);
 void SyncWithWallets(const uint256 &hash, const CTransaction& tx, const CBlock* pblock = NULL, bool fUpdate = false);
 /** Process an incoming block */
 bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp = NULL);
+/** Kimoto Gravity Well difficulty retarget, used between blocks 227000 and 445000 */
+unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader *pblock, uint64 TargetBlocksSpacingSeconds, uint64 PastBlocksMin, uint64 PastBlocksMax);
+/** Height of the best known chain of headers, which may be ahead of the blocks */
+int GetBestHeaderHeight();
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64 nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Open an undo file (rev?????.dat) */
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+/** Map the block stored at pos, to read it in place */
+bool MapBlockRecord(const CDiskBlockPos &pos, CDiskRecord &record);
+/** Map the undo data stored at pos, followed by its checksum */
+bool MapUndoRecord(const CDiskBlockPos &pos, CDiskRecord &record);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
 /** Initialize a new block tree database + block data on disk */
@@ -158,11 +207,21 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Get the counters of the script checking threads */
+void GetScriptCheckStats(CCheckQueueStats &stats);
+/** Run an instance of the coins prefetch thread */
+void ThreadCoinsPrefetch();
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet);
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey);
+/** Get the block template shared by the mining RPCs, on top of the best chain
+ *  and paying to OP_TRUE. It is built again once the best chain changes, or
+ *  the memory pool changed and it is more than nMaxAge seconds old. */
+boost::shared_ptr<const CBlockTemplate> GetSharedBlockTemplate(int64 nMaxAge, CBlockIndex*& pindexPrevRet);
+/** Get the counters of the shared block template */
+void GetBlockTemplateStats(CBlockTemplateStats &stats);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 /** Do mining precalculation */
@@ -253,6 +312,16 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+/** A block or undo record inside a mapped data file */
+struct CDiskRecord
+{
+    boost::shared_ptr<const CMappedFile> file; // keeps the mapping alive while the record is read
+    const char* pbegin;
+    const char* pend;
+
+    CDiskRecord() : pbegin(NULL), pend(NULL) {}
+};
+
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
 class CInPoint
@@ -811,19 +880,34 @@ public:
 
     bool ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock)
     {
-        // Open history file to read
-        CAutoFile filein = CAutoFile(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-        if (!filein)
-            return error("CBlockUndo::ReadFromDisk() : OpenBlockFile failed");
-
-        // Read block
+        // Read undo data, in place from the mapped history file where possible
         uint256 hashChecksum;
-        try {
-            filein >> *this;
-            filein >> hashChecksum;
+        CDiskRecord record;
+        if (MapUndoRecord(pos, record))
+        {
+            try {
+                CBufferReader filein(record.pbegin, record.pend, SER_DISK, CLIENT_VERSION);
+                filein >> *this;
+                filein >> hashChecksum;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+            }
         }
-        catch (std::exception &e) {
-            return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+        else
+        {
+            // Open history file to read
+            CAutoFile filein = CAutoFile(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (!filein)
+                return error("CBlockUndo::ReadFromDisk() : OpenBlockFile failed");
+
+            try {
+                filein >> *this;
+                filein >> hashChecksum;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+            }
         }
 
         // Verify checksum
@@ -1084,6 +1168,14 @@ public:
                 return false;
         return true;
     }
+
+    // heap memory owned by this object, in bytes
+    size_t DynamicMemoryUsage() const {
+        size_t nUsage = vout.capacity() * sizeof(CTxOut);
+        BOOST_FOREACH(const CTxOut &out, vout)
+            nUsage += out.scriptPubKey.capacity();
+        return nUsage;
+    }
 };
 
 /** Closure representing one script verification
@@ -1282,6 +1374,10 @@ public:
     unsigned int nBits;
     unsigned int nNonce;
 
+    // memory only: scrypt hash of the header, and the block hash it was computed for
+    mutable uint256 hashPoWCached;
+    mutable uint256 hashPoWCachedFor;
+
     CBlockHeader()
     {
         SetNull();
@@ -1306,6 +1402,8 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce = 0;
+        hashPoWCached = 0;
+        hashPoWCachedFor = 0;
     }
 
     bool IsNull() const
@@ -1318,6 +1416,25 @@ public:
         return Hash(BEGIN(nVersion), END(nNonce));
     }
 
+    // Scrypt is only run again when the header changed since the last call
+    uint256 GetPoWHash() const
+    {
+        uint256 hash = GetHash();
+        if (hash != hashPoWCachedFor)
+        {
+            scrypt_1024_1_1_256(BEGIN(nVersion), BEGIN(hashPoWCached));
+            hashPoWCachedFor = hash;
+        }
+        return hashPoWCached;
+    }
+
+    // Seed the cache with a proof-of-work hash known to belong to this header
+    void SetPoWHash(const uint256 &hashPoW) const
+    {
+        hashPoWCached = hashPoW;
+        hashPoWCachedFor = GetHash();
+    }
+
     int64 GetBlockTime() const
     {
         return (int64)nTime;
@@ -1359,13 +1476,6 @@ public:
         vMerkleTree.clear();
     }
 
-    uint256 GetPoWHash() const
-    {
-        uint256 thash;
-        scrypt_1024_1_1_256(BEGIN(nVersion), BEGIN(thash));
-        return thash;
-    }
-
     CBlockHeader GetBlockHeader() const
     {
         CBlockHeader block;
@@ -1460,25 +1570,39 @@ public:
         return true;
     }
 
-    bool ReadFromDisk(const CDiskBlockPos &pos)
+    bool ReadFromDisk(const CDiskBlockPos &pos, bool fCheckPOW = true)
     {
         SetNull();
 
-        // Open history file to read
-        CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-        if (!filein)
-            return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
-
-        // Read block
-        try {
-            filein >> *this;
+        // Read block, in place from the mapped block file where possible
+        CDiskRecord record;
+        if (MapBlockRecord(pos, record))
+        {
+            try {
+                CBufferReader filein(record.pbegin, record.pend, SER_DISK, CLIENT_VERSION);
+                filein >> *this;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+            }
         }
-        catch (std::exception &e) {
-            return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+        else
+        {
+            // Open history file to read
+            CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (!filein)
+                return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
+
+            try {
+                filein >> *this;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+            }
         }
 
         // Check the header
-        if (!CheckProofOfWork(GetPoWHash(), nBits))
+        if (fCheckPOW && !CheckProofOfWork(GetPoWHash(), nBits))
             return error("CBlock::ReadFromDisk() : errors in block header");
 
         return true;
@@ -1608,9 +1732,17 @@ enum BlockStatus {
 
     BLOCK_FAILED_VALID       =   32, // stage after last reached validness failed
     BLOCK_FAILED_CHILD       =   64, // descends from failed block
-    BLOCK_FAILED_MASK        =   96
+    BLOCK_FAILED_MASK        =   96,
+
+    BLOCK_HAVE_POWHASH       =  128, // scrypt hash of the header stored in hashPoW
+    BLOCK_HAVE_SUPPLY        =  256, // cumulative coin supply stored in nMoneySupply
 };
 
+/** First client version that writes the fields following the header of a
+ *  block index entry. Older versions keep the flags for them when they
+ *  rewrite an entry, but drop the fields. */
+static const int BLOCK_INDEX_TRAILER_VERSION = 3000001;
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block.  pprev and pnext link a path through the
@@ -1662,6 +1794,15 @@ public:
     unsigned int nBits;
     unsigned int nNonce;
 
+    // Scrypt proof-of-work hash of the header, valid if nStatus has BLOCK_HAVE_POWHASH
+    uint256 hashPoW;
+
+    // Coins issued by the chain up to and including this block, valid if nStatus has BLOCK_HAVE_SUPPLY
+    int64 nMoneySupply;
+
+    // (memory only) Kimoto Gravity Well target for the successor of this block, 0 until computed
+    unsigned int nBitsNextKGW;
+
 
     CBlockIndex()
     {
@@ -1682,6 +1823,9 @@ public:
         nTime          = 0;
         nBits          = 0;
         nNonce         = 0;
+        hashPoW        = 0;
+        nMoneySupply   = 0;
+        nBitsNextKGW   = 0;
     }
 
     CBlockIndex(CBlockHeader& block)
@@ -1703,6 +1847,9 @@ public:
         nTime          = block.nTime;
         nBits          = block.nBits;
         nNonce         = block.nNonce;
+        hashPoW        = 0;
+        nMoneySupply   = 0;
+        nBitsNextKGW   = 0;
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -1741,6 +1888,26 @@ public:
         return *phashBlock;
     }
 
+    uint256 GetPoWHash() const
+    {
+        if (nStatus & BLOCK_HAVE_POWHASH)
+            return hashPoW;
+        // Indexed by a version that did not store it
+        return GetBlockHeader().GetPoWHash();
+    }
+
+    void SetPoWHash(const uint256 &hash)
+    {
+        hashPoW = hash;
+        nStatus |= BLOCK_HAVE_POWHASH;
+    }
+
+    void SetMoneySupply(int64 nSupply)
+    {
+        nMoneySupply = nSupply;
+        nStatus |= BLOCK_HAVE_SUPPLY;
+    }
+
     int64 GetBlockTime() const
     {
         return (int64)nTime;
@@ -1867,6 +2034,16 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+
+        // last, so that older versions ignore it; nVersion is now that of the writer
+        if (fRead && nVersion < BLOCK_INDEX_TRAILER_VERSION)
+            const_cast<CDiskBlockIndex*>(this)->nStatus &= ~BLOCK_HAVE_POWHASH;
+        if ((nStatus & BLOCK_HAVE_POWHASH) && nVersion >= BLOCK_INDEX_TRAILER_VERSION)
+            READWRITE(hashPoW);
+        if (fRead && nVersion < BLOCK_INDEX_TRAILER_VERSION)
+            const_cast<CDiskBlockIndex*>(this)->nStatus &= ~BLOCK_HAVE_SUPPLY;
+        if ((nStatus & BLOCK_HAVE_SUPPLY) && nVersion >= BLOCK_INDEX_TRAILER_VERSION)
+            READWRITE(VARINT(nMoneySupply));
     )
 
     uint256 GetBlockHash() const
@@ -2090,14 +2267,80 @@ public:
 
 
 
+/** A transaction in the memory pool, with what is known about it when it
+ *  entered and the totals of the in-pool transactions it depends on
+ *  (ancestors) and that depend on it (descendants), itself included.
+ */
+class CTxMemPoolEntry
+{
+private:
+    CTransaction tx;
+    int64 nFee;              // fee paid, or 0 if unknown
+    unsigned int nTxSize;    // serialized size
+    size_t nUsageSize;       // memory used by the entry
+    int64 nTime;             // when it entered the pool
+    double dPriority;        // priority when it entered the pool
+    int nHeight;             // chain height when it entered the pool
+    int64 nValueInChain;     // input value spent from the chain, which ages
+
+public:
+    uint64 nCountWithAncestors;
+    uint64 nSizeWithAncestors;
+    int64 nFeesWithAncestors;
+    uint64 nCountWithDescendants;
+    uint64 nSizeWithDescendants;
+    int64 nFeesWithDescendants;
+    bool fScriptsChecked;    // its input scripts were verified when it entered
+
+    CTxMemPoolEntry();
+    CTxMemPoolEntry(const CTransaction& txIn, int64 nFeeIn, int64 nTimeIn, double dPriorityIn, int nHeightIn, int64 nValueInChainIn);
+
+    const CTransaction& GetTx() const { return tx; }
+    CTransaction& GetTx() { return tx; }
+    int64 GetFee() const { return nFee; }
+    unsigned int GetTxSize() const { return nTxSize; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
+    int64 GetTime() const { return nTime; }
+    int GetHeight() const { return nHeight; }
+
+    // Priority at a chain height: sum(valuein * age) / txsize
+    double GetPriority(int nCurrentHeight) const;
+
+    // Fee per kilobyte of the transaction alone, and with its descendants
+    double GetFeeRate() const { return (double)nFee * 1000 / nTxSize; }
+    double GetDescendantFeeRate() const { return (double)nFeesWithDescendants * 1000 / nSizeWithDescendants; }
+};
+
 class CTxMemPool
 {
+public:
+    // An ordering of the pool: a score and the transaction hash, lowest first
+    typedef std::set<std::pair<double, uint256> > indexed_set;
+
+private:
+    indexed_set setByFeeRate;        // mining order once priority space is used
+    indexed_set setByPriority;       // mining order for the priority space
+    indexed_set setByDescendantFeeRate; // eviction order
+    size_t nTotalUsage;
+    int64 nTotalFees;
+    double dRollingMinFeeRate;      // fee rate of the last package evicted, decaying
+    int64 nLastRollingFeeUpdate;
+
+    void CalculateAncestors(const uint256& hash, const CTransaction& tx, std::set<uint256>& setAncestors);
+    void CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants);
+    void UpdateDescendantState(const uint256& hash, CTxMemPoolEntry& entry, int64 nCount, int64 nSize, int64 nFees);
+    void UpdatePackages(const std::set<uint256>& setChanged);
+    void removeUnchecked(const uint256& hash);
+
 public:
     mutable CCriticalSection cs;
-    std::map<uint256, CTransaction> mapTx;
+    std::map<uint256, CTxMemPoolEntry> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
 
+    CTxMemPool() : nTotalUsage(0), nTotalFees(0), dRollingMinFeeRate(0), nLastRollingFeeUpdate(0) {}
+
     bool accept(CValidationState &state, CTransaction &tx, bool fCheckInputs, bool fLimitFree, bool* pfMissingInputs);
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry);
     bool addUnchecked(const uint256& hash, const CTransaction &tx);
     bool remove(const CTransaction &tx, bool fRecursive = false);
     bool removeConflicts(const CTransaction &tx);
@@ -2105,12 +2348,41 @@ public:
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins &coins);
 
+    // Evict the transactions, with their descendants, whose descendant fee
+    // rate is lowest until the pool uses at most nSizeLimit bytes
+    void TrimToSize(size_t nSizeLimit);
+
+    // Whether tx, of nSize bytes, would keep itself and every in-pool package
+    // it joins within -limitancestor*/-limitdescendant*, so that the work done
+    // on each addition stays bounded
+    bool CheckPackageLimits(const uint256& hash, const CTransaction& tx, unsigned int nSize, std::string& strReason);
+
+    // Fee per kilobyte a transaction must beat to enter the pool, so that
+    // what was just evicted isn't accepted again; 0 when there is none
+    double GetMinFeeRate();
+
+    // The hashes of the pool's transactions in mining order, best first
+    const indexed_set& GetFeeRateOrder() const { return setByFeeRate; }
+    const indexed_set& GetPriorityOrder() const { return setByPriority; }
+
     unsigned long size()
     {
         LOCK(cs);
         return mapTx.size();
     }
 
+    size_t DynamicMemoryUsage()
+    {
+        LOCK(cs);
+        return nTotalUsage;
+    }
+
+    int64 GetTotalFees()
+    {
+        LOCK(cs);
+        return nTotalFees;
+    }
+
     bool exists(uint256 hash)
     {
         return (mapTx.count(hash) != 0);
@@ -2118,7 +2390,7 @@ public:
 
     CTransaction& lookup(uint256 hash)
     {
-        return mapTx[hash];
+        return mapTx[hash].GetTx();
     }
 };
 
@@ -2137,6 +2409,23 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0), nTotalAmount(0) {}
 };
 
+/** A CCoins in a CCoinsViewCache, with its bookkeeping */
+struct CCoinsCacheEntry
+{
+    CCoins coins;
+    unsigned char flags;
+    size_t nUsage; // coins.DynamicMemoryUsage() when last counted
+
+    enum Flags {
+        DIRTY = (1 << 0), // may differ from the version in the parent view
+        FRESH = (1 << 1), // the parent view has no unspent version of it
+    };
+
+    CCoinsCacheEntry() : flags(0), nUsage(0) {}
+};
+
+typedef uint256map<CCoinsCacheEntry> CCoinsMap;
+
 /** Abstract view on the open txout dataset. */
 class CCoinsView
 {
@@ -2157,8 +2446,9 @@ public:
     // Modify the currently active block index
     virtual bool SetBestBlock(CBlockIndex *pindex);
 
-    // Do a bulk modification (multiple SetCoins + one SetBestBlock)
-    virtual bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    // Do a bulk modification (multiple SetCoins + one SetBestBlock).
+    // Only entries flagged DIRTY are applied; their coins may be moved out of mapCoins.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex);
 
     // Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats);
@@ -2181,16 +2471,28 @@ public:
     CBlockIndex *GetBestBlock();
     bool SetBestBlock(CBlockIndex *pindex);
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex);
     bool GetStats(CCoinsStats &stats);
 };
 
-/** CCoinsView that adds a memory cache for transactions to another CCoinsView */
+/** CCoinsView that adds a memory cache for transactions to another CCoinsView.
+ *
+ * Only entries that were modified (DIRTY) are pushed to the base on Flush().
+ * Entries the base is known not to have (FRESH) are dropped instead of being
+ * written when they get spent entirely before the flush. Lookups that miss
+ * the base are remembered as FRESH pruned entries, which HaveCoins reports
+ * as absent.
+ */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
     CBlockIndex *pindexTip;
-    std::map<uint256,CCoins> cacheCoins;
+    CCoinsMap cacheCoins;
+
+    // Memory owned by the entries in cacheCoins, as last counted
+    size_t nCachedCoinsUsage;
+    // Entries handed out for modification since they were last counted
+    std::vector<CCoinsMap::iterator> vUncounted;
 
 public:
     CCoinsViewCache(CCoinsView &baseIn, bool fDummy = false);
@@ -2201,13 +2503,16 @@ public:
     bool HaveCoins(const uint256 &txid);
     CBlockIndex *GetBestBlock();
     bool SetBestBlock(CBlockIndex *pindex);
-    bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex);
 
-    // Return a modifiable reference to a CCoins. Check HaveCoins first.
-    // Many methods explicitly require a CCoinsViewCache because of this method, to reduce
-    // copying.
+    // Return a modifiable reference to a CCoins, which is marked as modified.
+    // Check HaveCoins first. Many methods explicitly require a CCoinsViewCache
+    // because of this method, to reduce copying.
     CCoins &GetCoins(const uint256 &txid);
 
+    // Return a read-only reference to a CCoins. Check HaveCoins first.
+    const CCoins &AccessCoins(const uint256 &txid);
+
     // Push the modifications applied to this cache to its base.
     // Failure to call this method before destruction will cause the changes to be forgotten.
     bool Flush();
@@ -2215,8 +2520,15 @@ public:
     // Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize();
 
+    // Calculate the memory used by the cache, in bytes
+    size_t DynamicMemoryUsage();
+
+    // Whether txid is cached, without asking the base
+    bool HaveCoinsInCache(const uint256 &txid);
+
 private:
-    std::map<uint256,CCoins>::iterator FetchCoins(const uint256 &txid);
+    CCoinsMap::iterator FetchCoins(const uint256 &txid);
+    void UpdateUsage();
 };
 
 /** CCoinsView that brings transactions from a memorypool into view.
@@ -2232,9 +2544,70 @@ public:
     bool HaveCoins(const uint256 &txid);
 };
 
+/** CCoinsView that sits between the tip cache and the database, and hands out
+ * coins which worker threads have read ahead of validation.
+ *
+ * Blocks are queued with Prefetch() as soon as they pass CheckBlock; the
+ * workers read their inputs from the base while the caller validates the
+ * previous block. Each prefetched entry is served once, to the cache above,
+ * which then owns it. Writes through this view discard everything that was
+ * read before them, so a lookup never returns an older state than the base.
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condQuit;
+
+    // Txids waiting to be read, and the results (pruned means not found)
+    std::deque<uint256> queue;
+    std::map<uint256, CCoins> mapPrefetched;
+
+    // Memory held by mapPrefetched, and the part of -dbcache it may use
+    size_t nUsage;
+    size_t nMaxUsage;
+
+    // Bumped by every write, to drop reads that started before it
+    unsigned int nGeneration;
+
+    // Running worker threads, and whether they should exit
+    int nThreads;
+    bool fQuit;
+
+    // Statistics since the last call to GetStatistics()
+    unsigned int nRead, nHit, nMiss;
+
+public:
+    CCoinsViewPrefetch(CCoinsView &baseIn, size_t nMaxUsageIn);
+
+    bool GetCoins(const uint256 &txid, CCoins &coins);
+    bool SetCoins(const uint256 &txid, const CCoins &coins);
+    bool HaveCoins(const uint256 &txid);
+    bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex);
+
+    // Queue the inputs of block that are neither created by the block itself
+    // nor already present in cache. Returns the number of txids queued.
+    unsigned int Prefetch(const CBlock &block, CCoinsViewCache &cache);
+
+    // Worker thread main loop; returns after Stop() or when interrupted
+    void Thread();
+
+    // Make all worker threads exit, and wait until they did
+    void Stop();
+
+    void GetStatistics(unsigned int &nReadOut, unsigned int &nHitOut, unsigned int &nMissOut);
+
+    // Memory held by entries read ahead and not used yet, in bytes
+    size_t DynamicMemoryUsage();
+};
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Read-ahead layer below pcoinsTip, or NULL if -prefetchthreads=0 */
+extern CCoinsViewPrefetch *pcoinsPrefetch;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -2243,6 +2616,19 @@ struct CBlockTemplate
     CBlock block;
     std::vector<int64_t> vTxFees;
     std::vector<int64_t> vTxSigOps;
+    int64 nPoolFees; // fees in the memory pool it was built from
+};
+
+struct CBlockTemplateStats
+{
+    uint256 hashPrevBlock;  // the block the shared template builds on
+    int64 nTimeBuilt;       // when it was built
+    int64 nBuildMicros;     // how long building it took
+    unsigned int nTx;       // transactions in it, the coinbase included
+    uint64 nBuilds;         // templates built
+    uint64 nRequests;       // requests for the shared template
+
+    CBlockTemplateStats() : hashPrevBlock(0), nTimeBuilt(0), nBuildMicros(0), nTx(0), nBuilds(0), nRequests(0) {}
 };
 
 #if defined(_M_IX86) || defined(__i386__) || defined(__i386) || defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64)
@@ -0,0 +1,82 @@
+// Copyright (c) 2013 The CasinoCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+using namespace boost::interprocess;
+
+CMappedFile::CMappedFile(const boost::filesystem::path &path) :
+    mapping(path.string().c_str(), read_only),
+    region(mapping, read_only)
+{
+}
+
+boost::shared_ptr<const CMappedFile> CMappedFilePool::Get(const boost::filesystem::path &path, uint64 nMinSize)
+{
+    LOCK(cs);
+    string strPath = path.string();
+
+    map<string, list_type::iterator>::iterator mi = mapFiles.find(strPath);
+    if (mi != mapFiles.end())
+    {
+        list_type::iterator it = mi->second;
+        listFiles.splice(listFiles.begin(), listFiles, it);
+        if (it->second->size() >= nMinSize)
+            return it->second;
+        // The file grew since it was mapped
+        listFiles.erase(it);
+        mapFiles.erase(mi);
+    }
+
+    boost::shared_ptr<const CMappedFile> file;
+    try {
+        boost::system::error_code ec;
+        uint64 nFileSize = boost::filesystem::file_size(path, ec);
+        if (ec || nFileSize == 0 || nFileSize < nMinSize)
+            return file;
+        file.reset(new CMappedFile(path));
+    }
+    catch (interprocess_exception &e) {
+        printf("CMappedFilePool::Get() : unable to map %s: %s\n", strPath.c_str(), e.what());
+        return file;
+    }
+    if (file->size() < nMinSize)
+        return boost::shared_ptr<const CMappedFile>();
+
+    listFiles.push_front(make_pair(strPath, file));
+    mapFiles[strPath] = listFiles.begin();
+    while (listFiles.size() > nMaxFiles)
+    {
+        mapFiles.erase(listFiles.back().first);
+        listFiles.pop_back();
+    }
+    return file;
+}
+
+void CMappedFilePool::Release(const boost::filesystem::path &path)
+{
+    LOCK(cs);
+    map<string, list_type::iterator>::iterator mi = mapFiles.find(path.string());
+    if (mi == mapFiles.end())
+        return;
+    listFiles.erase(mi->second);
+    mapFiles.erase(mi);
+}
+
+void CMappedFilePool::Clear()
+{
+    LOCK(cs);
+    mapFiles.clear();
+    listFiles.clear();
+}
+
+size_t CMappedFilePool::size() const
+{
+    LOCK(cs);
+    return listFiles.size();
+}
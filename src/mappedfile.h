@@ -0,0 +1,68 @@
+// Copyright (c) 2013 The CasinoCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include "sync.h"
+#include "util.h"
+
+#include <list>
+#include <map>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/shared_ptr.hpp>
+
+/** A file mapped read-only into memory, as large as the file was when it
+ *  was mapped. Data appended later is not visible through it.
+ */
+class CMappedFile
+{
+private:
+    boost::interprocess::file_mapping mapping;
+    boost::interprocess::mapped_region region;
+
+public:
+    // Throws boost::interprocess::interprocess_exception if the file can't be mapped
+    CMappedFile(const boost::filesystem::path &path);
+
+    const char* begin() const { return (const char*)region.get_address(); }
+    const char* end() const   { return begin() + size(); }
+    size_t size() const       { return region.get_size(); }
+};
+
+/** Keeps the most recently used files mapped, so that reading from them costs
+ *  no system calls. A file that has grown past the part that is mapped is
+ *  mapped again when a read needs the new part. Mappings handed out stay
+ *  valid for as long as the caller holds on to them, even if the pool drops
+ *  them in the meantime.
+ */
+class CMappedFilePool
+{
+private:
+    typedef std::list<std::pair<std::string, boost::shared_ptr<const CMappedFile> > > list_type;
+
+    mutable CCriticalSection cs;
+    size_t nMaxFiles;
+    list_type listFiles; // most recently used first
+    std::map<std::string, list_type::iterator> mapFiles;
+
+public:
+    CMappedFilePool(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn) {}
+
+    // Mapping of path covering at least its first nMinSize bytes, or NULL if
+    // the file is missing, can't be mapped or isn't that large
+    boost::shared_ptr<const CMappedFile> Get(const boost::filesystem::path &path, uint64 nMinSize);
+
+    // Drop the mapping of path, before the file is truncated or rewritten
+    void Release(const boost::filesystem::path &path);
+
+    void Clear();
+
+    size_t size() const;
+};
+
+#endif
@@ -12,6 +12,8 @@
 
 #ifdef WIN32
 #include <string.h>
+#else
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_UPNP
@@ -29,6 +31,9 @@ using namespace boost;
 
 static const int MAX_OUTBOUND_CONNECTIONS = 8;
 
+// How soon the message handler retries a node whose receive buffer was locked
+static const int MESSAGE_HANDLER_RETRY_MILLIS = 2;
+
 bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOutbound = NULL, const char *strDest = NULL, bool fOneShot = false);
 
 
@@ -71,6 +76,17 @@ CCriticalSection cs_vAddedNodes;
 
 static CSemaphore *semOutbound = NULL;
 
+// Socket event backend; hEpoll is -1 when select() is used
+bool fNetEpoll = false;
+#ifdef USE_EPOLL
+static int hEpoll = -1;
+#endif
+
+// Nodes that received a complete message since the message handler last looked
+static boost::mutex mutexMsgHandler;
+static boost::condition_variable condMsgHandler;
+static set<CNode*> setMsgHandlerReady;
+
 void AddOneShot(string strDest)
 {
     LOCK(cs_vOneShots);
@@ -454,6 +470,54 @@ CNode* FindNode(const CService& addr)
     return NULL;
 }
 
+bool SetupEpoll()
+{
+#ifdef USE_EPOLL
+    if (hEpoll == -1)
+        hEpoll = epoll_create(1024);
+    if (hEpoll == -1)
+        printf("epoll_create() failed, error %d; using select()\n", errno);
+    return hEpoll != -1;
+#else
+    return false;
+#endif
+}
+
+// Watch a new node's socket; it stays registered until it is closed
+static void RegisterNodeSocket(CNode *pnode)
+{
+#ifdef USE_EPOLL
+    if (hEpoll == -1 || pnode->hSocket == INVALID_SOCKET)
+        return;
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) == SOCKET_ERROR)
+        printf("epoll_ctl() : adding socket failed, error %d\n", errno);
+#endif
+}
+
+void WakeMessageHandler(CNode *pnode)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutexMsgHandler);
+        if (!setMsgHandlerReady.insert(pnode).second)
+            return;
+    }
+    condMsgHandler.notify_one();
+}
+
+// Sleep until a node is ready or nMilliSeconds have passed, and return the ready nodes.
+// They are only compared against vNodes, never dereferenced, as they may be gone.
+static void WaitForMessages(int64 nMilliSeconds, set<CNode*> &setReady)
+{
+    boost::unique_lock<boost::mutex> lock(mutexMsgHandler);
+    if (setMsgHandlerReady.empty() && nMilliSeconds > 0)
+        condMsgHandler.timed_wait(lock, boost::posix_time::milliseconds(nMilliSeconds));
+    setReady.swap(setMsgHandlerReady);
+    setMsgHandlerReady.clear();
+}
+
 CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
 {
     if (pszDest == NULL) {
@@ -497,6 +561,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
         // Add node
         CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
         pnode->AddRef();
+        RegisterNodeSocket(pnode);
 
         {
             LOCK(cs_vNodes);
@@ -525,7 +590,10 @@ void CNode::CloseSocketDisconnect()
     // in case this fails, we'll empty the recv buffer when the CNode is deleted
     TRY_LOCK(cs_vRecvMsg, lockRecv);
     if (lockRecv)
+    {
         vRecvMsg.clear();
+        nRecvSize = 0;
+    }
 
     // if this was the sync node, we'll need a new one
     if (this == pnodeSync)
@@ -619,6 +687,32 @@ void CNode::copyStats(CNodeStats &stats)
     X(nSendBytes);
     X(nRecvBytes);
     X(nBlocksRequested);
+
+    // The queues are only read when their locks are free, so that this
+    // doesn't wait on a socket or message handler thread
+    stats.fSendQueue = false;
+    stats.nSendSize = stats.nSendMsgs = 0;
+    {
+        TRY_LOCK(cs_vSend, lockSend);
+        if (lockSend)
+        {
+            stats.fSendQueue = true;
+            X(nSendSize);
+            stats.nSendMsgs = vSendMsg.size();
+        }
+    }
+    stats.fRecvQueue = false;
+    stats.nRecvSize = 0;
+    stats.dProcessDelay = 0;
+    {
+        TRY_LOCK(cs_vRecvMsg, lockRecv);
+        if (lockRecv)
+        {
+            stats.fRecvQueue = true;
+            X(nRecvSize);
+            stats.dProcessDelay = nMessagesProcessed ? 0.001 * nProcessDelayTotal / nMessagesProcessed : 0;
+        }
+    }
     stats.fSyncNode = (this == pnodeSync);
 }
 #undef X
@@ -644,6 +738,10 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         if (handled < 0)
                 return false;
+        nRecvSize += handled;
+
+        if (msg.complete())
+            msg.nTime = GetTimeMicros();
 
         pch += handled;
         nBytes -= handled;
@@ -677,9 +775,9 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     if (hdr.nMessageSize > MAX_SIZE)
             return -1;
 
-    // switch state to reading message data
+    // switch state to reading message data; the buffer grows as data
+    // arrives, so a peer can't make us allocate by announcing large messages
     in_data = true;
-    vRecv.resize(hdr.nMessageSize);
 
     return nCopy;
 }
@@ -689,6 +787,11 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
+    if (vRecv.size() < nDataPos + nCopy) {
+        // Allocate up to RECV_CHUNK_SIZE ahead, but never more than the total message size
+        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + RECV_CHUNK_SIZE));
+    }
+
     memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
@@ -703,25 +806,67 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+#ifndef WIN32
+// Number of queued messages handed to the kernel in one call
+static const int MAX_SEND_IOV = 64;
+#endif
+
+// Send queued data starting at message it, as much as the socket takes in a
+// single call. nAttempted is set to the number of bytes offered.
+// requires LOCK(cs_vSend)
+static int SendQueuedData(CNode *pnode, std::deque<CSerializeData>::iterator it, size_t &nAttempted)
+{
+#ifndef WIN32
+    struct iovec iov[MAX_SEND_IOV];
+    int nIov = 0;
+    size_t nOffset = pnode->nSendOffset;
+    nAttempted = 0;
+    for (; it != pnode->vSendMsg.end() && nIov < MAX_SEND_IOV; it++, nIov++) {
+        assert((*it).size() > nOffset);
+        iov[nIov].iov_base = (void*)&(*it)[nOffset];
+        iov[nIov].iov_len = (*it).size() - nOffset;
+        nAttempted += iov[nIov].iov_len;
+        nOffset = 0;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nIov;
+    return sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    const CSerializeData &data = *it;
+    assert(data.size() > pnode->nSendOffset);
+    nAttempted = data.size() - pnode->nSendOffset;
+    return send(pnode->hSocket, &data[pnode->nSendOffset], nAttempted, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
     std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        size_t nAttempted;
+        int nBytes = SendQueuedData(pnode, it, nAttempted);
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Step over the messages that went out in full
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRest = (*it).size() - pnode->nSendOffset;
+                if (nLeft < nRest) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRest;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= (*it).size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nAttempted) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -744,78 +889,387 @@ void SocketSendData(CNode *pnode)
         assert(pnode->nSendSize == 0);
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+
+#ifdef USE_EPOLL
+    // Only ask for writability while there is something left to send
+    bool fWantOut = !pnode->vSendMsg.empty();
+    if (hEpoll != -1 && fWantOut != pnode->fEpollOut && pnode->hSocket != INVALID_SOCKET)
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (fWantOut ? (uint32_t)EPOLLOUT : 0u);
+        event.data.ptr = pnode;
+        if (epoll_ctl(hEpoll, EPOLL_CTL_MOD, pnode->hSocket, &event) != SOCKET_ERROR)
+            pnode->fEpollOut = fWantOut;
+    }
+#endif
 }
 
 static list<CNode*> vNodesDisconnected;
 
-void ThreadSocketHandler()
+static void DisconnectNodes(unsigned int &nPrevNodeCount)
 {
-    unsigned int nPrevNodeCount = 0;
-    loop
     {
-        //
-        // Disconnect nodes
-        //
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
             {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
-                {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
-                    pnode->Cleanup();
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
+                pnode->Cleanup();
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
+        }
 
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
+        {
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0)
             {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0)
+                bool fDelete = false;
                 {
-                    bool fDelete = false;
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
                     {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend)
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv)
                         {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv)
-                            {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete)
-                    {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
+                }
+                if (fDelete)
+                {
+                    vNodesDisconnected.remove(pnode);
+                    delete pnode;
                 }
             }
         }
-        if (vNodes.size() != nPrevNodeCount)
+    }
+    if (vNodes.size() != nPrevNodeCount)
+    {
+        nPrevNodeCount = vNodes.size();
+        uiInterface.NotifyNumConnectionsChanged(vNodes.size());
+    }
+}
+
+// Accept one pending connection; returns false if there was none
+// Accept one connection. Returns whether to call again for the rest of the
+// backlog; fBackOff is set when accept failed for lack of descriptors or
+// memory, and the backlog should be tried again a little later.
+static bool AcceptConnection(SOCKET hListenSocket, bool& fBackOff)
+{
+#ifdef USE_IPV6
+    struct sockaddr_storage sockaddr;
+#else
+    struct sockaddr sockaddr;
+#endif
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            printf("Warning: Unknown socket family\n");
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET)
+    {
+        int nErr = WSAGetLastError();
+        if (nErr == WSAEWOULDBLOCK)
+            return false;
+        // the connection went away before it was accepted; others may be waiting
+        if (nErr == WSAEINTR || nErr == WSAECONNABORTED)
+            return true;
+        printf("socket error accept failed: %d\n", nErr);
+#ifndef WIN32
+        if (nErr == ENFILE || nErr == ENOMEM)
+            fBackOff = true;
+#endif
+        if (nErr == WSAEMFILE || nErr == WSAENOBUFS)
+            fBackOff = true;
+        return false;
+    }
+    else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS)
+    {
+        {
+            LOCK(cs_setservAddNodeAddresses);
+            if (!setservAddNodeAddresses.count(addr))
+                closesocket(hSocket);
+        }
+    }
+    else if (CNode::IsBanned(addr))
+    {
+        printf("connection from %s dropped (banned)\n", addr.ToString().c_str());
+        closesocket(hSocket);
+    }
+    else
+    {
+        printf("accepted connection %s\n", addr.ToString().c_str());
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        RegisterNodeSocket(pnode);
+        {
+            LOCK(cs_vNodes);
+            vNodes.push_back(pnode);
+        }
+    }
+    return true;
+}
+
+// requires LOCK(cs_vRecvMsg)
+// Read once from the socket; returns whether more data may be waiting
+static bool SocketRecvData(CNode *pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        if (!pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete())
+            WakeMessageHandler(pnode);
+        // a short read means the socket buffer was drained
+        return nBytes == (int)sizeof(pchBuf) && pnode->hSocket != INVALID_SOCKET;
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            printf("socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
         {
-            nPrevNodeCount = vNodes.size();
-            uiInterface.NotifyNumConnectionsChanged(vNodes.size());
+            if (!pnode->fDisconnect)
+                printf("socket recv error %d\n", nErr);
+            pnode->CloseSocketDisconnect();
         }
+    }
+    return false;
+}
+
+// Whether there is room to receive more data for pnode (requires LOCK(cs_vRecvMsg))
+static bool CanReceiveMore(CNode *pnode)
+{
+    return pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+           pnode->GetTotalRecvSize() <= ReceiveFloodSize();
+}
+
+static void InactivityCheck(CNode *pnode)
+{
+    if (pnode->vSendMsg.empty())
+        pnode->nLastSendEmpty = GetTime();
+    if (GetTime() - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            printf("socket no message in first 60 seconds, %d %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0);
+            pnode->fDisconnect = true;
+        }
+        else if (GetTime() - pnode->nLastSend > 90*60 && GetTime() - pnode->nLastSendEmpty > 90*60)
+        {
+            printf("socket not sending\n");
+            pnode->fDisconnect = true;
+        }
+        else if (GetTime() - pnode->nLastRecv > 90*60)
+        {
+            printf("socket inactivity timeout\n");
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+static const int MAX_EPOLL_EVENTS = 256;
+
+// Edge-triggered: an event only says that something changed, so sockets
+// stay in setRecv/setSend (holding a reference) until they have been
+// drained, which may take several rounds when the receive buffer is full.
+static void ThreadSocketHandlerEpoll()
+{
+    unsigned int nPrevNodeCount = 0;
+    int64 nLastSweep = 0;
+    int64 nAcceptRetry = 0; // when to try the backlog again after running out of descriptors
+    bool fReadable = false;
+    set<CNode*> setRecv;
+    set<CNode*> setSend;
+    struct epoll_event vEvents[MAX_EPOLL_EVENTS];
+
+    BOOST_FOREACH(SOCKET hListenSocket, vhListenSocket)
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = NULL;
+        if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket, &event) == SOCKET_ERROR)
+            printf("epoll_ctl() : adding listening socket failed, error %d\n", errno);
+    }
+
+    loop
+    {
+        // Disconnects and timeouts don't need to be noticed on every wake-up
+        if (GetTimeMillis() - nLastSweep >= 100)
+        {
+            DisconnectNodes(nPrevNodeCount);
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes)
+                InactivityCheck(pnode);
+            nLastSweep = GetTimeMillis();
+        }
+
+        // Don't wait if a socket still has data to read, and only poll quickly
+        // while some socket is waiting for room to receive into
+        int nTimeout = fReadable ? 0 : (setRecv.empty() && setSend.empty() ? 50 : 10);
+        int nEvents = epoll_wait(hEpoll, vEvents, MAX_EPOLL_EVENTS, nTimeout);
+        boost::this_thread::interruption_point();
+        if (nEvents == SOCKET_ERROR)
+        {
+            if (errno != EINTR)
+            {
+                printf("socket epoll_wait error %d\n", errno);
+                MilliSleep(10);
+            }
+            nEvents = 0;
+        }
+
+        // No new edge comes for a backlog left behind, so go back to it
+        // once the back-off is over
+        bool fAccept = nAcceptRetry && GetTimeMillis() >= nAcceptRetry;
+        vector<CNode*> vNew;
+        for (int i = 0; i < nEvents; i++)
+        {
+            CNode* pnode = (CNode*)vEvents[i].data.ptr;
+            if (pnode == NULL)
+            {
+                fAccept = true;
+                continue;
+            }
+            if ((vEvents[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP)) && setRecv.insert(pnode).second)
+                vNew.push_back(pnode);
+            if ((vEvents[i].events & EPOLLOUT) && setSend.insert(pnode).second)
+                vNew.push_back(pnode);
+        }
+        if (fAccept)
+        {
+            bool fBackOff = false;
+            BOOST_FOREACH(SOCKET hListenSocket, vhListenSocket)
+                while (AcceptConnection(hListenSocket, fBackOff))
+                    boost::this_thread::interruption_point();
+            nAcceptRetry = fBackOff ? GetTimeMillis() + 500 : 0;
+        }
+        if (!vNew.empty())
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNew)
+                pnode->AddRef();
+        }
+
+        //
+        // Service the sockets that are ready
+        //
+        vector<CNode*> vDone;
+        fReadable = false;
+        for (set<CNode*>::iterator it = setRecv.begin(); it != setRecv.end(); )
+        {
+            CNode* pnode = *it;
+            bool fMore = false;
+            if (pnode->hSocket != INVALID_SOCKET)
+            {
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (!lockRecv || !CanReceiveMore(pnode))
+                    fMore = true;
+                else
+                {
+                    // a few reads at a time, to be fair to the other sockets
+                    for (int nReads = 0; nReads < 4 && CanReceiveMore(pnode); nReads++)
+                        if (!(fMore = SocketRecvData(pnode)))
+                            break;
+                    fReadable |= fMore;
+                }
+            }
+            if (fMore)
+                it++;
+            else
+            {
+                vDone.push_back(pnode);
+                setRecv.erase(it++);
+            }
+        }
+        for (set<CNode*>::iterator it = setSend.begin(); it != setSend.end(); )
+        {
+            CNode* pnode = *it;
+            bool fMore = false;
+            if (pnode->hSocket != INVALID_SOCKET)
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend)
+                    SocketSendData(pnode);
+                else
+                    fMore = true;
+            }
+            if (fMore)
+                it++;
+            else
+            {
+                vDone.push_back(pnode);
+                setSend.erase(it++);
+            }
+        }
+        if (!vDone.empty())
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vDone)
+                pnode->Release();
+        }
+    }
+}
+#endif
+
+void ThreadSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (hEpoll != -1)
+        return ThreadSocketHandlerEpoll();
+#endif
+
+    unsigned int nPrevNodeCount = 0;
+    loop
+    {
+        //
+        // Disconnect nodes
+        //
+        DisconnectNodes(nPrevNodeCount);
 
 
         //
@@ -873,9 +1327,7 @@ void ThreadSocketHandler()
                 }
                 {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                    if (lockRecv && CanReceiveMore(pnode))
                         FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
@@ -906,56 +1358,8 @@ void ThreadSocketHandler()
         BOOST_FOREACH(SOCKET hListenSocket, vhListenSocket)
         if (hListenSocket != INVALID_SOCKET && FD_ISSET(hListenSocket, &fdsetRecv))
         {
-#ifdef USE_IPV6
-            struct sockaddr_storage sockaddr;
-#else
-            struct sockaddr sockaddr;
-#endif
-            socklen_t len = sizeof(sockaddr);
-            SOCKET hSocket = accept(hListenSocket, (struct sockaddr*)&sockaddr, &len);
-            CAddress addr;
-            int nInbound = 0;
-
-            if (hSocket != INVALID_SOCKET)
-                if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                    printf("Warning: Unknown socket family\n");
-
-            {
-                LOCK(cs_vNodes);
-                BOOST_FOREACH(CNode* pnode, vNodes)
-                    if (pnode->fInbound)
-                        nInbound++;
-            }
-
-            if (hSocket == INVALID_SOCKET)
-            {
-                int nErr = WSAGetLastError();
-                if (nErr != WSAEWOULDBLOCK)
-                    printf("socket error accept failed: %d\n", nErr);
-            }
-            else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS)
-            {
-                {
-                    LOCK(cs_setservAddNodeAddresses);
-                    if (!setservAddNodeAddresses.count(addr))
-                        closesocket(hSocket);
-                }
-            }
-            else if (CNode::IsBanned(addr))
-            {
-                printf("connection from %s dropped (banned)\n", addr.ToString().c_str());
-                closesocket(hSocket);
-            }
-            else
-            {
-                printf("accepted connection %s\n", addr.ToString().c_str());
-                CNode* pnode = new CNode(hSocket, addr, "", true);
-                pnode->AddRef();
-                {
-                    LOCK(cs_vNodes);
-                    vNodes.push_back(pnode);
-                }
-            }
+            bool fBackOff = false;
+            AcceptConnection(hListenSocket, fBackOff);
         }
 
 
@@ -982,38 +1386,7 @@ void ThreadSocketHandler()
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                printf("socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    printf("socket recv error %d\n", nErr);
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+                    SocketRecvData(pnode);
             }
 
             //
@@ -1031,26 +1404,7 @@ void ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            if (pnode->vSendMsg.empty())
-                pnode->nLastSendEmpty = GetTime();
-            if (GetTime() - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    printf("socket no message in first 60 seconds, %d %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0);
-                    pnode->fDisconnect = true;
-                }
-                else if (GetTime() - pnode->nLastSend > 90*60 && GetTime() - pnode->nLastSendEmpty > 90*60)
-                {
-                    printf("socket not sending\n");
-                    pnode->fDisconnect = true;
-                }
-                else if (GetTime() - pnode->nLastRecv > 90*60)
-                {
-                    printf("socket inactivity timeout\n");
-                    pnode->fDisconnect = true;
-                }
-            }
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -1540,6 +1894,8 @@ void static StartSync(const vector<CNode*> &vNodes) {
 void ThreadMessageHandler()
 {
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
+    set<CNode*> setReady;
+    int64 nLastSweep = 0;
     while (true)
     {
         bool fHaveSyncNode = false;
@@ -1558,17 +1914,26 @@ void ThreadMessageHandler()
         if (!fHaveSyncNode)
             StartSync(vNodesCopy);
 
+        // Every 100ms visit all nodes, for trickling, pings and nodes that were
+        // waiting for send buffer space; otherwise only those with new messages
+        bool fSweep = GetTimeMillis() - nLastSweep >= 100;
+        if (fSweep)
+            nLastSweep = GetTimeMillis();
+
         // Poll the connected nodes for messages
         CNode* pnodeTrickle = NULL;
-        if (!vNodesCopy.empty())
+        if (fSweep && !vNodesCopy.empty())
             pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
 
-        bool fSleep = true;
+        set<CNode*> setMore;
+        set<CNode*> setBusy;
 
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
             if (pnode->fDisconnect)
                 continue;
+            if (!fSweep && !setReady.count(pnode))
+                continue;
 
             // Receive messages
             {
@@ -1582,10 +1947,12 @@ void ThreadMessageHandler()
                     {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
                         {
-                            fSleep = false;
+                            setMore.insert(pnode);
                         }
                     }
                 }
+                else
+                    setBusy.insert(pnode);
             }
             boost::this_thread::interruption_point();
 
@@ -1604,8 +1971,17 @@ void ThreadMessageHandler()
                 pnode->Release();
         }
 
-        if (fSleep)
-            MilliSleep(100);
+        // Sleep until a node gets a message or the next sweep is due, unless
+        // there are nodes left with work to do. Nodes whose receive buffer the
+        // socket thread had locked are retried shortly, rather than spinning.
+        int64 nWait = std::max((int64)0, nLastSweep + 100 - GetTimeMillis());
+        if (!setBusy.empty())
+            nWait = std::min(nWait, (int64)MESSAGE_HANDLER_RETRY_MILLIS);
+        if (!setMore.empty())
+            nWait = 0;
+        WaitForMessages(nWait, setReady);
+        setReady.insert(setMore.begin(), setMore.end());
+        setReady.insert(setBusy.begin(), setBusy.end());
     }
 }
 
@@ -1902,9 +2278,10 @@ void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataSt
         LOCK(pnode->cs_filter);
         if (pnode->pfilter)
         {
-            if (pnode->pfilter->IsRelevantAndUpdate(tx, hash))
-                pnode->PushInventory(inv);
-        } else
-            pnode->PushInventory(inv);
+            if (!pnode->pfilter->IsRelevantAndUpdate(tx, hash))
+                continue;
+        }
+        pnode->PushInventory(inv);
+        WakeMessageHandler(pnode);
     }
 }
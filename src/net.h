@@ -30,6 +30,8 @@ extern int nBestHeight;
 
 inline unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 inline unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
+/** Receive buffers grow by up to this many bytes at a time as message data arrives */
+static const unsigned int RECV_CHUNK_SIZE = 256 * 1024;
 
 void AddOneShot(std::string strDest);
 bool RecvLine(SOCKET hSocket, std::string& strLine);
@@ -44,6 +46,8 @@ bool BindListenPort(const CService &bindAddr, std::string& strError=REF(std::str
 void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+bool SetupEpoll();
+void WakeMessageHandler(CNode *pnode);
 
 enum
 {
@@ -75,6 +79,7 @@ extern uint64 nLocalServices;
 extern uint64 nLocalHostNonce;
 extern CAddrMan addrman;
 extern int nMaxConnections;
+extern bool fNetEpoll;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -105,7 +110,13 @@ public:
     uint64 nSendBytes;
     uint64 nRecvBytes;
     uint64 nBlocksRequested;
+    bool fSendQueue; // whether nSendSize and nSendMsgs were read (cs_vSend was free)
+    size_t nSendSize; // bytes queued to send
+    size_t nSendMsgs; // messages queued to send
+    bool fRecvQueue; // whether nRecvSize and dProcessDelay were read (cs_vRecvMsg was free)
+    size_t nRecvSize; // bytes received and not processed yet
     bool fSyncNode;
+    double dProcessDelay; // average time in ms from receiving a message to processing it
 };
 
 
@@ -122,11 +133,20 @@ public:
     CDataStream vRecv;              // received message data
     unsigned int nDataPos;
 
+    int64 nTime;                    // time (in microseconds) the message was completed
+
     CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
+        nTime = 0;
+    }
+
+    // bytes of the message received so far, header included
+    unsigned int size() const
+    {
+        return nHdrPos + nDataPos;
     }
 
     bool complete() const
@@ -163,12 +183,17 @@ public:
     uint64 nSendBytes;
     std::deque<CSerializeData> vSendMsg;
     CCriticalSection cs_vSend;
+    bool fEpollOut; // socket is registered for writability (protected by cs_vSend)
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    size_t nRecvSize; // bytes of vRecvMsg entries received so far (protected by cs_vRecvMsg)
     uint64 nRecvBytes;
     int nRecvVersion;
+    // Time between completing and processing messages (protected by cs_vRecvMsg)
+    int64 nProcessDelayTotal;
+    uint64 nMessagesProcessed;
 
     int64 nLastSend;
     int64 nLastRecv;
@@ -214,6 +239,11 @@ public:
     int nStartingHeight;
     bool fStartSync;
 
+    // Headers-first block download, protected by cs_main
+    int nBestKnownHeight;      // height of the best header this peer sent or announced
+    int nBlocksInFlight;       // blocks requested from this peer and not received yet
+    int64 nStallingSince;      // when it started holding up the download window, or 0
+
     // flood relay
     std::vector<CAddress> vAddrToSend;
     std::set<CAddress> setAddrKnown;
@@ -235,6 +265,9 @@ public:
         nLastRecv = 0;
         nSendBytes = 0;
         nRecvBytes = 0;
+        nRecvSize = 0;
+        nProcessDelayTotal = 0;
+        nMessagesProcessed = 0;
         nLastSendEmpty = GetTime();
         nTimeConnected = GetTime();
         nBlocksRequested = 0;
@@ -248,6 +281,7 @@ public:
         fNetworkNode = false;
         fSuccessfullyConnected = false;
         fDisconnect = false;
+        fEpollOut = false;
         nRefCount = 0;
         nSendSize = 0;
         nSendOffset = 0;
@@ -256,6 +290,9 @@ public:
         hashLastGetBlocksEnd = 0;
         nStartingHeight = -1;
         fStartSync = false;
+        nBestKnownHeight = -1;
+        nBlocksInFlight = 0;
+        nStallingSince = 0;
         fGetAddr = false;
         nMisbehavior = 0;
         fRelayTxes = false;
@@ -293,10 +330,16 @@ public:
     // requires LOCK(cs_vRecvMsg)
     unsigned int GetTotalRecvSize()
     {
-        unsigned int total = 0;
-        BOOST_FOREACH(const CNetMessage &msg, vRecvMsg) 
-            total += msg.vRecv.size() + 24;
-        return total;
+        return nRecvSize;
+    }
+
+    // Remove processed messages from the front of vRecvMsg
+    // requires LOCK(cs_vRecvMsg)
+    void EraseRecvMsg(std::deque<CNetMessage>::iterator itEnd)
+    {
+        for (std::deque<CNetMessage>::iterator it = vRecvMsg.begin(); it != itEnd; it++)
+            nRecvSize -= (*it).size();
+        vRecvMsg.erase(vRecvMsg.begin(), itEnd);
     }
 
     // requires LOCK(cs_vRecvMsg)
@@ -350,9 +393,13 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
-                vInventoryToSend.push_back(inv);
+            if (setInventoryKnown.count(inv))
+                return;
+            vInventoryToSend.push_back(inv);
         }
+        // Announce blocks on the next pass of the message handler, not the next sweep
+        if (inv.type == MSG_BLOCK)
+            WakeMessageHandler(this);
     }
 
     void AskFor(const CInv& inv)
@@ -446,6 +493,21 @@ public:
         LEAVE_CRITICAL_SECTION(cs_vSend);
     }
 
+    // Queue a message that is already serialized in full, header included
+    void PushSerializedMessage(const CSerializeData &vMessage)
+    {
+        LOCK(cs_vSend);
+        if (fDebug)
+            printf("sending: serialized message (%" PRIszu " bytes)\n", vMessage.size() - CMessageHeader::HEADER_SIZE);
+
+        std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), vMessage);
+        nSendSize += (*it).size();
+
+        // If write queue empty, attempt "optimistic write"
+        if (it == vSendMsg.begin())
+            SocketSendData(this);
+    }
+
     void PushVersion();
 
 
@@ -0,0 +1,152 @@
+// Copyright (c) 2014 The CasinoCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pushnotify.h"
+#include "compat.h"
+#include "sync.h"
+#include "ui_interface.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <boost/foreach.hpp>
+
+#ifndef WIN32
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+using namespace std;
+
+#ifndef WIN32
+static CCriticalSection cs_pushnotify;
+static SOCKET hListenSocket = INVALID_SOCKET;
+static vector<SOCKET> vPushClients;
+static boost::filesystem::path pathPushSocket;
+static boost::signals2::connection connBestBlock, connTransaction;
+
+static void PushLine(const string& strLine)
+{
+    LOCK(cs_pushnotify);
+    vector<SOCKET>::iterator it = vPushClients.begin();
+    while (it != vPushClients.end())
+    {
+        int nBytes = send(*it, strLine.data(), strLine.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (nBytes == (int)strLine.size())
+        {
+            it++;
+            continue;
+        }
+
+        // Gone, or so far behind that the line doesn't fit; rather than send
+        // part of it, drop the client
+        if (fDebug)
+            printf("PushLine() : dropping client (error %d)\n", nBytes < 0 ? WSAGetLastError() : 0);
+        closesocket(*it);
+        it = vPushClients.erase(it);
+    }
+}
+
+static void PushBestBlock(const uint256& hash)
+{
+    PushLine("block " + hash.GetHex() + "\n");
+}
+
+static void PushTransaction(const uint256& hash)
+{
+    PushLine("tx " + hash.GetHex() + "\n");
+}
+
+static void ThreadPushNotify()
+{
+    while (true)
+    {
+        boost::this_thread::interruption_point();
+
+        fd_set fdsetRecv;
+        FD_ZERO(&fdsetRecv);
+        FD_SET(hListenSocket, &fdsetRecv);
+        struct timeval timeout;
+        timeout.tv_sec  = 0;
+        timeout.tv_usec = 200000;
+        if (select(hListenSocket + 1, &fdsetRecv, NULL, NULL, &timeout) <= 0)
+            continue;
+
+        SOCKET hSocket = accept(hListenSocket, NULL, NULL);
+        if (hSocket == INVALID_SOCKET)
+            continue;
+        LOCK(cs_pushnotify);
+        vPushClients.push_back(hSocket);
+    }
+}
+#endif
+
+bool StartPushNotify(boost::thread_group& threadGroup, std::string& strError)
+{
+    if (!mapArgs.count("-pushsocket"))
+        return true;
+
+#ifdef WIN32
+    strError = _("-pushsocket is not supported on this platform");
+    return false;
+#else
+    boost::filesystem::path path(mapArgs["-pushsocket"]);
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.string().size() >= sizeof(addr.sun_path))
+    {
+        strError = strprintf(_("Socket path %s is too long"), path.string().c_str());
+        return false;
+    }
+    strncpy(addr.sun_path, path.string().c_str(), sizeof(addr.sun_path) - 1);
+
+    // A socket left behind by an earlier run
+    struct stat st;
+    if (stat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(addr.sun_path);
+
+    hListenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (hListenSocket == INVALID_SOCKET)
+    {
+        strError = strprintf(_("Error: Couldn't open socket for push notifications (socket returned error %d)"), WSAGetLastError());
+        return false;
+    }
+    if (bind(hListenSocket, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(hListenSocket, SOMAXCONN) == SOCKET_ERROR)
+    {
+        strError = strprintf(_("Unable to bind to %s on this computer (bind returned error %d, %s)"),
+                             path.string().c_str(), WSAGetLastError(), strerror(WSAGetLastError()));
+        closesocket(hListenSocket);
+        return false;
+    }
+    pathPushSocket = path;
+    printf("Publishing notifications on %s\n", path.string().c_str());
+
+    connBestBlock = uiInterface.NotifyBestBlockChanged.connect(&PushBestBlock);
+    connTransaction = uiInterface.NotifyTransactionAccepted.connect(&PushTransaction);
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "pushnotify", &ThreadPushNotify));
+    return true;
+#endif
+}
+
+void StopPushNotify()
+{
+#ifndef WIN32
+    if (hListenSocket == INVALID_SOCKET)
+        return;
+
+    connBestBlock.disconnect();
+    connTransaction.disconnect();
+
+    LOCK(cs_pushnotify);
+    BOOST_FOREACH(SOCKET& hSocket, vPushClients)
+        closesocket(hSocket);
+    vPushClients.clear();
+    closesocket(hListenSocket);
+    boost::filesystem::remove(pathPushSocket);
+#endif
+}
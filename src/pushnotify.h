@@ -0,0 +1,18 @@
+// Copyright (c) 2014 The CasinoCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_PUSHNOTIFY_H
+#define BITCOIN_PUSHNOTIFY_H
+
+#include <string>
+
+#include <boost/thread.hpp>
+
+/** Publish new best blocks and memory pool transactions to the clients of
+ *  the local socket at -pushsocket, one line each: "block <hash>" or
+ *  "tx <hash>". Clients that don't keep up are disconnected.
+ */
+bool StartPushNotify(boost::thread_group& threadGroup, std::string& strError);
+void StopPushNotify();
+
+#endif
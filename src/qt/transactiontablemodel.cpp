@@ -50,7 +50,9 @@ class TransactionTablePriv
 public:
     TransactionTablePriv(CWallet *wallet, TransactionTableModel *parent):
             wallet(wallet),
-            parent(parent)
+            parent(parent),
+            loaded(false),
+            cachedTip(0)
     {
     }
     CWallet *wallet;
@@ -62,20 +64,59 @@ public:
      */
     QList<TransactionRecord> cachedWallet;
 
-    /* Query entire wallet anew from core.
+    /* Transactions are read into the cache a batch at a time, in the
+     * wallet's order, so that the table shows before a large wallet is
+     * read. Those from hashLoadNext on are still to come.
      */
-    void refreshWallet()
+    bool loaded;
+    uint256 hashLoadNext;
+
+    /* Tip for which the unstable rows were last brought up to date */
+    CBlockIndex *cachedTip;
+
+    /* Read the next nCount transactions from the core into the cache.
+       Returns whether there are more.
+     */
+    bool loadWallet(int nCount)
     {
-        OutputDebugStringF("refreshWallet\n");
-        cachedWallet.clear();
+        if(loaded)
+            return false;
+        QList<TransactionRecord> toInsert;
         {
             LOCK(wallet->cs_wallet);
-            for(std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
+            std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.lower_bound(hashLoadNext);
+            for(int n = 0; it != wallet->mapWallet.end() && n < nCount; ++it, ++n)
             {
                 if(TransactionRecord::showTransaction(it->second))
-                    cachedWallet.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                    toInsert.append(TransactionRecord::decomposeTransaction(wallet, it->second));
             }
+            if(it == wallet->mapWallet.end())
+                loaded = true;
+            else
+                hashLoadNext = it->first;
+        }
+        OutputDebugStringF("loadWallet %i records, %s\n", toInsert.size(), loaded ? "done" : "more to come");
+
+        // Everything loaded so far sorts before these
+        if(!toInsert.isEmpty())
+        {
+            parent->beginInsertRows(QModelIndex(), cachedWallet.size(), cachedWallet.size()+toInsert.size()-1);
+            cachedWallet.append(toInsert);
+            parent->endInsertRows();
         }
+        return !loaded;
+    }
+
+    /* Whether the status of rec can change with the next block, short of
+       a reorganisation. Rows whose status was never looked at don't count;
+       it is worked out when they are.
+     */
+    static bool statusUnstable(const TransactionRecord &rec)
+    {
+        if(rec.status.cur_num_blocks == -1)
+            return false;
+        return rec.status.status != TransactionStatus::HaveConfirmations ||
+               rec.status.maturity != TransactionStatus::Mature;
     }
 
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
@@ -86,6 +127,10 @@ public:
     void updateWallet(const uint256 &hash, int status)
     {
         OutputDebugStringF("updateWallet %s %i\n", hash.ToString().c_str(), status);
+
+        // Not loaded yet; loadWallet() will find it as it is then
+        if(!loaded && !(hash < hashLoadNext))
+            return;
         {
             LOCK(wallet->cs_wallet);
 
@@ -224,7 +269,8 @@ TransactionTableModel::TransactionTableModel(CWallet* wallet, WalletModel *paren
 {
     columns << QString() << tr("Date") << tr("Type") << tr("Address") << tr("Amount");
 
-    priv->refreshWallet();
+    priv->loadWallet(MODEL_LOAD_BATCH);
+    QTimer::singleShot(0, this, SLOT(loadTransactions()));
 
     QTimer *timer = new QTimer(this);
     connect(timer, SIGNAL(timeout()), this, SLOT(updateConfirmations()));
@@ -246,17 +292,51 @@ void TransactionTableModel::updateTransaction(const QString &hash, int status)
     priv->updateWallet(updated, status);
 }
 
+void TransactionTableModel::loadTransactions()
+{
+    // One batch per pass through the event loop, so the GUI stays responsive
+    if(priv->loadWallet(MODEL_LOAD_BATCH))
+        QTimer::singleShot(0, this, SLOT(loadTransactions()));
+}
+
 void TransactionTableModel::updateConfirmations()
 {
     if(nBestHeight != cachedNumBlocks)
     {
         cachedNumBlocks = nBestHeight;
+
         // Blocks came in since last poll.
-        // Invalidate status (number of confirmations) and (possibly) description
-        //  for all rows. Qt is smart enough to only actually request the data for the
-        //  visible rows.
-        emit dataChanged(index(0, Status), index(priv->size()-1, Status));
-        emit dataChanged(index(0, ToAddress), index(priv->size()-1, ToAddress));
+        // After a reorganisation any row may have changed, so invalidate status
+        // (number of confirmations) and (possibly) description for all of them.
+        // Otherwise only rows not yet confirmed and mature change in ways that
+        // matter for sorting and filtering; the others are brought up to date
+        // as they are shown.
+        CBlockIndex *pindexOld = priv->cachedTip;
+        priv->cachedTip = pindexBest;
+        bool fReorganized = pindexOld && pindexOld != pindexBest && !pindexOld->pnext;
+        if(fReorganized)
+        {
+            emit dataChanged(index(0, Status), index(priv->size()-1, Status));
+            emit dataChanged(index(0, ToAddress), index(priv->size()-1, ToAddress));
+            return;
+        }
+
+        // Emit the unstable rows as contiguous ranges
+        int size = priv->size();
+        for(int begin = 0; begin < size; )
+        {
+            if(!TransactionTablePriv::statusUnstable(priv->cachedWallet.at(begin)))
+            {
+                ++begin;
+                continue;
+            }
+            int end = begin;
+            while(end + 1 < size && TransactionTablePriv::statusUnstable(priv->cachedWallet.at(end + 1)))
+                ++end;
+            emit dataChanged(index(begin, Status), index(end, Status));
+            emit dataChanged(index(begin, ToAddress), index(end, ToAddress));
+            begin = end + 1;
+        }
     }
 }
 
@@ -621,7 +701,7 @@ QModelIndex TransactionTableModel::index(int row, int column, const QModelIndex
     TransactionRecord *data = priv->index(row);
     if(data)
     {
-        return createIndex(row, column, priv->index(row));
+        return createIndex(row, column, data);
     }
     else
     {
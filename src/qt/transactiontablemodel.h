@@ -80,6 +80,10 @@ public slots:
     void updateConfirmations();
     void updateDisplayUnit();
 
+private slots:
+    /* Read the next batch of wallet transactions into the table */
+    void loadTransactions();
+
     friend class TransactionTablePriv;
 };
 
@@ -107,10 +107,36 @@ void WalletModel::checkBalanceChanged()
     }
 }
 
-void WalletModel::updateTransaction(const QString &hash, int status)
+bool WalletModel::queueTransaction(const QString &hash, int status)
 {
+    QMutexLocker locker(&pendingMutex);
+    QHash<QString, int>::const_iterator it = pendingIndex.constFind(hash);
+    if(it != pendingIndex.constEnd())
+    {
+        // Changed again; let the table work out what it amounts to
+        pendingTransactions[it.value()].second = CT_UPDATED;
+        return false;
+    }
+    pendingIndex.insert(hash, pendingTransactions.size());
+    pendingTransactions.append(qMakePair(hash, status));
+    return pendingTransactions.size() == 1;
+}
+
+void WalletModel::updateTransactions()
+{
+    QList<QPair<QString, int> > updates;
+    {
+        QMutexLocker locker(&pendingMutex);
+        updates = pendingTransactions;
+        pendingTransactions.clear();
+        pendingIndex.clear();
+    }
+
     if(transactionTableModel)
-        transactionTableModel->updateTransaction(hash, status);
+    {
+        for(int i = 0; i < updates.size(); ++i)
+            transactionTableModel->updateTransaction(updates[i].first, updates[i].second);
+    }
 
     // Balance and number of transactions might have changed
     checkBalanceChanged();
@@ -335,9 +361,9 @@ static void NotifyAddressBookChanged(WalletModel *walletmodel, CWallet *wallet,
 static void NotifyTransactionChanged(WalletModel *walletmodel, CWallet *wallet, const uint256 &hash, ChangeType status)
 {
     OutputDebugStringF("NotifyTransactionChanged %s status=%i\n", hash.GetHex().c_str(), status);
-    QMetaObject::invokeMethod(walletmodel, "updateTransaction", Qt::QueuedConnection,
-                              Q_ARG(QString, QString::fromStdString(hash.GetHex())),
-                              Q_ARG(int, status));
+    // A rescan or a block sends many at once; the GUI thread takes them together
+    if(walletmodel->queueTransaction(QString::fromStdString(hash.GetHex()), status))
+        QMetaObject::invokeMethod(walletmodel, "updateTransactions", Qt::QueuedConnection);
 }
 
 void WalletModel::subscribeToCoreSignals()
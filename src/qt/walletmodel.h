@@ -2,6 +2,10 @@
 #define WALLETMODEL_H
 
 #include <QObject>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
 #include <vector>
 #include <map>
 
@@ -126,6 +130,11 @@ public:
     void unlockCoin(COutPoint& output);
     void listLockedCoins(std::vector<COutPoint>& vOutpts);
 
+    /* Queue a transaction change from the core, for updateTransactions().
+       Returns true if the queue was empty, and the caller should invoke it.
+     */
+    bool queueTransaction(const QString &hash, int status);
+
 private:
     CWallet *wallet;
 
@@ -146,6 +155,11 @@ private:
 
     QTimer *pollTimer;
 
+    // Transaction changes not yet handled, in order, at most one per hash
+    QMutex pendingMutex;
+    QList<QPair<QString, int> > pendingTransactions;
+    QHash<QString, int> pendingIndex;
+
     void subscribeToCoreSignals();
     void unsubscribeFromCoreSignals();
     void checkBalanceChanged();
@@ -171,8 +185,8 @@ signals:
 public slots:
     /* Wallet status might have changed */
     void updateStatus();
-    /* New transaction, or transaction changed status */
-    void updateTransaction(const QString &hash, int status);
+    /* New transactions, or transactions changed status, since the last call */
+    void updateTransactions();
     /* New, updated or removed address book entry */
     void updateAddressBook(const QString &address, const QString &label, bool isMine, int status);
     /* Current, immature or unconfirmed balance might have changed - emit 'balanceChanged' if so */
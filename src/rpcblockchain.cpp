@@ -120,10 +120,60 @@ Value settxfee(const Array& params, bool fHelp)
 
 Value getrawmempool(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "getrawmempool\n"
-            "Returns all transaction ids in memory pool.");
+            "getrawmempool [verbose=false]\n"
+            "Returns all transaction ids in memory pool.\n"
+            "If verbose is true, returns an object for each of them with its size, fee,\n"
+            "time and height it entered the pool, priority, the count, size and fees\n"
+            "of its ancestors and descendants in the pool, themselves included, and\n"
+            "the pool transactions it spends.");
+
+    bool fVerbose = false;
+    if (params.size() > 0)
+        fVerbose = params[0].get_bool();
+
+    if (fVerbose)
+    {
+        // The height current priorities are computed at, taken before
+        // mempool.cs as everywhere else
+        int nHeight;
+        {
+            LOCK(cs_main);
+            nHeight = nBestHeight;
+        }
+
+        LOCK(mempool.cs);
+        Object o;
+        BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
+        {
+            const uint256& hash = entry.first;
+            const CTxMemPoolEntry& e = entry.second;
+            Object info;
+            info.push_back(Pair("size", (int)e.GetTxSize()));
+            info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
+            info.push_back(Pair("time", (boost::int64_t)e.GetTime()));
+            info.push_back(Pair("height", e.GetHeight()));
+            info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
+            info.push_back(Pair("currentpriority", e.GetPriority(nHeight)));
+            info.push_back(Pair("descendantcount", (boost::uint64_t)e.nCountWithDescendants));
+            info.push_back(Pair("descendantsize", (boost::uint64_t)e.nSizeWithDescendants));
+            info.push_back(Pair("descendantfees", ValueFromAmount(e.nFeesWithDescendants)));
+            info.push_back(Pair("ancestorcount", (boost::uint64_t)e.nCountWithAncestors));
+            info.push_back(Pair("ancestorsize", (boost::uint64_t)e.nSizeWithAncestors));
+            info.push_back(Pair("ancestorfees", ValueFromAmount(e.nFeesWithAncestors)));
+            set<string> setDepends;
+            BOOST_FOREACH(const CTxIn& txin, e.GetTx().vin)
+            {
+                if (mempool.exists(txin.prevout.hash))
+                    setDepends.insert(txin.prevout.hash.ToString());
+            }
+            Array depends(setDepends.begin(), setDepends.end());
+            info.push_back(Pair("depends", depends));
+            o.push_back(Pair(hash.ToString(), info));
+        }
+        return o;
+    }
 
     vector<uint256> vtxid;
     mempool.queryHashes(vtxid);
@@ -206,6 +256,47 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
     return ret;
 }
 
+Value getsigcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "Returns statistics about the signature verification cache.");
+
+    CSignatureCacheStats stats;
+    GetSignatureCacheStats(stats);
+
+    Object ret;
+    ret.push_back(Pair("entries", (boost::uint64_t)stats.nEntries));
+    ret.push_back(Pair("maxentries", (boost::uint64_t)stats.nMaxEntries));
+    ret.push_back(Pair("hits", (boost::uint64_t)stats.nHits));
+    ret.push_back(Pair("misses", (boost::uint64_t)stats.nMisses));
+    return ret;
+}
+
+Value getscriptcheckinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getscriptcheckinfo\n"
+            "Returns statistics about the script verification threads.");
+
+    CCheckQueueStats stats;
+    GetScriptCheckStats(stats);
+
+    Object ret;
+    ret.push_back(Pair("threads", stats.nThreads));
+    ret.push_back(Pair("checks", (boost::uint64_t)stats.nChecks));
+    ret.push_back(Pair("checkspersec", stats.nActiveMicros > 0 ? (double)stats.nChecks * 1000000 / stats.nActiveMicros : 0.0));
+    ret.push_back(Pair("checktime", stats.dCheckMicros));
+    ret.push_back(Pair("batches", (boost::uint64_t)stats.nBatches));
+    ret.push_back(Pair("batchsize", (boost::uint64_t)stats.nBatchSize));
+    ret.push_back(Pair("steals", (boost::uint64_t)stats.nSteals));
+    ret.push_back(Pair("activetime", (boost::int64_t)(stats.nActiveMicros / 1000)));
+    ret.push_back(Pair("idletime", (boost::int64_t)(stats.nIdleMicros / 1000)));
+    return ret;
+}
+
 Value gettxout(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
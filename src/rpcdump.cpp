@@ -97,6 +97,9 @@ Value importaddress(const Array& params, bool fHelp)
     if (fRescan)
     {
         pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true);
+        // Checked before re-accepting, which may start a rescan of its own
+        if (pwalletMain->IsAbortingRescan())
+            throw JSONRPCError(RPC_MISC_ERROR, "Rescan aborted");
         pwalletMain->ReacceptWalletTransactions();
     }
 
@@ -141,6 +144,9 @@ Value importprivkey(const Array& params, bool fHelp)
 
         if (fRescan) {
             pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true);
+            // Checked before re-accepting, which may start a rescan of its own
+            if (pwalletMain->IsAbortingRescan())
+                throw JSONRPCError(RPC_MISC_ERROR, "Rescan aborted");
             pwalletMain->ReacceptWalletTransactions();
         }
     }
@@ -148,6 +154,43 @@ Value importprivkey(const Array& params, bool fHelp)
     return Value::null;
 }
 
+Value abortrescan(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "abortrescan\n"
+            "Stops the wallet rescan started by importprivkey or importaddress.\n"
+            "Returns false if no rescan was running.");
+
+    CWalletScanStatus status;
+    pwalletMain->GetScanStatus(status);
+    if (!status.fScanning)
+        return false;
+    pwalletMain->AbortRescan();
+    return true;
+}
+
+Value getrescaninfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrescaninfo\n"
+            "Returns the progress of the wallet rescan in progress, or of the last one.");
+
+    CWalletScanStatus status;
+    pwalletMain->GetScanStatus(status);
+    Object obj;
+    obj.push_back(Pair("scanning",      status.fScanning));
+    obj.push_back(Pair("startheight",   status.nStartHeight));
+    obj.push_back(Pair("height",        status.nHeight));
+    obj.push_back(Pair("endheight",     status.nEndHeight));
+    obj.push_back(Pair("progress",      status.dProgress));
+    obj.push_back(Pair("duration",      status.nStartTime ? (boost::int64_t)(GetTime() - status.nStartTime) : (boost::int64_t)0));
+    if (status.fScanning && status.nRemaining >= 0)
+        obj.push_back(Pair("remaining", (boost::int64_t)status.nRemaining));
+    return obj;
+}
+
 Value dumpprivkey(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
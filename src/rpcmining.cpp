@@ -11,6 +11,11 @@
 using namespace json_spirit;
 using namespace std;
 
+/** Fees the memory pool has to gain for a long poll to be answered */
+static const int64 LONGPOLL_FEE_GAIN = CENT;
+/** Seconds after which any change to the memory pool answers a long poll */
+static const int64 LONGPOLL_REFRESH_INTERVAL = 60;
+
 // Return average network hashes per second based on the last 'lookup' blocks,
 // or from the last difficulty change if 'lookup' is nonpositive.
 // If 'height' is nonnegative, compute the estimate at the time when a given block was found.
@@ -158,10 +163,36 @@ Value getmininginfo(const Array& params, bool fHelp)
     obj.push_back(Pair("networkhashps", getnetworkhashps(params, false)));
     obj.push_back(Pair("pooledtx",      (uint64_t)mempool.size()));
     obj.push_back(Pair("testnet",       fTestNet));
+
+    CBlockTemplateStats stats;
+    GetBlockTemplateStats(stats);
+    Object templ;
+    templ.push_back(Pair("previousblockhash", stats.hashPrevBlock.GetHex()));
+    templ.push_back(Pair("age",         (int64_t)(stats.nTimeBuilt ? GetTime() - stats.nTimeBuilt : -1)));
+    templ.push_back(Pair("buildms",     0.001 * stats.nBuildMicros));
+    templ.push_back(Pair("tx",          (int)stats.nTx));
+    templ.push_back(Pair("builds",      (uint64_t)stats.nBuilds));
+    templ.push_back(Pair("requests",    (uint64_t)stats.nRequests));
+    obj.push_back(Pair("template",      templ));
     return obj;
 }
 
 
+// A copy of the shared block template that pays to a key of the wallet, for
+// getwork to fill in the extra nonce of
+static CBlockTemplate* CopyBlockTemplateWithKey(const CBlockTemplate& blocktemplate, CReserveKey& reservekey)
+{
+    CPubKey pubkey;
+    if (!reservekey.GetReservedKey(pubkey))
+        return NULL;
+
+    CBlockTemplate* pblocktemplate = new CBlockTemplate(blocktemplate);
+    CTransaction& txCoinbase = pblocktemplate->block.vtx[0];
+    txCoinbase.vout[0].scriptPubKey = CScript() << pubkey << OP_CHECKSIG;
+    pblocktemplate->vTxSigOps[0] = txCoinbase.GetLegacySigOpCount();
+    return pblocktemplate;
+}
+
 Value getworkex(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 2)
@@ -184,14 +215,16 @@ Value getworkex(const Array& params, bool fHelp)
     if (params.size() == 0)
     {
         // Update block
-        static unsigned int nTransactionsUpdatedLast;
         static CBlockIndex* pindexPrev;
-        static int64 nStart;
+        static boost::shared_ptr<const CBlockTemplate> pblocktemplateShared;
         static CBlockTemplate* pblocktemplate;
-        if (pindexPrev != pindexBest ||
-            (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 60))
+        CBlockIndex* pindexPrevNew = NULL;
+        boost::shared_ptr<const CBlockTemplate> pblocktemplateNew = GetSharedBlockTemplate(60, pindexPrevNew);
+        if (!pblocktemplateNew)
+            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+        if (pblocktemplateNew != pblocktemplateShared)
         {
-            if (pindexPrev != pindexBest)
+            if (pindexPrev != pindexPrevNew)
             {
                 // Deallocate old blocks since they're obsolete now
                 mapNewBlock.clear();
@@ -202,20 +235,17 @@ Value getworkex(const Array& params, bool fHelp)
 
             // Clear pindexPrev so future getworks make a new block, despite any failures from here on
             pindexPrev = NULL;
-
-            // Store the pindexBest used before CreateNewBlock, to avoid races
-            nTransactionsUpdatedLast = nTransactionsUpdated;
-            CBlockIndex* pindexPrevNew = pindexBest;
-            nStart = GetTime();
+            pblocktemplateShared.reset();
 
             // Create new block
-            pblocktemplate = CreateNewBlockWithKey(*pMiningKey);
+            pblocktemplate = CopyBlockTemplateWithKey(*pblocktemplateNew, *pMiningKey);
             if (!pblocktemplate)
                 throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
             vNewBlockTemplate.push_back(pblocktemplate);
 
-            // Need to update only after we know CreateNewBlock succeeded
+            // Need to update only after we know the copy succeeded
             pindexPrev = pindexPrevNew;
+            pblocktemplateShared = pblocktemplateNew;
         }
         CBlock* pblock = &pblocktemplate->block; // pointer for convenience
 
@@ -323,14 +353,16 @@ Value getwork(const Array& params, bool fHelp)
     if (params.size() == 0)
     {
         // Update block
-        static unsigned int nTransactionsUpdatedLast;
         static CBlockIndex* pindexPrev;
-        static int64 nStart;
+        static boost::shared_ptr<const CBlockTemplate> pblocktemplateShared;
         static CBlockTemplate* pblocktemplate;
-        if (pindexPrev != pindexBest ||
-            (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 60))
+        CBlockIndex* pindexPrevNew = NULL;
+        boost::shared_ptr<const CBlockTemplate> pblocktemplateNew = GetSharedBlockTemplate(60, pindexPrevNew);
+        if (!pblocktemplateNew)
+            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+        if (pblocktemplateNew != pblocktemplateShared)
         {
-            if (pindexPrev != pindexBest)
+            if (pindexPrev != pindexPrevNew)
             {
                 // Deallocate old blocks since they're obsolete now
                 mapNewBlock.clear();
@@ -341,20 +373,17 @@ Value getwork(const Array& params, bool fHelp)
 
             // Clear pindexPrev so future getworks make a new block, despite any failures from here on
             pindexPrev = NULL;
-
-            // Store the pindexBest used before CreateNewBlock, to avoid races
-            nTransactionsUpdatedLast = nTransactionsUpdated;
-            CBlockIndex* pindexPrevNew = pindexBest;
-            nStart = GetTime();
+            pblocktemplateShared.reset();
 
             // Create new block
-            pblocktemplate = CreateNewBlockWithKey(*pMiningKey);
+            pblocktemplate = CopyBlockTemplateWithKey(*pblocktemplateNew, *pMiningKey);
             if (!pblocktemplate)
                 throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
             vNewBlockTemplate.push_back(pblocktemplate);
 
-            // Need to update only after we know CreateNewBlock succeeded
+            // Need to update only after we know the copy succeeded
             pindexPrev = pindexPrevNew;
+            pblocktemplateShared = pblocktemplateNew;
         }
         CBlock* pblock = &pblocktemplate->block; // pointer for convenience
 
@@ -412,6 +441,26 @@ Value getwork(const Array& params, bool fHelp)
 }
 
 
+// Whether a long poll on a template built on hashPrevBlock, when the memory
+// pool held nPoolFees in fees, is to be answered
+bool IsLongPollDone(uint256 hashPrevBlock, int64 nPoolFees, unsigned int nTransactionsUpdatedStart, int64 nTimeStart)
+{
+    if (ShutdownRequested())
+        return true;
+
+    // Polled from the deferral thread; if the chain is busy, look again next time
+    TRY_LOCK(cs_main, lockMain);
+    if (!lockMain)
+        return false;
+    if (pindexBest == NULL || pindexBest->GetBlockHash() != hashPrevBlock)
+        return true;
+    if (mempool.GetTotalFees() >= nPoolFees + LONGPOLL_FEE_GAIN)
+        return true;
+
+    // After a while, any change to the pool will do
+    return nTransactionsUpdated != nTransactionsUpdatedStart && GetTime() - nTimeStart >= LONGPOLL_REFRESH_INTERVAL;
+}
+
 Value getblocktemplate(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -432,12 +481,21 @@ Value getblocktemplate(const Array& params, bool fHelp)
             "  \"sizelimit\" : limit of block size\n"
             "  \"bits\" : compressed target of next block\n"
             "  \"height\" : height of the next block\n"
+            "  \"longpollid\" : id to pass back as \"longpollid\", for the call to return once the\n"
+            "      best block changes or the memory pool gains enough fees\n"
             "See https://en.bitcoin.it/wiki/BIP_0022 for full specification.");
 
     std::string strMode = "template";
+    std::string strLongPollId;
+    Object oparam;
     if (params.size() > 0)
     {
-        const Object& oparam = params[0].get_obj();
+        oparam = params[0].get_obj();
+        const Value& lpval = find_value(oparam, "longpollid");
+        if (lpval.type() == str_type)
+            strLongPollId = lpval.get_str();
+        else if (lpval.type() != null_type)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid longpollid");
         const Value& modeval = find_value(oparam, "mode");
         if (modeval.type() == str_type)
             strMode = modeval.get_str();
@@ -458,80 +516,88 @@ Value getblocktemplate(const Array& params, bool fHelp)
     if (IsInitialBlockDownload())
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, ""+ COIN_NAME_DISPLAY + " is downloading blocks...");
 
-    // Update block
-    static unsigned int nTransactionsUpdatedLast;
-    static CBlockIndex* pindexPrev;
-    static int64 nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != pindexBest ||
-        (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 5))
+    if (!strLongPollId.empty())
     {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = nTransactionsUpdated;
-        CBlockIndex* pindexPrevNew = pindexBest;
-        nStart = GetTime();
-
-        // Create new block
-        if(pblocktemplate)
-        {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
-        }
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = CreateNewBlock(scriptDummy);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
+        // The id is the previous block hash and the pool fees the template was built from
+        if (strLongPollId.size() <= 64 || !IsHex(strLongPollId.substr(0, 64)))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid longpollid");
+        uint256 hashWatched(strLongPollId.substr(0, 64));
+        int64 nFeesWatched = atoi64(strLongPollId.substr(64));
+
+        // Once the call is to be answered, it is made again without the id
+        CRPCDeferral deferral;
+        deferral.fnReady = boost::bind(&IsLongPollDone, hashWatched, nFeesWatched, nTransactionsUpdated, GetTime());
+        deferral.strMethod = "getblocktemplate";
+        Object oparamNew;
+        BOOST_FOREACH(const Pair& pair, oparam)
+            if (pair.name_ != "longpollid")
+                oparamNew.push_back(pair);
+        deferral.params.push_back(oparamNew);
+        if (!deferral.fnReady())
+            throw deferral;
     }
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
+
+    // Update block
+    CBlockIndex* pindexPrev = NULL;
+    boost::shared_ptr<const CBlockTemplate> pblocktemplate = GetSharedBlockTemplate(5, pindexPrev);
+    if (!pblocktemplate)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
     // Update nTime
-    pblock->UpdateTime(pindexPrev);
-    pblock->nNonce = 0;
+    CBlockHeader header = pblocktemplate->block.GetBlockHeader();
+    header.UpdateTime(pindexPrev);
 
+    // The transactions are encoded once for each template
+    static CCriticalSection cs_transactions;
+    static boost::shared_ptr<const CBlockTemplate> pblocktemplateLast;
+    static Array transactionsLast;
     Array transactions;
-    map<uint256, int64_t> setTxIndex;
-    int i = 0;
-    BOOST_FOREACH (CTransaction& tx, pblock->vtx)
     {
-        uint256 txHash = tx.GetHash();
-        setTxIndex[txHash] = i++;
+    LOCK(cs_transactions);
+    if (pblocktemplate != pblocktemplateLast)
+    {
+        transactionsLast.clear();
+        map<uint256, int64_t> setTxIndex;
+        int i = 0;
+        BOOST_FOREACH (const CTransaction& tx, pblocktemplate->block.vtx)
+        {
+            uint256 txHash = tx.GetHash();
+            setTxIndex[txHash] = i++;
 
-        if (tx.IsCoinBase())
-            continue;
+            if (tx.IsCoinBase())
+                continue;
 
-        Object entry;
+            Object entry;
 
-        CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
-        ssTx << tx;
-        entry.push_back(Pair("data", HexStr(ssTx.begin(), ssTx.end())));
+            CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+            ssTx << tx;
+            entry.push_back(Pair("data", HexStr(ssTx.begin(), ssTx.end())));
 
-        entry.push_back(Pair("hash", txHash.GetHex()));
+            entry.push_back(Pair("hash", txHash.GetHex()));
 
-        Array deps;
-        BOOST_FOREACH (const CTxIn &in, tx.vin)
-        {
-            if (setTxIndex.count(in.prevout.hash))
-                deps.push_back(setTxIndex[in.prevout.hash]);
-        }
-        entry.push_back(Pair("depends", deps));
+            Array deps;
+            BOOST_FOREACH (const CTxIn &in, tx.vin)
+            {
+                if (setTxIndex.count(in.prevout.hash))
+                    deps.push_back(setTxIndex[in.prevout.hash]);
+            }
+            entry.push_back(Pair("depends", deps));
 
-        int index_in_template = i - 1;
-        entry.push_back(Pair("fee", pblocktemplate->vTxFees[index_in_template]));
-        entry.push_back(Pair("sigops", pblocktemplate->vTxSigOps[index_in_template]));
+            int index_in_template = i - 1;
+            entry.push_back(Pair("fee", pblocktemplate->vTxFees[index_in_template]));
+            entry.push_back(Pair("sigops", pblocktemplate->vTxSigOps[index_in_template]));
 
-        transactions.push_back(entry);
+            transactionsLast.push_back(entry);
+        }
+        pblocktemplateLast = pblocktemplate;
+    }
+    transactions = transactionsLast;
     }
 
     Object aux;
     aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
 
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = CBigNum().SetCompact(header.nBits).getuint256();
 
     static Array aMutable;
     if (aMutable.empty())
@@ -542,20 +608,21 @@ Value getblocktemplate(const Array& params, bool fHelp)
     }
 
     Object result;
-    result.push_back(Pair("version", pblock->nVersion));
-    result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
+    result.push_back(Pair("version", header.nVersion));
+    result.push_back(Pair("previousblockhash", header.hashPrevBlock.GetHex()));
     result.push_back(Pair("transactions", transactions));
     result.push_back(Pair("coinbaseaux", aux));
-    result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue));
+    result.push_back(Pair("coinbasevalue", (int64_t)pblocktemplate->block.vtx[0].vout[0].nValue));
     result.push_back(Pair("target", hashTarget.GetHex()));
     result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
     result.push_back(Pair("mutable", aMutable));
     result.push_back(Pair("noncerange", "00000000ffffffff"));
     result.push_back(Pair("sigoplimit", (int64_t)MAX_BLOCK_SIGOPS));
     result.push_back(Pair("sizelimit", (int64_t)MAX_BLOCK_SIZE));
-    result.push_back(Pair("curtime", (int64_t)pblock->nTime));
-    result.push_back(Pair("bits", HexBits(pblock->nBits)));
+    result.push_back(Pair("curtime", (int64_t)header.nTime));
+    result.push_back(Pair("bits", HexBits(header.nBits)));
     result.push_back(Pair("height", (int64_t)(pindexPrev->nHeight+1)));
+    result.push_back(Pair("longpollid", pindexPrev->GetBlockHash().GetHex() + i64tostr(pblocktemplate->nPoolFees)));
 
     return result;
 }
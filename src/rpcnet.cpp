@@ -53,6 +53,12 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("lastrecv", (boost::int64_t)stats.nLastRecv));
         obj.push_back(Pair("bytessent", (boost::int64_t)stats.nSendBytes));
         obj.push_back(Pair("bytesrecv", (boost::int64_t)stats.nRecvBytes));
+        if (stats.fSendQueue) {
+            obj.push_back(Pair("sendqueuebytes", (boost::int64_t)stats.nSendSize));
+            obj.push_back(Pair("sendqueuemsgs", (boost::int64_t)stats.nSendMsgs));
+        }
+        if (stats.fRecvQueue)
+            obj.push_back(Pair("recvqueuebytes", (boost::int64_t)stats.nRecvSize));
         obj.push_back(Pair("blocksrequested", (boost::int64_t)stats.nBlocksRequested));
         obj.push_back(Pair("conntime", (boost::int64_t)stats.nTimeConnected));
         obj.push_back(Pair("version", stats.nVersion));
@@ -63,6 +69,8 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("inbound", stats.fInbound));
         obj.push_back(Pair("startingheight", stats.nStartingHeight));
         obj.push_back(Pair("banscore", stats.nMisbehavior));
+        if (stats.fRecvQueue)
+            obj.push_back(Pair("processdelay", stats.dProcessDelay));
         if (stats.fSyncNode)
             obj.push_back(Pair("syncnode", true));
 
@@ -75,8 +75,11 @@ Value getinfo(const Array& params, bool fHelp)
     if (pwalletMain) {
         obj.push_back(Pair("walletversion", pwalletMain->GetVersion()));
         obj.push_back(Pair("balance",       ValueFromAmount(pwalletMain->GetBalance())));
+        if (pwalletMain->HaveWatchOnly())
+            obj.push_back(Pair("watchonlybalance", ValueFromAmount(pwalletMain->GetWatchOnlyBalance())));
     }
     obj.push_back(Pair("blocks",        (int)nBestHeight));
+    obj.push_back(Pair("headers",       GetBestHeaderHeight()));
     obj.push_back(Pair("timeoffset",    (boost::int64_t)GetTimeOffset()));
     obj.push_back(Pair("connections",   (int)vNodes.size()));
     obj.push_back(Pair("proxy",         (proxy.first.IsValid() ? proxy.first.ToStringIPPort() : string())));
@@ -623,6 +626,8 @@ Value movecmd(const Array& params, bool fHelp)
 
     if (!walletdb.TxnCommit())
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
+    pwalletMain->AddAccountingEntry(debit);
+    pwalletMain->AddAccountingEntry(credit);
 
     return true;
 }
@@ -1080,11 +1085,10 @@ Value listtransactions(const Array& params, bool fHelp)
 
     Array ret;
 
-    std::list<CAccountingEntry> acentries;
-    CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
+    const CWallet::TxItems& txOrdered = pwalletMain->OrderedTxItems(strAccount);
 
     // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+    for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
     {
         CWalletTx *const pwtx = (*it).second.first;
         if (pwtx != 0)
@@ -1114,6 +1118,60 @@ Value listtransactions(const Array& params, bool fHelp)
     return ret;
 }
 
+Value listtransactionsafter(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "listtransactionsafter <account> [cursor] [count=100]\n"
+            "Returns the transactions for account <account> (\"*\" for all) that came after [cursor], oldest first,\n"
+            "as \"transactions\", and the cursor to continue from as \"cursor\". Without [cursor], starts\n"
+            "from the first transaction. Stops after at least [count] entries, or at the end, but never\n"
+            "splits the entries of one transaction between two calls.");
+
+    string strAccount = params[0].get_str();
+    int64 nOrderPos = -1;
+    if (params.size() > 1 && params[1].get_str() != "")
+    {
+        const string& strCursor = params[1].get_str();
+        if (strCursor.find_first_not_of("0123456789") != string::npos || strCursor.size() > 18)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        nOrderPos = atoi64(strCursor);
+    }
+    int nCount = 100;
+    if (params.size() > 2)
+        nCount = params[2].get_int();
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    Array transactions;
+    const CWallet::TxItems& txOrdered = pwalletMain->OrderedTxItems(strAccount);
+    CWallet::TxItems::const_iterator it = txOrdered.upper_bound(nOrderPos);
+    for (; it != txOrdered.end() && (int)transactions.size() < nCount; ++it)
+    {
+        CWalletTx *const pwtx = (*it).second.first;
+        if (pwtx != 0)
+            ListTransactions(*pwtx, strAccount, 0, true, transactions);
+        CAccountingEntry *const pacentry = (*it).second.second;
+        if (pacentry != 0)
+            AcentryToJSON(*pacentry, strAccount, transactions);
+        nOrderPos = (*it).first;
+    }
+
+    // Items sharing a position (only in wallets from before ordering) go together
+    for (; it != txOrdered.end() && (*it).first == nOrderPos; ++it)
+    {
+        if ((*it).second.first != 0)
+            ListTransactions(*(*it).second.first, strAccount, 0, true, transactions);
+        if ((*it).second.second != 0)
+            AcentryToJSON(*(*it).second.second, strAccount, transactions);
+    }
+
+    Object ret;
+    ret.push_back(Pair("transactions", transactions));
+    ret.push_back(Pair("cursor", nOrderPos < 0 ? string("") : i64tostr(nOrderPos)));
+    return ret;
+}
+
 Value listaccounts(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -1152,9 +1210,7 @@ Value listaccounts(const Array& params, bool fHelp)
         }
     }
 
-    list<CAccountingEntry> acentries;
-    CWalletDB(pwalletMain->strWalletFile).ListAccountCreditDebit("*", acentries);
-    BOOST_FOREACH(const CAccountingEntry& entry, acentries)
+    BOOST_FOREACH(const CAccountingEntry& entry, pwalletMain->laccentries)
         mapAccountBalances[entry.strAccount] += entry.nCreditDebit;
 
     Object ret;
@@ -1190,17 +1246,12 @@ Value listsinceblock(const Array& params, bool fHelp)
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter");
     }
 
-    int depth = pindex ? (1 + nBestHeight - pindex->nHeight) : -1;
-
     Array transactions;
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
-    {
-        CWalletTx tx = (*it).second;
-
-        if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions);
-    }
+    vector<const CWalletTx*> vwtx;
+    pwalletMain->GetTransactionsSince(pindex, vwtx);
+    BOOST_FOREACH(const CWalletTx* pwtx, vwtx)
+        ListTransactions(*pwtx, "*", 0, true, transactions);
 
     uint256 lastblock;
 
@@ -1611,20 +1662,56 @@ Value listlockunspent(const Array& params, bool fHelp)
 
 Value getcoinsupply(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() > 2)
+    if (fHelp || params.size() > 3)
         throw runtime_error(
-            "getcoinsupply [height]\n"
+            "getcoinsupply [height] [nocheckpoints=false] [verify=false]\n"
             "Returns the total number of issued coins at the current block.\n"
-            "Pass in [height] to inform about the coin supply for a certain block.");
+            "Pass in [height] to inform about the coin supply for a certain block.\n"
+            "With [verify] the supply stored in the block index is checked against the\n"
+            "unspent transaction output set, which never holds more than was issued.\n"
+            "The set is only known at the current block, which [height] must then be.");
 
     int height = nBestHeight;
     bool noCheckpoints = false;
+    bool fVerify = false;
     if (params.size() > 0) {
         height = (int) params[0].get_int();
         if(params.size() > 1){
             noCheckpoints = (bool) params[1].get_bool();
         }
+        if (params.size() > 2)
+            fVerify = params[2].get_bool();
     }
-    int64 coinSupply =  GetTotalCoinSupply(height,noCheckpoints);
-    return ValueFromAmount(coinSupply);
+    if (!fVerify) {
+        int64 coinSupply =  GetTotalCoinSupply(height,noCheckpoints);
+        return ValueFromAmount(coinSupply);
+    }
+
+    LOCK(cs_main);
+    if (height != nBestHeight)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Can only verify the supply at the current block");
+
+    // The coins database lags behind the tip until the cache is written out
+    if (!pcoinsTip->Flush())
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to write the unspent transaction output set");
+    CCoinsStats stats;
+    if (!pcoinsTip->GetStats(stats))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the unspent transaction output set");
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(stats.hashBlock);
+    if (mi == mapBlockIndex.end())
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unspent transaction output set is not at a known block");
+    CBlockIndex* pindex = (*mi).second;
+
+    int64 nStored = pindex->nMoneySupply;
+    int64 nSummed = GetTotalCoinSupply(pindex->nHeight, true);
+    Object ret;
+    ret.push_back(Pair("height", (boost::int64_t)pindex->nHeight));
+    ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
+    ret.push_back(Pair("supply", ValueFromAmount(nStored)));
+    ret.push_back(Pair("rewards", ValueFromAmount(nSummed)));
+    ret.push_back(Pair("utxo", ValueFromAmount(stats.nTotalAmount)));
+    // Unclaimed fees and rewards, and unspendable outputs
+    ret.push_back(Pair("unaccounted", ValueFromAmount(nStored - stats.nTotalAmount)));
+    ret.push_back(Pair("valid", (pindex->nStatus & BLOCK_HAVE_SUPPLY) && nStored == nSummed && stats.nTotalAmount <= nStored));
+    return ret;
 }
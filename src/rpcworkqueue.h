@@ -0,0 +1,165 @@
+// Copyright (c) 2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef RPCWORKQUEUE_H
+#define RPCWORKQUEUE_H
+
+#include "util.h"
+
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/foreach.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <list>
+
+//
+// The RPC server frames HTTP requests asynchronously on a single I/O thread,
+// and hands them to the -rpcthreads workers through a queue of at most
+// -rpcworkqueue requests. A slow call holds one worker rather than a
+// connection, and idle keep-alive connections hold nothing.
+//
+
+/** Counters kept by a CRPCWorkQueue, see CRPCWorkQueue::GetStats() */
+struct CRPCWorkQueueStats
+{
+    size_t nDepth;          // jobs waiting for a worker
+    size_t nMaxDepth;       // jobs that may wait before new ones are turned away
+    size_t nHighWater;      // most jobs ever waiting at once
+    uint64 nRejected;       // jobs turned away because the queue was full
+    int nActive;            // jobs being run by a worker
+};
+
+class CRPCWorkQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<boost::function<void ()> > queue;
+    CRPCWorkQueueStats stats;
+    bool fRunning;
+
+public:
+    CRPCWorkQueue(size_t nMaxDepth) : fRunning(true)
+    {
+        stats.nDepth = 0;
+        stats.nMaxDepth = nMaxDepth;
+        stats.nHighWater = 0;
+        stats.nRejected = 0;
+        stats.nActive = 0;
+    }
+
+    // Only work that was already accepted once may go past the depth limit
+    bool Push(const boost::function<void ()>& job, bool fForce = false)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning || (!fForce && queue.size() >= stats.nMaxDepth))
+        {
+            stats.nRejected++;
+            return false;
+        }
+        queue.push_back(job);
+        stats.nHighWater = std::max(stats.nHighWater, queue.size());
+        cond.notify_one();
+        return true;
+    }
+
+    /** Run jobs until interrupted and the jobs queued by then are done */
+    void Run()
+    {
+        loop
+        {
+            boost::function<void ()> job;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (fRunning && queue.empty())
+                    cond.wait(lock);
+                if (queue.empty())
+                    return;
+                job.swap(queue.front());
+                queue.pop_front();
+                stats.nActive++;
+            }
+            job();
+            boost::unique_lock<boost::mutex> lock(mutex);
+            stats.nActive--;
+        }
+    }
+
+    /** Turn new jobs away, and let the workers return once the queue is drained */
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fRunning = false;
+        cond.notify_all();
+    }
+
+    void GetStats(CRPCWorkQueueStats& statsRet)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        statsRet = stats;
+        statsRet.nDepth = queue.size();
+    }
+};
+
+/**
+ * Calls set aside until they can be answered. Check() hands those that are
+ * ready to a work queue; they were accepted once, so they always get in.
+ */
+class CRPCDeferredCalls
+{
+private:
+    struct CCall
+    {
+        boost::function<bool ()> fnReady;
+        boost::function<void ()> job;
+    };
+
+    boost::mutex mutex;
+    std::list<CCall> listCalls;
+
+public:
+    void Add(const boost::function<bool ()>& fnReady, const boost::function<void ()>& job)
+    {
+        CCall call;
+        call.fnReady = fnReady;
+        call.job = job;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        listCalls.push_back(call);
+    }
+
+    void Check(CRPCWorkQueue& queue)
+    {
+        std::list<CCall> listReady;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            std::list<CCall>::iterator it = listCalls.begin();
+            while (it != listCalls.end())
+            {
+                if (it->fnReady())
+                    listReady.splice(listReady.end(), listCalls, it++);
+                else
+                    it++;
+            }
+        }
+        BOOST_FOREACH(const CCall& call, listReady)
+            queue.Push(call.job, true);
+    }
+
+    size_t size()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return listCalls.size();
+    }
+
+    void clear()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        listCalls.clear();
+    }
+};
+
+#endif
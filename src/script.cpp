@@ -3,7 +3,7 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 #include <boost/foreach.hpp>
-#include <boost/tuple/tuple.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 using namespace std;
 using namespace boost;
@@ -1032,59 +1032,106 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
 class CSignatureCache
 {
 private:
-     // sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
+    // Entries are a salted hash of (signature hash, public key, signature), so
+    // every entry costs the same 32 bytes and the eviction order cannot be
+    // predicted by someone who doesn't know the salt.
+    uint256 nonce;
+    std::set<uint256> setValid;
     boost::shared_mutex cs_sigcache;
+    int64 nMaxCacheSize;
+
+    // Hit/miss counters, reported by getsigcacheinfo
+    CCriticalSection cs_stats;
+    uint64 nHits;
+    uint64 nMisses;
+
+    uint256 ComputeEntry(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nonce << hash << pubKey << vchSig;
+        return ss.GetHash();
+    }
 
 public:
+    CSignatureCache() : nonce(GetRandHash()), nHits(0), nMisses(0)
+    {
+        // DoS prevention: limit cache size to less than 5MB
+        // (~80 bytes per cache entry times 50,000 entries)
+        // Since there are a maximum of 20,000 signature operations per block
+        // 50,000 is a reasonable default.
+        nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
+    }
+
     bool
     Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        uint256 entry = ComputeEntry(hash, vchSig, pubKey);
+        bool fFound;
+        {
+            boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+            fFound = (setValid.count(entry) != 0);
+        }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+        LOCK(cs_stats);
+        if (fFound)
+            nHits++;
+        else
+            nMisses++;
+        return fFound;
     }
 
     void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64 nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
         if (nMaxCacheSize <= 0) return;
 
+        uint256 entry = ComputeEntry(hash, vchSig, pubKey);
+
         boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
 
-        while (static_cast<int64>(setValid.size()) > nMaxCacheSize)
+        while (static_cast<int64>(setValid.size()) >= nMaxCacheSize)
         {
             // Evict a random entry. Random because that helps
             // foil would-be DoS attackers who might try to pre-generate
             // and re-use a set of valid signatures just-slightly-greater
             // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
             if (it == setValid.end())
                 it = setValid.begin();
-            setValid.erase(*it);
+            setValid.erase(it);
         }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+        setValid.insert(entry);
+    }
+
+    void GetStats(CSignatureCacheStats &stats)
+    {
+        {
+            boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+            stats.nEntries = setValid.size();
+        }
+        stats.nMaxEntries = std::max(nMaxCacheSize, (int64)0);
+        LOCK(cs_stats);
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
     }
 };
 
+static CSignatureCache& GetSignatureCache()
+{
+    // Constructed on first use, after the command line has been parsed
+    static CSignatureCache signatureCache;
+    return signatureCache;
+}
+
+void GetSignatureCacheStats(CSignatureCacheStats &stats)
+{
+    GetSignatureCache().GetStats(stats);
+}
+
 bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode,
               const CTransaction& txTo, unsigned int nIn, int nHashType, int flags)
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
 
     CPubKey pubkey(vchPubKey);
     if (!pubkey.IsValid())
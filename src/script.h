@@ -667,6 +667,19 @@ public:
     }
 };
 
+/** Signature cache statistics (see getsigcacheinfo) */
+struct CSignatureCacheStats
+{
+    uint64 nEntries;
+    uint64 nMaxEntries;
+    uint64 nHits;
+    uint64 nMisses;
+
+    CSignatureCacheStats() : nEntries(0), nMaxEntries(0), nHits(0), nMisses(0) {}
+};
+
+void GetSignatureCacheStats(CSignatureCacheStats &stats);
+
 bool IsCanonicalPubKey(const std::vector<unsigned char> &vchPubKey);
 bool IsCanonicalSignature(const std::vector<unsigned char> &vchSig);
 
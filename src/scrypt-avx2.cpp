@@ -0,0 +1,177 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler, 2014 The CasinoCoin developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+#include "scrypt.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+/*
+ * 4-way scrypt for AVX2. Each 256-bit register carries the same four words of
+ * two hashes, one per 128-bit lane, which lets the lane-local shuffles of the
+ * SSE2 core be reused unchanged. Two such register sets are interleaved.
+ */
+#define SALSA_STEP_4WAY(x, y, z, r) \
+	Ta = _mm256_add_epi32(y##a, z##a); \
+	Tb = _mm256_add_epi32(y##b, z##b); \
+	x##a = _mm256_xor_si256(x##a, _mm256_slli_epi32(Ta, r)); \
+	x##b = _mm256_xor_si256(x##b, _mm256_slli_epi32(Tb, r)); \
+	x##a = _mm256_xor_si256(x##a, _mm256_srli_epi32(Ta, 32 - r)); \
+	x##b = _mm256_xor_si256(x##b, _mm256_srli_epi32(Tb, 32 - r));
+
+static inline void xor_salsa8_avx2_4way(__m256i Ba[4], const __m256i Bxa[4],
+                                        __m256i Bb[4], const __m256i Bxb[4])
+{
+	__m256i X0a, X1a, X2a, X3a, X0b, X1b, X2b, X3b;
+	__m256i Ta, Tb;
+	int i;
+
+	X0a = Ba[0] = _mm256_xor_si256(Ba[0], Bxa[0]);
+	X1a = Ba[1] = _mm256_xor_si256(Ba[1], Bxa[1]);
+	X2a = Ba[2] = _mm256_xor_si256(Ba[2], Bxa[2]);
+	X3a = Ba[3] = _mm256_xor_si256(Ba[3], Bxa[3]);
+	X0b = Bb[0] = _mm256_xor_si256(Bb[0], Bxb[0]);
+	X1b = Bb[1] = _mm256_xor_si256(Bb[1], Bxb[1]);
+	X2b = Bb[2] = _mm256_xor_si256(Bb[2], Bxb[2]);
+	X3b = Bb[3] = _mm256_xor_si256(Bb[3], Bxb[3]);
+
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on "columns". */
+		SALSA_STEP_4WAY(X1, X0, X3, 7);
+		SALSA_STEP_4WAY(X2, X1, X0, 9);
+		SALSA_STEP_4WAY(X3, X2, X1, 13);
+		SALSA_STEP_4WAY(X0, X3, X2, 18);
+
+		/* Rearrange data. */
+		X1a = _mm256_shuffle_epi32(X1a, 0x93);
+		X1b = _mm256_shuffle_epi32(X1b, 0x93);
+		X2a = _mm256_shuffle_epi32(X2a, 0x4E);
+		X2b = _mm256_shuffle_epi32(X2b, 0x4E);
+		X3a = _mm256_shuffle_epi32(X3a, 0x39);
+		X3b = _mm256_shuffle_epi32(X3b, 0x39);
+
+		/* Operate on "rows". */
+		SALSA_STEP_4WAY(X3, X0, X1, 7);
+		SALSA_STEP_4WAY(X2, X3, X0, 9);
+		SALSA_STEP_4WAY(X1, X2, X3, 13);
+		SALSA_STEP_4WAY(X0, X1, X2, 18);
+
+		/* Rearrange data. */
+		X1a = _mm256_shuffle_epi32(X1a, 0x39);
+		X1b = _mm256_shuffle_epi32(X1b, 0x39);
+		X2a = _mm256_shuffle_epi32(X2a, 0x4E);
+		X2b = _mm256_shuffle_epi32(X2b, 0x4E);
+		X3a = _mm256_shuffle_epi32(X3a, 0x93);
+		X3b = _mm256_shuffle_epi32(X3b, 0x93);
+	}
+
+	Ba[0] = _mm256_add_epi32(Ba[0], X0a);
+	Ba[1] = _mm256_add_epi32(Ba[1], X1a);
+	Ba[2] = _mm256_add_epi32(Ba[2], X2a);
+	Ba[3] = _mm256_add_epi32(Ba[3], X3a);
+	Bb[0] = _mm256_add_epi32(Bb[0], X0b);
+	Bb[1] = _mm256_add_epi32(Bb[1], X1b);
+	Bb[2] = _mm256_add_epi32(Bb[2], X2b);
+	Bb[3] = _mm256_add_epi32(Bb[3], X3b);
+}
+
+void scrypt_1024_1_1_256_sp_avx2_4way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[128];
+	union {
+		__m128i i128[8];
+		uint32_t u32[32];
+	} Y[4];
+	union {
+		__m256i i256[8];
+		uint32_t u32[64];
+	} X[2];
+	__m128i *V[4];
+	uint32_t i, j[4], k, n;
+
+	/* Every hash keeps its own 128 KiB table so a lookup touches two cache lines */
+	V[0] = (__m128i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	for (n = 1; n < 4; n++)
+		V[n] = V[n - 1] + 1024 * 8;
+
+	for (n = 0; n < 4; n++) {
+		PBKDF2_SHA256((const uint8_t *)input + 80 * n, 80, (const uint8_t *)input + 80 * n, 80, 1, B, 128);
+		for (k = 0; k < 2; k++) {
+			for (i = 0; i < 16; i++) {
+				Y[n].u32[k * 16 + i] = le32dec(&B[(k * 16 + (i * 5 % 16)) * 4]);
+			}
+		}
+	}
+	for (n = 0; n < 2; n++) {
+		for (k = 0; k < 8; k++)
+			X[n].i256[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(Y[2 * n].i128[k]), Y[2 * n + 1].i128[k], 1);
+	}
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 8; k++) {
+			V[0][i * 8 + k] = _mm256_castsi256_si128(X[0].i256[k]);
+			V[1][i * 8 + k] = _mm256_extracti128_si256(X[0].i256[k], 1);
+			V[2][i * 8 + k] = _mm256_castsi256_si128(X[1].i256[k]);
+			V[3][i * 8 + k] = _mm256_extracti128_si256(X[1].i256[k], 1);
+		}
+		xor_salsa8_avx2_4way(&X[0].i256[0], &X[0].i256[4], &X[1].i256[0], &X[1].i256[4]);
+		xor_salsa8_avx2_4way(&X[0].i256[4], &X[0].i256[0], &X[1].i256[4], &X[1].i256[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		j[0] = 8 * (X[0].u32[32] & 1023);
+		j[1] = 8 * (X[0].u32[36] & 1023);
+		j[2] = 8 * (X[1].u32[32] & 1023);
+		j[3] = 8 * (X[1].u32[36] & 1023);
+		for (k = 0; k < 8; k++) {
+			X[0].i256[k] = _mm256_xor_si256(X[0].i256[k],
+				_mm256_inserti128_si256(_mm256_castsi128_si256(V[0][j[0] + k]), V[1][j[1] + k], 1));
+			X[1].i256[k] = _mm256_xor_si256(X[1].i256[k],
+				_mm256_inserti128_si256(_mm256_castsi128_si256(V[2][j[2] + k]), V[3][j[3] + k], 1));
+		}
+		xor_salsa8_avx2_4way(&X[0].i256[0], &X[0].i256[4], &X[1].i256[0], &X[1].i256[4]);
+		xor_salsa8_avx2_4way(&X[0].i256[4], &X[0].i256[0], &X[1].i256[4], &X[1].i256[0]);
+	}
+
+	for (n = 0; n < 2; n++) {
+		for (k = 0; k < 8; k++) {
+			Y[2 * n].i128[k] = _mm256_castsi256_si128(X[n].i256[k]);
+			Y[2 * n + 1].i128[k] = _mm256_extracti128_si256(X[n].i256[k], 1);
+		}
+	}
+	for (n = 0; n < 4; n++) {
+		for (k = 0; k < 2; k++) {
+			for (i = 0; i < 16; i++) {
+				le32enc(&B[(k * 16 + (i * 5 % 16)) * 4], Y[n].u32[k * 16 + i]);
+			}
+		}
+		PBKDF2_SHA256((const uint8_t *)input + 80 * n, 80, B, 128, 1, (uint8_t *)output + 32 * n, 32);
+	}
+}
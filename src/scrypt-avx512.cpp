@@ -0,0 +1,180 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler, 2014 The CasinoCoin developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+#include "scrypt.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+/*
+ * 8-way scrypt for AVX-512F. Same layout as the AVX2 kernel with four hashes
+ * per 512-bit register, one per 128-bit lane, and native 32-bit rotates.
+ */
+#define SALSA_STEP_8WAY(x, y, z, r) \
+	x##a = _mm512_xor_si512(x##a, _mm512_rol_epi32(_mm512_add_epi32(y##a, z##a), r)); \
+	x##b = _mm512_xor_si512(x##b, _mm512_rol_epi32(_mm512_add_epi32(y##b, z##b), r));
+
+static inline void xor_salsa8_avx512_8way(__m512i Ba[4], const __m512i Bxa[4],
+                                          __m512i Bb[4], const __m512i Bxb[4])
+{
+	__m512i X0a, X1a, X2a, X3a, X0b, X1b, X2b, X3b;
+	int i;
+
+	X0a = Ba[0] = _mm512_xor_si512(Ba[0], Bxa[0]);
+	X1a = Ba[1] = _mm512_xor_si512(Ba[1], Bxa[1]);
+	X2a = Ba[2] = _mm512_xor_si512(Ba[2], Bxa[2]);
+	X3a = Ba[3] = _mm512_xor_si512(Ba[3], Bxa[3]);
+	X0b = Bb[0] = _mm512_xor_si512(Bb[0], Bxb[0]);
+	X1b = Bb[1] = _mm512_xor_si512(Bb[1], Bxb[1]);
+	X2b = Bb[2] = _mm512_xor_si512(Bb[2], Bxb[2]);
+	X3b = Bb[3] = _mm512_xor_si512(Bb[3], Bxb[3]);
+
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on "columns". */
+		SALSA_STEP_8WAY(X1, X0, X3, 7);
+		SALSA_STEP_8WAY(X2, X1, X0, 9);
+		SALSA_STEP_8WAY(X3, X2, X1, 13);
+		SALSA_STEP_8WAY(X0, X3, X2, 18);
+
+		/* Rearrange data. */
+		X1a = _mm512_shuffle_epi32(X1a, (_MM_PERM_ENUM)0x93);
+		X1b = _mm512_shuffle_epi32(X1b, (_MM_PERM_ENUM)0x93);
+		X2a = _mm512_shuffle_epi32(X2a, (_MM_PERM_ENUM)0x4E);
+		X2b = _mm512_shuffle_epi32(X2b, (_MM_PERM_ENUM)0x4E);
+		X3a = _mm512_shuffle_epi32(X3a, (_MM_PERM_ENUM)0x39);
+		X3b = _mm512_shuffle_epi32(X3b, (_MM_PERM_ENUM)0x39);
+
+		/* Operate on "rows". */
+		SALSA_STEP_8WAY(X3, X0, X1, 7);
+		SALSA_STEP_8WAY(X2, X3, X0, 9);
+		SALSA_STEP_8WAY(X1, X2, X3, 13);
+		SALSA_STEP_8WAY(X0, X1, X2, 18);
+
+		/* Rearrange data. */
+		X1a = _mm512_shuffle_epi32(X1a, (_MM_PERM_ENUM)0x39);
+		X1b = _mm512_shuffle_epi32(X1b, (_MM_PERM_ENUM)0x39);
+		X2a = _mm512_shuffle_epi32(X2a, (_MM_PERM_ENUM)0x4E);
+		X2b = _mm512_shuffle_epi32(X2b, (_MM_PERM_ENUM)0x4E);
+		X3a = _mm512_shuffle_epi32(X3a, (_MM_PERM_ENUM)0x93);
+		X3b = _mm512_shuffle_epi32(X3b, (_MM_PERM_ENUM)0x93);
+	}
+
+	Ba[0] = _mm512_add_epi32(Ba[0], X0a);
+	Ba[1] = _mm512_add_epi32(Ba[1], X1a);
+	Ba[2] = _mm512_add_epi32(Ba[2], X2a);
+	Ba[3] = _mm512_add_epi32(Ba[3], X3a);
+	Bb[0] = _mm512_add_epi32(Bb[0], X0b);
+	Bb[1] = _mm512_add_epi32(Bb[1], X1b);
+	Bb[2] = _mm512_add_epi32(Bb[2], X2b);
+	Bb[3] = _mm512_add_epi32(Bb[3], X3b);
+}
+
+static inline __m512i combine4(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+	__m512i x = _mm512_castsi128_si512(a);
+	x = _mm512_inserti32x4(x, b, 1);
+	x = _mm512_inserti32x4(x, c, 2);
+	return _mm512_inserti32x4(x, d, 3);
+}
+
+void scrypt_1024_1_1_256_sp_avx512_8way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[128];
+	union {
+		__m128i i128[8];
+		uint32_t u32[32];
+	} Y[8];
+	union {
+		__m512i i512[8];
+		uint32_t u32[128];
+	} X[2];
+	__m128i *V[8];
+	uint32_t i, j[8], k, n;
+
+	V[0] = (__m128i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	for (n = 1; n < 8; n++)
+		V[n] = V[n - 1] + 1024 * 8;
+
+	for (n = 0; n < 8; n++) {
+		PBKDF2_SHA256((const uint8_t *)input + 80 * n, 80, (const uint8_t *)input + 80 * n, 80, 1, B, 128);
+		for (k = 0; k < 2; k++) {
+			for (i = 0; i < 16; i++) {
+				Y[n].u32[k * 16 + i] = le32dec(&B[(k * 16 + (i * 5 % 16)) * 4]);
+			}
+		}
+	}
+	for (n = 0; n < 2; n++) {
+		for (k = 0; k < 8; k++)
+			X[n].i512[k] = combine4(Y[4 * n].i128[k], Y[4 * n + 1].i128[k], Y[4 * n + 2].i128[k], Y[4 * n + 3].i128[k]);
+	}
+
+	for (i = 0; i < 1024; i++) {
+		for (n = 0; n < 2; n++) {
+			for (k = 0; k < 8; k++) {
+				V[4 * n][i * 8 + k] = _mm512_castsi512_si128(X[n].i512[k]);
+				V[4 * n + 1][i * 8 + k] = _mm512_extracti32x4_epi32(X[n].i512[k], 1);
+				V[4 * n + 2][i * 8 + k] = _mm512_extracti32x4_epi32(X[n].i512[k], 2);
+				V[4 * n + 3][i * 8 + k] = _mm512_extracti32x4_epi32(X[n].i512[k], 3);
+			}
+		}
+		xor_salsa8_avx512_8way(&X[0].i512[0], &X[0].i512[4], &X[1].i512[0], &X[1].i512[4]);
+		xor_salsa8_avx512_8way(&X[0].i512[4], &X[0].i512[0], &X[1].i512[4], &X[1].i512[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		for (n = 0; n < 8; n++)
+			j[n] = 8 * (X[n / 4].u32[64 + 4 * (n % 4)] & 1023);
+		for (n = 0; n < 2; n++) {
+			for (k = 0; k < 8; k++)
+				X[n].i512[k] = _mm512_xor_si512(X[n].i512[k],
+					combine4(V[4 * n][j[4 * n] + k], V[4 * n + 1][j[4 * n + 1] + k],
+					         V[4 * n + 2][j[4 * n + 2] + k], V[4 * n + 3][j[4 * n + 3] + k]));
+		}
+		xor_salsa8_avx512_8way(&X[0].i512[0], &X[0].i512[4], &X[1].i512[0], &X[1].i512[4]);
+		xor_salsa8_avx512_8way(&X[0].i512[4], &X[0].i512[0], &X[1].i512[4], &X[1].i512[0]);
+	}
+
+	for (n = 0; n < 2; n++) {
+		for (k = 0; k < 8; k++) {
+			Y[4 * n].i128[k] = _mm512_castsi512_si128(X[n].i512[k]);
+			Y[4 * n + 1].i128[k] = _mm512_extracti32x4_epi32(X[n].i512[k], 1);
+			Y[4 * n + 2].i128[k] = _mm512_extracti32x4_epi32(X[n].i512[k], 2);
+			Y[4 * n + 3].i128[k] = _mm512_extracti32x4_epi32(X[n].i512[k], 3);
+		}
+	}
+	for (n = 0; n < 8; n++) {
+		for (k = 0; k < 2; k++) {
+			for (i = 0; i < 16; i++) {
+				le32enc(&B[(k * 16 + (i * 5 % 16)) * 4], Y[n].u32[k * 16 + i]);
+			}
+		}
+		PBKDF2_SHA256((const uint8_t *)input + 80 * n, 80, B, 128, 1, (uint8_t *)output + 32 * n, 32);
+	}
+}
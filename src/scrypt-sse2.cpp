@@ -134,3 +134,123 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
+
+/*
+ * Multi-buffer variant: two independent hashes run through the same loop so
+ * that the long dependency chain of one Salsa20/8 core hides the latency of
+ * the other, and the random reads of the second loop overlap.
+ */
+#define SALSA_STEP_2WAY(x, y, z, r) \
+	Ta = _mm_add_epi32(y##a, z##a); \
+	Tb = _mm_add_epi32(y##b, z##b); \
+	x##a = _mm_xor_si128(x##a, _mm_slli_epi32(Ta, r)); \
+	x##b = _mm_xor_si128(x##b, _mm_slli_epi32(Tb, r)); \
+	x##a = _mm_xor_si128(x##a, _mm_srli_epi32(Ta, 32 - r)); \
+	x##b = _mm_xor_si128(x##b, _mm_srli_epi32(Tb, 32 - r));
+
+static inline void xor_salsa8_sse2_2way(__m128i Ba[4], const __m128i Bxa[4],
+                                        __m128i Bb[4], const __m128i Bxb[4])
+{
+	__m128i X0a, X1a, X2a, X3a, X0b, X1b, X2b, X3b;
+	__m128i Ta, Tb;
+	int i;
+
+	X0a = Ba[0] = _mm_xor_si128(Ba[0], Bxa[0]);
+	X1a = Ba[1] = _mm_xor_si128(Ba[1], Bxa[1]);
+	X2a = Ba[2] = _mm_xor_si128(Ba[2], Bxa[2]);
+	X3a = Ba[3] = _mm_xor_si128(Ba[3], Bxa[3]);
+	X0b = Bb[0] = _mm_xor_si128(Bb[0], Bxb[0]);
+	X1b = Bb[1] = _mm_xor_si128(Bb[1], Bxb[1]);
+	X2b = Bb[2] = _mm_xor_si128(Bb[2], Bxb[2]);
+	X3b = Bb[3] = _mm_xor_si128(Bb[3], Bxb[3]);
+
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on "columns". */
+		SALSA_STEP_2WAY(X1, X0, X3, 7);
+		SALSA_STEP_2WAY(X2, X1, X0, 9);
+		SALSA_STEP_2WAY(X3, X2, X1, 13);
+		SALSA_STEP_2WAY(X0, X3, X2, 18);
+
+		/* Rearrange data. */
+		X1a = _mm_shuffle_epi32(X1a, 0x93);
+		X1b = _mm_shuffle_epi32(X1b, 0x93);
+		X2a = _mm_shuffle_epi32(X2a, 0x4E);
+		X2b = _mm_shuffle_epi32(X2b, 0x4E);
+		X3a = _mm_shuffle_epi32(X3a, 0x39);
+		X3b = _mm_shuffle_epi32(X3b, 0x39);
+
+		/* Operate on "rows". */
+		SALSA_STEP_2WAY(X3, X0, X1, 7);
+		SALSA_STEP_2WAY(X2, X3, X0, 9);
+		SALSA_STEP_2WAY(X1, X2, X3, 13);
+		SALSA_STEP_2WAY(X0, X1, X2, 18);
+
+		/* Rearrange data. */
+		X1a = _mm_shuffle_epi32(X1a, 0x39);
+		X1b = _mm_shuffle_epi32(X1b, 0x39);
+		X2a = _mm_shuffle_epi32(X2a, 0x4E);
+		X2b = _mm_shuffle_epi32(X2b, 0x4E);
+		X3a = _mm_shuffle_epi32(X3a, 0x93);
+		X3b = _mm_shuffle_epi32(X3b, 0x93);
+	}
+
+	Ba[0] = _mm_add_epi32(Ba[0], X0a);
+	Ba[1] = _mm_add_epi32(Ba[1], X1a);
+	Ba[2] = _mm_add_epi32(Ba[2], X2a);
+	Ba[3] = _mm_add_epi32(Ba[3], X3a);
+	Bb[0] = _mm_add_epi32(Bb[0], X0b);
+	Bb[1] = _mm_add_epi32(Bb[1], X1b);
+	Bb[2] = _mm_add_epi32(Bb[2], X2b);
+	Bb[3] = _mm_add_epi32(Bb[3], X3b);
+}
+
+void scrypt_1024_1_1_256_sp_sse2_2way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[2][128];
+	union {
+		__m128i i128[8];
+		uint32_t u32[32];
+	} X[2];
+	__m128i *V[2];
+	uint32_t i, j[2], k, n;
+
+	V[0] = (__m128i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	V[1] = V[0] + 1024 * 8;
+
+	for (n = 0; n < 2; n++) {
+		PBKDF2_SHA256((const uint8_t *)input + 80 * n, 80, (const uint8_t *)input + 80 * n, 80, 1, B[n], 128);
+		for (k = 0; k < 2; k++) {
+			for (i = 0; i < 16; i++) {
+				X[n].u32[k * 16 + i] = le32dec(&B[n][(k * 16 + (i * 5 % 16)) * 4]);
+			}
+		}
+	}
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 8; k++) {
+			V[0][i * 8 + k] = X[0].i128[k];
+			V[1][i * 8 + k] = X[1].i128[k];
+		}
+		xor_salsa8_sse2_2way(&X[0].i128[0], &X[0].i128[4], &X[1].i128[0], &X[1].i128[4]);
+		xor_salsa8_sse2_2way(&X[0].i128[4], &X[0].i128[0], &X[1].i128[4], &X[1].i128[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		j[0] = 8 * (X[0].u32[16] & 1023);
+		j[1] = 8 * (X[1].u32[16] & 1023);
+		for (k = 0; k < 8; k++) {
+			X[0].i128[k] = _mm_xor_si128(X[0].i128[k], V[0][j[0] + k]);
+			X[1].i128[k] = _mm_xor_si128(X[1].i128[k], V[1][j[1] + k]);
+		}
+		xor_salsa8_sse2_2way(&X[0].i128[0], &X[0].i128[4], &X[1].i128[0], &X[1].i128[4]);
+		xor_salsa8_sse2_2way(&X[0].i128[4], &X[0].i128[0], &X[1].i128[4], &X[1].i128[0]);
+	}
+
+	for (n = 0; n < 2; n++) {
+		for (k = 0; k < 2; k++) {
+			for (i = 0; i < 16; i++) {
+				le32enc(&B[n][(k * 16 + (i * 5 % 16)) * 4], X[n].u32[k * 16 + i]);
+			}
+		}
+		PBKDF2_SHA256((const uint8_t *)input + 80 * n, 80, B[n], 128, 1, (uint8_t *)output + 32 * n, 32);
+	}
+}
@@ -34,7 +34,7 @@
 #include <string.h>
 #include <openssl/sha.h>
 
-#if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
+#if defined(USE_SSE2)
 #ifdef _MSC_VER
 // MSVC 64bit is unable to use inline asm
 #include <intrin.h>
@@ -286,29 +286,59 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
 
+int scrypt_multi_ways = 1;
+void (*scrypt_1024_1_1_256_sp_multi)(const char *input, char *output, char *scratchpad) = &scrypt_1024_1_1_256_sp_generic;
+bool scrypt_cpu_avx2 = false;
+bool scrypt_cpu_avx512 = false;
+
 #if defined(USE_SSE2)
 // By default, set to generic scrypt function. This will prevent crash in case when scrypt_detect_sse2() wasn't called
 void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad) = &scrypt_1024_1_1_256_sp_generic;
 
+static void scrypt_cpuid(unsigned int leaf, unsigned int regs[4])
+{
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+#if defined(_MSC_VER)
+    int x86cpuid[4];
+    __cpuidex(x86cpuid, leaf, 0);
+    for (int i = 0; i < 4; i++)
+        regs[i] = (unsigned int)x86cpuid[i];
+#else
+    if (__get_cpuid_max(0, 0) >= leaf)
+        __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the OS saves on context switch (XCR0), 0 without OSXSAVE
+static uint64_t scrypt_xgetbv(unsigned int cpuid_ecx)
+{
+    if (!(cpuid_ecx & 1<<27))
+        return 0;
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ __volatile__(".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
 void scrypt_detect_sse2()
 {
+    unsigned int leaf1[4], leaf7[4];
+    scrypt_cpuid(1, leaf1);
+    scrypt_cpuid(7, leaf7);
+    uint64_t xcr0 = scrypt_xgetbv(leaf1[2]);
+    bool fSSE2 = (leaf1[3] & 1<<26) != 0;
+    // AVX2 needs XMM and YMM state enabled, AVX-512 additionally opmask and ZMM state
+    scrypt_cpu_avx2 = (leaf7[1] & 1<<5) && (xcr0 & 0x06) == 0x06;
+    scrypt_cpu_avx512 = (leaf7[1] & 1<<16) && (xcr0 & 0xe6) == 0xe6;
+
 #if defined(USE_SSE2_ALWAYS)
+    fSSE2 = true;
     printf("scrypt: using scrypt-sse2 as built.\n");
 #else // USE_SSE2_ALWAYS
-    // 32bit x86 Linux or Windows, detect cpuid features
-    unsigned int cpuid_edx=0;
-#if defined(_MSC_VER)
-    // MSVC
-    int x86cpuid[4];
-    __cpuid(x86cpuid, 1);
-    cpuid_edx = (unsigned int)buffer[3];
-#else // _MSC_VER
-    // Linux or i686-w64-mingw32 (gcc-4.6.3)
-    unsigned int eax, ebx, ecx;
-    __get_cpuid(1, &eax, &ebx, &ecx, &cpuid_edx);
-#endif // _MSC_VER
-
-    if (cpuid_edx & 1<<26)
+    if (fSSE2)
     {
         scrypt_1024_1_1_256_sp_detected = &scrypt_1024_1_1_256_sp_sse2;
         printf("scrypt: using scrypt-sse2 as detected.\n");
@@ -319,6 +349,34 @@ void scrypt_detect_sse2()
         printf("scrypt: using scrypt-generic, SSE2 unavailable.\n");
     }
 #endif // USE_SSE2_ALWAYS
+
+    // Pick the widest multi-buffer kernel that is both built and supported
+    const char *pszKernel = "generic";
+    scrypt_multi_ways = 1;
+    scrypt_1024_1_1_256_sp_multi = &scrypt_1024_1_1_256_sp_generic;
+    if (fSSE2)
+    {
+        pszKernel = "sse2";
+        scrypt_multi_ways = 2;
+        scrypt_1024_1_1_256_sp_multi = &scrypt_1024_1_1_256_sp_sse2_2way;
+    }
+#if defined(USE_AVX2)
+    if (scrypt_cpu_avx2)
+    {
+        pszKernel = "avx2";
+        scrypt_multi_ways = 4;
+        scrypt_1024_1_1_256_sp_multi = &scrypt_1024_1_1_256_sp_avx2_4way;
+    }
+#endif
+#if defined(USE_AVX512)
+    if (scrypt_cpu_avx512)
+    {
+        pszKernel = "avx512";
+        scrypt_multi_ways = 8;
+        scrypt_1024_1_1_256_sp_multi = &scrypt_1024_1_1_256_sp_avx512_8way;
+    }
+#endif
+    printf("scrypt: mining with the %d-way %s kernel.\n", scrypt_multi_ways, pszKernel);
 }
 #endif
 
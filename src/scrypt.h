@@ -8,6 +8,10 @@ static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+#if (defined(USE_AVX2) || defined(USE_AVX512)) && !defined(USE_SSE2)
+#error "USE_AVX2 and USE_AVX512 need USE_SSE2"
+#endif
+
 #if defined(USE_SSE2)
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
@@ -19,10 +23,32 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 void scrypt_detect_sse2();
 void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad);
 extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad);
+void scrypt_1024_1_1_256_sp_sse2_2way(const char *input, char *output, char *scratchpad);
+#if defined(USE_AVX2)
+void scrypt_1024_1_1_256_sp_avx2_4way(const char *input, char *output, char *scratchpad);
+#endif
+#if defined(USE_AVX512)
+void scrypt_1024_1_1_256_sp_avx512_8way(const char *input, char *output, char *scratchpad);
+#endif
 #else
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
 #endif
 
+/* Multi-buffer scrypt: scrypt_1024_1_1_256_sp_multi hashes scrypt_multi_ways
+ * consecutive 80-byte inputs into as many consecutive 32-byte outputs.
+ * The scratchpad must hold SCRYPT_MULTI_SCRATCHPAD_SIZE bytes. Both are
+ * chosen by scrypt_detect_sse2(); until then it is the one-way generic code.
+ */
+static const int SCRYPT_MAX_WAYS = 8;
+static const int SCRYPT_MULTI_SCRATCHPAD_SIZE = SCRYPT_MAX_WAYS * 131072 + 63;
+
+extern int scrypt_multi_ways;
+extern void (*scrypt_1024_1_1_256_sp_multi)(const char *input, char *output, char *scratchpad);
+
+/* Instruction sets found by scrypt_detect_sse2() */
+extern bool scrypt_cpu_avx2;
+extern bool scrypt_cpu_avx512;
+
 void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen);
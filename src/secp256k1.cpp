@@ -0,0 +1,868 @@
+// Copyright (c) 2013-2014 The CasinoCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "secp256k1.h"
+
+// anonymous namespace with the field, scalar and group implementation
+namespace {
+
+#if defined(__SIZEOF_INT128__)
+typedef uint64_t limb_t;
+typedef unsigned __int128 dlimb_t;
+#else
+typedef uint32_t limb_t;
+typedef uint64_t dlimb_t;
+#endif
+
+static const int LIMB_BITS = sizeof(limb_t) * 8;
+static const int LIMB_BYTES = sizeof(limb_t);
+static const int NLIMBS = 256 / LIMB_BITS;
+
+// Window sizes of the wNAF multiplication. The generator table is built
+// once (2^(WINDOW_G-2) affine points), the table for the public key is
+// rebuilt for every verification and is kept small.
+static const int WINDOW_G = 8;
+static const int WINDOW_Q = 5;
+static const int TABLE_SIZE_G = 1 << (WINDOW_G - 2);
+static const int TABLE_SIZE_Q = 1 << (WINDOW_Q - 2);
+static const int WNAF_MAX = 258;
+
+//
+// 256-bit numbers as little-endian arrays of limbs
+//
+
+void SetBytes(limb_t r[NLIMBS], const unsigned char b[32])
+{
+    for (int i = 0; i < NLIMBS; i++) {
+        limb_t v = 0;
+        for (int j = 0; j < LIMB_BYTES; j++)
+            v = (v << 8) | b[32 - (i+1)*LIMB_BYTES + j];
+        r[i] = v;
+    }
+}
+
+void GetBytes(unsigned char b[32], const limb_t a[NLIMBS])
+{
+    for (int i = 0; i < NLIMBS; i++)
+        for (int j = 0; j < LIMB_BYTES; j++)
+            b[32 - (i+1)*LIMB_BYTES + j] = (unsigned char)(a[i] >> (8 * (LIMB_BYTES - 1 - j)));
+}
+
+// r = a + b, returns the carry
+limb_t Add(limb_t r[NLIMBS], const limb_t a[NLIMBS], const limb_t b[NLIMBS])
+{
+    limb_t carry = 0;
+    for (int i = 0; i < NLIMBS; i++) {
+        dlimb_t t = (dlimb_t)a[i] + b[i] + carry;
+        r[i] = (limb_t)t;
+        carry = (limb_t)(t >> LIMB_BITS);
+    }
+    return carry;
+}
+
+// r = a - b, returns the borrow
+limb_t Sub(limb_t r[NLIMBS], const limb_t a[NLIMBS], const limb_t b[NLIMBS])
+{
+    limb_t borrow = 0;
+    for (int i = 0; i < NLIMBS; i++) {
+        dlimb_t t = (dlimb_t)a[i] - b[i] - borrow;
+        r[i] = (limb_t)t;
+        borrow = (limb_t)(t >> LIMB_BITS) & 1;
+    }
+    return borrow;
+}
+
+// r = flag ? a : b, without branching on flag (0 or 1)
+void Select(limb_t r[NLIMBS], const limb_t a[NLIMBS], const limb_t b[NLIMBS], limb_t flag)
+{
+    limb_t mask = (limb_t)0 - flag;
+    for (int i = 0; i < NLIMBS; i++)
+        r[i] = (a[i] & mask) | (b[i] & ~mask);
+}
+
+bool IsZero(const limb_t a[NLIMBS])
+{
+    limb_t z = 0;
+    for (int i = 0; i < NLIMBS; i++)
+        z |= a[i];
+    return z == 0;
+}
+
+bool Equal(const limb_t a[NLIMBS], const limb_t b[NLIMBS])
+{
+    limb_t z = 0;
+    for (int i = 0; i < NLIMBS; i++)
+        z |= a[i] ^ b[i];
+    return z == 0;
+}
+
+bool LessThan(const limb_t a[NLIMBS], const limb_t b[NLIMBS])
+{
+    limb_t t[NLIMBS];
+    return Sub(t, a, b) != 0;
+}
+
+// r = a * b (512-bit result)
+void MulWide(limb_t r[2*NLIMBS], const limb_t a[NLIMBS], const limb_t b[NLIMBS])
+{
+    memset(r, 0, 2 * NLIMBS * sizeof(limb_t));
+    for (int i = 0; i < NLIMBS; i++) {
+        limb_t carry = 0;
+        for (int j = 0; j < NLIMBS; j++) {
+            dlimb_t t = (dlimb_t)a[i] * b[j] + r[i+j] + carry;
+            r[i+j] = (limb_t)t;
+            carry = (limb_t)(t >> LIMB_BITS);
+        }
+        r[i+NLIMBS] = carry;
+    }
+}
+
+/** A modulus of the form m = 2^256 - c with a small c, as both p and n are. */
+struct Modulus
+{
+    limb_t m[NLIMBS];
+    limb_t c[NLIMBS];
+    int nc; // number of significant limbs in c
+
+    // Reduction folds the part above 2^256 back in, x = lo + hi * c, until
+    // the value fits in 256 bits. nHi[k] is how many limbs of hi can be
+    // non-zero in round k; it only depends on the size of c.
+    int nRounds;
+    int nHi[8];
+
+    Modulus(const unsigned char mBytes[32])
+    {
+        SetBytes(m, mBytes);
+        limb_t zero[NLIMBS] = {0};
+        Sub(c, zero, m);
+        nc = NLIMBS;
+        while (nc > 0 && c[nc-1] == 0)
+            nc--;
+        int nBitsC = nc * LIMB_BITS;
+        while (nBitsC > 0 && !((c[(nBitsC-1) / LIMB_BITS] >> ((nBitsC-1) % LIMB_BITS)) & 1))
+            nBitsC--;
+
+        // x < 2^nBits gives lo + hi * c < 2^(max(256, nBits - 256 + nBitsC) + 1)
+        int nBits = 512;
+        nRounds = 0;
+        while (nBits > 257) {
+            nHi[nRounds++] = (nBits - 256 + LIMB_BITS - 1) / LIMB_BITS;
+            nBits = std::max(256, nBits - 256 + nBitsC) + 1;
+        }
+        // Below 2^257 hi is at most 1; two more rounds end below 2^256
+        nHi[nRounds++] = 1;
+        nHi[nRounds++] = 1;
+    }
+};
+
+// r = x mod m, using 2^256 = c (mod m). The number of rounds and limbs
+// touched is fixed per modulus, so this does not branch on x.
+void Reduce(limb_t r[NLIMBS], const limb_t x[2*NLIMBS], const Modulus& mod)
+{
+    limb_t t[2*NLIMBS];
+    memcpy(t, x, sizeof(t));
+    for (int round = 0; round < mod.nRounds; round++) {
+        int nHi = mod.nHi[round];
+        int nLen = std::min(2*NLIMBS, NLIMBS + nHi + mod.nc);
+        limb_t u[2*NLIMBS];
+        for (int i = 0; i < NLIMBS; i++) {
+            u[i] = t[i];
+            u[i+NLIMBS] = 0;
+        }
+        for (int i = 0; i < nHi; i++) {
+            limb_t carry = 0;
+            int j = 0;
+            for (; j < mod.nc; j++) {
+                dlimb_t p = (dlimb_t)t[i+NLIMBS] * mod.c[j] + u[i+j] + carry;
+                u[i+j] = (limb_t)p;
+                carry = (limb_t)(p >> LIMB_BITS);
+            }
+            for (j += i; j < nLen; j++) {
+                dlimb_t p = (dlimb_t)u[j] + carry;
+                u[j] = (limb_t)p;
+                carry = (limb_t)(p >> LIMB_BITS);
+            }
+        }
+        memcpy(t, u, sizeof(t));
+    }
+
+    // t < 2^256 < 2m: subtract m once if t >= m, that is if t + c overflows
+    limb_t s[NLIMBS];
+    limb_t carry = Add(s, t, mod.c);
+    Select(r, s, t, carry);
+}
+
+static const unsigned char P_BYTES[32] = {
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFE,0xFF,0xFF,0xFC,0x2F
+};
+static const unsigned char N_BYTES[32] = {
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFE,
+    0xBA,0xAE,0xDC,0xE6,0xAF,0x48,0xA0,0x3B,0xBF,0xD2,0x5E,0x8C,0xD0,0x36,0x41,0x41
+};
+static const unsigned char GX_BYTES[32] = {
+    0x79,0xBE,0x66,0x7E,0xF9,0xDC,0xBB,0xAC,0x55,0xA0,0x62,0x95,0xCE,0x87,0x0B,0x07,
+    0x02,0x9B,0xFC,0xDB,0x2D,0xCE,0x28,0xD9,0x59,0xF2,0x81,0x5B,0x16,0xF8,0x17,0x98
+};
+static const unsigned char GY_BYTES[32] = {
+    0x48,0x3A,0xDA,0x77,0x26,0xA3,0xC4,0x65,0x5D,0xA4,0xFB,0xFC,0x0E,0x11,0x08,0xA8,
+    0xFD,0x17,0xB4,0x48,0xA6,0x85,0x54,0x19,0x9C,0x47,0xD0,0x8F,0xFB,0x10,0xD4,0xB8
+};
+
+/** Curve parameters and the exponents used for inversion and square roots */
+struct CCurveParams
+{
+    Modulus p;
+    Modulus n;
+    limb_t pMinus2[NLIMBS];
+    limb_t pPlus1Div4[NLIMBS];
+    limb_t nMinus2[NLIMBS];
+
+    CCurveParams() : p(P_BYTES), n(N_BYTES)
+    {
+        limb_t two[NLIMBS] = {2};
+        Sub(pMinus2, p.m, two);
+        Sub(nMinus2, n.m, two);
+        // (p + 1) / 4 = (p >> 2) + 1, as p = 3 (mod 4)
+        for (int i = 0; i < NLIMBS; i++)
+            pPlus1Div4[i] = (p.m[i] >> 2) | (i + 1 < NLIMBS ? p.m[i+1] << (LIMB_BITS - 2) : 0);
+        limb_t one[NLIMBS] = {1};
+        Add(pPlus1Div4, pPlus1Div4, one);
+    }
+};
+
+static const CCurveParams curve;
+
+//
+// Field elements modulo p, always fully reduced
+//
+
+struct FieldElem
+{
+    limb_t n[NLIMBS];
+};
+
+void FeSetInt(FieldElem& r, limb_t v)
+{
+    memset(r.n, 0, sizeof(r.n));
+    r.n[0] = v;
+}
+
+// Returns false if the value is not below p
+bool FeSetBytes(FieldElem& r, const unsigned char b[32])
+{
+    SetBytes(r.n, b);
+    return LessThan(r.n, curve.p.m);
+}
+
+void FeAdd(FieldElem& r, const FieldElem& a, const FieldElem& b)
+{
+    limb_t s[NLIMBS], t[NLIMBS];
+    limb_t c1 = Add(s, a.n, b.n);
+    limb_t c2 = Add(t, s, curve.p.c);
+    Select(r.n, t, s, c1 | c2);
+}
+
+void FeSub(FieldElem& r, const FieldElem& a, const FieldElem& b)
+{
+    limb_t d[NLIMBS], t[NLIMBS];
+    limb_t borrow = Sub(d, a.n, b.n);
+    Sub(t, d, curve.p.c);
+    Select(r.n, t, d, borrow);
+}
+
+void FeNeg(FieldElem& r, const FieldElem& a)
+{
+    FieldElem zero;
+    FeSetInt(zero, 0);
+    FeSub(r, zero, a);
+}
+
+// Field multiplication dominates verification time, so the reduction modulo
+// p gets an unrolled version for 64-bit limbs.
+void FeReduce(limb_t r[NLIMBS], const limb_t x[2*NLIMBS])
+{
+#if defined(__SIZEOF_INT128__)
+    // 2^256 = 0x1000003D1 (mod p)
+    const limb_t C = 0x1000003D1ULL;
+    limb_t t[4];
+    dlimb_t acc = (dlimb_t)x[4] * C + x[0];
+    t[0] = (limb_t)acc; acc >>= 64;
+    acc += (dlimb_t)x[5] * C + x[1];
+    t[1] = (limb_t)acc; acc >>= 64;
+    acc += (dlimb_t)x[6] * C + x[2];
+    t[2] = (limb_t)acc; acc >>= 64;
+    acc += (dlimb_t)x[7] * C + x[3];
+    t[3] = (limb_t)acc; acc >>= 64;
+
+    // acc < 2^34 now; fold it in, which can carry out at most once more
+    acc = acc * C + t[0];
+    t[0] = (limb_t)acc; acc >>= 64;
+    acc += t[1];
+    t[1] = (limb_t)acc; acc >>= 64;
+    acc += t[2];
+    t[2] = (limb_t)acc; acc >>= 64;
+    acc += t[3];
+    t[3] = (limb_t)acc; acc >>= 64;
+
+    // if it did, t is small and t + C cannot overflow again
+    acc = acc * C + t[0];
+    t[0] = (limb_t)acc; acc >>= 64;
+    acc += t[1];
+    t[1] = (limb_t)acc; acc >>= 64;
+    acc += t[2];
+    t[2] = (limb_t)acc; acc >>= 64;
+    t[3] += (limb_t)acc;
+
+    limb_t s[NLIMBS];
+    limb_t carry = Add(s, t, curve.p.c);
+    Select(r, s, t, carry);
+#else
+    Reduce(r, x, curve.p);
+#endif
+}
+
+void FeMul(FieldElem& r, const FieldElem& a, const FieldElem& b)
+{
+    limb_t w[2*NLIMBS];
+    MulWide(w, a.n, b.n);
+    FeReduce(r.n, w);
+}
+
+void FeSqr(FieldElem& r, const FieldElem& a)
+{
+    FeMul(r, a, a);
+}
+
+// r = a^e; the exponent is a public constant
+void FePow(FieldElem& r, const FieldElem& a, const limb_t e[NLIMBS])
+{
+    FieldElem x;
+    FeSetInt(x, 1);
+    for (int i = 255; i >= 0; i--) {
+        FeSqr(x, x);
+        if ((e[i / LIMB_BITS] >> (i % LIMB_BITS)) & 1)
+            FeMul(x, x, a);
+    }
+    r = x;
+}
+
+void FeInv(FieldElem& r, const FieldElem& a)
+{
+    FePow(r, a, curve.pMinus2);
+}
+
+// Returns false if a is not a quadratic residue
+bool FeSqrt(FieldElem& r, const FieldElem& a)
+{
+    FieldElem x, x2;
+    FePow(x, a, curve.pPlus1Div4);
+    FeSqr(x2, x);
+    r = x;
+    return Equal(x2.n, a.n);
+}
+
+bool FeIsZero(const FieldElem& a)
+{
+    return IsZero(a.n);
+}
+
+bool FeEqual(const FieldElem& a, const FieldElem& b)
+{
+    return Equal(a.n, b.n);
+}
+
+bool FeIsOdd(const FieldElem& a)
+{
+    return a.n[0] & 1;
+}
+
+//
+// Scalars modulo the group order n
+//
+
+struct Scalar
+{
+    limb_t n[NLIMBS];
+};
+
+// Reduces the value modulo n, setting fOverflow if it was not below n
+void ScSetBytes(Scalar& r, const unsigned char b[32], bool& fOverflow)
+{
+    limb_t v[NLIMBS], t[NLIMBS];
+    SetBytes(v, b);
+    limb_t carry = Add(t, v, curve.n.c);
+    Select(r.n, t, v, carry);
+    fOverflow = (carry != 0);
+}
+
+void ScMul(Scalar& r, const Scalar& a, const Scalar& b)
+{
+    limb_t w[2*NLIMBS];
+    MulWide(w, a.n, b.n);
+    Reduce(r.n, w, curve.n);
+}
+
+void ScInv(Scalar& r, const Scalar& a)
+{
+    Scalar x;
+    memset(x.n, 0, sizeof(x.n));
+    x.n[0] = 1;
+    for (int i = 255; i >= 0; i--) {
+        ScMul(x, x, x);
+        if ((curve.nMinus2[i / LIMB_BITS] >> (i % LIMB_BITS)) & 1)
+            ScMul(x, x, a);
+    }
+    r = x;
+}
+
+bool ScIsZero(const Scalar& a)
+{
+    return IsZero(a.n);
+}
+
+// Width-w non-adjacent form: every non-zero digit is odd and below 2^(w-1) in
+// absolute value, and any w consecutive digits contain at most one non-zero.
+int ScWNAF(int wnaf[WNAF_MAX], const Scalar& a, int w)
+{
+    // 288 bits, so adding back a negative digit can never overflow
+    uint32_t k[9];
+    unsigned char b[32];
+    GetBytes(b, a.n);
+    for (int i = 0; i < 8; i++)
+        k[i] = ((uint32_t)b[31-4*i]) | ((uint32_t)b[30-4*i] << 8) | ((uint32_t)b[29-4*i] << 16) | ((uint32_t)b[28-4*i] << 24);
+    k[8] = 0;
+
+    memset(wnaf, 0, WNAF_MAX * sizeof(int));
+    int len = 0;
+    while (true) {
+        uint32_t z = 0;
+        for (int i = 0; i < 9; i++)
+            z |= k[i];
+        if (z == 0)
+            break;
+
+        int d = 0;
+        if (k[0] & 1) {
+            d = k[0] & ((1 << w) - 1);
+            if (d >= (1 << (w - 1)))
+                d -= (1 << w);
+            if (d > 0) {
+                // the low w bits are exactly d, so no borrow
+                k[0] -= d;
+            } else {
+                uint64_t carry = (uint64_t)(-d);
+                for (int i = 0; i < 9 && carry; i++) {
+                    carry += k[i];
+                    k[i] = (uint32_t)carry;
+                    carry >>= 32;
+                }
+            }
+        }
+        wnaf[len++] = d;
+
+        for (int i = 0; i < 8; i++)
+            k[i] = (k[i] >> 1) | (k[i+1] << 31);
+        k[8] >>= 1;
+    }
+    return len;
+}
+
+//
+// Group elements
+//
+
+struct GeAffine
+{
+    FieldElem x, y;
+    bool fInfinity;
+};
+
+struct GeJac
+{
+    FieldElem x, y, z;
+    bool fInfinity;
+};
+
+void GeSetAffine(GeJac& r, const GeAffine& a)
+{
+    r.x = a.x;
+    r.y = a.y;
+    FeSetInt(r.z, 1);
+    r.fInfinity = a.fInfinity;
+}
+
+bool GeIsOnCurve(const GeAffine& a)
+{
+    FieldElem y2, x3, b;
+    FeSqr(y2, a.y);
+    FeSqr(x3, a.x);
+    FeMul(x3, x3, a.x);
+    FeSetInt(b, 7);
+    FeAdd(x3, x3, b);
+    return FeEqual(y2, x3);
+}
+
+// r = 2a (dbl-2009-l, a = 0)
+void GeDouble(GeJac& r, const GeJac& a)
+{
+    if (a.fInfinity) {
+        r.fInfinity = true;
+        return;
+    }
+    FieldElem A, B, C, D, E, F, t, z3;
+    FeMul(z3, a.y, a.z);
+    FeAdd(z3, z3, z3);
+    FeSqr(A, a.x);
+    FeSqr(B, a.y);
+    FeSqr(C, B);
+    FeAdd(t, a.x, B);
+    FeSqr(t, t);
+    FeSub(t, t, A);
+    FeSub(t, t, C);
+    FeAdd(D, t, t);
+    FeAdd(E, A, A);
+    FeAdd(E, E, A);
+    FeSqr(F, E);
+    FeSub(r.x, F, D);
+    FeSub(r.x, r.x, D);
+    FeSub(t, D, r.x);
+    FeMul(r.y, E, t);
+    FeAdd(C, C, C);
+    FeAdd(C, C, C);
+    FeAdd(C, C, C);
+    FeSub(r.y, r.y, C);
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+// Shared tail of the additions: given U1, S1, H = U2 - U1, R = S2 - S1 and
+// the new Z (before the factor H), finish r = a + b.
+void GeAddFinish(GeJac& r, const FieldElem& U1, const FieldElem& S1, const FieldElem& H, const FieldElem& R, const FieldElem& Z)
+{
+    FieldElem HH, HHH, V, t;
+    FeSqr(HH, H);
+    FeMul(HHH, H, HH);
+    FeMul(V, U1, HH);
+    FeMul(r.z, Z, H);
+    FeSqr(r.x, R);
+    FeSub(r.x, r.x, HHH);
+    FeSub(r.x, r.x, V);
+    FeSub(r.x, r.x, V);
+    FeSub(t, V, r.x);
+    FeMul(r.y, R, t);
+    FeMul(t, S1, HHH);
+    FeSub(r.y, r.y, t);
+    r.fInfinity = false;
+}
+
+// r = a + b with b in affine coordinates
+void GeAddAffine(GeJac& r, const GeJac& a, const GeAffine& b)
+{
+    if (b.fInfinity) {
+        r = a;
+        return;
+    }
+    if (a.fInfinity) {
+        GeSetAffine(r, b);
+        return;
+    }
+    FieldElem Z1Z1, U2, S2, H, R;
+    FeSqr(Z1Z1, a.z);
+    FeMul(U2, b.x, Z1Z1);
+    FeMul(S2, b.y, a.z);
+    FeMul(S2, S2, Z1Z1);
+    FeSub(H, U2, a.x);
+    FeSub(R, S2, a.y);
+    if (FeIsZero(H)) {
+        if (FeIsZero(R))
+            GeDouble(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+    FieldElem U1 = a.x, S1 = a.y, Z = a.z;
+    GeAddFinish(r, U1, S1, H, R, Z);
+}
+
+// r = a + b
+void GeAdd(GeJac& r, const GeJac& a, const GeJac& b)
+{
+    if (b.fInfinity) {
+        r = a;
+        return;
+    }
+    if (a.fInfinity) {
+        r = b;
+        return;
+    }
+    FieldElem Z1Z1, Z2Z2, U1, U2, S1, S2, H, R, Z;
+    FeSqr(Z1Z1, a.z);
+    FeSqr(Z2Z2, b.z);
+    FeMul(U1, a.x, Z2Z2);
+    FeMul(U2, b.x, Z1Z1);
+    FeMul(S1, a.y, b.z);
+    FeMul(S1, S1, Z2Z2);
+    FeMul(S2, b.y, a.z);
+    FeMul(S2, S2, Z1Z1);
+    FeSub(H, U2, U1);
+    FeSub(R, S2, S1);
+    if (FeIsZero(H)) {
+        if (FeIsZero(R))
+            GeDouble(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+    FeMul(Z, a.z, b.z);
+    GeAddFinish(r, U1, S1, H, R, Z);
+}
+
+// Convert points to affine coordinates with a single field inversion
+// (Montgomery's trick). None of the inputs may be infinity.
+void GeBatchToAffine(GeAffine *r, const GeJac *a, int n)
+{
+    FieldElem *prod = new FieldElem[n];
+    prod[0] = a[0].z;
+    for (int i = 1; i < n; i++)
+        FeMul(prod[i], prod[i-1], a[i].z);
+
+    FieldElem inv;
+    FeInv(inv, prod[n-1]);
+    for (int i = n - 1; i >= 0; i--) {
+        FieldElem zi, zi2;
+        if (i > 0) {
+            FeMul(zi, inv, prod[i-1]);
+            FeMul(inv, inv, a[i].z);
+        } else {
+            zi = inv;
+        }
+        FeSqr(zi2, zi);
+        FeMul(r[i].x, a[i].x, zi2);
+        FeMul(zi2, zi2, zi);
+        FeMul(r[i].y, a[i].y, zi2);
+        r[i].fInfinity = false;
+    }
+    delete[] prod;
+}
+
+/** Odd multiples G, 3G, 5G, ... of the generator in affine coordinates */
+class CGeneratorTable
+{
+public:
+    GeAffine points[TABLE_SIZE_G];
+
+    CGeneratorTable()
+    {
+        GeAffine g;
+        FeSetBytes(g.x, GX_BYTES);
+        FeSetBytes(g.y, GY_BYTES);
+        g.fInfinity = false;
+
+        GeJac jac[TABLE_SIZE_G], g2;
+        GeSetAffine(jac[0], g);
+        GeDouble(g2, jac[0]);
+        for (int i = 1; i < TABLE_SIZE_G; i++)
+            GeAdd(jac[i], jac[i-1], g2);
+        GeBatchToAffine(points, jac, TABLE_SIZE_G);
+    }
+};
+
+const GeAffine *GetGeneratorTable()
+{
+    static CGeneratorTable table;
+    return table.points;
+}
+
+// r = na*a + ng*G (Shamir's trick over interleaved wNAF expansions)
+void GeMulDouble(GeJac& r, const GeAffine& a, const Scalar& na, const Scalar& ng)
+{
+    const GeAffine *tableG = GetGeneratorTable();
+
+    GeJac tableA[TABLE_SIZE_Q], a2;
+    GeSetAffine(tableA[0], a);
+    GeDouble(a2, tableA[0]);
+    for (int i = 1; i < TABLE_SIZE_Q; i++)
+        GeAdd(tableA[i], tableA[i-1], a2);
+
+    int wnafA[WNAF_MAX], wnafG[WNAF_MAX];
+    int lenA = ScWNAF(wnafA, na, WINDOW_Q);
+    int lenG = ScWNAF(wnafG, ng, WINDOW_G);
+    int len = lenA > lenG ? lenA : lenG;
+
+    r.fInfinity = true;
+    for (int i = len - 1; i >= 0; i--) {
+        GeDouble(r, r);
+        int d = wnafA[i];
+        if (d != 0) {
+            GeJac t = tableA[((d > 0 ? d : -d) - 1) / 2];
+            if (d < 0)
+                FeNeg(t.y, t.y);
+            GeAdd(r, r, t);
+        }
+        d = wnafG[i];
+        if (d != 0) {
+            GeAffine t = tableG[((d > 0 ? d : -d) - 1) / 2];
+            if (d < 0)
+                FeNeg(t.y, t.y);
+            GeAddAffine(r, r, t);
+        }
+    }
+}
+
+//
+// Serialization
+//
+
+bool ParsePubKey(GeAffine& r, const unsigned char *pubkey, unsigned int nLen)
+{
+    r.fInfinity = false;
+    if (nLen == 33 && (pubkey[0] == 0x02 || pubkey[0] == 0x03)) {
+        if (!FeSetBytes(r.x, pubkey + 1))
+            return false;
+        FieldElem y2, b;
+        FeSqr(y2, r.x);
+        FeMul(y2, y2, r.x);
+        FeSetInt(b, 7);
+        FeAdd(y2, y2, b);
+        if (!FeSqrt(r.y, y2))
+            return false;
+        if (FeIsOdd(r.y) != (pubkey[0] == 0x03))
+            FeNeg(r.y, r.y);
+        return true;
+    }
+    if (nLen == 65 && (pubkey[0] == 0x04 || pubkey[0] == 0x06 || pubkey[0] == 0x07)) {
+        if (!FeSetBytes(r.x, pubkey + 1) || !FeSetBytes(r.y, pubkey + 33))
+            return false;
+        // hybrid keys encode the parity of y in the header byte
+        if (pubkey[0] != 0x04 && FeIsOdd(r.y) != (pubkey[0] == 0x07))
+            return false;
+        return GeIsOnCurve(r);
+    }
+    return false;
+}
+
+// Read one strict DER INTEGER into 32 big-endian bytes. fOverflow is set for
+// values of 2^256 and above, which no valid signature can contain.
+void ReadDERInteger(unsigned char out[32], const unsigned char *p, unsigned int nLen, bool& fOverflow)
+{
+    // drop the sign padding byte
+    if (nLen > 1 && p[0] == 0) {
+        p++;
+        nLen--;
+    }
+    fOverflow = (nLen > 32);
+    memset(out, 0, 32);
+    if (!fOverflow)
+        memcpy(out + 32 - nLen, p, nLen);
+}
+
+// Accepts exactly the encodings that IsCanonicalSignature allows (without the
+// hash type byte). Anything else is left to OpenSSL so that the set of
+// accepted signatures stays identical.
+bool ParseStrictDER(const unsigned char *sig, unsigned int nLen, unsigned char r[32], unsigned char s[32], bool& fOverflow)
+{
+    if (nLen < 8 || nLen > 72)
+        return false;
+    if (sig[0] != 0x30 || sig[1] != nLen - 2)
+        return false;
+    unsigned int nLenR = sig[3];
+    if (sig[2] != 0x02 || nLenR == 0 || 5 + nLenR >= nLen)
+        return false;
+    const unsigned char *R = &sig[4];
+    if (R[0] & 0x80)
+        return false;
+    if (nLenR > 1 && R[0] == 0x00 && !(R[1] & 0x80))
+        return false;
+    unsigned int nLenS = sig[5+nLenR];
+    if (sig[4+nLenR] != 0x02 || nLenS == 0 || nLenR + nLenS + 6 != nLen)
+        return false;
+    const unsigned char *S = &sig[6+nLenR];
+    if (S[0] & 0x80)
+        return false;
+    if (nLenS > 1 && S[0] == 0x00 && !(S[1] & 0x80))
+        return false;
+
+    bool fOverflowR, fOverflowS;
+    ReadDERInteger(r, R, nLenR, fOverflowR);
+    ReadDERInteger(s, S, nLenS, fOverflowS);
+    fOverflow = fOverflowR || fOverflowS;
+    return true;
+}
+
+}; // end of anonymous namespace
+
+int Secp256k1Verify(const unsigned char *pubkey, unsigned int nPubKeyLen,
+                    const unsigned char hash[32],
+                    const unsigned char *sig, unsigned int nSigLen)
+{
+    unsigned char vchR[32], vchS[32];
+    bool fOverflow;
+    if (!ParseStrictDER(sig, nSigLen, vchR, vchS, fOverflow))
+        return SECP256K1_VERIFY_UNSUPPORTED;
+    if (fOverflow)
+        return SECP256K1_VERIFY_BAD;
+
+    GeAffine q;
+    if (!ParsePubKey(q, pubkey, nPubKeyLen))
+        return SECP256K1_VERIFY_BAD;
+
+    // r and s must be in [1, n-1]
+    Scalar r, s, z;
+    ScSetBytes(r, vchR, fOverflow);
+    if (fOverflow || ScIsZero(r))
+        return SECP256K1_VERIFY_BAD;
+    ScSetBytes(s, vchS, fOverflow);
+    if (fOverflow || ScIsZero(s))
+        return SECP256K1_VERIFY_BAD;
+    ScSetBytes(z, hash, fOverflow);
+
+    // R = (z/s)*G + (r/s)*Q
+    Scalar w, u1, u2;
+    ScInv(w, s);
+    ScMul(u1, z, w);
+    ScMul(u2, r, w);
+    GeJac R;
+    GeMulDouble(R, q, u2, u1);
+    if (R.fInfinity)
+        return SECP256K1_VERIFY_BAD;
+
+    // Check R.x mod n == r without leaving Jacobian coordinates: the affine x
+    // is X/Z^2, and since n < p it equals either r or r + n.
+    FieldElem xr, zz, t;
+    FeSqr(zz, R.z);
+    memcpy(xr.n, r.n, sizeof(xr.n));
+    FeMul(t, xr, zz);
+    if (FeEqual(t, R.x))
+        return SECP256K1_VERIFY_OK;
+    limb_t rn[NLIMBS];
+    if (Add(rn, r.n, curve.n.m) == 0 && LessThan(rn, curve.p.m)) {
+        memcpy(xr.n, rn, sizeof(xr.n));
+        FeMul(t, xr, zz);
+        if (FeEqual(t, R.x))
+            return SECP256K1_VERIFY_OK;
+    }
+    return SECP256K1_VERIFY_BAD;
+}
+
+bool Secp256k1PubKeyIsValid(const unsigned char *pubkey, unsigned int nPubKeyLen)
+{
+    GeAffine q;
+    return ParsePubKey(q, pubkey, nPubKeyLen);
+}
+
+bool Secp256k1DecompressPubKey(const unsigned char *pubkey, unsigned int nPubKeyLen, unsigned char out[65])
+{
+    GeAffine q;
+    if (!ParsePubKey(q, pubkey, nPubKeyLen))
+        return false;
+    out[0] = 0x04;
+    GetBytes(out + 1, q.x.n);
+    GetBytes(out + 33, q.y.n);
+    return true;
+}
@@ -0,0 +1,36 @@
+// Copyright (c) 2013-2014 The CasinoCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SECP256K1_H
+#define BITCOIN_SECP256K1_H
+
+/** Self-contained secp256k1 arithmetic used for ECDSA signature verification.
+ *
+ * Field and scalar operations are branch-free on their operands. Point
+ * multiplication (wNAF, no endomorphism) is variable-time and must only be
+ * used on public data, which is all signature verification ever sees.
+ * Signing and key generation stay with OpenSSL.
+ */
+
+/** Results of Secp256k1Verify */
+enum
+{
+    SECP256K1_VERIFY_BAD         = 0,  // invalid signature or public key
+    SECP256K1_VERIFY_OK          = 1,  // valid signature
+    SECP256K1_VERIFY_UNSUPPORTED = -1, // signature is not strict DER; ask OpenSSL
+};
+
+/** Verify a DER encoded ECDSA signature of a 32-byte big-endian message hash
+ * against a serialized public key (compressed, uncompressed or hybrid).
+ */
+int Secp256k1Verify(const unsigned char *pubkey, unsigned int nPubKeyLen,
+                    const unsigned char hash[32],
+                    const unsigned char *sig, unsigned int nSigLen);
+
+/** Check that a serialized public key is a point on the curve. */
+bool Secp256k1PubKeyIsValid(const unsigned char *pubkey, unsigned int nPubKeyLen);
+
+/** Parse a serialized public key and write it in 65-byte uncompressed form. */
+bool Secp256k1DecompressPubKey(const unsigned char *pubkey, unsigned int nPubKeyLen, unsigned char out[65]);
+
+#endif
@@ -1358,4 +1358,63 @@ public:
     }
 };
 
+
+/** Read-only stream over memory owned by someone else, such as a mapped
+ *  file. Objects are deserialized straight out of it, without the buffer
+ *  being copied first. */
+class CBufferReader
+{
+private:
+    const char* pbegin;
+    const char* pcur;
+    const char* pend;
+
+public:
+    int nType;
+    int nVersion;
+
+    CBufferReader(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn) :
+        pbegin(pbeginIn), pcur(pbeginIn), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {
+    }
+
+    int GetType()                { return nType; }
+    int GetVersion()             { return nVersion; }
+
+    // bytes left to read
+    size_t size() const {
+        return pend - pcur;
+    }
+
+    bool empty() const {
+        return pcur == pend;
+    }
+
+    // return the current reading position
+    size_t GetPos() const {
+        return pcur - pbegin;
+    }
+
+    CBufferReader& read(char* pch, size_t nSize) {
+        if (nSize > (size_t)(pend - pcur))
+            throw std::ios_base::failure("CBufferReader::read : end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    CBufferReader& ignore(size_t nSize) {
+        if (nSize > (size_t)(pend - pcur))
+            throw std::ios_base::failure("CBufferReader::ignore : end of data");
+        pcur += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CBufferReader& operator>>(T& obj) {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 #endif
@@ -0,0 +1,157 @@
+//
+// Unit tests for the parallel block download scheduler
+//
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include "main.h"
+#include "net.h"
+#include "util.h"
+
+// Tests these internal-to-main.cpp methods:
+extern void MarkBlockAsInFlight(CNode* pnode, const uint256 &hash);
+extern void MarkBlockAsReceived(const uint256 &hash);
+extern void CheckBlocksInFlight();
+extern void FindBlocksToDownload(CNode* pto, std::vector<CInv> &vGetData);
+extern std::deque<CBlockIndex*> dequeBlocksToDownload;
+extern int64 nBlockStallingTimeout;
+
+using namespace std;
+
+// A chain of headers waiting to be downloaded, and peers to fetch them from
+struct BlockDownloadSetup
+{
+    vector<uint256> vHash;
+    vector<CBlockIndex> vIndex;
+    vector<CNode*> vNodes;
+
+    BlockDownloadSetup(unsigned int nBlocks)
+    {
+        SetMockTime(GetTime());
+        vHash.resize(nBlocks);
+        vIndex.resize(nBlocks);
+        for (unsigned int i = 0; i < nBlocks; i++)
+        {
+            vHash[i] = GetRandHash();
+            vIndex[i].phashBlock = &vHash[i];
+            vIndex[i].nHeight = i + 1;
+            dequeBlocksToDownload.push_back(&vIndex[i]);
+        }
+    }
+
+    CNode* AddNode(int nHeight)
+    {
+        CAddress addr(CService(CNetAddr(), 0));
+        CNode* pnode = new CNode(INVALID_SOCKET, addr, "", true);
+        pnode->nStartingHeight = nHeight;
+        vNodes.push_back(pnode);
+        return pnode;
+    }
+
+    ~BlockDownloadSetup()
+    {
+        BOOST_FOREACH(const uint256& hash, vHash)
+            MarkBlockAsReceived(hash);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+            delete pnode;
+        dequeBlocksToDownload.clear();
+        nBlockStallingTimeout = BLOCK_STALLING_TIMEOUT;
+        SetMockTime(0);
+    }
+};
+
+BOOST_AUTO_TEST_SUITE(blockdownload_tests)
+
+BOOST_AUTO_TEST_CASE(blockdownload_assign)
+{
+    BlockDownloadSetup setup(20);
+    CNode* pnodeA = setup.AddNode(100);
+    CNode* pnodeB = setup.AddNode(100);
+    CNode* pnodeShort = setup.AddNode(0);
+
+    // Each peer gets its share of the first blocks nobody else is fetching
+    vector<CInv> vGetData;
+    FindBlocksToDownload(pnodeA, vGetData);
+    BOOST_REQUIRE_EQUAL(vGetData.size(), (size_t)MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK(vGetData[0].hash == setup.vHash[0]);
+    BOOST_CHECK_EQUAL(pnodeA->nBlocksInFlight, MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    vGetData.clear();
+    FindBlocksToDownload(pnodeB, vGetData);
+    BOOST_REQUIRE_EQUAL(vGetData.size(), 20U - MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK(vGetData[0].hash == setup.vHash[MAX_BLOCKS_IN_TRANSIT_PER_PEER]);
+
+    // A peer without the blocks isn't asked for them
+    vGetData.clear();
+    FindBlocksToDownload(pnodeShort, vGetData);
+    BOOST_CHECK(vGetData.empty());
+    BOOST_CHECK_EQUAL(pnodeShort->nBlocksInFlight, 0);
+
+    // A received block frees its slot
+    MarkBlockAsReceived(setup.vHash[0]);
+    BOOST_CHECK_EQUAL(pnodeA->nBlocksInFlight, MAX_BLOCKS_IN_TRANSIT_PER_PEER - 1);
+}
+
+BOOST_AUTO_TEST_CASE(blockdownload_disconnect)
+{
+    BlockDownloadSetup setup(MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    CNode* pnodeA = setup.AddNode(100);
+    CNode* pnodeB = setup.AddNode(100);
+
+    vector<CInv> vGetData;
+    FindBlocksToDownload(pnodeA, vGetData);
+    BOOST_CHECK_EQUAL(pnodeA->nBlocksInFlight, MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    vGetData.clear();
+    FindBlocksToDownload(pnodeB, vGetData);
+    BOOST_CHECK(vGetData.empty());
+
+    // The requests of a disconnected peer go to the next one that asks
+    pnodeA->fDisconnect = true;
+    CheckBlocksInFlight();
+    BOOST_CHECK_EQUAL(pnodeA->nBlocksInFlight, 0);
+    FindBlocksToDownload(pnodeB, vGetData);
+    BOOST_REQUIRE_EQUAL(vGetData.size(), (size_t)MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK(vGetData[0].hash == setup.vHash[0]);
+
+    // So do those not answered in time
+    SetMockTime(GetTime() + BLOCK_DOWNLOAD_TIMEOUT + 1);
+    CheckBlocksInFlight();
+    BOOST_CHECK_EQUAL(pnodeB->nBlocksInFlight, 0);
+    BOOST_CHECK(!pnodeB->fDisconnect);
+}
+
+BOOST_AUTO_TEST_CASE(blockdownload_stalling)
+{
+    BlockDownloadSetup setup(BLOCK_DOWNLOAD_WINDOW);
+    vector<CInv> vGetData;
+    for (unsigned int i = 0; i < BLOCK_DOWNLOAD_WINDOW / MAX_BLOCKS_IN_TRANSIT_PER_PEER; i++)
+        FindBlocksToDownload(setup.AddNode(BLOCK_DOWNLOAD_WINDOW), vGetData);
+    BOOST_CHECK_EQUAL(vGetData.size(), BLOCK_DOWNLOAD_WINDOW);
+    CNode* pnodeFirst = setup.vNodes[0];
+
+    // A peer with nothing left to fetch marks whoever holds the first block
+    CNode* pnodeIdle = setup.AddNode(BLOCK_DOWNLOAD_WINDOW);
+    vGetData.clear();
+    FindBlocksToDownload(pnodeIdle, vGetData);
+    BOOST_CHECK(vGetData.empty());
+    BOOST_CHECK(pnodeFirst->nStallingSince != 0);
+    BOOST_CHECK_EQUAL(setup.vNodes[1]->nStallingSince, 0);
+
+    // Within the timeout nothing happens
+    SetMockTime(GetTime() + BLOCK_STALLING_TIMEOUT);
+    CheckBlocksInFlight();
+    BOOST_CHECK(!pnodeFirst->fDisconnect);
+
+    // After it the staller is dropped, its blocks go to others, and the
+    // next staller gets longer
+    SetMockTime(GetTime() + 1);
+    CheckBlocksInFlight();
+    BOOST_CHECK(pnodeFirst->fDisconnect);
+    BOOST_CHECK_EQUAL(pnodeFirst->nBlocksInFlight, 0);
+    BOOST_CHECK_EQUAL(nBlockStallingTimeout, BLOCK_STALLING_TIMEOUT * 2);
+    FindBlocksToDownload(pnodeIdle, vGetData);
+    BOOST_REQUIRE_EQUAL(vGetData.size(), (size_t)MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK(vGetData[0].hash == setup.vHash[0]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
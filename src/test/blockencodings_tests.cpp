@@ -0,0 +1,99 @@
+#include <boost/test/unit_test.hpp>
+
+#include "blockencodings.h"
+#include "hash.h"
+#include "main.h"
+
+// A block of nTx transactions that differ by the outpoint they spend
+static CBlock BuildBlock(unsigned int nTx)
+{
+    CBlock block;
+    block.nVersion = 2;
+    block.nTime = 1370000000;
+    block.nBits = 0x1e0ffff0;
+    block.vtx.resize(nTx);
+    for (unsigned int i = 0; i < nTx; i++)
+    {
+        block.vtx[i].vin.resize(1);
+        block.vtx[i].vout.resize(1);
+        block.vtx[i].vout[0].nValue = i * CENT;
+        if (i == 0)
+            block.vtx[i].vin[0].scriptSig = CScript() << 1 << OP_0;
+        else
+            block.vtx[i].vin[0].prevout = COutPoint(uint256(i), i);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    // Reference vector from the SipHash paper's key, over 32 bytes counting up from 0
+    uint256 val("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100");
+    BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, val), 0x7127512f72f27cceULL);
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_roundtrip)
+{
+    CBlock block = BuildBlock(20);
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    BOOST_CHECK_EQUAL(cmpctblock.BlockTxCount(), 20U);
+    BOOST_CHECK_EQUAL(cmpctblock.vPrefilledTxn.size(), 1U);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << cmpctblock;
+    // Header, nonce, count, 6 bytes per short id and the coinbase
+    BOOST_CHECK_EQUAL(ss.size(), 80 + 8 + 1 + 19 * SHORTTXID_SIZE + ::GetSerializeSize(cmpctblock.vPrefilledTxn, SER_NETWORK, PROTOCOL_VERSION));
+
+    CBlockHeaderAndShortTxIDs cmpctblock2;
+    ss >> cmpctblock2;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(cmpctblock2.header.GetHash() == block.GetHash());
+    BOOST_CHECK(cmpctblock2.vShortTxIDs == cmpctblock.vShortTxIDs);
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        BOOST_CHECK_EQUAL(cmpctblock2.GetShortID(block.vtx[i].GetHash()), cmpctblock.vShortTxIDs[i - 1]);
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_reconstruct)
+{
+    CBlock block = BuildBlock(10);
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+
+    // The pool has every other transaction, and one that isn't in the block
+    CTxMemPool pool;
+    for (unsigned int i = 1; i < block.vtx.size(); i += 2)
+        pool.addUnchecked(block.vtx[i].GetHash(), block.vtx[i]);
+    CTransaction txOther = BuildBlock(12).vtx[11];
+    pool.addUnchecked(txOther.GetHash(), txOther);
+
+    CPartialBlock partial;
+    BOOST_REQUIRE(partial.Init(cmpctblock, pool));
+    std::vector<unsigned int> vMissing;
+    partial.GetMissing(vMissing);
+    BOOST_REQUIRE_EQUAL(vMissing.size(), 4U);
+    std::vector<CTransaction> vMissingTx;
+    BOOST_FOREACH(unsigned int nIndex, vMissing)
+    {
+        BOOST_CHECK(nIndex % 2 == 0 && nIndex > 0);
+        vMissingTx.push_back(block.vtx[nIndex]);
+    }
+
+    CBlock block2;
+    BOOST_CHECK(partial.FillBlock(block2, vMissingTx));
+    BOOST_CHECK(block2.GetHash() == block.GetHash());
+    BOOST_CHECK(block2.BuildMerkleTree() == block.hashMerkleRoot);
+
+    // Too few, or the wrong transactions don't make the block
+    vMissingTx.pop_back();
+    BOOST_CHECK(!partial.FillBlock(block2, vMissingTx));
+    vMissingTx.push_back(txOther);
+    BOOST_CHECK(!partial.FillBlock(block2, vMissingTx));
+
+    // A prefilled position out of range is refused
+    cmpctblock.vPrefilledTxn[0].nIndex = 10;
+    BOOST_CHECK(!partial.Init(cmpctblock, pool));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,99 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "checkqueue.h"
+#include "util.h"
+
+// Records how often each slot was checked; fails when its slot says so
+struct CCountingCheck
+{
+    std::vector<int> *pvCount;
+    const std::vector<bool> *pvFail;
+    unsigned int nSlot;
+
+    CCountingCheck() : pvCount(NULL), pvFail(NULL), nSlot(0) {}
+    CCountingCheck(std::vector<int> *pvCountIn, const std::vector<bool> *pvFailIn, unsigned int nSlotIn) :
+        pvCount(pvCountIn), pvFail(pvFailIn), nSlot(nSlotIn) {}
+
+    bool operator()()
+    {
+        // every slot is handed to exactly one check, so no locking is needed
+        (*pvCount)[nSlot]++;
+        if (nSlot % 7 == 0)
+            MilliSleep(nSlot % 2);
+        return !(*pvFail)[nSlot];
+    }
+
+    void swap(CCountingCheck &check)
+    {
+        std::swap(pvCount, check.pvCount);
+        std::swap(pvFail, check.pvFail);
+        std::swap(nSlot, check.nSlot);
+    }
+};
+
+static bool RunRound(CCheckQueue<CCountingCheck> &queue, std::vector<int> &vCount, const std::vector<bool> &vFail)
+{
+    CCheckQueueControl<CCountingCheck> control(&queue);
+    // Add in uneven batches, like ConnectBlock does per transaction
+    unsigned int nSlot = 0;
+    for (unsigned int nBatch = 1; nSlot < vCount.size(); nBatch = nBatch * 3 % 101 + 1)
+    {
+        std::vector<CCountingCheck> vChecks;
+        for (unsigned int i = 0; i < nBatch && nSlot < vCount.size(); i++)
+            vChecks.push_back(CCountingCheck(&vCount, &vFail, nSlot++));
+        control.Add(vChecks);
+    }
+    return control.Wait();
+}
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_workers)
+{
+    CCheckQueue<CCountingCheck> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 4; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CCountingCheck>::Thread, &queue));
+
+    std::vector<int> vCount(5000, 0);
+    std::vector<bool> vFail(5000, false);
+    for (int nRound = 1; nRound <= 5; nRound++)
+    {
+        BOOST_CHECK(RunRound(queue, vCount, vFail));
+        bool fAllCounted = true;
+        for (unsigned int i = 0; i < vCount.size(); i++)
+            fAllCounted &= (vCount[i] == nRound);
+        BOOST_CHECK(fAllCounted);
+    }
+
+    // A single failure fails the round, but not the next one
+    vFail[4321] = true;
+    BOOST_CHECK(!RunRound(queue, vCount, vFail));
+    vFail[4321] = false;
+    BOOST_CHECK(RunRound(queue, vCount, vFail));
+
+    CCheckQueueStats stats;
+    queue.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nThreads, 5);
+    BOOST_CHECK_EQUAL(stats.nChecks, 7U * 5000);
+    BOOST_CHECK(stats.nBatchSize >= 1 && stats.nBatchSize <= 128);
+    BOOST_CHECK(stats.dCheckMicros > 0);
+    BOOST_CHECK(stats.nActiveMicros > 0);
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_master_only)
+{
+    // Without worker threads the master does everything in Wait()
+    CCheckQueue<CCountingCheck> queue(16);
+    std::vector<int> vCount(300, 0);
+    std::vector<bool> vFail(300, false);
+    BOOST_CHECK(RunRound(queue, vCount, vFail));
+    for (unsigned int i = 0; i < vCount.size(); i++)
+        BOOST_CHECK_EQUAL(vCount[i], 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,364 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include <map>
+
+#include "main.h"
+#include "uint256map.h"
+#include "util.h"
+
+// In-memory base view that counts what reaches it
+class CCoinsViewTest : public CCoinsView
+{
+public:
+    std::map<uint256, CCoins> mapCoins;
+    unsigned int nWrites;
+
+    CCoinsViewTest() : nWrites(0) {}
+
+    bool GetCoins(const uint256 &txid, CCoins &coins)
+    {
+        std::map<uint256, CCoins>::const_iterator it = mapCoins.find(txid);
+        if (it == mapCoins.end())
+            return false;
+        coins = it->second;
+        return true;
+    }
+
+    bool HaveCoins(const uint256 &txid) { return mapCoins.count(txid) > 0; }
+    CBlockIndex *GetBestBlock() { return NULL; }
+    bool SetBestBlock(CBlockIndex *pindex) { return true; }
+
+    bool BatchWrite(CCoinsMap &mapIn, CBlockIndex *pindex)
+    {
+        for (CCoinsMap::iterator it = mapIn.begin(); it != mapIn.end(); it++)
+        {
+            const CCoinsCacheEntry &entry = it->second;
+            if (!(entry.flags & CCoinsCacheEntry::DIRTY))
+                continue;
+            nWrites++;
+            if (entry.coins.IsPruned())
+                mapCoins.erase(it->first);
+            else
+                mapCoins[it->first] = entry.coins;
+        }
+        return true;
+    }
+};
+
+static CCoins MakeCoins(int nOutputs, int nHeight)
+{
+    CCoins coins;
+    coins.nHeight = nHeight;
+    coins.nVersion = 1;
+    for (int i = 0; i < nOutputs; i++)
+    {
+        CTxOut out;
+        out.nValue = (i + 1) * CENT;
+        out.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+        coins.vout.push_back(out);
+    }
+    return coins;
+}
+
+static void SpendAll(CCoins &coins)
+{
+    for (unsigned int i = 0; i < coins.vout.size(); i++)
+    {
+        CTxInUndo undo;
+        coins.Spend(COutPoint(0, i), undo);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(coins_tests)
+
+BOOST_AUTO_TEST_CASE(uint256map_basics)
+{
+    uint256map<int> map(GetRand(1000), GetRand(1000));
+    std::map<uint256, int> mapRef;
+    std::map<uint256, int*> mapAddress;
+    for (int i = 0; i < 100000; i++)
+    {
+        uint256 key = GetRand(2000);
+        switch (GetRand(3))
+        {
+        case 0: {
+            int &value = map[key];
+            value = i;
+            mapRef[key] = i;
+            // entries never move while they exist
+            if (mapAddress.count(key))
+                BOOST_CHECK(mapAddress[key] == &value);
+            mapAddress[key] = &value;
+            break;
+        }
+        case 1:
+            BOOST_CHECK_EQUAL(map.erase(key), mapRef.erase(key));
+            mapAddress.erase(key);
+            break;
+        case 2:
+            BOOST_CHECK_EQUAL(map.count(key), mapRef.count(key));
+            if (mapRef.count(key))
+                BOOST_CHECK_EQUAL(map.find(key)->second, mapRef[key]);
+            break;
+        }
+    }
+
+    unsigned int nCount = 0;
+    for (uint256map<int>::iterator it = map.begin(); it != map.end(); it++, nCount++)
+        BOOST_CHECK_EQUAL(it->second, mapRef[it->first]);
+    BOOST_CHECK_EQUAL(nCount, mapRef.size());
+    BOOST_CHECK_EQUAL(map.size(), mapRef.size());
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_dirty)
+{
+    CCoinsViewTest base;
+    uint256 txid = GetRandHash();
+    base.mapCoins[txid] = MakeCoins(2, 100);
+
+    // Reading does not cause a write back
+    {
+        CCoinsViewCache cache(base);
+        BOOST_CHECK(cache.HaveCoins(txid));
+        BOOST_CHECK(cache.AccessCoins(txid) == base.mapCoins[txid]);
+        CCoins coins;
+        BOOST_CHECK(cache.GetCoins(txid, coins));
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK_EQUAL(base.nWrites, 0U);
+    }
+
+    // Modifying does
+    {
+        CCoinsViewCache cache(base);
+        CTxInUndo undo;
+        BOOST_CHECK(cache.GetCoins(txid).Spend(COutPoint(txid, 0), undo));
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK_EQUAL(base.nWrites, 1U);
+        BOOST_CHECK(!base.mapCoins[txid].IsAvailable(0));
+        BOOST_CHECK(base.mapCoins[txid].IsAvailable(1));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_fresh)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(base);
+    uint256 txid = GetRandHash();
+
+    // Created and spent in a child view: the parent drops it
+    BOOST_CHECK(!cache.HaveCoins(txid));
+    {
+        CCoinsViewCache child(cache, true);
+        BOOST_CHECK(!child.HaveCoins(txid));
+        child.SetCoins(txid, MakeCoins(3, 200));
+        BOOST_CHECK(child.Flush());
+    }
+    BOOST_CHECK(cache.HaveCoins(txid));
+    {
+        CCoinsViewCache child(cache, true);
+        SpendAll(child.GetCoins(txid));
+        BOOST_CHECK(child.Flush());
+    }
+    BOOST_CHECK(!cache.HaveCoins(txid));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(base.nWrites, 0U);
+
+    // Spending something the base has is written as an erase
+    base.mapCoins[txid] = MakeCoins(1, 300);
+    {
+        CCoinsViewCache child(cache, true);
+        SpendAll(child.GetCoins(txid));
+        BOOST_CHECK(child.Flush());
+    }
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(base.nWrites, 1U);
+    BOOST_CHECK(!base.mapCoins.count(txid));
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_simulation)
+{
+    // Random modifications through a stack of caches must match a plain map
+    std::map<uint256, CCoins> mapRef;
+    std::vector<uint256> vTxids;
+    for (int i = 0; i < 200; i++)
+        vTxids.push_back(GetRandHash());
+
+    CCoinsViewTest base;
+    std::vector<CCoinsViewCache*> vStack;
+    vStack.push_back(new CCoinsViewCache(base));
+
+    for (int i = 0; i < 20000; i++)
+    {
+        const uint256 &txid = vTxids[GetRand(vTxids.size())];
+        CCoinsViewCache &top = *vStack.back();
+        if (GetRand(2) == 0)
+        {
+            CCoins coins = GetRand(4) ? MakeCoins(1 + GetRand(3), i) : CCoins();
+            top.SetCoins(txid, coins);
+            mapRef[txid] = coins;
+        }
+        else if (top.HaveCoins(txid))
+        {
+            CCoins &coins = top.GetCoins(txid);
+            CTxInUndo undo;
+            unsigned int n = GetRand(coins.vout.size());
+            coins.Spend(COutPoint(txid, n), undo);
+            mapRef[txid].Spend(COutPoint(txid, n), undo);
+        }
+
+        CCoins coins;
+        bool fHave = top.GetCoins(txid, coins);
+        BOOST_CHECK_EQUAL(fHave, mapRef.count(txid) && !mapRef[txid].IsPruned());
+        if (fHave)
+            BOOST_CHECK(coins == mapRef[txid]);
+
+        if (GetRand(100) == 0)
+        {
+            // flush the top cache and drop it, or push a new one
+            if (vStack.size() > 1 && GetRand(2) == 0)
+            {
+                BOOST_CHECK(vStack.back()->Flush());
+                delete vStack.back();
+                vStack.pop_back();
+            }
+            else if (vStack.size() < 4)
+                vStack.push_back(new CCoinsViewCache(*vStack.back(), true));
+        }
+    }
+
+    while (!vStack.empty())
+    {
+        BOOST_CHECK(vStack.back()->Flush());
+        delete vStack.back();
+        vStack.pop_back();
+    }
+    for (std::map<uint256, CCoins>::iterator it = mapRef.begin(); it != mapRef.end(); it++)
+    {
+        if (it->second.IsPruned())
+            BOOST_CHECK(!base.mapCoins.count(it->first));
+        else
+            BOOST_CHECK(base.mapCoins[it->first] == it->second);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_usage)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(base);
+    size_t nEmpty = cache.DynamicMemoryUsage();
+
+    uint256 txid = GetRandHash();
+    cache.SetCoins(txid, MakeCoins(10, 1));
+    size_t nUsage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > nEmpty + 10 * sizeof(CTxOut));
+
+    // Changes made through a reference are counted too
+    cache.GetCoins(txid).vout.resize(100);
+    BOOST_CHECK(cache.DynamicMemoryUsage() > nUsage);
+
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nEmpty);
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewTest base;
+    CCoinsViewPrefetch prefetch(base, 1 << 20);
+    CCoinsViewCache cache(prefetch);
+
+    // A block spending two stored transactions, one unknown one and one of its own
+    uint256 txidA = GetRandHash(), txidB = GetRandHash(), txidUnknown = GetRandHash();
+    base.mapCoins[txidA] = MakeCoins(2, 10);
+    base.mapCoins[txidB] = MakeCoins(1, 11);
+    CBlock block;
+    block.vtx.resize(3);
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vout.resize(1);
+    block.vtx[1].vin.resize(3);
+    block.vtx[1].vin[0].prevout = COutPoint(txidA, 1);
+    block.vtx[1].vin[1].prevout = COutPoint(txidB, 0);
+    block.vtx[1].vin[2].prevout = COutPoint(txidUnknown, 0);
+    block.vtx[1].vout.resize(1);
+    block.vtx[2].vin.resize(1);
+    block.vtx[2].vin[0].prevout = COutPoint(block.vtx[1].GetHash(), 0);
+
+    // txidB is already cached above, so only A and the unknown one are read
+    BOOST_CHECK(cache.HaveCoins(txidB));
+    BOOST_CHECK_EQUAL(prefetch.Prefetch(block, cache), 2U);
+
+    boost::thread thread(boost::bind(&CCoinsViewPrefetch::Thread, &prefetch));
+    unsigned int nRead = 0, nHit, nMiss;
+    for (int i = 0; i < 1000 && nRead < 2; i++)
+    {
+        unsigned int n;
+        prefetch.GetStatistics(n, nHit, nMiss);
+        nRead += n;
+        MilliSleep(1);
+    }
+    BOOST_CHECK_EQUAL(nRead, 2U);
+    BOOST_CHECK(prefetch.DynamicMemoryUsage() > 0);
+
+    BOOST_CHECK(cache.HaveCoins(txidA));
+    BOOST_CHECK(cache.AccessCoins(txidA) == base.mapCoins[txidA]);
+    BOOST_CHECK(!cache.HaveCoins(txidUnknown));
+    prefetch.GetStatistics(nRead, nHit, nMiss);
+    BOOST_CHECK_EQUAL(nHit, 2U);
+    BOOST_CHECK_EQUAL(nMiss, 0U);
+    BOOST_CHECK_EQUAL(prefetch.DynamicMemoryUsage(), 0U);
+
+    // Prefetched state never survives a write to the base
+    base.mapCoins[txidUnknown] = MakeCoins(1, 12);
+    cache.SetCoins(txidA, CCoins());
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!base.mapCoins.count(txidA));
+    BOOST_CHECK_EQUAL(prefetch.Prefetch(block, cache), 3U);
+    for (int i = 0; i < 1000 && nRead < 3; i++)
+    {
+        unsigned int n;
+        prefetch.GetStatistics(n, nHit, nMiss);
+        nRead += n;
+        MilliSleep(1);
+    }
+    BOOST_CHECK(!cache.HaveCoins(txidA));
+    BOOST_CHECK(cache.HaveCoins(txidUnknown));
+
+    prefetch.Stop();
+    thread.join();
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch_budget)
+{
+    CCoinsViewTest base;
+    CCoinsViewPrefetch prefetch(base, 0);
+    CCoinsViewCache cache(prefetch);
+
+    uint256 txid = GetRandHash();
+    base.mapCoins[txid] = MakeCoins(2, 10);
+    CBlock block;
+    block.vtx.resize(2);
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vout.resize(1);
+    block.vtx[1].vin.resize(1);
+    block.vtx[1].vin[0].prevout = COutPoint(txid, 0);
+    block.vtx[1].vout.resize(1);
+
+    // With no room in its budget, what the worker reads is dropped
+    BOOST_CHECK_EQUAL(prefetch.Prefetch(block, cache), 1U);
+    boost::thread thread(boost::bind(&CCoinsViewPrefetch::Thread, &prefetch));
+    MilliSleep(50);
+    prefetch.Stop();
+    thread.join();
+
+    unsigned int nRead, nHit, nMiss;
+    prefetch.GetStatistics(nRead, nHit, nMiss);
+    BOOST_CHECK_EQUAL(nRead, 0U);
+    BOOST_CHECK_EQUAL(prefetch.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(cache.HaveCoins(txid));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,54 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include "main.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(coinsupply_tests)
+
+BOOST_AUTO_TEST_CASE(coinsupply_matches_rewards)
+{
+    // Past the tip the stored supply is extended block by block, which has to
+    // agree with summing every reward from the first block
+    int heights[] = { 0, 1, 719, 720, 7199, 7200, 100000, 100001, 575000, 575001, 600000, 1500000, 1575000, 1600000 };
+    BOOST_FOREACH(int nHeight, heights)
+        BOOST_CHECK_EQUAL(GetTotalCoinSupply(nHeight, false), GetTotalCoinSupply(nHeight, true));
+
+    BOOST_CHECK_EQUAL(GetTotalCoinSupply(0, false), 0);
+    BOOST_CHECK_EQUAL(GetTotalCoinSupply(100000, false), 482721500000000LL);
+}
+
+BOOST_AUTO_TEST_CASE(coinsupply_disk_index)
+{
+    CBlockHeader header;
+    header.nTime = 1370000000;
+    CBlockIndex index(header);
+    index.nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA;
+    index.SetMoneySupply(3782721500000000LL);
+
+    // The supply is kept across a write to the block tree
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CDiskBlockIndex(&index);
+    CDiskBlockIndex diskindex;
+    ss >> diskindex;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(diskindex.nStatus & BLOCK_HAVE_SUPPLY);
+    BOOST_CHECK_EQUAL(diskindex.nMoneySupply, 3782721500000000LL);
+
+    // Entries written without it still deserialize, to be filled in on load
+    index.nStatus &= ~BLOCK_HAVE_SUPPLY;
+    ss << CDiskBlockIndex(&index);
+    ss >> diskindex;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(!(diskindex.nStatus & BLOCK_HAVE_SUPPLY));
+
+    // An older version rewriting the entry keeps the flag but drops the supply
+    index.nStatus |= BLOCK_HAVE_SUPPLY;
+    CDataStream ssOld(SER_DISK, BLOCK_INDEX_TRAILER_VERSION - 1);
+    ssOld << CDiskBlockIndex(&index);
+    ssOld >> diskindex;
+    BOOST_CHECK(ssOld.empty());
+    BOOST_CHECK(!(diskindex.nStatus & BLOCK_HAVE_SUPPLY));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
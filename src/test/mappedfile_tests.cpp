@@ -0,0 +1,89 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include "mappedfile.h"
+#include "serialize.h"
+#include "util.h"
+
+static void AppendToFile(const boost::filesystem::path &path, const std::string &str)
+{
+    FILE* file = fopen(path.string().c_str(), "ab");
+    BOOST_REQUIRE(file != NULL);
+    fwrite(str.data(), 1, str.size(), file);
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_SUITE(mappedfile_tests)
+
+BOOST_AUTO_TEST_CASE(mappedfile_pool)
+{
+    boost::filesystem::path pathTemp = GetTempPath() / strprintf("test_mappedfile_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+    boost::filesystem::create_directories(pathTemp);
+    boost::filesystem::path pathA = pathTemp / "a.dat";
+    boost::filesystem::path pathB = pathTemp / "b.dat";
+    boost::filesystem::path pathC = pathTemp / "c.dat";
+
+    CMappedFilePool pool(2);
+    BOOST_CHECK(!pool.Get(pathA, 1));
+
+    AppendToFile(pathA, "block");
+    boost::shared_ptr<const CMappedFile> file = pool.Get(pathA, 5);
+    BOOST_REQUIRE(file);
+    BOOST_CHECK_EQUAL(std::string(file->begin(), file->end()), "block");
+    BOOST_CHECK(pool.Get(pathA, 5) == file);
+    BOOST_CHECK(!pool.Get(pathA, 6));
+
+    // A grown file is mapped again, while the old mapping stays readable
+    AppendToFile(pathA, "chain");
+    boost::shared_ptr<const CMappedFile> fileGrown = pool.Get(pathA, 10);
+    BOOST_REQUIRE(fileGrown);
+    BOOST_CHECK(fileGrown != file);
+    BOOST_CHECK_EQUAL(std::string(fileGrown->begin(), fileGrown->end()), "blockchain");
+    BOOST_CHECK_EQUAL(std::string(file->begin(), file->end()), "block");
+
+    // The least recently used file is dropped
+    AppendToFile(pathB, "b");
+    AppendToFile(pathC, "c");
+    BOOST_CHECK(pool.Get(pathB, 1));
+    BOOST_CHECK(pool.Get(pathA, 10) == fileGrown);
+    BOOST_CHECK(pool.Get(pathC, 1));
+    BOOST_CHECK_EQUAL(pool.size(), 2U);
+    BOOST_CHECK(pool.Get(pathA, 10) == fileGrown);
+
+    pool.Release(pathA);
+    BOOST_CHECK_EQUAL(pool.size(), 1U);
+    BOOST_CHECK(pool.Get(pathA, 10) != fileGrown);
+    pool.Clear();
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+
+    file.reset();
+    fileGrown.reset();
+    boost::filesystem::remove_all(pathTemp);
+}
+
+BOOST_AUTO_TEST_CASE(bufferreader)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << 7 << std::string("casino") << (uint64)1234567890123ULL;
+    std::vector<char> vch(ss.begin(), ss.end());
+
+    CBufferReader reader(&vch[0], &vch[0] + vch.size(), SER_DISK, CLIENT_VERSION);
+    int n;
+    std::string str;
+    uint64 nLarge;
+    reader >> n;
+    reader.ignore(7); // "casino" and its length
+    reader >> nLarge;
+    BOOST_CHECK_EQUAL(n, 7);
+    BOOST_CHECK_EQUAL(nLarge, 1234567890123ULL);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+
+    CBufferReader reader2(&vch[0], &vch[0] + vch.size(), SER_DISK, CLIENT_VERSION);
+    reader2 >> n >> str;
+    BOOST_CHECK_EQUAL(str, "casino");
+    BOOST_CHECK_EQUAL(reader2.GetPos(), sizeof(int) + 7);
+    BOOST_CHECK_EQUAL(reader2.size(), sizeof(uint64));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,184 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+
+// A transaction spending the given outputs, to one output
+static CTransaction BuildTx(const std::vector<COutPoint>& vPrevout, int64 nValue)
+{
+    CTransaction tx;
+    tx.vin.resize(vPrevout.size());
+    for (unsigned int i = 0; i < vPrevout.size(); i++)
+    {
+        tx.vin[i].prevout = vPrevout[i];
+        tx.vin[i].scriptSig = CScript() << OP_1;
+    }
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValue;
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    return tx;
+}
+
+static CTransaction BuildTx(const COutPoint& prevout, int64 nValue)
+{
+    return BuildTx(std::vector<COutPoint>(1, prevout), nValue);
+}
+
+static void AddTx(CTxMemPool& pool, const CTransaction& tx, int64 nFee)
+{
+    pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, 0, 0.0, 1, 0));
+}
+
+BOOST_AUTO_TEST_SUITE(mempool_tests)
+
+BOOST_AUTO_TEST_CASE(mempool_packages)
+{
+    CTxMemPool pool;
+
+    // parent <- child <- grandchild, and a second child spending the parent
+    CTransaction txParent = BuildTx(COutPoint(uint256(1), 0), 10 * COIN);
+    txParent.vout.resize(2);
+    txParent.vout[1] = txParent.vout[0];
+    CTransaction txChild = BuildTx(COutPoint(txParent.GetHash(), 0), 9 * COIN);
+    CTransaction txGrandChild = BuildTx(COutPoint(txChild.GetHash(), 0), 8 * COIN);
+    CTransaction txChild2 = BuildTx(COutPoint(txParent.GetHash(), 1), 7 * COIN);
+    unsigned int nParentSize = ::GetSerializeSize(txParent, SER_NETWORK, PROTOCOL_VERSION);
+    unsigned int nChildSize = ::GetSerializeSize(txChild, SER_NETWORK, PROTOCOL_VERSION);
+
+    AddTx(pool, txParent, 1000);
+    AddTx(pool, txChild, 2000);
+    AddTx(pool, txGrandChild, 3000);
+    AddTx(pool, txChild2, 4000);
+
+    const CTxMemPoolEntry& parent = pool.mapTx[txParent.GetHash()];
+    const CTxMemPoolEntry& grandchild = pool.mapTx[txGrandChild.GetHash()];
+    BOOST_CHECK_EQUAL(parent.nCountWithDescendants, 4U);
+    BOOST_CHECK_EQUAL(parent.nFeesWithDescendants, 10000);
+    BOOST_CHECK_EQUAL(parent.nCountWithAncestors, 1U);
+    BOOST_CHECK_EQUAL(grandchild.nCountWithAncestors, 3U);
+    BOOST_CHECK_EQUAL(grandchild.nFeesWithAncestors, 6000);
+    BOOST_CHECK_EQUAL(grandchild.nSizeWithAncestors, nParentSize + nChildSize + grandchild.GetTxSize());
+
+    // Removing the child takes the grandchild with it
+    pool.remove(txChild, true);
+    BOOST_CHECK_EQUAL(pool.size(), 2U);
+    BOOST_CHECK_EQUAL(parent.nCountWithDescendants, 2U);
+    BOOST_CHECK_EQUAL(parent.nFeesWithDescendants, 5000);
+
+    // Mining the parent leaves the second child on its own
+    pool.remove(txParent);
+    const CTxMemPoolEntry& child2 = pool.mapTx[txChild2.GetHash()];
+    BOOST_CHECK_EQUAL(child2.nCountWithAncestors, 1U);
+    BOOST_CHECK_EQUAL(child2.nFeesWithAncestors, 4000);
+
+    // A parent put back after a reorg counts the child already in the pool
+    AddTx(pool, txParent, 1000);
+    BOOST_CHECK_EQUAL(pool.mapTx[txParent.GetHash()].nCountWithDescendants, 2U);
+    BOOST_CHECK_EQUAL(pool.mapTx[txChild2.GetHash()].nCountWithAncestors, 2U);
+    BOOST_CHECK_EQUAL(pool.mapTx[txChild2.GetHash()].nFeesWithAncestors, 5000);
+
+    pool.clear();
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_orders_and_eviction)
+{
+    CTxMemPool pool;
+
+    CTransaction txLow = BuildTx(COutPoint(uint256(1), 0), COIN);
+    CTransaction txHigh = BuildTx(COutPoint(uint256(2), 0), COIN);
+    CTransaction txMid = BuildTx(COutPoint(uint256(3), 0), COIN);
+    AddTx(pool, txLow, 1000);
+    AddTx(pool, txHigh, 100000);
+    AddTx(pool, txMid, 10000);
+
+    const CTxMemPool::indexed_set& setByFeeRate = pool.GetFeeRateOrder();
+    BOOST_REQUIRE_EQUAL(setByFeeRate.size(), 3U);
+    BOOST_CHECK(setByFeeRate.rbegin()->second == txHigh.GetHash());
+    BOOST_CHECK(setByFeeRate.begin()->second == txLow.GetHash());
+
+    // A child paying well raises its parent above the others for eviction
+    CTransaction txLowChild = BuildTx(COutPoint(txLow.GetHash(), 0), COIN / 2);
+    AddTx(pool, txLowChild, 1000000);
+
+    size_t nUsage = pool.DynamicMemoryUsage();
+    pool.TrimToSize(nUsage - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3U);
+    BOOST_CHECK(!pool.exists(txMid.GetHash()));
+    BOOST_CHECK(pool.exists(txLow.GetHash()));
+
+    // Evicting a parent takes its children and leaves the package's fee rate
+    // as the pool's minimum
+    SetMockTime(GetTime());
+    CTransaction txPoor = BuildTx(COutPoint(uint256(4), 0), COIN);
+    CTransaction txPoorChild = BuildTx(COutPoint(txPoor.GetHash(), 0), COIN / 2);
+    CTransaction txPoorGrandChild = BuildTx(COutPoint(txPoorChild.GetHash(), 0), COIN / 4);
+    AddTx(pool, txPoor, 10000);
+    AddTx(pool, txPoorChild, 20000);
+    AddTx(pool, txPoorGrandChild, 30000);
+    double dPackageFeeRate = pool.mapTx[txPoor.GetHash()].GetDescendantFeeRate();
+    BOOST_CHECK(pool.GetMinFeeRate() < dPackageFeeRate);
+
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(txPoor.GetHash()));
+    BOOST_CHECK(!pool.exists(txPoorChild.GetHash()));
+    BOOST_CHECK(!pool.exists(txPoorGrandChild.GetHash()));
+    BOOST_CHECK_EQUAL(pool.size(), 3U);
+    BOOST_CHECK_EQUAL(pool.GetMinFeeRate(), dPackageFeeRate);
+
+    // The floor halves over MEMPOOL_MIN_FEE_HALFLIFE
+    SetMockTime(GetTime() + MEMPOOL_MIN_FEE_HALFLIFE);
+    BOOST_CHECK_CLOSE(pool.GetMinFeeRate(), dPackageFeeRate / 2, 0.0001);
+    SetMockTime(0);
+
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 2U);
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    BOOST_CHECK(pool.GetFeeRateOrder().empty());
+    BOOST_CHECK(pool.GetPriorityOrder().empty());
+}
+
+BOOST_AUTO_TEST_CASE(mempool_package_limits)
+{
+    CTxMemPool pool;
+    std::string strReason;
+
+    // A chain as long as the ancestor limit allows
+    std::vector<CTransaction> vChain;
+    uint256 hashPrev(5);
+    for (unsigned int i = 0; i < DEFAULT_ANCESTOR_LIMIT; i++)
+    {
+        CTransaction tx = BuildTx(COutPoint(hashPrev, 0), COIN);
+        unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_CHECK(pool.CheckPackageLimits(tx.GetHash(), tx, nSize, strReason));
+        AddTx(pool, tx, 10000);
+        vChain.push_back(tx);
+        hashPrev = tx.GetHash();
+    }
+
+    // A child at the end would have one ancestor too many
+    CTransaction txChild = BuildTx(COutPoint(hashPrev, 0), COIN);
+    unsigned int nChildSize = ::GetSerializeSize(txChild, SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(!pool.CheckPackageLimits(txChild.GetHash(), txChild, nChildSize, strReason));
+
+    // Further up it would give the first one a descendant too many
+    CTransaction txBranch = BuildTx(COutPoint(vChain[DEFAULT_ANCESTOR_LIMIT - 2].GetHash(), 0), COIN / 2);
+    BOOST_CHECK(!pool.CheckPackageLimits(txBranch.GetHash(), txBranch, nChildSize, strReason));
+
+    // Neither limit touches transactions outside the chain
+    CTransaction txOther = BuildTx(COutPoint(uint256(6), 0), COIN);
+    BOOST_CHECK(pool.CheckPackageLimits(txOther.GetHash(), txOther, nChildSize, strReason));
+
+    // The size limits count bytes of the whole package
+    CTransaction txSmallChild = BuildTx(COutPoint(vChain[0].GetHash(), 0), COIN / 4);
+    pool.remove(vChain[1], true);
+    BOOST_CHECK_EQUAL(pool.size(), 1U);
+    BOOST_CHECK(pool.CheckPackageLimits(txSmallChild.GetHash(), txSmallChild, nChildSize, strReason));
+    BOOST_CHECK(!pool.CheckPackageLimits(txSmallChild.GetHash(), txSmallChild, DEFAULT_DESCENDANT_SIZE_LIMIT * 1000, strReason));
+    mapArgs["-limitancestorsize"] = "0";
+    BOOST_CHECK(!pool.CheckPackageLimits(txOther.GetHash(), txOther, nChildSize, strReason));
+    mapArgs.erase("-limitancestorsize");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,172 @@
+#include <boost/test/unit_test.hpp>
+#include <math.h>
+
+#include "bignum.h"
+#include "main.h"
+#include "util.h"
+
+// Kimoto Gravity Well as it was written with CBigNum, to check the uint256 one against
+static unsigned int ReferenceKimotoGravityWell(const CBlockIndex* pindexLast, uint64 TargetBlocksSpacingSeconds, uint64 PastBlocksMin, uint64 PastBlocksMax)
+{
+    const CBigNum bnProofOfWorkLimit(~uint256(0) >> 20);
+    const CBlockIndex *BlockLastSolved = pindexLast;
+    const CBlockIndex *BlockReading = pindexLast;
+    uint64 PastBlocksMass = 0;
+    int64 PastRateActualSeconds = 0;
+    int64 PastRateTargetSeconds = 0;
+    double PastRateAdjustmentRatio = double(1);
+    CBigNum PastDifficultyAverage;
+    CBigNum PastDifficultyAveragePrev;
+
+    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || (uint64)BlockLastSolved->nHeight < PastBlocksMin)
+        return bnProofOfWorkLimit.GetCompact();
+
+    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++)
+    {
+        if (PastBlocksMax > 0 && i > PastBlocksMax)
+            break;
+        PastBlocksMass++;
+
+        if (i == 1)
+            PastDifficultyAverage.SetCompact(BlockReading->nBits);
+        else
+            PastDifficultyAverage = ((CBigNum().SetCompact(BlockReading->nBits) - PastDifficultyAveragePrev) / i) + PastDifficultyAveragePrev;
+        PastDifficultyAveragePrev = PastDifficultyAverage;
+
+        PastRateActualSeconds = BlockLastSolved->GetBlockTime() - BlockReading->GetBlockTime();
+        PastRateTargetSeconds = TargetBlocksSpacingSeconds * PastBlocksMass;
+        PastRateAdjustmentRatio = double(1);
+        if (PastRateActualSeconds < 0)
+            PastRateActualSeconds = 0;
+        if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0)
+            PastRateAdjustmentRatio = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
+        double EventHorizonDeviation = 1 + (0.7084 * pow((double(PastBlocksMass)/double(28.2)), -1.228));
+        double EventHorizonDeviationFast = EventHorizonDeviation;
+        double EventHorizonDeviationSlow = 1 / EventHorizonDeviation;
+
+        if (PastBlocksMass >= PastBlocksMin)
+            if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow) || (PastRateAdjustmentRatio >= EventHorizonDeviationFast))
+                break;
+        if (BlockReading->pprev == NULL)
+            break;
+        BlockReading = BlockReading->pprev;
+    }
+
+    CBigNum bnNew(PastDifficultyAverage);
+    if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0)
+    {
+        bnNew *= PastRateActualSeconds;
+        bnNew /= PastRateTargetSeconds;
+    }
+    if (bnNew > bnProofOfWorkLimit)
+        bnNew = bnProofOfWorkLimit;
+    return bnNew.GetCompact();
+}
+
+// Deterministic pseudo-random numbers, so that failures can be reproduced
+static uint64 nRandState = 1;
+static uint64 NextRand(uint64 nMax)
+{
+    nRandState = nRandState * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (nRandState >> 33) % nMax;
+}
+
+static uint256 RandomUint256(unsigned int nBits)
+{
+    uint256 n;
+    for (int i = 0; i < 8; i++)
+        n = (n << 32) | uint256(NextRand(0x100000000ULL));
+    if (nBits < 256)
+        n &= (~uint256(0)) >> (256 - nBits);
+    return n;
+}
+
+BOOST_AUTO_TEST_SUITE(retarget_tests)
+
+BOOST_AUTO_TEST_CASE(uint256_arithmetic)
+{
+    nRandState = 1;
+    for (int i = 0; i < 2000; i++)
+    {
+        uint256 a = RandomUint256(1 + NextRand(128));
+        uint256 b = RandomUint256(1 + NextRand(128));
+        if (b == 0)
+            b = 1;
+
+        uint256 nProduct = a;
+        nProduct *= b;
+        BOOST_CHECK(nProduct == (CBigNum(a) * CBigNum(b)).getuint256());
+
+        uint256 nLarge = RandomUint256(1 + NextRand(256));
+        uint256 nQuotient = nLarge;
+        nQuotient /= b;
+        BOOST_CHECK(nQuotient == (CBigNum(nLarge) / CBigNum(b)).getuint256());
+    }
+    BOOST_CHECK_EQUAL(uint256(0).bits(), 0U);
+    BOOST_CHECK_EQUAL(uint256(1).bits(), 1U);
+    BOOST_CHECK_EQUAL((~uint256(0)).bits(), 256U);
+    BOOST_CHECK_THROW(uint256(1) /= uint256(0), std::domain_error);
+}
+
+BOOST_AUTO_TEST_CASE(uint256_compact)
+{
+    nRandState = 2;
+    for (int i = 0; i < 2000; i++)
+    {
+        // Targets of all sizes, including the ones that need the mantissa shifted
+        uint256 n = RandomUint256(1 + NextRand(256));
+        BOOST_CHECK_EQUAL(n.GetCompact(), CBigNum(n).GetCompact());
+
+        unsigned int nCompact = ((1 + NextRand(32)) << 24) | NextRand(0x800000);
+        BOOST_CHECK(uint256().SetCompact(nCompact) == CBigNum().SetCompact(nCompact).getuint256());
+    }
+    BOOST_CHECK_EQUAL(uint256(0).GetCompact(), 0U);
+    BOOST_CHECK_EQUAL(uint256().SetCompact(0x1d00ffff).GetCompact(), 0x1d00ffffU);
+    BOOST_CHECK_EQUAL(uint256().SetCompact(0x01123456).GetCompact(), CBigNum().SetCompact(0x01123456).GetCompact());
+
+    bool fNegative = false;
+    uint256().SetCompact(0x04923456, &fNegative);
+    BOOST_CHECK(fNegative);
+}
+
+BOOST_AUTO_TEST_CASE(kgw_matches_reference)
+{
+    // Replay a chain through fast, slow, stalled and out of order stretches,
+    // with every block using the target the new code computes for it
+    const uint64 nSpacing = 30;
+    const uint64 nPastBlocksMin = (60 * 60 * 24 * 0.01) / nSpacing;
+    const uint64 nPastBlocksMax = (60 * 60 * 24 * 0.14) / nSpacing;
+    const int nBlocks = 4000;
+
+    nRandState = 3;
+    std::vector<CBlockIndex> vChain(nBlocks);
+    vChain[0].nHeight = 0;
+    vChain[0].nTime = 1370000000;
+    vChain[0].nBits = (~uint256(0) >> 20).GetCompact();
+    for (int nHeight = 1; nHeight < nBlocks; nHeight++)
+    {
+        CBlockIndex &index = vChain[nHeight];
+        index.pprev = &vChain[nHeight - 1];
+        index.nHeight = nHeight;
+
+        int64 nDelta;
+        switch ((nHeight / 250) % 5)
+        {
+        case 0: nDelta = NextRand(60); break;             // around the target
+        case 1: nDelta = NextRand(8); break;              // hash rate surge
+        case 2: nDelta = 60 + NextRand(600); break;       // hash rate drop
+        case 3: nDelta = NextRand(90) - 30; break;        // timestamps out of order
+        default: nDelta = NextRand(50) == 0 ? 86400 * (1 + NextRand(20)) : NextRand(45); // stalls
+        }
+        index.nTime = index.pprev->nTime + nDelta;
+
+        unsigned int nBits = KimotoGravityWell(index.pprev, NULL, nSpacing, nPastBlocksMin, nPastBlocksMax);
+        unsigned int nExpected = ReferenceKimotoGravityWell(index.pprev, nSpacing, nPastBlocksMin, nPastBlocksMax);
+        BOOST_CHECK_EQUAL(nBits, nExpected);
+        // Asking again is answered from the block index
+        BOOST_CHECK_EQUAL(KimotoGravityWell(index.pprev, NULL, nSpacing, nPastBlocksMin, nPastBlocksMax), nExpected);
+        index.nBits = nBits;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,134 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "rpcworkqueue.h"
+#include "main.h"
+#include "util.h"
+
+// Tests this internal-to-rpcmining.cpp method:
+extern bool IsLongPollDone(uint256 hashPrevBlock, int64 nPoolFees, unsigned int nTransactionsUpdatedStart, int64 nTimeStart);
+
+static void CountJob(boost::mutex* pmutex, int* pnCount)
+{
+    boost::unique_lock<boost::mutex> lock(*pmutex);
+    (*pnCount)++;
+}
+
+static bool IsFlagSet(const bool* pfFlag)
+{
+    return *pfFlag;
+}
+
+BOOST_AUTO_TEST_SUITE(rpcworkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(rpcworkqueue_bounded)
+{
+    CRPCWorkQueue queue(2);
+    boost::mutex mutex;
+    int nCount = 0;
+    boost::function<void ()> job = boost::bind(&CountJob, &mutex, &nCount);
+
+    BOOST_CHECK(queue.Push(job));
+    BOOST_CHECK(queue.Push(job));
+    // Full: new work is turned away, but work accepted before still gets in
+    BOOST_CHECK(!queue.Push(job));
+    BOOST_CHECK(queue.Push(job, true));
+
+    CRPCWorkQueueStats stats;
+    queue.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nDepth, 3U);
+    BOOST_CHECK_EQUAL(stats.nMaxDepth, 2U);
+    BOOST_CHECK_EQUAL(stats.nHighWater, 3U);
+    BOOST_CHECK_EQUAL(stats.nRejected, 1U);
+    BOOST_CHECK_EQUAL(nCount, 0);
+
+    queue.Interrupt();
+    queue.Run();
+    BOOST_CHECK_EQUAL(nCount, 3);
+}
+
+BOOST_AUTO_TEST_CASE(rpcworkqueue_drain)
+{
+    CRPCWorkQueue queue(100);
+    boost::mutex mutex;
+    int nCount = 0;
+    boost::function<void ()> job = boost::bind(&CountJob, &mutex, &nCount);
+
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 4; i++)
+        threadGroup.create_thread(boost::bind(&CRPCWorkQueue::Run, &queue));
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(queue.Push(job));
+
+    // Whatever was queued is done before the workers return, and nothing
+    // is taken after that
+    queue.Interrupt();
+    threadGroup.join_all();
+    BOOST_CHECK_EQUAL(nCount, 100);
+    BOOST_CHECK(!queue.Push(job));
+    BOOST_CHECK(!queue.Push(job, true));
+
+    CRPCWorkQueueStats stats;
+    queue.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nDepth, 0U);
+    BOOST_CHECK_EQUAL(stats.nActive, 0);
+}
+
+BOOST_AUTO_TEST_CASE(rpcdeferred_ready)
+{
+    CRPCWorkQueue queue(1);
+    CRPCDeferredCalls deferred;
+    boost::mutex mutex;
+    int nCount = 0;
+    boost::function<void ()> job = boost::bind(&CountJob, &mutex, &nCount);
+    bool fReadyA = false, fReadyB = false;
+
+    deferred.Add(boost::bind(&IsFlagSet, &fReadyA), job);
+    deferred.Add(boost::bind(&IsFlagSet, &fReadyB), job);
+    deferred.Check(queue);
+    BOOST_CHECK_EQUAL(deferred.size(), 2U);
+
+    // Only the calls that are ready are queued, even past a full queue
+    BOOST_CHECK(queue.Push(job));
+    fReadyB = true;
+    deferred.Check(queue);
+    BOOST_CHECK_EQUAL(deferred.size(), 1U);
+    CRPCWorkQueueStats stats;
+    queue.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nDepth, 2U);
+
+    fReadyA = true;
+    deferred.Check(queue);
+    BOOST_CHECK_EQUAL(deferred.size(), 0U);
+    queue.Interrupt();
+    queue.Run();
+    BOOST_CHECK_EQUAL(nCount, 3);
+}
+
+BOOST_AUTO_TEST_CASE(rpcdeferred_longpoll)
+{
+    LOCK(cs_main);
+    BOOST_REQUIRE(pindexBest != NULL);
+    SetMockTime(GetTime());
+    uint256 hashBest = pindexBest->GetBlockHash();
+    int64 nFees = mempool.GetTotalFees();
+    unsigned int nUpdated = nTransactionsUpdated;
+
+    // Nothing changed
+    BOOST_CHECK(!IsLongPollDone(hashBest, nFees, nUpdated, GetTime()));
+
+    // A new best block answers at once
+    BOOST_CHECK(IsLongPollDone(uint256(1), nFees, nUpdated, GetTime()));
+
+    // A change to the pool alone only answers once the poll has waited a while
+    BOOST_CHECK(!IsLongPollDone(hashBest, nFees, nUpdated - 1, GetTime()));
+    BOOST_CHECK(!IsLongPollDone(hashBest, nFees, nUpdated, GetTime() - 3600));
+    BOOST_CHECK(IsLongPollDone(hashBest, nFees, nUpdated - 1, GetTime() - 3600));
+
+    // As does a gain in fees, whatever the time
+    BOOST_CHECK(IsLongPollDone(hashBest, nFees - COIN, nUpdated, GetTime()));
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -444,4 +444,43 @@ BOOST_AUTO_TEST_CASE(script_combineSigs)
     BOOST_CHECK(combined == partial3c);
 }
 
+BOOST_AUTO_TEST_CASE(script_sigcache)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    CScript scriptPubKey;
+    scriptPubKey << OP_1 << key.GetPubKey() << OP_1 << OP_CHECKMULTISIG;
+
+    CTransaction txFrom;
+    txFrom.vout.resize(1);
+    txFrom.vout[0].scriptPubKey = scriptPubKey;
+
+    CTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vout.resize(1);
+    txTo.vin[0].prevout.n = 0;
+    txTo.vin[0].prevout.hash = txFrom.GetHash();
+    txTo.vout[0].nValue = 1;
+
+    CScript sig = sign_multisig(scriptPubKey, key, txTo);
+
+    // A verification with SCRIPT_VERIFY_NOCACHE must not populate the cache
+    CSignatureCacheStats before, after;
+    GetSignatureCacheStats(before);
+    BOOST_CHECK(VerifyScript(sig, scriptPubKey, txTo, 0, flags | SCRIPT_VERIFY_NOCACHE, 0));
+    BOOST_CHECK(VerifyScript(sig, scriptPubKey, txTo, 0, flags | SCRIPT_VERIFY_NOCACHE, 0));
+    GetSignatureCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nHits, before.nHits);
+    BOOST_CHECK_EQUAL(after.nMisses, before.nMisses + 2);
+
+    // The first cached verification misses, later ones hit
+    BOOST_CHECK(VerifyScript(sig, scriptPubKey, txTo, 0, flags, 0));
+    BOOST_CHECK(VerifyScript(sig, scriptPubKey, txTo, 0, flags | SCRIPT_VERIFY_NOCACHE, 0));
+    GetSignatureCacheStats(before);
+    BOOST_CHECK_EQUAL(before.nHits, after.nHits + 1);
+    BOOST_CHECK_EQUAL(before.nMisses, after.nMisses + 1);
+    BOOST_CHECK(before.nEntries <= before.nMaxEntries);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,8 +1,45 @@
 #include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
 
+#include "main.h"
 #include "util.h"
 #include "scrypt.h"
 
+typedef void (*scrypt_func)(const char *input, char *output, char *scratchpad);
+
+struct ScryptKernel
+{
+    const char *pszName;
+    scrypt_func func;
+    int nWays;
+};
+
+// Every multi-buffer kernel this CPU can run, plus the one-way reference
+static std::vector<ScryptKernel> AvailableKernels()
+{
+    std::vector<ScryptKernel> vKernels;
+    ScryptKernel generic = { "generic", &scrypt_1024_1_1_256_sp_generic, 1 };
+    vKernels.push_back(generic);
+#if defined(USE_SSE2)
+    scrypt_detect_sse2();
+    ScryptKernel sse2 = { "sse2", &scrypt_1024_1_1_256_sp_sse2, 1 };
+    vKernels.push_back(sse2);
+    ScryptKernel sse2_2way = { "sse2 2-way", &scrypt_1024_1_1_256_sp_sse2_2way, 2 };
+    vKernels.push_back(sse2_2way);
+#if defined(USE_AVX2)
+    ScryptKernel avx2_4way = { "avx2 4-way", &scrypt_1024_1_1_256_sp_avx2_4way, 4 };
+    if (scrypt_cpu_avx2)
+        vKernels.push_back(avx2_4way);
+#endif
+#if defined(USE_AVX512)
+    ScryptKernel avx512_8way = { "avx512 8-way", &scrypt_1024_1_1_256_sp_avx512_8way, 8 };
+    if (scrypt_cpu_avx512)
+        vKernels.push_back(avx512_8way);
+#endif
+#endif
+    return vKernels;
+}
+
 BOOST_AUTO_TEST_SUITE(scrypt_tests)
 
 BOOST_AUTO_TEST_CASE(scrypt_hashtest)
@@ -30,4 +67,99 @@ BOOST_AUTO_TEST_CASE(scrypt_hashtest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(scrypt_powhash_cache)
+{
+    std::vector<unsigned char> vchHeader = ParseHex("020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659");
+    CBlockHeader header;
+    CDataStream(vchHeader, SER_NETWORK, PROTOCOL_VERSION) >> header;
+    BOOST_CHECK_EQUAL(header.GetPoWHash().ToString(), "00000000002bef4107f882f6115e0b01f348d21195dacd3582aa2dabd7985806");
+
+    // A changed header is hashed again
+    uint256 hashPoW = header.GetPoWHash();
+    header.nNonce++;
+    BOOST_CHECK(header.GetPoWHash() != hashPoW);
+    header.nNonce--;
+    BOOST_CHECK(header.GetPoWHash() == hashPoW);
+
+    // The block index stores it and keeps it across a write to the block tree
+    CBlockIndex index(header);
+    index.nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA;
+    index.SetPoWHash(header.GetPoWHash());
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CDiskBlockIndex(&index);
+    CDiskBlockIndex diskindex;
+    ss >> diskindex;
+    BOOST_CHECK(diskindex.nStatus & BLOCK_HAVE_POWHASH);
+    BOOST_CHECK(diskindex.GetPoWHash() == hashPoW);
+
+    // Entries written without it still deserialize, and fall back to scrypt
+    index.nStatus &= ~BLOCK_HAVE_POWHASH;
+    ss << CDiskBlockIndex(&index);
+    ss >> diskindex;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(!(diskindex.nStatus & BLOCK_HAVE_POWHASH));
+
+    // An older version rewriting the entry keeps the flag but drops the hash
+    index.nStatus |= BLOCK_HAVE_POWHASH;
+    CDataStream ssOld(SER_DISK, BLOCK_INDEX_TRAILER_VERSION - 1);
+    ssOld << CDiskBlockIndex(&index);
+    ssOld >> diskindex;
+    BOOST_CHECK(ssOld.empty());
+    BOOST_CHECK(!(diskindex.nStatus & BLOCK_HAVE_POWHASH));
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_multiway)
+{
+    // Each lane of a multi-buffer kernel must match the one-way hash of its own input
+    std::vector<char> vScratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    std::vector<char> vInput(SCRYPT_MAX_WAYS * 80);
+    std::vector<uint256> vExpected(SCRYPT_MAX_WAYS);
+    for (int i = 0; i < SCRYPT_MAX_WAYS; i++)
+    {
+        for (int j = 0; j < 80; j++)
+            vInput[i * 80 + j] = (char)GetRand(256);
+        scrypt_1024_1_1_256_sp_generic(&vInput[i * 80], BEGIN(vExpected[i]), &vScratchpad[0]);
+    }
+
+    std::vector<ScryptKernel> vKernels = AvailableKernels();
+    BOOST_FOREACH(const ScryptKernel &kernel, vKernels)
+    {
+        std::vector<uint256> vHashes(SCRYPT_MAX_WAYS);
+        // Unaligned scratchpad on purpose, the kernels align it themselves
+        for (int i = 0; i < SCRYPT_MAX_WAYS; i += kernel.nWays)
+            kernel.func(&vInput[i * 80], BEGIN(vHashes[i]), &vScratchpad[1]);
+        for (int i = 0; i < SCRYPT_MAX_WAYS; i++)
+            BOOST_CHECK_MESSAGE(vHashes[i] == vExpected[i], kernel.pszName << " lane " << i % kernel.nWays);
+    }
+
+    // The runtime selection is one of them
+    BOOST_CHECK(scrypt_multi_ways >= 1 && scrypt_multi_ways <= SCRYPT_MAX_WAYS);
+    BOOST_CHECK_EQUAL(SCRYPT_MAX_WAYS % scrypt_multi_ways, 0);
+    std::vector<uint256> vHashes(SCRYPT_MAX_WAYS);
+    scrypt_1024_1_1_256_sp_multi(&vInput[0], BEGIN(vHashes[0]), &vScratchpad[0]);
+    for (int i = 0; i < scrypt_multi_ways; i++)
+        BOOST_CHECK(vHashes[i] == vExpected[i]);
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_benchmark)
+{
+    static const int nHashes = 128;
+    std::vector<char> vScratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    std::vector<char> vInput(SCRYPT_MAX_WAYS * 80);
+    std::vector<uint256> vHashes(SCRYPT_MAX_WAYS);
+
+    std::vector<ScryptKernel> vKernels = AvailableKernels();
+    BOOST_FOREACH(const ScryptKernel &kernel, vKernels)
+    {
+        int64 nStart = GetTimeMicros();
+        for (int i = 0; i < nHashes; i += kernel.nWays)
+        {
+            *(unsigned int*)&vInput[76] = i;
+            kernel.func(&vInput[0], BEGIN(vHashes[0]), &vScratchpad[0]);
+        }
+        int64 nElapsed = std::max(GetTimeMicros() - nStart, (int64)1);
+        BOOST_TEST_MESSAGE("scrypt " << kernel.pszName << ": " << nHashes * 1000000LL / nElapsed << " hashes/s");
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,186 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+
+#include "json/json_spirit_reader_template.h"
+#include "json/json_spirit_writer_template.h"
+#include "json/json_spirit_utils.h"
+
+#include "base58.h"
+#include "key.h"
+#include "secp256k1.h"
+#include "util.h"
+
+using namespace json_spirit;
+extern Array read_json(const std::string& filename);
+
+// The verification path CPubKey::Verify used before secp256k1.cpp existed
+static bool OpenSSLVerify(const CPubKey &pubkey, const uint256 &hash, const std::vector<unsigned char> &vchSig)
+{
+    EC_KEY *pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
+    const unsigned char *pbegin = pubkey.begin();
+    bool fRet = o2i_ECPublicKey(&pkey, &pbegin, pubkey.size()) &&
+                ECDSA_verify(0, (unsigned char*)&hash, sizeof(hash), &vchSig[0], vchSig.size(), pkey) == 1;
+    EC_KEY_free(pkey);
+    return fRet;
+}
+
+static int Secp256k1Verify(const CPubKey &pubkey, const uint256 &hash, const std::vector<unsigned char> &vchSig)
+{
+    return Secp256k1Verify(pubkey.begin(), pubkey.size(), (const unsigned char*)&hash, &vchSig[0], vchSig.size());
+}
+
+// Both engines must agree on the signature and on a few corruptions of it
+static void CheckAgreement(const CKey &key, const uint256 &hash)
+{
+    CPubKey pubkey = key.GetPubKey();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+
+    BOOST_CHECK(OpenSSLVerify(pubkey, hash, vchSig));
+    BOOST_CHECK_EQUAL(Secp256k1Verify(pubkey, hash, vchSig), (int)SECP256K1_VERIFY_OK);
+    BOOST_CHECK(pubkey.Verify(hash, vchSig));
+
+    uint256 hashOther = hash ^ 1;
+    BOOST_CHECK(!OpenSSLVerify(pubkey, hashOther, vchSig));
+    BOOST_CHECK_EQUAL(Secp256k1Verify(pubkey, hashOther, vchSig), (int)SECP256K1_VERIFY_BAD);
+
+    for (unsigned int i = 0; i < vchSig.size(); i += 7)
+    {
+        std::vector<unsigned char> vchBad(vchSig);
+        vchBad[i] ^= 0x01;
+        int ret = Secp256k1Verify(pubkey, hash, vchBad);
+        if (ret != SECP256K1_VERIFY_UNSUPPORTED)
+            BOOST_CHECK_EQUAL(ret == SECP256K1_VERIFY_OK, OpenSSLVerify(pubkey, hash, vchBad));
+        BOOST_CHECK_EQUAL(pubkey.Verify(hash, vchBad), OpenSSLVerify(pubkey, hash, vchBad));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(secp256k1_tests)
+
+BOOST_AUTO_TEST_CASE(secp256k1_random_keys)
+{
+    for (int i = 0; i < 64; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        CheckAgreement(key, GetRandHash());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_base58_keys)
+{
+    // Sign with every private key in the base58 test vectors
+    Array tests = read_json("base58_keys_valid.json");
+    BOOST_FOREACH(Value& tv, tests)
+    {
+        Array test = tv.get_array();
+        if (test.size() < 3)
+            continue;
+        const Object &metadata = test[2].get_obj();
+        if (!find_value(metadata, "isPrivkey").get_bool())
+            continue;
+        std::vector<unsigned char> payload = ParseHex(test[1].get_str());
+        CKey key;
+        key.Set(payload.begin(), payload.end(), find_value(metadata, "isCompressed").get_bool());
+        BOOST_CHECK(key.IsValid());
+        CheckAgreement(key, Hash(payload.begin(), payload.end()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_canonical_encodings)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    uint256 hash = GetRandHash();
+
+    // Canonical signatures (minus the hash type) are always handled natively
+    Array tests = read_json("sig_canonical.json");
+    BOOST_FOREACH(Value &tv, tests)
+    {
+        if (!IsHex(tv.get_str()))
+            continue;
+        std::vector<unsigned char> vchSig = ParseHex(tv.get_str());
+        vchSig.pop_back();
+        BOOST_CHECK(Secp256k1Verify(pubkey, hash, vchSig) != SECP256K1_VERIFY_UNSUPPORTED);
+        BOOST_CHECK(!pubkey.Verify(hash, vchSig));
+    }
+
+    // Non-canonical ones are never accepted for the wrong key
+    tests = read_json("sig_noncanonical.json");
+    BOOST_FOREACH(Value &tv, tests)
+    {
+        if (!IsHex(tv.get_str()))
+            continue;
+        std::vector<unsigned char> vchSig = ParseHex(tv.get_str());
+        BOOST_CHECK(Secp256k1Verify(pubkey, hash, vchSig) != SECP256K1_VERIFY_OK);
+        BOOST_CHECK(!pubkey.Verify(hash, vchSig));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_pubkeys)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        CPubKey pubkey = key.GetPubKey();
+        BOOST_CHECK(pubkey.IsFullyValid());
+
+        CKey keyUncompressed;
+        keyUncompressed.Set(key.begin(), key.end(), false);
+        CPubKey pubkeyUncompressed = keyUncompressed.GetPubKey();
+
+        unsigned char vch[65];
+        BOOST_CHECK(Secp256k1DecompressPubKey(pubkey.begin(), pubkey.size(), vch));
+        BOOST_CHECK(memcmp(vch, pubkeyUncompressed.begin(), 65) == 0);
+        BOOST_CHECK(pubkey.Decompress());
+        BOOST_CHECK(pubkey == pubkeyUncompressed);
+
+        // Not on the curve any more
+        std::vector<unsigned char> vchBad(pubkeyUncompressed.begin(), pubkeyUncompressed.end());
+        vchBad[64] ^= 0x01;
+        BOOST_CHECK(!Secp256k1PubKeyIsValid(&vchBad[0], vchBad.size()));
+        BOOST_CHECK(!CPubKey(vchBad).IsFullyValid());
+
+        // Hybrid encoding with the wrong parity
+        vchBad[64] ^= 0x01;
+        vchBad[0] = (vchBad[64] & 1) ? 0x06 : 0x07;
+        BOOST_CHECK(!Secp256k1PubKeyIsValid(&vchBad[0], vchBad.size()));
+        vchBad[0] ^= 0x01;
+        BOOST_CHECK(Secp256k1PubKeyIsValid(&vchBad[0], vchBad.size()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_benchmark)
+{
+    static const int nSigs = 200;
+    std::vector<CPubKey> vPubKeys;
+    std::vector<uint256> vHashes;
+    std::vector<std::vector<unsigned char> > vSigs(nSigs);
+    for (int i = 0; i < nSigs; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        vPubKeys.push_back(key.GetPubKey());
+        vHashes.push_back(GetRandHash());
+        key.Sign(vHashes[i], vSigs[i]);
+    }
+
+    int64 nStart = GetTimeMicros();
+    for (int i = 0; i < nSigs; i++)
+        BOOST_CHECK(OpenSSLVerify(vPubKeys[i], vHashes[i], vSigs[i]));
+    int64 nOpenSSL = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nSigs; i++)
+        BOOST_CHECK(vPubKeys[i].Verify(vHashes[i], vSigs[i]));
+    int64 nSecp256k1 = GetTimeMicros() - nStart;
+
+    BOOST_TEST_MESSAGE("ECDSA verify: OpenSSL " << nOpenSSL / nSigs << "us, secp256k1 " << nSecp256k1 / nSigs << "us per signature");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -64,3 +64,8 @@ void StartShutdown()
   exit(0);
 }
 
+bool ShutdownRequested()
+{
+  return false;
+}
+
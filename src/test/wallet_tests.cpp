@@ -2,6 +2,8 @@
 
 #include "main.h"
 #include "wallet.h"
+#include "bitcoinrpc.h"
+#include "init.h"
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -11,6 +13,7 @@
 #define RANDOM_REPEATS 5
 
 using namespace std;
+using namespace json_spirit;
 
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
@@ -291,4 +294,219 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     }
 }
 
+BOOST_AUTO_TEST_CASE(wallet_balances)
+{
+    CWallet walletBalances("wallet_balances.dat");
+    walletBalances.fCheckBalances = true;
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_REQUIRE(walletBalances.AddKey(key));
+    CScript scriptMine;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+
+    // Received, paying someone else as well
+    CTransaction txIn;
+    txIn.vin.resize(1);
+    txIn.vin[0].prevout = COutPoint(uint256(1), 0);
+    txIn.vout.resize(2);
+    txIn.vout[0].nValue = 5 * COIN;
+    txIn.vout[0].scriptPubKey = scriptMine;
+    txIn.vout[1].nValue = 3 * COIN;
+    txIn.vout[1].scriptPubKey = CScript() << OP_TRUE;
+    BOOST_CHECK(walletBalances.AddToWallet(CWalletTx(&walletBalances, txIn)));
+    BOOST_CHECK_EQUAL(walletBalances.GetBalance(), 0);
+    BOOST_CHECK_EQUAL(walletBalances.GetUnconfirmedBalance(), 5 * COIN);
+
+    vector<COutput> vAvailable;
+    walletBalances.AvailableCoins(vAvailable, true);
+    BOOST_CHECK(vAvailable.empty());
+    walletBalances.AvailableCoins(vAvailable, false);
+    BOOST_REQUIRE_EQUAL(vAvailable.size(), 1U);
+    BOOST_CHECK(vAvailable[0].tx->GetHash() == txIn.GetHash() && vAvailable[0].i == 0);
+
+    // Spent by a transaction of ours that pays us change
+    CTransaction txOut;
+    txOut.vin.resize(1);
+    txOut.vin[0].prevout = COutPoint(txIn.GetHash(), 0);
+    txOut.vout.resize(1);
+    txOut.vout[0].nValue = 1 * COIN;
+    txOut.vout[0].scriptPubKey = scriptMine;
+    BOOST_CHECK(walletBalances.AddToWallet(CWalletTx(&walletBalances, txOut)));
+    BOOST_CHECK_EQUAL(walletBalances.GetUnconfirmedBalance(), 1 * COIN);
+    walletBalances.AvailableCoins(vAvailable, false);
+    BOOST_REQUIRE_EQUAL(vAvailable.size(), 1U);
+    BOOST_CHECK(vAvailable[0].tx->GetHash() == txOut.GetHash());
+
+    // Forgetting the change leaves nothing, as the coin it spent stays spent
+    walletBalances.EraseFromWallet(txOut.GetHash());
+    BOOST_CHECK_EQUAL(walletBalances.GetUnconfirmedBalance(), 0);
+    walletBalances.AvailableCoins(vAvailable, false);
+    BOOST_CHECK(vAvailable.empty());
+
+    // A full rebuild agrees
+    walletBalances.MarkDirty();
+    BOOST_CHECK_EQUAL(walletBalances.GetUnconfirmedBalance(), 0);
+    BOOST_CHECK(walletBalances.CheckBalances());
+}
+
+BOOST_AUTO_TEST_CASE(wallet_scan_filter)
+{
+    CWallet walletScan;
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    BOOST_REQUIRE(walletScan.AddKey(key));
+    CScript scriptRedeem = CScript() << OP_1 << key.GetPubKey() << OP_1 << OP_CHECKMULTISIG;
+    BOOST_REQUIRE(walletScan.AddCScript(scriptRedeem));
+
+    CWalletScanFilter filter;
+    walletScan.GetScanFilter(filter);
+
+    CScript script;
+    script.SetDestination(key.GetPubKey().GetID());
+    BOOST_CHECK(filter.IsRelevant(script));
+    script = CScript() << key.GetPubKey() << OP_CHECKSIG;
+    BOOST_CHECK(filter.IsRelevant(script));
+    script.SetDestination(scriptRedeem.GetID());
+    BOOST_CHECK(filter.IsRelevant(script));
+    script.SetDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(!filter.IsRelevant(script));
+    BOOST_CHECK(!filter.IsRelevant(CScript() << OP_TRUE));
+
+    // A multisig output with one of our keys is picked, though not ours
+    script = CScript() << OP_2 << key.GetPubKey() << keyOther.GetPubKey() << OP_2 << OP_CHECKMULTISIG;
+    BOOST_CHECK(filter.IsRelevant(script));
+    BOOST_CHECK(!IsMine(walletScan, script));
+
+    CTransaction tx;
+    tx.vout.resize(2);
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx.vout[1].scriptPubKey.SetDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(!filter.IsRelevant(tx));
+    tx.vout[1].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    BOOST_CHECK(filter.IsRelevant(tx));
+
+    // The wallet's own filter follows the keys added after it was built
+    BOOST_CHECK(walletScan.IsRelevantToMe(tx));
+    tx.vout[1].scriptPubKey.SetDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(!walletScan.IsRelevantToMe(tx));
+    BOOST_REQUIRE(walletScan.AddKey(keyOther));
+    BOOST_CHECK(walletScan.IsRelevantToMe(tx));
+}
+
+static CTransaction PayTo(const CScript& scriptPubKey, const uint256& hashPrev)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(hashPrev, 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = COIN;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    return tx;
+}
+
+static bool HasTx(const vector<const CWalletTx*>& vwtx, const CTransaction& tx)
+{
+    BOOST_FOREACH(const CWalletTx* pwtx, vwtx)
+        if (pwtx->GetHash() == tx.GetHash())
+            return true;
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(wallet_ordered_log)
+{
+    CWallet walletOrdered("wallet_ordered.dat");
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_REQUIRE(walletOrdered.AddKey(key));
+    CScript scriptMine;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+
+    // One unconfirmed, one in the genesis block and one in a block we don't know
+    CTransaction txPending = PayTo(scriptMine, uint256(1));
+    CTransaction txGenesis = PayTo(scriptMine, uint256(2));
+    CTransaction txUnknown = PayTo(scriptMine, uint256(3));
+    BOOST_CHECK(walletOrdered.AddToWallet(CWalletTx(&walletOrdered, txPending)));
+    CWalletTx wtxGenesis(&walletOrdered, txGenesis);
+    wtxGenesis.hashBlock = pindexGenesisBlock->GetBlockHash();
+    BOOST_CHECK(walletOrdered.AddToWallet(wtxGenesis));
+    CWalletTx wtxUnknown(&walletOrdered, txUnknown);
+    wtxUnknown.hashBlock = uint256(4);
+    BOOST_CHECK(walletOrdered.AddToWallet(wtxUnknown));
+
+    const CWallet::TxItems& txOrdered = walletOrdered.OrderedTxItems();
+    BOOST_REQUIRE_EQUAL(txOrdered.size(), 3U);
+    BOOST_CHECK(txOrdered.begin()->second.first->GetHash() == txPending.GetHash());
+    BOOST_CHECK(txOrdered.rbegin()->second.first->GetHash() == txUnknown.GetHash());
+
+    vector<const CWalletTx*> vwtx;
+    walletOrdered.GetTransactionsSince(NULL, vwtx);
+    BOOST_CHECK_EQUAL(vwtx.size(), 3U);
+    walletOrdered.GetTransactionsSince(pindexGenesisBlock, vwtx);
+    BOOST_REQUIRE_EQUAL(vwtx.size(), 2U);
+    BOOST_CHECK(vwtx[0]->GetHash() == txPending.GetHash());
+    BOOST_CHECK(vwtx[1]->GetHash() == txUnknown.GetHash());
+
+    // Merging in the block it was mined in takes it out of the results
+    CWalletTx wtxMined(&walletOrdered, txPending);
+    wtxMined.hashBlock = pindexGenesisBlock->GetBlockHash();
+    BOOST_CHECK(walletOrdered.AddToWallet(wtxMined));
+    walletOrdered.GetTransactionsSince(pindexGenesisBlock, vwtx);
+    BOOST_CHECK(!HasTx(vwtx, txPending));
+    BOOST_CHECK(HasTx(vwtx, txUnknown));
+
+    // Erased transactions leave every view
+    walletOrdered.EraseFromWallet(txUnknown.GetHash());
+    BOOST_CHECK_EQUAL(walletOrdered.OrderedTxItems().size(), 2U);
+    walletOrdered.GetTransactionsSince(pindexGenesisBlock, vwtx);
+    BOOST_CHECK(vwtx.empty());
+    walletOrdered.GetTransactionsSince(NULL, vwtx);
+    BOOST_CHECK_EQUAL(vwtx.size(), 2U);
+
+    // Accounting entries go in at their position, in their account's view
+    CAccountingEntry acentry;
+    acentry.strAccount = "savings";
+    acentry.nCreditDebit = COIN;
+    acentry.nOrderPos = walletOrdered.IncOrderPosNext();
+    walletOrdered.AddAccountingEntry(acentry);
+    BOOST_REQUIRE_EQUAL(walletOrdered.OrderedTxItems().size(), 3U);
+    BOOST_CHECK(walletOrdered.OrderedTxItems().rbegin()->second.second != NULL);
+    BOOST_CHECK_EQUAL(walletOrdered.OrderedTxItems("savings").size(), 1U);
+
+    // Naming the address adds what it received to that account's view
+    walletOrdered.SetAddressBookName(key.GetPubKey().GetID(), "savings");
+    const CWallet::TxItems& txSavings = walletOrdered.OrderedTxItems("savings");
+    BOOST_REQUIRE_EQUAL(txSavings.size(), 3U);
+    BOOST_CHECK(txSavings.begin()->second.first->GetHash() == txPending.GetHash());
+    BOOST_CHECK(txSavings.rbegin()->second.second != NULL);
+
+    // listtransactionsafter returns everything at the cursor's last position together
+    int64 nOrderPos = pwalletMain->IncOrderPosNext();
+    for (int i = 0; i < 3; i++)
+    {
+        CAccountingEntry acentryShared;
+        acentryShared.strAccount = "cursor";
+        acentryShared.nCreditDebit = i;
+        acentryShared.nOrderPos = nOrderPos + (i == 2 ? 1 : 0);
+        pwalletMain->AddAccountingEntry(acentryShared);
+    }
+    Array params;
+    params.push_back("cursor");
+    params.push_back("");
+    params.push_back(1);
+    Object ret = listtransactionsafter(params, false).get_obj();
+    BOOST_CHECK_EQUAL(find_value(ret, "transactions").get_array().size(), 2U);
+    BOOST_CHECK_EQUAL(find_value(ret, "cursor").get_str(), i64tostr(nOrderPos));
+
+    params[1] = i64tostr(nOrderPos);
+    ret = listtransactionsafter(params, false).get_obj();
+    BOOST_CHECK_EQUAL(find_value(ret, "transactions").get_array().size(), 1U);
+    BOOST_CHECK_EQUAL(find_value(ret, "cursor").get_str(), i64tostr(nOrderPos + 1));
+
+    params[1] = i64tostr(nOrderPos + 1);
+    ret = listtransactionsafter(params, false).get_obj();
+    BOOST_CHECK(find_value(ret, "transactions").get_array().empty());
+    BOOST_CHECK_EQUAL(find_value(ret, "cursor").get_str(), i64tostr(nOrderPos + 1));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
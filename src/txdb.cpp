@@ -53,12 +53,20 @@ bool CCoinsViewDB::SetBestBlock(CBlockIndex *pindex) {
     return db.WriteBatch(batch);
 }
 
-bool CCoinsViewDB::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) {
-    printf("Committing %u changed transactions to coin database...\n", (unsigned int)mapCoins.size());
-
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex) {
     CLevelDBBatch batch;
-    for (std::map<uint256, CCoins>::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
-        BatchWriteCoins(batch, it->first, it->second);
+    unsigned int nChanged = 0;
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        const CCoinsCacheEntry &entry = it->second;
+        if (!(entry.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        // never written, so there is nothing to erase either
+        if ((entry.flags & CCoinsCacheEntry::FRESH) && entry.coins.IsPruned())
+            continue;
+        BatchWriteCoins(batch, it->first, entry.coins);
+        nChanged++;
+    }
+    printf("Committing %u changed transactions (of %u cached) to coin database...\n", nChanged, (unsigned int)mapCoins.size());
     if (pindex)
         BatchWriteHashBestChain(batch, pindex->GetBlockHash());
 
@@ -221,6 +229,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nNonce         = diskindex.nNonce;
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
+                pindexNew->hashPoW        = diskindex.hashPoW;
+                pindexNew->nMoneySupply   = diskindex.nMoneySupply;
 
                 // Watch for genesis block
                 if (pindexGenesisBlock == NULL && diskindex.GetBlockHash() == hashGenesisBlock)
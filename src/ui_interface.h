@@ -85,6 +85,12 @@ public:
     /** Block chain changed. */
     boost::signals2::signal<void ()> NotifyBlocksChanged;
 
+    /** Best block changed, once past the initial block download. */
+    boost::signals2::signal<void (const uint256 &hash)> NotifyBestBlockChanged;
+
+    /** Transaction accepted into the memory pool. */
+    boost::signals2::signal<void (const uint256 &hash)> NotifyTransactionAccepted;
+
     /** Number of network connections changed. */
     boost::signals2::signal<void (int newNumConnections)> NotifyNumConnectionsChanged;
 
@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -179,6 +180,69 @@ public:
         return *this;
     }
 
+    // Multiplication and division are truncated to the width, like the other operators
+    base_uint& operator*=(const base_uint& b)
+    {
+        base_uint a = *this;
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+        for (int j = 0; j < WIDTH; j++)
+        {
+            uint64 carry = 0;
+            for (int i = 0; i + j < WIDTH; i++)
+            {
+                uint64 n = carry + pn[i + j] + (uint64)a.pn[j] * b.pn[i];
+                pn[i + j] = n & 0xffffffff;
+                carry = n >> 32;
+            }
+        }
+        return *this;
+    }
+
+    base_uint& operator/=(const base_uint& b)
+    {
+        base_uint div = b;
+        base_uint num = *this;
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+        int nNumBits = num.bits();
+        int nDivBits = div.bits();
+        if (nDivBits == 0)
+            throw std::domain_error("base_uint: division by zero");
+        if (nDivBits > nNumBits)
+            return *this;
+        // Shift and subtract, one bit of the quotient at a time
+        int nShift = nNumBits - nDivBits;
+        div <<= nShift;
+        while (nShift >= 0)
+        {
+            if (num >= div)
+            {
+                num -= div;
+                pn[nShift / 32] |= (1U << (nShift & 31));
+            }
+            div >>= 1;
+            nShift--;
+        }
+        return *this;
+    }
+
+    // Number of significant bits, 0 for zero
+    unsigned int bits() const
+    {
+        for (int i = WIDTH - 1; i >= 0; i--)
+        {
+            if (pn[i])
+            {
+                for (int nBits = 31; nBits > 0; nBits--)
+                    if (pn[i] & (1U << nBits))
+                        return 32 * i + nBits + 1;
+                return 32 * i + 1;
+            }
+        }
+        return 0;
+    }
+
 
     base_uint& operator++()
     {
@@ -575,6 +639,51 @@ public:
         return *this;
     }
 
+    // Decode the compact representation used for nBits, as CBigNum::SetCompact does.
+    // Targets are never negative; pfNegative reports the sign bit that was ignored.
+    uint256& SetCompact(unsigned int nCompact, bool *pfNegative = NULL)
+    {
+        unsigned int nSize = nCompact >> 24;
+        unsigned int nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8*(3-nSize);
+            *this = nWord;
+        }
+        else
+        {
+            *this = nWord;
+            *this <<= 8*(nSize-3);
+        }
+        if (pfNegative)
+            *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
+        return *this;
+    }
+
+    // Encode in the compact representation, as CBigNum::GetCompact does
+    unsigned int GetCompact() const
+    {
+        unsigned int nSize = (bits() + 7) / 8;
+        unsigned int nCompact = 0;
+        if (nSize <= 3)
+            nCompact = pn[0] << 8*(3-nSize);
+        else
+        {
+            uint256 bn = *this;
+            bn >>= 8*(nSize-3);
+            nCompact = bn.pn[0];
+        }
+        // The 0x00800000 bit denotes the sign, so if it is already set, divide
+        // the mantissa by 256 and increase the exponent
+        if (nCompact & 0x00800000)
+        {
+            nCompact >>= 8;
+            nSize++;
+        }
+        nCompact |= nSize << 24;
+        return nCompact;
+    }
+
     explicit uint256(const std::string& str)
     {
         SetHex(str);
@@ -0,0 +1,224 @@
+// Copyright (c) 2013-2014 The CasinoCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_UINT256MAP_H
+#define BITCOIN_UINT256MAP_H
+
+#include "uint256.h"
+
+#include <vector>
+#include <utility>
+
+/** STL-like map from uint256 to T, using open addressing with linear probing.
+ *
+ * The slot table only holds a 32-bit hash and an index; the entries live in
+ * fixed-size chunks that never move, so references to them stay valid until
+ * the entry is erased, just like with std::map. Freed entries are reused.
+ * Keys are hashed with a caller supplied salt so that txids chosen by others
+ * cannot be made to collide. Iteration order is unspecified.
+ */
+template <typename T> class uint256map
+{
+public:
+    typedef uint256 key_type;
+    typedef T mapped_type;
+    typedef std::pair<uint256, T> value_type; // the key must not be modified
+    typedef size_t size_type;
+
+private:
+    static const unsigned int CHUNK_SIZE = 256;
+
+    struct slot
+    {
+        unsigned int nHash;
+        unsigned int nIndex; // entry index + 1, 0 if the slot is empty
+    };
+
+    uint64 k0, k1;
+    std::vector<slot> vSlots;
+    std::vector<value_type*> vChunks;
+    std::vector<unsigned char> vUsed;
+    std::vector<unsigned int> vFree;
+    size_type nSize;
+
+    unsigned int Hash(const uint256 &key) const
+    {
+        uint64 h = k0;
+        for (int i = 0; i < 4; i++)
+        {
+            h = (h ^ key.Get64(i)) * 0x9e3779b97f4a7c15ULL;
+            h ^= (h >> 29) ^ k1;
+        }
+        return (unsigned int)(h >> 32);
+    }
+
+    value_type &Entry(unsigned int nIndex) const { return vChunks[nIndex / CHUNK_SIZE][nIndex % CHUNK_SIZE]; }
+
+    // Slot holding key, or the empty slot where it would go
+    size_type FindSlot(const uint256 &key, unsigned int nHash) const
+    {
+        size_type nMask = vSlots.size() - 1;
+        for (size_type i = nHash & nMask; ; i = (i + 1) & nMask)
+        {
+            const slot &s = vSlots[i];
+            if (s.nIndex == 0 || (s.nHash == nHash && Entry(s.nIndex - 1).first == key))
+                return i;
+        }
+    }
+
+    void Rehash(size_type nSlots)
+    {
+        std::vector<slot> vOld(nSlots);
+        vOld.swap(vSlots);
+        size_type nMask = nSlots - 1;
+        for (typename std::vector<slot>::const_iterator it = vOld.begin(); it != vOld.end(); it++)
+        {
+            if (it->nIndex == 0)
+                continue;
+            size_type i = it->nHash & nMask;
+            while (vSlots[i].nIndex != 0)
+                i = (i + 1) & nMask;
+            vSlots[i] = *it;
+        }
+    }
+
+    unsigned int AllocEntry()
+    {
+        if (vFree.empty())
+        {
+            unsigned int nBase = vChunks.size() * CHUNK_SIZE;
+            vChunks.push_back(new value_type[CHUNK_SIZE]);
+            vUsed.resize(nBase + CHUNK_SIZE, 0);
+            for (unsigned int i = CHUNK_SIZE; i-- > 0; )
+                vFree.push_back(nBase + i);
+        }
+        unsigned int nIndex = vFree.back();
+        vFree.pop_back();
+        vUsed[nIndex] = 1;
+        return nIndex;
+    }
+
+public:
+    class iterator
+    {
+        friend class uint256map;
+        const uint256map *pmap;
+        unsigned int nIndex;
+        iterator(const uint256map *pmapIn, unsigned int nIndexIn) : pmap(pmapIn), nIndex(nIndexIn) {}
+    public:
+        iterator() : pmap(NULL), nIndex(0) {}
+        value_type &operator*() const { return pmap->Entry(nIndex); }
+        value_type *operator->() const { return &pmap->Entry(nIndex); }
+        iterator &operator++()
+        {
+            do
+                nIndex++;
+            while (nIndex < pmap->vUsed.size() && !pmap->vUsed[nIndex]);
+            return *this;
+        }
+        iterator operator++(int) { iterator ret = *this; ++*this; return ret; }
+        bool operator==(const iterator &other) const { return nIndex == other.nIndex; }
+        bool operator!=(const iterator &other) const { return nIndex != other.nIndex; }
+    };
+    typedef iterator const_iterator;
+
+    uint256map(uint64 k0In = 0, uint64 k1In = 0) : k0(k0In), k1(k1In), nSize(0) {}
+    ~uint256map() { clear(); }
+
+    iterator begin() const
+    {
+        iterator it(this, 0);
+        if (!vUsed.empty() && !vUsed[0])
+            ++it;
+        return it;
+    }
+    iterator end() const { return iterator(this, vUsed.size()); }
+    size_type size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const uint256 &key) const
+    {
+        if (nSize == 0)
+            return end();
+        const slot &s = vSlots[FindSlot(key, Hash(key))];
+        return s.nIndex ? iterator(this, s.nIndex - 1) : end();
+    }
+    size_type count(const uint256 &key) const { return find(key) != end(); }
+
+    // Insert a default constructed value if key is not present yet
+    std::pair<iterator, bool> insert(const uint256 &key)
+    {
+        // keep the load factor at or below 3/4
+        if ((nSize + 1) * 4 > vSlots.size() * 3)
+            Rehash(vSlots.empty() ? 64 : vSlots.size() * 2);
+        unsigned int nHash = Hash(key);
+        slot &s = vSlots[FindSlot(key, nHash)];
+        if (s.nIndex)
+            return std::make_pair(iterator(this, s.nIndex - 1), false);
+        unsigned int nIndex = AllocEntry();
+        Entry(nIndex).first = key;
+        s.nHash = nHash;
+        s.nIndex = nIndex + 1;
+        nSize++;
+        return std::make_pair(iterator(this, nIndex), true);
+    }
+
+    T &operator[](const uint256 &key) { return insert(key).first->second; }
+
+    void erase(iterator it)
+    {
+        value_type &entry = Entry(it.nIndex);
+        size_type nMask = vSlots.size() - 1;
+        size_type i = FindSlot(entry.first, Hash(entry.first));
+        // Backward shift deletion: pull later members of the probe run into the hole
+        for (size_type j = (i + 1) & nMask; vSlots[j].nIndex != 0; j = (j + 1) & nMask)
+        {
+            size_type nHome = vSlots[j].nHash & nMask;
+            if (((j - nHome) & nMask) >= ((j - i) & nMask))
+            {
+                vSlots[i] = vSlots[j];
+                i = j;
+            }
+        }
+        vSlots[i].nIndex = 0;
+
+        // Release whatever the value owns; the storage itself is reused
+        entry.second = T();
+        vUsed[it.nIndex] = 0;
+        vFree.push_back(it.nIndex);
+        nSize--;
+    }
+    size_type erase(const uint256 &key)
+    {
+        iterator it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    void clear()
+    {
+        for (typename std::vector<value_type*>::iterator it = vChunks.begin(); it != vChunks.end(); it++)
+            delete[] *it;
+        std::vector<value_type*>().swap(vChunks);
+        std::vector<slot>().swap(vSlots);
+        std::vector<unsigned char>().swap(vUsed);
+        std::vector<unsigned int>().swap(vFree);
+        nSize = 0;
+    }
+
+    // Bytes allocated by the table itself, excluding memory owned by the values
+    size_type memory_usage() const
+    {
+        return vSlots.capacity() * sizeof(slot) + vChunks.size() * CHUNK_SIZE * sizeof(value_type) +
+               vChunks.capacity() * sizeof(value_type*) + vUsed.capacity() + vFree.capacity() * sizeof(unsigned int);
+    }
+
+private:
+    // Entries are referenced by index, so the map cannot be copied
+    uint256map(const uint256map &);
+    uint256map &operator=(const uint256map &);
+};
+
+#endif
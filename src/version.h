@@ -29,7 +29,7 @@ static const std::string COIN_NAME_DISPLAY("CasinoCoin");
 // network protocol versioning
 //
 
-static const int PROTOCOL_VERSION = 80001;
+static const int PROTOCOL_VERSION = 80002;
 
 // intial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -51,4 +51,7 @@ static const int BIP0031_VERSION = 60000;
 // "mempool" command, enhanced "getdata" behavior starts with this version:
 static const int MEMPOOL_GD_VERSION = 60002;
 
+// "cmpctblock", "getblocktxn" and "blocktxn" commands start with this version
+static const int COMPACT_BLOCKS_VERSION = 80002;
+
 #endif
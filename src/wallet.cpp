@@ -9,6 +9,8 @@
 #include "ui_interface.h"
 #include "base58.h"
 #include "coincontrol.h"
+#include "checkqueue.h"
+#include "init.h"
 #include <boost/algorithm/string/replace.hpp>
 
 using namespace std;
@@ -50,6 +52,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
 {
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    AddToFilterMine(pubkey.GetID());
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
@@ -62,6 +65,7 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey, const vector<unsigned char
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    AddToFilterMine(vchPubKey.GetID());
     if (!fFileBacked)
         return true;
     {
@@ -74,20 +78,40 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey, const vector<unsigned char
     return false;
 }
 
+bool CWallet::LoadKey(const CKey& key, const CPubKey &pubkey)
+{
+    if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+        return false;
+    AddToFilterMine(pubkey.GetID());
+    return true;
+}
+
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    AddToFilterMine(vchPubKey.GetID());
+    return true;
 }
 
 bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    AddToFilterMine(redeemScript.GetID());
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
 }
 
+bool CWallet::LoadCScript(const CScript& redeemScript)
+{
+    if (!CCryptoKeyStore::AddCScript(redeemScript))
+        return false;
+    AddToFilterMine(redeemScript.GetID());
+    return true;
+}
+
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
 {
     if (!IsLocked())
@@ -311,30 +335,194 @@ int64 CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
     return nRet;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount)
+void CWallet::GetTxAccounts(const CWalletTx& wtx, set<string>& setAccounts) const
 {
-    CWalletDB walletdb(strWalletFile);
+    // Every account ListTransactions might show it under, and maybe more
+    setAccounts.insert(wtx.strFromAccount);
+    BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+    {
+        if (!IsMine(txout))
+            continue;
+        CTxDestination address;
+        map<CTxDestination, string>::const_iterator mi = mapAddressBook.end();
+        if (ExtractDestination(txout.scriptPubKey, address))
+            mi = mapAddressBook.find(address);
+        setAccounts.insert(mi != mapAddressBook.end() ? (*mi).second : string(""));
+    }
+}
+
+static bool IsBlockInMainChain(const uint256& hashBlock)
+{
+    if (hashBlock == 0)
+        return false;
+    map<uint256, CBlockIndex*>::const_iterator mi = mapBlockIndex.find(hashBlock);
+    return mi != mapBlockIndex.end() && (*mi).second->IsInMainChain();
+}
 
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
-    TxItems txOrdered;
+static void AddTxBlock(map<uint256, set<uint256> >& mapTxByBlock, set<uint256>& setTxOffChain,
+                       const uint256& hash, const uint256& hashBlock)
+{
+    if (hashBlock != 0)
+        mapTxByBlock[hashBlock].insert(hash);
+    if (!IsBlockInMainChain(hashBlock))
+        setTxOffChain.insert(hash);
+}
 
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) --> acentry
-    // would make this much faster for applications that do this a lot.
-    for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+static void RemoveTxBlock(map<uint256, set<uint256> >& mapTxByBlock, set<uint256>& setTxOffChain,
+                          const uint256& hash, const uint256& hashBlock)
+{
+    map<uint256, set<uint256> >::iterator mi = mapTxByBlock.find(hashBlock);
+    if (mi != mapTxByBlock.end())
+    {
+        (*mi).second.erase(hash);
+        if ((*mi).second.empty())
+            mapTxByBlock.erase(mi);
+    }
+    setTxOffChain.erase(hash);
+}
+
+void CWallet::AddToOrdered(CWalletTx* pwtx, CAccountingEntry* pacentry)
+{
+    if (!fOrderedValid)
+        return;
+
+    int64 nOrderPos = pwtx ? pwtx->nOrderPos : pacentry->nOrderPos;
+    wtxOrdered.insert(make_pair(nOrderPos, TxPair(pwtx, pacentry)));
+    if (pwtx)
+        AddTxBlock(mapTxByBlock, setTxOffChain, pwtx->GetHash(), pwtx->hashBlock);
+
+    if (mapAccountOrdered.empty())
+        return;
+    set<string> setAccounts;
+    if (pwtx)
+        GetTxAccounts(*pwtx, setAccounts);
+    else
+        setAccounts.insert(pacentry->strAccount);
+    BOOST_FOREACH(const string& strAccount, setAccounts)
     {
-        CWalletTx* wtx = &((*it).second);
-        txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        map<string, TxItems>::iterator mi = mapAccountOrdered.find(strAccount);
+        if (mi != mapAccountOrdered.end())
+            (*mi).second.insert(make_pair(nOrderPos, TxPair(pwtx, pacentry)));
     }
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    BOOST_FOREACH(CAccountingEntry& entry, acentries)
+}
+
+static void RemoveFromOrdered(CWallet::TxItems& txOrdered, const CWalletTx* pwtx)
+{
+    pair<CWallet::TxItems::iterator, CWallet::TxItems::iterator> range = txOrdered.equal_range(pwtx->nOrderPos);
+    for (CWallet::TxItems::iterator it = range.first; it != range.second; ++it)
     {
-        txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+        if ((*it).second.first == pwtx)
+        {
+            txOrdered.erase(it);
+            return;
+        }
     }
+}
 
+void CWallet::BuildOrderedTxItems()
+{
+    wtxOrdered.clear();
+    mapAccountOrdered.clear();
+    mapTxByBlock.clear();
+    setTxOffChain.clear();
+    fOrderedValid = true;
+
+    for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        AddToOrdered(&(*it).second, (CAccountingEntry*)0);
+    BOOST_FOREACH(CAccountingEntry& entry, laccentries)
+        AddToOrdered((CWalletTx*)0, &entry);
+}
+
+const CWallet::TxItems& CWallet::OrderedTxItems(const std::string& strAccount)
+{
+    if (!fOrderedValid)
+        BuildOrderedTxItems();
+    if (strAccount == "*")
+        return wtxOrdered;
+
+    map<string, TxItems>::iterator mi = mapAccountOrdered.find(strAccount);
+    if (mi != mapAccountOrdered.end())
+        return (*mi).second;
+
+    // Kept up to date from now on, until the address book changes
+    TxItems& txOrdered = mapAccountOrdered[strAccount];
+    for (TxItems::iterator it = wtxOrdered.begin(); it != wtxOrdered.end(); ++it)
+    {
+        CWalletTx *const pwtx = (*it).second.first;
+        CAccountingEntry *const pacentry = (*it).second.second;
+        if (pwtx)
+        {
+            set<string> setAccounts;
+            GetTxAccounts(*pwtx, setAccounts);
+            if (!setAccounts.count(strAccount))
+                continue;
+        }
+        else if (pacentry->strAccount != strAccount)
+            continue;
+        txOrdered.insert(txOrdered.end(), *it);
+    }
     return txOrdered;
 }
 
+void CWallet::GetTransactionsSince(const CBlockIndex* pindex, std::vector<const CWalletTx*>& vwtx)
+{
+    vwtx.clear();
+    if (!fOrderedValid)
+        BuildOrderedTxItems();
+
+    // Everything, in order
+    if (!pindex)
+    {
+        for (TxItems::const_iterator it = wtxOrdered.begin(); it != wtxOrdered.end(); ++it)
+            if ((*it).second.first)
+                vwtx.push_back((*it).second.first);
+        return;
+    }
+
+    multimap<int64, const CWalletTx*> mapSorted;
+
+    // Those in no block or not in the main chain, dropping the ones whose
+    // block has been connected since
+    for (set<uint256>::iterator it = setTxOffChain.begin(); it != setTxOffChain.end(); )
+    {
+        const CWalletTx& wtx = mapWallet[*it];
+        if (IsBlockInMainChain(wtx.hashBlock))
+        {
+            setTxOffChain.erase(it++);
+            continue;
+        }
+        mapSorted.insert(make_pair(wtx.nOrderPos, &wtx));
+        ++it;
+    }
+
+    // Those in the main chain above pindex, walking forward from where it
+    // (or the branch it is on) meets the main chain
+    const CBlockIndex* pindexWalk = pindex;
+    while (pindexWalk && !pindexWalk->IsInMainChain())
+        pindexWalk = pindexWalk->pprev;
+    for (; pindexWalk; pindexWalk = pindexWalk->pnext)
+    {
+        if (pindexWalk->nHeight <= pindex->nHeight)
+            continue;
+        map<uint256, set<uint256> >::const_iterator mi = mapTxByBlock.find(pindexWalk->GetBlockHash());
+        if (mi == mapTxByBlock.end())
+            continue;
+        BOOST_FOREACH(const uint256& hash, (*mi).second)
+        {
+            const CWalletTx& wtx = mapWallet[hash];
+            mapSorted.insert(make_pair(wtx.nOrderPos, &wtx));
+        }
+    }
+    for (multimap<int64, const CWalletTx*>::const_iterator it = mapSorted.begin(); it != mapSorted.end(); ++it)
+        vwtx.push_back((*it).second);
+}
+
+void CWallet::AddAccountingEntry(const CAccountingEntry& acentry)
+{
+    laccentries.push_back(acentry);
+    AddToOrdered((CWalletTx*)0, &laccentries.back());
+}
+
 void CWallet::WalletUpdateSpent(const CTransaction &tx)
 {
     // Anytime a signature is successfully verified, it's proof the outpoint is spent.
@@ -355,6 +543,7 @@ void CWallet::WalletUpdateSpent(const CTransaction &tx)
                     printf("WalletUpdateSpent found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.GetHash().ToString().c_str());
                     wtx.MarkSpent(txin.prevout.n);
                     wtx.WriteToDisk();
+                    setUnspentDirty.insert(txin.prevout.hash);
                     NotifyTransactionChanged(this, txin.prevout.hash, CT_UPDATED);
                 }
             }
@@ -368,6 +557,7 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        fUnspentValid = false;
     }
 }
 
@@ -385,6 +575,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         {
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos = IncOrderPosNext();
+            AddToOrdered(&wtx, (CAccountingEntry*)0);
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (wtxIn.hashBlock != 0)
@@ -396,9 +587,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
                     {
                         // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
                         int64 latestTolerated = latestNow + 300;
-                        std::list<CAccountingEntry> acentries;
-                        TxItems txOrdered = OrderedTxItems(acentries);
-                        for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+                        const TxItems& txOrdered = OrderedTxItems();
+                        for (TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
                         {
                             CWalletTx *const pwtx = (*it).second.first;
                             if (pwtx == &wtx)
@@ -439,6 +629,11 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
             // Merge
             if (wtxIn.hashBlock != 0 && wtxIn.hashBlock != wtx.hashBlock)
             {
+                if (fOrderedValid)
+                {
+                    RemoveTxBlock(mapTxByBlock, setTxOffChain, hash, wtx.hashBlock);
+                    AddTxBlock(mapTxByBlock, setTxOffChain, hash, wtxIn.hashBlock);
+                }
                 wtx.hashBlock = wtxIn.hashBlock;
                 fUpdated = true;
             }
@@ -463,6 +658,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         if (fInsertedNew || fUpdated)
             if (!wtx.WriteToDisk())
                 return false;
+        setUnspentDirty.insert(hash);
 #ifndef QT_GUI
         // If default receiving address gets used, replace it with a new one
         if (vchDefaultKey.IsValid()) {
@@ -510,6 +706,8 @@ bool CWallet::AddToWalletIfInvolvingMe(const uint256 &hash, const CTransaction&
         LOCK(cs_wallet);
         bool fExisted = mapWallet.count(hash);
         if (fExisted && !fUpdate) return false;
+        // Most transactions are nothing to us, which the filter tells quickly
+        if (!fExisted && !IsRelevantToMe(tx)) return false;
         if (fExisted || IsMine(tx) || IsFromMe(tx))
         {
             CWalletTx wtx(this,tx);
@@ -530,8 +728,20 @@ bool CWallet::EraseFromWallet(uint256 hash)
         return false;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
-            CWalletDB(strWalletFile).EraseTx(hash);
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi == mapWallet.end())
+            return true;
+        if (fOrderedValid)
+        {
+            const CWalletTx* pwtx = &(*mi).second;
+            RemoveFromOrdered(wtxOrdered, pwtx);
+            for (map<string, TxItems>::iterator it = mapAccountOrdered.begin(); it != mapAccountOrdered.end(); ++it)
+                RemoveFromOrdered((*it).second, pwtx);
+            RemoveTxBlock(mapTxByBlock, setTxOffChain, hash, pwtx->hashBlock);
+        }
+        mapWallet.erase(mi);
+        CWalletDB(strWalletFile).EraseTx(hash);
+        setUnspentDirty.insert(hash);
     }
     return true;
 }
@@ -768,26 +978,255 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+bool CWalletScanFilter::IsRelevant(const CScript& scriptPubKey) const
+{
+    // Pay-to-pubkey-hash and pay-to-script-hash, without going through Solver()
+    uint160 hash;
+    if (scriptPubKey.size() == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 &&
+        scriptPubKey[2] == 20 && scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG)
+    {
+        memcpy(hash.begin(), &scriptPubKey[3], 20);
+        return setKeys.count(CKeyID(hash)) > 0;
+    }
+    if (scriptPubKey.IsPayToScriptHash())
+    {
+        memcpy(hash.begin(), &scriptPubKey[2], 20);
+        return setScripts.count(CScriptID(hash)) > 0;
+    }
+
+    vector<valtype> vSolutions;
+    txnouttype whichType;
+    if (!Solver(scriptPubKey, whichType, vSolutions))
+        return false;
+
+    switch (whichType)
+    {
+    case TX_NONSTANDARD:
+        return false;
+    case TX_PUBKEY:
+        return setKeys.count(CPubKey(vSolutions[0]).GetID()) > 0;
+    case TX_PUBKEYHASH:
+        return setKeys.count(CKeyID(uint160(vSolutions[0]))) > 0;
+    case TX_SCRIPTHASH:
+        return setScripts.count(CScriptID(uint160(vSolutions[0]))) > 0;
+    case TX_MULTISIG:
+        for (unsigned int i = 1; i + 1 < vSolutions.size(); i++)
+            if (setKeys.count(CPubKey(vSolutions[i]).GetID()))
+                return true;
+        return false;
+    }
+    return false;
+}
+
+bool CWalletScanFilter::IsRelevant(const CTransaction& tx) const
+{
+    BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        if (IsRelevant(txout.scriptPubKey))
+            return true;
+    return false;
+}
+
+void CWallet::GetScanFilter(CWalletScanFilter& filter) const
+{
+    GetKeys(filter.setKeys);
+    filter.setScripts.clear();
+    {
+        LOCK(cs_KeyStore);
+        filter.setKeys.insert(setWatchOnly.begin(), setWatchOnly.end());
+        for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+            filter.setScripts.insert((*it).first);
+    }
+}
+
+void CWallet::AddToFilterMine(const CKeyID& keyID)
+{
+    LOCK(cs_wallet);
+    if (fFilterMineValid)
+        filterMine.setKeys.insert(keyID);
+}
+
+void CWallet::AddToFilterMine(const CScriptID& scriptID)
+{
+    LOCK(cs_wallet);
+    if (fFilterMineValid)
+        filterMine.setScripts.insert(scriptID);
+}
+
+bool CWallet::IsRelevantToMe(const CTransaction& tx) const
+{
+    LOCK(cs_wallet);
+    if (!fFilterMineValid)
+    {
+        GetScanFilter(filterMine);
+        fFilterMineValid = true;
+    }
+    if (filterMine.IsRelevant(tx))
+        return true;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        if (mapWallet.count(txin.prevout.hash))
+            return true;
+    return false;
+}
+
+void CWallet::GetScanStatus(CWalletScanStatus& status) const
+{
+    LOCK(cs_scan);
+    status = scanStatus;
+}
+
+/** A block read for a rescan, and which of its transactions the filter picked */
+struct CWalletScanBlock
+{
+    CBlock block;
+    bool fRead;
+    std::vector<uint256> vHash;
+    std::vector<bool> vRelevant;
+};
+
+/** Reads one block of a rescan and tests its transactions against the filter */
+class CWalletScanCheck
+{
+private:
+    const CWalletScanFilter *pfilter;
+    const CBlockIndex *pindex;
+    CWalletScanBlock *pscan;
+
+public:
+    CWalletScanCheck() : pfilter(NULL), pindex(NULL), pscan(NULL) {}
+    CWalletScanCheck(const CWalletScanFilter *pfilterIn, const CBlockIndex *pindexIn, CWalletScanBlock *pscanIn) :
+        pfilter(pfilterIn), pindex(pindexIn), pscan(pscanIn) {}
+
+    bool operator()()
+    {
+        pscan->fRead = pscan->block.ReadFromDisk(pindex);
+        const std::vector<CTransaction>& vtx = pscan->block.vtx;
+        pscan->vHash.resize(vtx.size());
+        pscan->vRelevant.resize(vtx.size());
+        for (unsigned int i = 0; i < vtx.size(); i++)
+        {
+            pscan->vHash[i] = vtx[i].GetHash();
+            pscan->vRelevant[i] = pfilter->IsRelevant(vtx[i]);
+        }
+        // Never fail, or the queue would skip the remaining blocks
+        return true;
+    }
+
+    void swap(CWalletScanCheck &check)
+    {
+        std::swap(pfilter, check.pfilter);
+        std::swap(pindex, check.pindex);
+        std::swap(pscan, check.pscan);
+    }
+};
+
+static CCheckQueue<CWalletScanCheck> walletscanqueue(4);
+
+void ThreadWalletScan()
+{
+    RenameThread("bitcoin-walletscan");
+    walletscanqueue.Thread();
+}
+
+// Blocks read ahead by the workers before the results are applied
+static const unsigned int WALLET_SCAN_BLOCKS = 128;
+
 // Scan the block chain (starting in pindexStart) for transactions
 // from or to us. If fUpdate is true, found transactions that already
 // exist in the wallet will be updated.
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
+    if (!pindexStart)
+        return ret;
 
     CBlockIndex* pindex = pindexStart;
     {
         LOCK(cs_wallet);
+        fAbortRescan = false;
+
+        // Reading the blocks and matching outputs against our keys is left to
+        // the workers; only the transactions they pick, or that spend or
+        // update ours, go through AddToWalletIfInvolvingMe, in chain order.
+        CWalletScanFilter filter;
+        GetScanFilter(filter);
+
+        CBlockIndex* pindexEnd = pindexStart;
+        while (pindexEnd->pnext)
+            pindexEnd = pindexEnd->pnext;
+        unsigned int nTxBefore = pindexStart->pprev ? pindexStart->pprev->nChainTx : 0;
+        unsigned int nTxTotal = pindexEnd->nChainTx - nTxBefore;
+        int64 nStart = GetTime();
+        int64 nLastReport = nStart;
+        {
+            LOCK(cs_scan);
+            scanStatus.SetNull();
+            scanStatus.fScanning = true;
+            scanStatus.nStartHeight = pindexStart->nHeight;
+            scanStatus.nEndHeight = pindexEnd->nHeight;
+            scanStatus.nStartTime = nStart;
+        }
+
+        std::vector<CWalletScanBlock> vScan(WALLET_SCAN_BLOCKS);
+        std::vector<CWalletScanCheck> vChecks;
+        vChecks.reserve(WALLET_SCAN_BLOCKS);
         while (pindex)
         {
-            CBlock block;
-            block.ReadFromDisk(pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            if (ShutdownRequested())
+                fAbortRescan = true;
+            if (fAbortRescan)
+                break;
+
+            std::vector<CBlockIndex*> vpindex;
+            for (; pindex && vpindex.size() < WALLET_SCAN_BLOCKS; pindex = pindex->pnext)
             {
-                if (AddToWalletIfInvolvingMe(tx.GetHash(), tx, &block, fUpdate))
-                    ret++;
+                vChecks.push_back(CWalletScanCheck(&filter, pindex, &vScan[vpindex.size()]));
+                vpindex.push_back(pindex);
             }
-            pindex = pindex->pnext;
+            CCheckQueueControl<CWalletScanCheck> control(&walletscanqueue);
+            control.Add(vChecks);
+            control.Wait();
+            vChecks.clear();
+
+            for (unsigned int i = 0; i < vpindex.size(); i++)
+            {
+                const CWalletScanBlock& scan = vScan[i];
+                if (!scan.fRead)
+                {
+                    printf("ScanForWalletTransactions() : couldn't read block %d\n", vpindex[i]->nHeight);
+                    continue;
+                }
+                for (unsigned int j = 0; j < scan.block.vtx.size(); j++)
+                {
+                    const CTransaction& tx = scan.block.vtx[j];
+                    bool fInvolved = scan.vRelevant[j] || mapWallet.count(scan.vHash[j]);
+                    for (unsigned int k = 0; k < tx.vin.size() && !fInvolved; k++)
+                        fInvolved = mapWallet.count(tx.vin[k].prevout.hash);
+                    if (fInvolved && AddToWalletIfInvolvingMe(scan.vHash[j], tx, &scan.block, fUpdate))
+                        ret++;
+                }
+            }
+
+            CBlockIndex* pindexLast = vpindex.back();
+            double dProgress = nTxTotal ? (double)(pindexLast->nChainTx - nTxBefore) / nTxTotal : 1.0;
+            int64 nNow = GetTime();
+            LOCK(cs_scan);
+            scanStatus.nHeight = pindexLast->nHeight;
+            scanStatus.dProgress = dProgress;
+            if (dProgress > 0 && nNow > nStart)
+                scanStatus.nRemaining = (int64)((nNow - nStart) * (1.0 - dProgress) / dProgress);
+            if (nNow - nLastReport >= 60)
+            {
+                printf("Still rescanning. At block %d, %.1f%% done, about %" PRI64d "s left\n",
+                       scanStatus.nHeight, 100 * dProgress, scanStatus.nRemaining);
+                nLastReport = nNow;
+            }
+        }
+
+        if (fAbortRescan)
+            printf("Rescan aborted at block %d\n", pindex ? pindex->nHeight : -1);
+        {
+            LOCK(cs_scan);
+            scanStatus.fScanning = false;
         }
     }
     return ret;
@@ -829,6 +1268,7 @@ void CWallet::ReacceptWalletTransactions()
                     printf("ReacceptWalletTransactions found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.GetHash().ToString().c_str());
                     wtx.MarkDirty();
                     wtx.WriteToDisk();
+                    setUnspentDirty.insert(wtx.GetHash());
                 }
             }
             else
@@ -919,49 +1359,156 @@ void CWallet::ResendWalletTransactions()
 //
 
 
-int64 CWallet::GetBalance() const
+void CWallet::UpdateUnspent(const uint256& hash) const
 {
-    int64 nTotal = 0;
+    map<uint256, CWalletUnspent>::iterator mi = mapUnspent.find(hash);
+    if (mi != mapUnspent.end())
     {
-        LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        balances -= (*mi).second.balances;
+        mapUnspent.erase(mi);
+    }
+    setUnspentUnstable.erase(hash);
+
+    map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+    if (it == mapWallet.end())
+        return;
+    const CWalletTx& wtx = (*it).second;
+
+    CWalletUnspent unspent;
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        if (!wtx.IsSpent(i) && IsMine(wtx.vout[i]))
+            unspent.vOut.push_back(i);
+    if (unspent.vOut.empty())
+        return;
+    unspent.pwtx = &wtx;
+
+    // The same sums GetBalance() and friends took over the whole wallet
+    bool fConfirmed = wtx.IsConfirmed();
+    int64 nAvailable = wtx.GetAvailableCredit();
+    if (fConfirmed)
+        unspent.balances.nConfirmed = nAvailable;
+    if (!wtx.IsFinal() || !fConfirmed)
+        unspent.balances.nUnconfirmed = nAvailable;
+    unspent.balances.nImmature = wtx.GetImmatureCredit();
+    if (fConfirmed && nAvailable > 0)
+    {
+        BOOST_FOREACH(unsigned int i, unspent.vOut)
         {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsConfirmed())
-                nTotal += pcoin->GetAvailableCredit();
+            if (HaveWatchOnly(wtx.vout[i].scriptPubKey))
+                unspent.balances.nWatchOnly += wtx.vout[i].nValue;
         }
     }
 
-    return nTotal;
+    unspent.fStable = (wtx.GetDepthInMainChain() >= 1 && wtx.IsFinal() && wtx.GetBlocksToMaturity() == 0);
+    if (!unspent.fStable)
+        setUnspentUnstable.insert(hash);
+    balances += unspent.balances;
+    mapUnspent.insert(make_pair(hash, unspent));
 }
 
-int64 CWallet::GetUnconfirmedBalance() const
+void CWallet::SyncBalances() const
 {
-    int64 nTotal = 0;
+    // New blocks confirm and mature transactions; a reorg may undo anything
+    if (pindexBalances != pindexBest)
     {
-        LOCK(cs_wallet);
+        if (pindexBalances && !pindexBalances->IsInMainChain())
+            fUnspentValid = false;
+        else
+            setUnspentDirty.insert(setUnspentUnstable.begin(), setUnspentUnstable.end());
+        pindexBalances = pindexBest;
+    }
+
+    if (!fUnspentValid)
+    {
+        mapUnspent.clear();
+        setUnspentUnstable.clear();
+        setUnspentDirty.clear();
+        balances.SetNull();
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsFinal() || !pcoin->IsConfirmed())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+            UpdateUnspent((*it).first);
+        fUnspentValid = true;
+    }
+    else if (!setUnspentDirty.empty())
+    {
+        // Whether an unconfirmed transaction of ours counts as confirmed
+        // depends on the transactions it spends
+        setUnspentDirty.insert(setUnspentUnstable.begin(), setUnspentUnstable.end());
+        BOOST_FOREACH(const uint256& hash, setUnspentDirty)
+            UpdateUnspent(hash);
+        setUnspentDirty.clear();
     }
-    return nTotal;
+
+    if (fCheckBalances)
+        assert(CheckBalances());
 }
 
-int64 CWallet::GetImmatureBalance() const
+bool CWallet::CheckBalances() const
 {
-    int64 nTotal = 0;
+    CWalletBalances balancesScan;
+    unsigned int nUnspent = 0;
     {
         LOCK(cs_wallet);
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
+            bool fConfirmed = pcoin->IsConfirmed();
+            if (fConfirmed)
+                balancesScan.nConfirmed += pcoin->GetAvailableCredit();
+            if (!pcoin->IsFinal() || !fConfirmed)
+                balancesScan.nUnconfirmed += pcoin->GetAvailableCredit();
+            balancesScan.nImmature += pcoin->GetImmatureCredit();
+
+            bool fUnspent = false;
+            for (unsigned int i = 0; i < pcoin->vout.size(); i++)
+            {
+                if (pcoin->IsSpent(i) || !IsMine(pcoin->vout[i]))
+                    continue;
+                fUnspent = true;
+                if (fConfirmed && pcoin->GetAvailableCredit() > 0 && HaveWatchOnly(pcoin->vout[i].scriptPubKey))
+                    balancesScan.nWatchOnly += pcoin->vout[i].nValue;
+            }
+            if (fUnspent)
+                nUnspent++;
+        }
+
+        if (!(balancesScan == balances) || nUnspent != mapUnspent.size())
+        {
+            printf("CheckBalances() : kept %" PRI64d "/%" PRI64d "/%" PRI64d "/%" PRI64d " in %" PRIszu " transactions, "
+                   "scanned %" PRI64d "/%" PRI64d "/%" PRI64d "/%" PRI64d " in %u\n",
+                   balances.nConfirmed, balances.nUnconfirmed, balances.nImmature, balances.nWatchOnly, mapUnspent.size(),
+                   balancesScan.nConfirmed, balancesScan.nUnconfirmed, balancesScan.nImmature, balancesScan.nWatchOnly, nUnspent);
+            return false;
         }
     }
-    return nTotal;
+    return true;
+}
+
+int64 CWallet::GetBalance() const
+{
+    LOCK(cs_wallet);
+    SyncBalances();
+    return balances.nConfirmed;
+}
+
+int64 CWallet::GetUnconfirmedBalance() const
+{
+    LOCK(cs_wallet);
+    SyncBalances();
+    return balances.nUnconfirmed;
+}
+
+int64 CWallet::GetImmatureBalance() const
+{
+    LOCK(cs_wallet);
+    SyncBalances();
+    return balances.nImmature;
+}
+
+int64 CWallet::GetWatchOnlyBalance() const
+{
+    LOCK(cs_wallet);
+    SyncBalances();
+    return balances.nWatchOnly;
 }
 
 // populate vCoins with vector of spendable COutputs
@@ -971,9 +1518,10 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        SyncBalances();
+        for (map<uint256, CWalletUnspent>::const_iterator it = mapUnspent.begin(); it != mapUnspent.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second.pwtx;
 
             if (!pcoin->IsFinal())
                 continue;
@@ -984,10 +1532,9 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
             if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue >= nMinimumInputValue &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i))) 
+            BOOST_FOREACH(unsigned int i, (*it).second.vOut) {
+                if (!IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue >= nMinimumInputValue &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
                         vCoins.push_back(COutput(pcoin, i, pcoin->GetDepthInMainChain()));
             }
         }
@@ -1361,6 +1908,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 coin.BindWallet(this);
                 coin.MarkSpent(txin.prevout.n);
                 coin.WriteToDisk();
+                setUnspentDirty.insert(txin.prevout.hash);
                 NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
             }
 
@@ -1464,6 +2012,7 @@ bool CWallet::SetAddressBookName(const CTxDestination& address, const string& st
 {
     std::map<CTxDestination, std::string>::iterator mi = mapAddressBook.find(address);
     mapAddressBook[address] = strName;
+    mapAccountOrdered.clear();
     NotifyAddressBookChanged(this, address, strName, ::IsMine(*this, address), (mi == mapAddressBook.end()) ? CT_NEW : CT_UPDATED);
     if (!fFileBacked)
         return false;
@@ -1473,6 +2022,7 @@ bool CWallet::SetAddressBookName(const CTxDestination& address, const string& st
 bool CWallet::DelAddressBookName(const CTxDestination& address)
 {
     mapAddressBook.erase(address);
+    mapAccountOrdered.clear();
     NotifyAddressBookChanged(this, address, "", ::IsMine(*this, address), CT_DELETED);
     if (!fFileBacked)
         return false;
@@ -1878,6 +2428,18 @@ void CWallet::UpdatedTransaction(const uint256 &hashTx)
     }
 }
 
+void CWallet::DisconnectedBlock(const uint256 &hashBlock)
+{
+    {
+        LOCK(cs_wallet);
+        if (!fOrderedValid)
+            return;
+        map<uint256, set<uint256> >::const_iterator mi = mapTxByBlock.find(hashBlock);
+        if (mi != mapTxByBlock.end())
+            setTxOffChain.insert((*mi).second.begin(), (*mi).second.end());
+    }
+}
+
 void CWallet::LockCoin(COutPoint& output)
 {
     setLockedCoins.insert(output);
@@ -1915,6 +2477,7 @@ bool CWallet::AddWatchOnly(const CScript& dest, int64_t nCreateTime, const CKeyI
 {
 	if (!CCryptoKeyStore::AddWatchOnly(dest, destID))
     return false;
+    AddToFilterMine(destID);
 
 return CWalletDB(strWalletFile).WriteWatchOnly(dest);
 }
@@ -1924,6 +2487,10 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    {
+        LOCK(cs_wallet);
+        fFilterMineValid = false;
+    }
     if (!CWalletDB(strWalletFile).EraseWatchOnly(dest))
         return false;
 
@@ -1958,7 +2525,10 @@ bool CWallet::LoadWatchOnly(const CScript &dest)
 	    	return false;
 	    }
 	    }
-	return CCryptoKeyStore::AddWatchOnly(dest,FKeyID);
+	if (!CCryptoKeyStore::AddWatchOnly(dest,FKeyID))
+	    return false;
+	AddToFilterMine(FKeyID);
+	return true;
 }
 
 
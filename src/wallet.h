@@ -63,6 +63,108 @@ public:
     )
 };
 
+/** The wallet's balance buckets, or what one transaction adds to them */
+class CWalletBalances
+{
+public:
+    int64 nConfirmed;
+    int64 nUnconfirmed;
+    int64 nImmature;
+    int64 nWatchOnly;
+
+    CWalletBalances()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nConfirmed = 0;
+        nUnconfirmed = 0;
+        nImmature = 0;
+        nWatchOnly = 0;
+    }
+
+    CWalletBalances& operator+=(const CWalletBalances& b)
+    {
+        nConfirmed += b.nConfirmed;
+        nUnconfirmed += b.nUnconfirmed;
+        nImmature += b.nImmature;
+        nWatchOnly += b.nWatchOnly;
+        return *this;
+    }
+
+    CWalletBalances& operator-=(const CWalletBalances& b)
+    {
+        nConfirmed -= b.nConfirmed;
+        nUnconfirmed -= b.nUnconfirmed;
+        nImmature -= b.nImmature;
+        nWatchOnly -= b.nWatchOnly;
+        return *this;
+    }
+
+    friend bool operator==(const CWalletBalances& a, const CWalletBalances& b)
+    {
+        return (a.nConfirmed == b.nConfirmed && a.nUnconfirmed == b.nUnconfirmed &&
+                a.nImmature == b.nImmature && a.nWatchOnly == b.nWatchOnly);
+    }
+};
+
+/** A wallet transaction with outputs that are ours and unspent */
+class CWalletUnspent
+{
+public:
+    const CWalletTx* pwtx;
+    std::vector<unsigned int> vOut;
+    CWalletBalances balances;
+    bool fStable; // in a block and mature: only a spend or a reorg changes it
+};
+
+/** A copy of a wallet's key and script ids, to pick out the transactions
+ *  that may be ours without Solver() or the keystore's locks. It matches
+ *  every output IsMine() does, and a few it doesn't, such as a multisig
+ *  output with only some of the keys ours.
+ */
+class CWalletScanFilter
+{
+public:
+    std::set<CKeyID> setKeys;
+    std::set<CScriptID> setScripts;
+
+    bool IsRelevant(const CScript& scriptPubKey) const;
+    bool IsRelevant(const CTransaction& tx) const;
+};
+
+/** Progress of a rescan, see CWallet::GetScanStatus() */
+class CWalletScanStatus
+{
+public:
+    bool fScanning;
+    int nStartHeight;
+    int nHeight;        // last block applied to the wallet
+    int nEndHeight;
+    double dProgress;   // by transactions scanned
+    int64 nStartTime;
+    int64 nRemaining;   // estimated seconds left, or -1 if not known yet
+
+    CWalletScanStatus()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        fScanning = false;
+        nStartHeight = nHeight = nEndHeight = -1;
+        dProgress = 0;
+        nStartTime = 0;
+        nRemaining = -1;
+    }
+};
+
+/** Worker thread for rescans, see CWallet::ScanForWalletTransactions() */
+void ThreadWalletScan();
+
 /** A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
  */
@@ -79,6 +181,32 @@ private:
     // the maximum wallet format version: memory-only variable that specifies to what version this wallet may be upgraded
     int nWalletMaxVersion;
 
+    // The transactions with unspent outputs of ours, and the sum of what they
+    // add to the balances. Transactions are marked dirty as they change, and
+    // SyncBalances() updates them, and the unstable ones when the tip moves.
+    mutable std::map<uint256, CWalletUnspent> mapUnspent;
+    mutable std::set<uint256> setUnspentDirty;
+    mutable std::set<uint256> setUnspentUnstable;
+    mutable CWalletBalances balances;
+    mutable CBlockIndex* pindexBalances;
+    mutable bool fUnspentValid;
+
+    void UpdateUnspent(const uint256& hash) const;
+    void SyncBalances() const;
+
+    // Progress of the current rescan, which holds cs_wallet meanwhile
+    mutable CCriticalSection cs_scan;
+    CWalletScanStatus scanStatus;
+    volatile bool fAbortRescan;
+
+    // Our key and script ids, for a first look at incoming transactions;
+    // kept up to date as keys are added, rebuilt when one is removed
+    mutable CWalletScanFilter filterMine;
+    mutable bool fFilterMineValid;
+
+    void AddToFilterMine(const CKeyID& keyID);
+    void AddToFilterMine(const CScriptID& scriptID);
+
 public:
     mutable CCriticalSection cs_wallet;
 
@@ -100,6 +228,12 @@ public:
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
         nOrderPosNext = 0;
+        pindexBalances = NULL;
+        fUnspentValid = false;
+        fCheckBalances = false;
+        fOrderedValid = false;
+        fAbortRescan = false;
+        fFilterMineValid = false;
     }
     CWallet(std::string strWalletFileIn)
     {
@@ -110,6 +244,12 @@ public:
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
         nOrderPosNext = 0;
+        pindexBalances = NULL;
+        fUnspentValid = false;
+        fCheckBalances = false;
+        fOrderedValid = false;
+        fAbortRescan = false;
+        fFilterMineValid = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -122,6 +262,9 @@ public:
 
     std::set<COutPoint> setLockedCoins;
 
+    // Compare the balances with a full scan whenever they are brought up to date
+    bool fCheckBalances;
+
     // check whether we are allowed to upgrade (or already support) to the named feature
     bool CanSupportFeature(enum WalletFeature wf) { return nWalletMaxVersion >= wf; }
 
@@ -139,7 +282,7 @@ public:
     // Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     // Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey);
 
     bool LoadMinVersion(int nVersion) { nWalletVersion = nVersion; nWalletMaxVersion = std::max(nWalletMaxVersion, nVersion); return true; }
 
@@ -148,7 +291,7 @@ public:
     // Adds an encrypted key to the store, without saving it to disk (used by LoadWallet)
     bool LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     bool AddCScript(const CScript& redeemScript);
-    bool LoadCScript(const CScript& redeemScript) { return CCryptoKeyStore::AddCScript(redeemScript); }
+    bool LoadCScript(const CScript& redeemScript);
     //#########Agregado para importaddress
 
            //! Adds a watch-only address to the store, and saves it to disk.
@@ -170,23 +313,55 @@ public:
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef std::multimap<int64, TxPair > TxItems;
 
-    /** Get the wallet's activity log
+    /** Get the wallet's activity log, or the part of it that may concern an account
         @return multimap of ordered transactions and accounting entries
-        @warning Returned pointers are *only* valid within the scope of passed acentries
+        @warning Only valid while cs_wallet is held
      */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
+    const TxItems& OrderedTxItems(const std::string& strAccount = "*");
 
+    /** Get the transactions that are in no block, or in the main chain after pindex */
+    void GetTransactionsSince(const CBlockIndex* pindex, std::vector<const CWalletTx*>& vwtx);
+
+    // Adds an accounting entry written to the wallet file, or read from it by LoadWallet
+    void AddAccountingEntry(const CAccountingEntry& acentry);
+    std::list<CAccountingEntry> laccentries;
+
+private:
+    // The activity log in order, the parts of it for the accounts asked about
+    // so far, the transactions by the block they are in, and those in no block
+    // or in one that may not be in the main chain. Built on first use and kept
+    // up to date as transactions come in and blocks are disconnected.
+    TxItems wtxOrdered;
+    std::map<std::string, TxItems> mapAccountOrdered;
+    std::map<uint256, std::set<uint256> > mapTxByBlock;
+    std::set<uint256> setTxOffChain;
+    bool fOrderedValid;
+
+    void BuildOrderedTxItems();
+    void AddToOrdered(CWalletTx* pwtx, CAccountingEntry* pacentry);
+    void GetTxAccounts(const CWalletTx& wtx, std::set<std::string>& setAccounts) const;
+
+public:
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn);
     bool AddToWalletIfInvolvingMe(const uint256 &hash, const CTransaction& tx, const CBlock* pblock, bool fUpdate = false, bool fFindBlock = false);
     bool EraseFromWallet(uint256 hash);
     void WalletUpdateSpent(const CTransaction& prevout);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    void GetScanFilter(CWalletScanFilter& filter) const;
+    // Whether tx may pay or spend from us; when false, it certainly doesn't
+    bool IsRelevantToMe(const CTransaction& tx) const;
+    void GetScanStatus(CWalletScanStatus& status) const;
+    // Stop the rescan in progress; stays set until the next one starts
+    void AbortRescan() { fAbortRescan = true; }
+    bool IsAbortingRescan() const { return fAbortRescan; }
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
     int64 GetBalance() const;
     int64 GetUnconfirmedBalance() const;
     int64 GetImmatureBalance() const;
+    int64 GetWatchOnlyBalance() const;
+    bool CheckBalances() const;
     bool CreateTransaction(const std::vector<std::pair<CScript, int64> >& vecSend,
                            CWalletTx& wtxNew, CReserveKey& reservekey, int64& nFeeRet, std::string& strFailReason, const CCoinControl *coinControl=NULL);
     bool CreateTransaction(CScript scriptPubKey, int64 nValue,
@@ -281,6 +456,9 @@ public:
 
     void UpdatedTransaction(const uint256 &hashTx);
 
+    // Called when a block leaves the main chain in a reorganization
+    void DisconnectedBlock(const uint256 &hashBlock);
+
     void PrintWallet(const CBlock& block);
 
     void Inventory(const uint256 &hash)